@@ -0,0 +1,17 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/benchmark-populate"
+  "CMakeFiles/benchmark-populate-complete"
+  "benchmark-populate-prefix/src/benchmark-populate-stamp/benchmark-populate-build"
+  "benchmark-populate-prefix/src/benchmark-populate-stamp/benchmark-populate-configure"
+  "benchmark-populate-prefix/src/benchmark-populate-stamp/benchmark-populate-download"
+  "benchmark-populate-prefix/src/benchmark-populate-stamp/benchmark-populate-install"
+  "benchmark-populate-prefix/src/benchmark-populate-stamp/benchmark-populate-mkdir"
+  "benchmark-populate-prefix/src/benchmark-populate-stamp/benchmark-populate-patch"
+  "benchmark-populate-prefix/src/benchmark-populate-stamp/benchmark-populate-test"
+  "benchmark-populate-prefix/src/benchmark-populate-stamp/benchmark-populate-update"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang )
+  include(CMakeFiles/benchmark-populate.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,22 @@
+# Distributed under the OSI-approved BSD 3-Clause License.  See accompanying
+# file Copyright.txt or https://cmake.org/licensing for details.
+
+cmake_minimum_required(VERSION 3.5)
+
+file(MAKE_DIRECTORY
+  "/root/repo/.cmake_dependencies/benchmark-src"
+  "/root/repo/.cmake_dependencies/benchmark-build"
+  "/root/repo/.cmake_dependencies/benchmark-subbuild/benchmark-populate-prefix"
+  "/root/repo/.cmake_dependencies/benchmark-subbuild/benchmark-populate-prefix/tmp"
+  "/root/repo/.cmake_dependencies/benchmark-subbuild/benchmark-populate-prefix/src/benchmark-populate-stamp"
+  "/root/repo/.cmake_dependencies/benchmark-subbuild/benchmark-populate-prefix/src"
+  "/root/repo/.cmake_dependencies/benchmark-subbuild/benchmark-populate-prefix/src/benchmark-populate-stamp"
+)
+
+set(configSubDirs )
+foreach(subDir IN LISTS configSubDirs)
+    file(MAKE_DIRECTORY "/root/repo/.cmake_dependencies/benchmark-subbuild/benchmark-populate-prefix/src/benchmark-populate-stamp/${subDir}")
+endforeach()
+if(cfgdir)
+  file(MAKE_DIRECTORY "/root/repo/.cmake_dependencies/benchmark-subbuild/benchmark-populate-prefix/src/benchmark-populate-stamp${cfgdir}") # cfgdir has leading slash
+endif()
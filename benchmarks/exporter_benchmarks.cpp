@@ -0,0 +1,133 @@
+#include <benchmark/benchmark.h>
+
+#include "waffle/exporter/fxt_writer.hpp"
+#include "waffle/exporter/span_encoders.hpp"
+
+#include <random>
+
+using namespace Waffle;
+
+namespace {
+
+// About one consumer drain: the records are cache resident, as when the
+// writer runs as a processor.
+constexpr size_t kBatchRecords = 1 << 12;
+
+uint64_t hash_of(std::string_view s) { return fnv1a_hash(s.data(), s.size()); }
+
+// kBatchRecords records: balanced spans over 64 names on 8 threads, each
+// start carrying an integer and a string attribute.
+struct Workload {
+  std::vector<trace_file::TraceRecord> records;
+  std::unordered_map<uint64_t, std::string> strings;
+};
+
+const Workload &workload() {
+  static const Workload w = [] {
+    Workload w;
+    std::vector<uint64_t> names;
+    for (int i = 0; i < 64; ++i) {
+      const std::string name = "op_" + std::to_string(i);
+      names.push_back(hash_of(name));
+      w.strings[names.back()] = name;
+    }
+    for (std::string_view s : {"bytes", "table", "orders"})
+      w.strings[hash_of(s)] = std::string(s);
+    std::mt19937_64 rng(42);
+    Attribute attrs[2];
+    attrs[0].key_id = hash_of("bytes");
+    attrs[0].value.type = AttributeValue::Type::INT64;
+    attrs[1].key_id = hash_of("table");
+    attrs[1].value.type = AttributeValue::Type::STRING_ID;
+    attrs[1].value.string_id = hash_of("orders");
+    for (uint64_t i = 0; i < kBatchRecords / 2; ++i) {
+      const uint16_t thread = static_cast<uint16_t>(1 + i % 8);
+      attrs[0].value.i64 = static_cast<int64_t>(rng() % 65536);
+      w.records.push_back(
+          {Tracelet(i * 100, 0, Id{1}, Id{i + 1}, kInvalidId, kInvalidId,
+                    names[rng() % names.size()],
+                    Tracelet::RecordType::SPAN_START, thread, 0, attrs[0],
+                    attrs[1]),
+           0});
+      w.records.push_back({Tracelet(i * 100 + 50, 0, Id{1}, Id{i + 1},
+                                    kInvalidId, kInvalidId, 0,
+                                    Tracelet::RecordType::SPAN_END, thread, 0),
+                           0});
+    }
+    return w;
+  }();
+  return w;
+}
+
+} // namespace
+
+/**
+ * @brief BM_Fxt_WriteSpans
+ *
+ * @Measures: Encoding throughput of FxtWriter for short spans with two
+ * attributes, written through its buffered sink to /dev/null. Arg 1 writes
+ * duration complete events, arg 0 begin/end pairs.
+ *
+ * @What_To_Look_For:
+ *   - **`bytes_per_second`**: FXT bytes produced per second; the writer is
+ *     meant to sustain GB/s so that the file system, not encoding, limits
+ *     export.
+ *   - **`items_per_second`**: Records consumed per second.
+ *
+ * @When_To_Be_Concerned:
+ *   - Throughput well below 1 GB/s: records are no longer encoded in place
+ *     (e.g. a per-record allocation or write call crept in).
+ */
+static void BM_Fxt_WriteSpans(benchmark::State &state) {
+  const Workload &w = workload();
+  exporter::FxtWriter::Options options;
+  options.complete_events = state.range(0) != 0;
+  exporter::FxtWriter writer("/dev/null", options);
+  const uint64_t before = writer.bytes_written();
+  for (auto _ : state)
+    for (const auto &record : w.records)
+      writer.write(record, w.strings);
+  state.SetItemsProcessed(state.iterations() * w.records.size());
+  state.SetBytesProcessed(
+      static_cast<int64_t>(writer.bytes_written() - before));
+}
+BENCHMARK(BM_Fxt_WriteSpans)->Arg(0)->Arg(1);
+
+/**
+ * @brief BM_SpanEncoder_Encode
+ *
+ * @Measures: Encoding throughput of the collector encoders for the same
+ * spans, batched 1024 per request body as HttpSpanExporter does. Arg 0 is
+ * Zipkin v2 JSON, arg 1 Jaeger Thrift.
+ *
+ * @What_To_Look_For:
+ *   - **`items_per_second`**: Spans encoded per second. This runs on the
+ *     processing thread, so it bounds the span rate an HTTP exporter can
+ *     keep up with.
+ *   - **`bytes_per_second`**: Request body bytes produced per second.
+ *
+ * @When_To_Be_Concerned:
+ *   - Fewer than a few million spans/s: encoding allocates or formats
+ *     through streams per span instead of appending in place.
+ */
+static void BM_SpanEncoder_Encode(benchmark::State &state) {
+  const Workload &w = workload();
+  std::unique_ptr<exporter::SpanEncoder> encoder;
+  if (state.range(0) == 0)
+    encoder = std::make_unique<exporter::ZipkinJsonEncoder>("bench");
+  else
+    encoder = std::make_unique<exporter::JaegerThriftEncoder>("bench", 1);
+  int64_t bytes = 0;
+  for (auto _ : state) {
+    // Records alternate SPAN_START / SPAN_END of the same span.
+    for (size_t i = 0; i + 1 < w.records.size(); i += 2) {
+      encoder->add(w.records[i].tracelet, w.records[i + 1].tracelet.timestamp,
+                   w.strings);
+      if (encoder->size() == 1024)
+        bytes += static_cast<int64_t>(encoder->take_batch().size());
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * (w.records.size() / 2));
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_SpanEncoder_Encode)->Arg(0)->Arg(1);
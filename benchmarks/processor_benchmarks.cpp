@@ -0,0 +1,119 @@
+#include <benchmark/benchmark.h>
+
+#include "waffle/live/trace_cache.hpp"
+#include "waffle/processor/anomaly_detector.hpp"
+
+#include <random>
+
+using namespace Waffle;
+
+namespace {
+
+// About one consumer drain, as in the exporter benchmarks.
+constexpr size_t kBatchRecords = 1 << 12;
+
+uint64_t hash_of(std::string_view s) { return fnv1a_hash(s.data(), s.size()); }
+
+// kBatchRecords records: spans over `names` names on 8 threads, each start
+// followed by its end, with log-normally distributed durations (median
+// 50us).
+struct Workload {
+  std::vector<Tracelet> records;
+  std::unordered_map<uint64_t, std::string> strings;
+};
+
+Workload make_workload(int names) {
+  Workload w;
+  std::vector<uint64_t> hashes;
+  for (int i = 0; i < names; ++i) {
+    const std::string name = "op_" + std::to_string(i);
+    hashes.push_back(hash_of(name));
+    w.strings[hashes.back()] = name;
+  }
+  std::mt19937_64 rng(42);
+  std::lognormal_distribution<double> duration(std::log(50'000.0), 0.5);
+  for (uint64_t i = 0; i < kBatchRecords / 2; ++i) {
+    const uint16_t thread = static_cast<uint16_t>(1 + i % 8);
+    w.records.emplace_back(i * 1000, 0, Id{1}, Id{i + 1}, kInvalidId,
+                           kInvalidId, hashes[rng() % hashes.size()],
+                           Tracelet::RecordType::SPAN_START, thread, 0);
+    w.records.emplace_back(i * 1000 + static_cast<uint64_t>(duration(rng)), 0,
+                           Id{1}, Id{i + 1}, kInvalidId, kInvalidId, 0,
+                           Tracelet::RecordType::SPAN_END, thread, 0);
+  }
+  return w;
+}
+
+} // namespace
+
+/**
+ * @brief BM_AnomalyDetector_Observe
+ *
+ * @Measures: Per-span cost of AnomalyDetector on the processing thread:
+ * matching each end to its start, updating the name's sketch and EWMA, and
+ * comparing against the cached threshold. The argument is the number of
+ * distinct span names.
+ *
+ * @What_To_Look_For:
+ *   - **`items_per_second`**: Spans observed per second. The detector runs
+ *     beside the other processors, so it should take a small share of a
+ *     core at millions of spans/s.
+ *   - Little change between 16 and 1024 names: per-name state is reached
+ *     through a pointer saved at the span start.
+ *
+ * @When_To_Be_Concerned:
+ *   - Fewer than a few million spans/s: the threshold is recomputed per
+ *     span (the quantile walk is O(buckets)) or the hot path grew.
+ */
+static void BM_AnomalyDetector_Observe(benchmark::State &state) {
+  const Workload w = make_workload(static_cast<int>(state.range(0)));
+  AnomalyDetector::Options options;
+  options.emit_events = false;
+  AnomalyDetector detector(options);
+  for (auto _ : state)
+    for (const Tracelet &record : w.records)
+      detector.on_record(record, w.strings);
+  benchmark::DoNotOptimize(detector.stats().anomalies);
+  state.SetItemsProcessed(state.iterations() * (w.records.size() / 2));
+}
+BENCHMARK(BM_AnomalyDetector_Observe)->Arg(16)->Arg(1024);
+
+/**
+ * @brief BM_TraceCache_GetTrace
+ *
+ * @Measures: Latency of TraceCache::get_trace() for a 4-span trace in a
+ * full 64 MiB cache (64 segments), as when a failed request's trace is
+ * fetched by id.
+ *
+ * @What_To_Look_For:
+ *   - **Time per iteration**: One index probe per segment plus copying the
+ *     spans and their strings; a few microseconds.
+ *
+ * @When_To_Be_Concerned:
+ *   - Tens of microseconds or more: lookups scan segment contents instead
+ *     of following the per-segment trace index, or wait on the writer.
+ */
+static void BM_TraceCache_GetTrace(benchmark::State &state) {
+  live::TraceCache cache;
+  cache.on_start({0, 0});
+  std::unordered_map<uint64_t, std::string> strings = {{hash_of("op"), "op"}};
+  // Fills the cache with 4-span traces.
+  uint64_t trace = 0;
+  for (uint64_t span = 1; cache.stats().segments_recycled == 0; ++span) {
+    if (span % 4 == 1)
+      trace = span;
+    cache.on_record(Tracelet(span * 10, 0, Id{trace}, Id{span}, kInvalidId,
+                             kInvalidId, hash_of("op"),
+                             Tracelet::RecordType::SPAN_START, 1, 0),
+                    strings);
+    cache.on_record(Tracelet(span * 10 + 5, 0, Id{trace}, Id{span},
+                             kInvalidId, kInvalidId, 0,
+                             Tracelet::RecordType::SPAN_END, 1, 0),
+                    strings);
+  }
+  size_t spans = 0;
+  for (auto _ : state)
+    spans += cache.get_trace(Id{trace}).spans.size();
+  benchmark::DoNotOptimize(spans);
+}
+BENCHMARK(BM_TraceCache_GetTrace);
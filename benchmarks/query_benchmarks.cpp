@@ -0,0 +1,230 @@
+#include <benchmark/benchmark.h>
+
+#include "waffle/profile/trace_diff.hpp"
+#include "waffle/query/span_query.hpp"
+#include "waffle/trace_file/trace_file_lookup.hpp"
+#include "waffle/trace_file/trace_file_writer.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <random>
+
+using namespace Waffle::query;
+
+namespace {
+
+constexpr size_t kTableRows = 1 << 20;
+
+uint64_t hash_of(std::string_view s) {
+  return Waffle::fnv1a_hash(s.data(), s.size());
+}
+
+// kTableRows spans over 16 names with log-uniform durations (100ns..100ms)
+// and an integer "rank" attribute in [0, 8).
+const SpanTable &table() {
+  static const SpanTable t = [] {
+    std::unordered_map<uint64_t, std::string> strings;
+    std::vector<uint64_t> names;
+    for (int i = 0; i < 16; ++i) {
+      const std::string name = "op_" + std::to_string(i);
+      names.push_back(hash_of(name));
+      strings[names.back()] = name;
+    }
+    strings[hash_of("rank")] = "rank";
+    std::mt19937_64 rng(42);
+    std::uniform_real_distribution<double> log_ns(2.0, 8.0);
+    SpanTable table;
+    for (uint64_t i = 0; i < kTableRows; ++i) {
+      Waffle::Attribute rank;
+      rank.key_id = hash_of("rank");
+      rank.value.type = Waffle::AttributeValue::Type::INT64;
+      rank.value.i64 = static_cast<int64_t>(rng() % 8);
+      const auto duration =
+          static_cast<uint64_t>(std::pow(10.0, log_ns(rng)));
+      table.append({names[rng() % names.size()], i * 1000, duration,
+                    static_cast<uint32_t>(i % 4), 1, 1, i + 1},
+                   &rank, &rank + 1, strings);
+    }
+    return table;
+  }();
+  return t;
+}
+
+} // namespace
+
+/**
+ * @brief BM_Kernel_FilterU64
+ *
+ * @Measures: Raw throughput of one `column > value` scan kernel over a
+ * cache-resident 64K-row u64 column (one chunk's duration column).
+ *
+ * @What_To_Look_For:
+ *   - **`bytes_per_second`**: Column bytes scanned per second. Several GB/s
+ *     per core means the kernel is vectorized (AVX2 clone on x86-64).
+ *
+ * @When_To_Be_Concerned:
+ *   - Throughput near 1 GB/s suggests the loop fell back to scalar code.
+ */
+static void BM_Kernel_FilterU64(benchmark::State &state) {
+  const auto &chunk = *table().chunks().front();
+  std::vector<uint8_t> mask(chunk.rows);
+  for (auto _ : state) {
+    std::fill(mask.begin(), mask.end(), 1);
+    kernels::filter_u64(chunk.duration.data(), chunk.rows, CompareOp::GT,
+                        10'000'000, mask.data());
+    benchmark::DoNotOptimize(mask.data());
+  }
+  state.SetBytesProcessed(state.iterations() * chunk.rows * sizeof(uint64_t));
+}
+BENCHMARK(BM_Kernel_FilterU64);
+
+/**
+ * @brief BM_Query_SelectiveScan
+ *
+ * @Measures: A full query over 1M spans with a name, attribute and duration
+ * predicate matching ~0.1% of the spans, grouped by name with percentiles.
+ *
+ * @What_To_Look_For:
+ *   - **`bytes_per_second`**: Bytes of the three scanned columns per second;
+ *     compare with BM_Kernel_FilterU64 to see the overhead of masks,
+ *     attribute presence and chunk scheduling.
+ *   - **`items_per_second`**: Spans scanned per second.
+ *
+ * @When_To_Be_Concerned:
+ *   - Large drops relative to the kernel benchmark, or no improvement with
+ *     more cores (the query runs chunks in parallel).
+ */
+static void BM_Query_SelectiveScan(benchmark::State &state) {
+  const SpanTable &t = table();
+  Query q;
+  q.where = {Predicate::parse("name=op_3"), Predicate::parse("attr.rank=1"),
+             Predicate::parse("duration>10ms")};
+  for (auto _ : state) {
+    auto result = run_query(t, q);
+    benchmark::DoNotOptimize(result);
+  }
+  state.SetItemsProcessed(state.iterations() * t.rows());
+  state.SetBytesProcessed(state.iterations() * t.rows() *
+                          (sizeof(uint32_t) + sizeof(int64_t) + 1 +
+                           sizeof(uint64_t)));
+}
+BENCHMARK(BM_Query_SelectiveScan)->Unit(benchmark::kMillisecond);
+
+/**
+ * @brief BM_TraceFileLookup_Point
+ *
+ * @Measures: Finding every record of one trace id in a 1 GiB trace file
+ * (16M records, 1 MiB chunks, 8 spans per trace, traces interleaved 4 at a
+ * time) through the chunk index and per-chunk trace-id bloom filters. The
+ * file is mapped and warm in the page cache.
+ *
+ * @What_To_Look_For:
+ *   - **Time per lookup**: The index scan plus one filter probe per chunk
+ *     (~1000 chunks) and the decoding of the one or two chunks holding the
+ *     trace; well under a millisecond. A full scan of the file is about a
+ *     second.
+ *   - **`chunks_decoded`**: 1-2; more means the filters' false positive rate
+ *     is off.
+ *
+ * @When_To_Be_Concerned:
+ *   - Lookups that grow with the file size beyond the per-chunk probes, or
+ *     `chunks_decoded` far above 2.
+ */
+static void BM_TraceFileLookup_Point(benchmark::State &state) {
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "waffle_bench_lookup.wtrace")
+          .string();
+  constexpr uint64_t kTraces = 1 << 20;
+  {
+    Waffle::trace_file::FileHeader header{};
+    std::memcpy(header.magic, Waffle::trace_file::kMagic, sizeof(header.magic));
+    header.version = Waffle::trace_file::kVersion;
+    header.header_size = sizeof(header);
+    Waffle::trace_file::TraceFileEncoder encoder(path, header);
+    using RT = Waffle::Tracelet::RecordType;
+    for (uint64_t trace = 0; trace < kTraces; trace += 4)
+      for (uint64_t span = 0; span < 8; ++span)
+        for (uint64_t i = trace; i < trace + 4; ++i)
+          for (RT type : {RT::SPAN_START, RT::SPAN_END})
+            encoder.add_record(Waffle::Tracelet(
+                i * 100 + span, 0, Waffle::Id{i + 1},
+                Waffle::Id{(i << 3) + span}, Waffle::kInvalidId,
+                Waffle::kInvalidId, type == RT::SPAN_START ? 1 : 0, type, 1,
+                0));
+  }
+  Waffle::trace_file::TraceFileLookup file(path);
+  std::mt19937_64 rng(42);
+  size_t chunks = 0;
+  for (auto _ : state) {
+    const Waffle::Id trace{rng() % kTraces + 1};
+    auto records = file.find({trace});
+    benchmark::DoNotOptimize(records);
+    chunks += file.chunks_decoded();
+  }
+  state.counters["chunks_decoded"] = benchmark::Counter(
+      static_cast<double>(chunks), benchmark::Counter::kAvgIterations);
+  std::filesystem::remove(path);
+}
+BENCHMARK(BM_TraceFileLookup_Point)->Unit(benchmark::kMicrosecond);
+
+/**
+ * @brief BM_SpanPathProfile_Add
+ *
+ * @Measures: Building the per-path duration profile that waffle-diff
+ * compares: span trees of 8 spans (depth 3, 16 random names: about 4400
+ * paths) fed as start/end records, as read from a trace file.
+ *
+ * @What_To_Look_For:
+ *   - **`items_per_second`**: Spans profiled per second per thread. At
+ *     ~8M/s, a recording of tens of millions of spans per file takes a few
+ *     seconds, files being read in parallel.
+ *
+ * @When_To_Be_Concerned:
+ *   - Throughput well below 5M spans/s: the open-span and path maps
+ *     dominate; check for rehashing or a poor path hash.
+ */
+static void BM_SpanPathProfile_Add(benchmark::State &state) {
+  using RT = Waffle::Tracelet::RecordType;
+  std::unordered_map<uint64_t, std::string> strings;
+  std::vector<uint64_t> names;
+  for (int i = 0; i < 16; ++i) {
+    const std::string name = "op_" + std::to_string(i);
+    names.push_back(hash_of(name));
+    strings[names.back()] = name;
+  }
+  // Trees of a root, 3 children and 4 grandchildren (2 + 1 + 1), with
+  // random names; spans are ids, start/end records in nesting order.
+  std::mt19937_64 rng(42);
+  std::vector<Waffle::Tracelet> records;
+  uint64_t next_id = 1, ts = 0;
+  auto start = [&](uint64_t parent) {
+    const uint64_t id = next_id++;
+    records.emplace_back(ts++, 0, Waffle::Id{1}, Waffle::Id{id},
+                         Waffle::Id{parent}, Waffle::kInvalidId,
+                         names[rng() % names.size()], RT::SPAN_START, 1, 0);
+    return id;
+  };
+  auto end = [&](uint64_t id) {
+    ts += rng() % 1000;
+    records.emplace_back(ts++, 0, Waffle::Id{1}, Waffle::Id{id},
+                         Waffle::kInvalidId, Waffle::kInvalidId, 0,
+                         RT::SPAN_END, 1, 0);
+  };
+  for (int tree = 0; tree < 1024; ++tree) {
+    const uint64_t root = start(0);
+    for (int c = 0; c < 3; ++c) {
+      const uint64_t child = start(root);
+      for (int g = 0; g < (c == 0 ? 2 : 1); ++g)
+        end(start(child));
+      end(child);
+    }
+    end(root);
+  }
+  Waffle::profile::SpanPathProfile profile;
+  for (auto _ : state)
+    for (const auto &record : records)
+      profile.add(record, strings);
+  state.SetItemsProcessed(state.iterations() * records.size() / 2);
+}
+BENCHMARK(BM_SpanPathProfile_Add);
@@ -1,8 +1,13 @@
 #include <benchmark/benchmark.h>
+#include <condition_variable>
+#include <mutex>
 #include <numeric> // For std::iota
 #include <thread>
 #include <vector>
+#include <memory>
+#include <waffle/helpers/broadcast_ring_buffer.hpp>
 #include <waffle/helpers/mpsc_ring_buffer.hpp>
+#include <waffle/helpers/per_cpu_ring_buffer.hpp>
 
 constexpr size_t BENCH_BUFFER_CAPACITY = 1024;
 
@@ -321,4 +326,301 @@ BENCHMARK(BM_RingBuffer_MPSC_HighContention)
     ->Arg(8)
     ->Unit(benchmark::kMillisecond);
 
+// Benchmark for producers that emit records in bursts
+/**
+ * @brief BM_RingBuffer_MPSC_Burst
+ *
+ * @Measures: The throughput of four producers that each emit bursts of
+ * `range(0)` items into a 1024-slot buffer drained by one consumer, either
+ * with one `try_emplace` per item (`range(1)` = 0) or with one `try_claim`
+ * per burst, published as a group (`range(1)` = 1).
+ *
+ * @What_To_Look_For:
+ *   - **`items_per_second`**: The primary metric. At a burst size of 1 both
+ * modes should match; with larger bursts `try_claim` should pull ahead, as
+ * the `_tail` CAS (and its retries under contention) is paid once per burst.
+ *   - The gap widening with the burst size, and with the number of cores
+ * the producers actually run on.
+ *
+ * @When_To_Be_Concerned:
+ *   - `try_claim` slower than `try_emplace` at burst size 1: the Claim
+ * bookkeeping costs more than it should.
+ *   - Throughput collapsing at 32: large claims wait for the consumer to
+ * free a whole burst of slots; a buffer close to the burst size would
+ * starve them.
+ */
+static void BM_RingBuffer_MPSC_Burst(benchmark::State &state) {
+  const long burst = state.range(0);
+  const bool use_claim = state.range(1) != 0;
+  constexpr int num_producers = 4;
+  MpscRingBuffer<long> rb(BENCH_BUFFER_CAPACITY);
+  const long bursts_per_producer = 32768 / num_producers / burst;
+  const long total_items = bursts_per_producer * burst * num_producers;
+
+  for (auto _ : state) {
+    std::vector<std::thread> producers;
+    for (int p = 0; p < num_producers; ++p) {
+      producers.emplace_back([&rb, burst, bursts_per_producer, use_claim, p] {
+        const long base = static_cast<long>(p) << 32;
+        for (long b = 0; b < bursts_per_producer; ++b) {
+          if (use_claim) {
+            auto claim = rb.try_claim(burst);
+            while (!claim) {
+              std::this_thread::yield();
+              claim = rb.try_claim(burst);
+            }
+            for (long i = 0; i < burst; ++i)
+              claim.emplace(base | (b * burst + i));
+            claim.publish();
+          } else {
+            for (long i = 0; i < burst; ++i) {
+              while (!rb.try_emplace(base | (b * burst + i)))
+                std::this_thread::yield();
+            }
+          }
+        }
+      });
+    }
+
+    long items_consumed = 0;
+    while (items_consumed < total_items) {
+      long popped_value;
+      if (rb.try_pop(popped_value)) {
+        benchmark::DoNotOptimize(popped_value);
+        items_consumed++;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+
+    state.PauseTiming();
+    for (auto &t : producers) {
+      t.join();
+    }
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * total_items);
+  state.SetLabel(use_claim ? "try_claim" : "try_emplace");
+}
+// Burst sizes 1..32, per-item emplace against one claim per burst
+BENCHMARK(BM_RingBuffer_MPSC_Burst)
+    ->ArgsProduct({{1, 2, 4, 8, 16, 32}, {0, 1}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+// Benchmark for the producer side of the broadcast ring
+/**
+ * @brief BM_BroadcastRing_Emplace
+ *
+ * @Measures: The cost of a single-threaded `try_emplace` into a
+ * BroadcastRingBuffer with `range(0)` subscribed LOSSY readers that never
+ * read (so the ring keeps overwriting).
+ *
+ * @What_To_Look_For:
+ *   - **`Time` (per item)**: Should be flat across reader counts: producers
+ * never look at reader cursors unless a LOSSLESS reader may be in the way,
+ * and then only once per capacity's worth of items.
+ *   - Comparable to BM_RingBuffer_SingleThread_EmplaceOnly; the extra slot
+ * CAS (the seqlock) is the expected difference.
+ *
+ * @When_To_Be_Concerned:
+ *   - Time growing with the number of readers: the producer fast path has
+ * started scanning the reader table.
+ */
+static void BM_BroadcastRing_Emplace(benchmark::State &state) {
+  BroadcastRingBuffer<long> rb(BENCH_BUFFER_CAPACITY);
+  std::vector<BroadcastRingBuffer<long>::Reader> readers;
+  for (int i = 0; i < state.range(0); ++i)
+    readers.push_back(
+        rb.subscribe(BroadcastRingBuffer<long>::ReaderMode::LOSSY));
+  long value = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(rb.try_emplace(value++));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BroadcastRing_Emplace)->Arg(0)->Arg(1)->Arg(4)->Arg(16);
+
+// Benchmark for fanning one stream out to several consumers
+/**
+ * @brief BM_RingBuffer_FanOut
+ *
+ * @Measures: The time to deliver 32768 items from one producer to each of
+ * `range(0)` consumer threads, either through one MpscRingBuffer per
+ * consumer (`range(1)` = 0: the producer emplaces every item once per
+ * consumer) or through one BroadcastRingBuffer with a LOSSLESS reader per
+ * consumer (`range(1)` = 1).
+ *
+ * @What_To_Look_For:
+ *   - **`items_per_second`** (items produced, not deliveries): With one
+ * consumer both should be close. As consumers are added the MPSC variant
+ * slows roughly in proportion on the producer side, while the broadcast
+ * variant is bounded by its slowest reader.
+ *
+ * @When_To_Be_Concerned:
+ *   - The broadcast variant losing to per-consumer rings at 2 or more
+ * consumers on a machine with spare cores.
+ *   - Benchmark stalls: a LOSSLESS reader's cursor is not releasing slots.
+ */
+static void BM_RingBuffer_FanOut(benchmark::State &state) {
+  const int consumers = static_cast<int>(state.range(0));
+  const bool broadcast = state.range(1) != 0;
+  constexpr long kItems = 32768;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    BroadcastRingBuffer<long> bring(BENCH_BUFFER_CAPACITY);
+    std::vector<std::unique_ptr<MpscRingBuffer<long>>> rings;
+    std::vector<BroadcastRingBuffer<long>::Reader> readers;
+    for (int c = 0; c < consumers; ++c) {
+      if (broadcast)
+        readers.push_back(
+            bring.subscribe(BroadcastRingBuffer<long>::ReaderMode::LOSSLESS));
+      else
+        rings.push_back(
+            std::make_unique<MpscRingBuffer<long>>(BENCH_BUFFER_CAPACITY));
+    }
+    state.ResumeTiming();
+
+    std::vector<std::thread> threads;
+    for (int c = 0; c < consumers; ++c) {
+      threads.emplace_back([&, c] {
+        long value;
+        for (long n = 0; n < kItems;) {
+          const bool got = broadcast ? readers[c].try_read(value)
+                                     : rings[c]->try_pop(value);
+          if (got) {
+            benchmark::DoNotOptimize(value);
+            ++n;
+          } else {
+            std::this_thread::yield();
+          }
+        }
+      });
+    }
+    for (long i = 0; i < kItems; ++i) {
+      if (broadcast) {
+        while (!bring.try_emplace(i))
+          std::this_thread::yield();
+      } else {
+        for (auto &ring : rings) {
+          while (!ring->try_emplace(i))
+            std::this_thread::yield();
+        }
+      }
+    }
+    for (auto &t : threads)
+      t.join();
+  }
+  state.SetItemsProcessed(state.iterations() * kItems);
+  state.SetLabel(broadcast ? "broadcast" : "mpsc_per_consumer");
+}
+BENCHMARK(BM_RingBuffer_FanOut)
+    ->ArgsProduct({{1, 2, 4}, {0, 1}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+namespace {
+struct BenchRecord { // The size of a small Tracelet
+  uint64_t ts;
+  uint64_t payload[7];
+};
+struct BenchRecordOrder {
+  bool operator()(const BenchRecord &a, const BenchRecord &b) const {
+    return a.ts < b.ts;
+  }
+};
+} // namespace
+
+// Benchmark for producer scaling with thread count: shared vs per-CPU rings
+/**
+ * @brief BM_PerCpuRing_Threads
+ *
+ * @Measures: The time for `range(0)` threads, released together, to push
+ * 64 records of 64 bytes each while one consumer drains them, into one
+ * shared MpscRingBuffer (`range(1)` = 0), per-CPU rings with a CAS per
+ * record (1), or per-CPU rings committed with rseq (2). Thread creation is
+ * excluded. At least two per-CPU rings are made, so modes 1 and 2 take
+ * their per-CPU paths even on a single-CPU machine.
+ *
+ * @What_To_Look_For:
+ *   - **`items_per_second`**: Should stay roughly flat from 1 to 10k
+ * threads for the per-CPU modes: contention is bounded by the CPU count,
+ * not the thread count. The shared ring's CAS is contended by every
+ * running producer, so its throughput falls with more cores in use.
+ *   - rseq against CAS per-CPU: the gap is the cost of the atomic RMW
+ * (uncontended, but still a full barrier on x86).
+ *   - On one CPU the modes differ little; the scaling shows with cores.
+ *
+ * @When_To_Be_Concerned:
+ *   - The rseq mode slower than the CAS per-CPU mode: restarts are
+ * frequent (e.g. a critical section long enough to be preempted often).
+ *   - Throughput collapsing with thread count in the per-CPU modes.
+ */
+static void BM_PerCpuRing_Threads(benchmark::State &state) {
+  using Rings = PerCpuRingBuffer<BenchRecord, BenchRecordOrder>;
+  const int threads = static_cast<int>(state.range(0));
+  const int mode = static_cast<int>(state.range(1));
+  constexpr int kPerThread = 64;
+  const long total = static_cast<long>(threads) * kPerThread;
+  const size_t rings = mode == 0 ? 1 : std::max<size_t>(
+                                           Rings::configured_cpus(), 2);
+  Rings rb(BENCH_BUFFER_CAPACITY * 4, rings, mode == 2);
+  if (mode == 2 && rb.mode() != Rings::Mode::RSEQ) {
+    state.SkipWithError("rseq is not available");
+    return;
+  }
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool go = false;
+    std::vector<std::thread> producers;
+    producers.reserve(threads);
+    for (int t = 0; t < threads; ++t) {
+      producers.emplace_back([&, t] {
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          cv.wait(lock, [&] { return go; });
+        }
+        BenchRecord record{};
+        for (int i = 0; i < kPerThread; ++i) {
+          record.ts = static_cast<uint64_t>(t) * kPerThread + i;
+          while (!rb.try_emplace(record))
+            std::this_thread::yield();
+        }
+      });
+    }
+    state.ResumeTiming();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      go = true;
+    }
+    cv.notify_all();
+
+    BenchRecord out;
+    for (long consumed = 0; consumed < total;) {
+      if (rb.try_pop(out)) {
+        benchmark::DoNotOptimize(out);
+        ++consumed;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    state.PauseTiming();
+    for (auto &t : producers)
+      t.join();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * total);
+  static constexpr const char *kLabels[] = {"shared", "per_cpu_cas",
+                                            "per_cpu_rseq"};
+  state.SetLabel(kLabels[mode]);
+}
+BENCHMARK(BM_PerCpuRing_Threads)
+    ->ArgsProduct({{1, 100, 1000, 10000}, {0, 1, 2}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
 BENCHMARK_MAIN(); // Generates main() for the benchmark executable
\ No newline at end of file
@@ -0,0 +1,307 @@
+#include <benchmark/benchmark.h>
+
+#include "waffle/processor/iprocessor.hpp"
+#include "waffle/waffle.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace Waffle::literals;
+
+constexpr int64_t LOOP_ITERATIONS = 4096;
+
+namespace {
+Waffle::StaticKey g_flag_key; // Only ever read through is_enabled().
+
+// Consumes records without output, so that the processing thread runs as
+// fast as the drain itself.
+class DiscardProcessor : public Waffle::IProcessor {
+public:
+  void on_record(const Waffle::Tracelet &record,
+                 const std::unordered_map<uint64_t, std::string> &) override {
+    benchmark::DoNotOptimize(&record);
+  }
+};
+} // namespace
+
+// Benchmarks for the cost of a WAFFLE_SPAN site while tracing is disabled.
+/**
+ * @brief BM_Loop_Uninstrumented
+ *
+ * @Measures: A tight loop doing a trivial amount of work per iteration with no
+ * tracing call site at all. Baseline for the two benchmarks below.
+ *
+ * @What_To_Look_For:
+ *   - **`Time` (per iteration)**: The floor that disabled sites are compared
+ * against.
+ */
+static void BM_Loop_Uninstrumented(benchmark::State &state) {
+  for (auto _ : state) {
+    int64_t sum = 0;
+    for (int64_t i = 0; i < LOOP_ITERATIONS; ++i) {
+      sum += i;
+      benchmark::DoNotOptimize(sum);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * LOOP_ITERATIONS);
+}
+BENCHMARK(BM_Loop_Uninstrumented);
+
+/**
+ * @brief BM_Loop_DisabledSpanSite
+ *
+ * @Measures: The same loop with a `WAFFLE_SPAN` (with one attribute) in its
+ * body, without `Waffle::setup()`. With jump-label support each site is a
+ * single NOP, so the loop should be indistinguishable from the baseline.
+ *
+ * @When_To_Be_Concerned:
+ *   - A measurable gap to `BM_Loop_Uninstrumented`: the site is doing a load,
+ * a branch or, worse, evaluating its arguments.
+ */
+static void BM_Loop_DisabledSpanSite(benchmark::State &state) {
+  for (auto _ : state) {
+    int64_t sum = 0;
+    for (int64_t i = 0; i < LOOP_ITERATIONS; ++i) {
+      WAFFLE_SPAN("hot_loop", "i"_w = static_cast<long long>(i));
+      sum += i;
+      benchmark::DoNotOptimize(sum);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * LOOP_ITERATIONS);
+}
+BENCHMARK(BM_Loop_DisabledSpanSite);
+
+/**
+ * @brief BM_Loop_FlagCheckedSite
+ *
+ * @Measures: The same loop guarded by a relaxed atomic "is enabled" check,
+ * i.e. what a site costs without jump labels (the WAFFLE_DISABLE_JUMP_LABEL
+ * fallback). The difference to `BM_Loop_DisabledSpanSite` is the saving of
+ * the patched NOP.
+ */
+static void BM_Loop_FlagCheckedSite(benchmark::State &state) {
+  for (auto _ : state) {
+    int64_t sum = 0;
+    for (int64_t i = 0; i < LOOP_ITERATIONS; ++i) {
+      if (g_flag_key.is_enabled()) {
+        sum -= i;
+      }
+      sum += i;
+      benchmark::DoNotOptimize(sum);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * LOOP_ITERATIONS);
+}
+BENCHMARK(BM_Loop_FlagCheckedSite);
+
+#if defined(__linux__)
+#include <sched.h>
+
+// Benchmarks for the per-record CPU id read.
+/**
+ * @brief BM_CurrentCpu_Rseq
+ *
+ * @Measures: `Waffle::detail::current_cpu()`, which every record pays. With
+ * glibc >= 2.35 this is a load from the thread's rseq area.
+ *
+ * @When_To_Be_Concerned:
+ *   - Close to `BM_CurrentCpu_Getcpu`: rseq is unavailable or disabled
+ * (GLIBC_TUNABLES=glibc.pthread.rseq=0) and every record makes a getcpu call.
+ */
+static void BM_CurrentCpu_Rseq(benchmark::State &state) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Waffle::detail::current_cpu());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CurrentCpu_Rseq);
+
+/**
+ * @brief BM_CurrentCpu_Getcpu
+ *
+ * @Measures: The `sched_getcpu()` fallback (vDSO getcpu) for comparison.
+ */
+static void BM_CurrentCpu_Getcpu(benchmark::State &state) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(sched_getcpu());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CurrentCpu_Getcpu);
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+
+namespace {
+/**
+ * @brief Counts user-space instructions retired by the calling thread via
+ * perf_event_open. `valid()` is false where perf events are unavailable
+ * (containers, perf_event_paranoid > 2); timings are still reported.
+ */
+class InstructionCounter {
+public:
+  InstructionCounter() {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    _fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+  }
+  ~InstructionCounter() {
+    if (_fd >= 0)
+      close(_fd);
+  }
+  bool valid() const { return _fd >= 0; }
+  void start() {
+    ioctl(_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  uint64_t stop() {
+    ioctl(_fd, PERF_EVENT_IOC_DISABLE, 0);
+    uint64_t count = 0;
+    if (read(_fd, &count, sizeof(count)) != sizeof(count))
+      return 0;
+    return count;
+  }
+
+private:
+  int _fd = -1;
+};
+} // namespace
+
+// Benchmarks for the hot path of an enabled span.
+/**
+ * @brief BM_Span_StartEnd
+ *
+ * @Measures: The application-thread cost of one enabled `WAFFLE_SPAN` without
+ * attributes: id allocation, context read/write, name registration, timestamp
+ * and the SPAN_START / SPAN_END ring buffer writes. The processing thread
+ * drains concurrently; records that do not fit are dropped, which is part of
+ * the measured hot path.
+ *
+ * @What_To_Look_For:
+ *   - **`insns/span`**: Instructions retired per start+end pair (only when
+ * perf events are available). This is the number to track across changes to
+ * the inline hot path; it is far less noisy than time.
+ *   - **`Time` (per iteration)**: Latency of one start+end pair.
+ *
+ * @When_To_Be_Concerned:
+ *   - `insns/span` growing after a change: something on the hot path stopped
+ * being inlined or picked up a lock.
+ */
+static void BM_Span_StartEnd(benchmark::State &state) {
+  Waffle::setup();
+  InstructionCounter counter;
+  uint64_t instructions = 0;
+  for (auto _ : state) {
+    if (counter.valid())
+      counter.start();
+    {
+      WAFFLE_SPAN("bench_span");
+    }
+    if (counter.valid())
+      instructions += counter.stop();
+  }
+  if (counter.valid()) {
+    state.counters["insns/span"] = benchmark::Counter(
+        static_cast<double>(instructions), benchmark::Counter::kAvgIterations);
+  }
+  state.SetItemsProcessed(state.iterations());
+  Waffle::shutdown();
+}
+BENCHMARK(BM_Span_StartEnd);
+
+/**
+ * @brief BM_Span_HeadSampled
+ *
+ * @Measures: A root `WAFFLE_SPAN` with one child while head sampling keeps
+ * `Arg` percent of root spans (Tracer::set_sampling_probability()). A dropped
+ * root costs its id allocation and the sampling hash; its child only a
+ * context compare.
+ *
+ * @What_To_Look_For:
+ *   - **`Time` at 100%**: Within noise of two `BM_Span_StartEnd` pairs; the
+ * sampling check is one relaxed load and a compare.
+ *   - **Scaling with `Arg`**: Time should fall roughly in proportion to the
+ * share kept, since dropped subtrees write nothing to the ring.
+ */
+static void BM_Span_HeadSampled(benchmark::State &state) {
+  Waffle::setup();
+  Waffle::detail::g_tracer_instance->set_sampling_probability(
+      static_cast<double>(state.range(0)) / 100);
+  for (auto _ : state) {
+    WAFFLE_SPAN("bench_root");
+    {
+      WAFFLE_SPAN("bench_child");
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  Waffle::shutdown();
+}
+BENCHMARK(BM_Span_HeadSampled)->Arg(100)->Arg(10)->Arg(1);
+#endif
+
+// Benchmarks for priority lanes under overload.
+/**
+ * @brief BM_PriorityLanes_Flood
+ *
+ * @Measures: One thread emitting CRITICAL events (`Priority::CRITICAL`, as
+ * for errors) every 2us while `Arg` threads flood the BULK lane with events
+ * as fast as they can, far beyond what the processing thread drains. Arg 0
+ * is the baseline without a flood.
+ *
+ * @What_To_Look_For:
+ *   - **`critical_dropped`**: Should stay 0; the flood fills only the BULK
+ * lane, and the weighted drain gives CRITICAL most of the consumer.
+ *   - **`bulk_dropped`**: Large; the flood's excess.
+ *   - **`Time`**: 2us plus a CRITICAL event; the flood adds contention on
+ * the HLC, not on the CRITICAL ring's tail.
+ *
+ * @When_To_Be_Concerned:
+ *   - Any `critical_dropped`: either the CRITICAL rate alone exceeds the
+ * drain, or lanes are starving each other.
+ */
+static void BM_PriorityLanes_Flood(benchmark::State &state) {
+  Waffle::TracerOptions options;
+  options.processors.push_back(std::make_shared<DiscardProcessor>());
+  Waffle::setup(options);
+  auto &tracer = *Waffle::detail::g_tracer_instance;
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> flooders;
+  for (int64_t t = 0; t < state.range(0); ++t) {
+    flooders.emplace_back([&stop] {
+      while (!stop.load(std::memory_order_relaxed)) {
+        WAFFLE_EVENT("flood", Waffle::Priority::BULK);
+      }
+    });
+  }
+  for (auto _ : state) {
+    WAFFLE_EVENT("error", Waffle::Priority::CRITICAL);
+    // About 500k errors/s: within what an idle processing thread (which
+    // sleeps 1ms when the lanes run empty) absorbs without drops.
+    const auto until =
+        std::chrono::steady_clock::now() + std::chrono::microseconds(2);
+    while (std::chrono::steady_clock::now() < until) {
+    }
+  }
+  stop = true;
+  for (auto &thread : flooders)
+    thread.join();
+  state.counters["critical_dropped"] = static_cast<double>(
+      tracer.dropped_records(Waffle::Priority::CRITICAL));
+  state.counters["bulk_dropped"] =
+      static_cast<double>(tracer.dropped_records(Waffle::Priority::BULK));
+  state.SetItemsProcessed(state.iterations());
+  Waffle::shutdown();
+}
+BENCHMARK(BM_PriorityLanes_Flood)->Arg(0)->Arg(1)->Arg(3)->UseRealTime();
@@ -4,6 +4,7 @@
 // It provides the main user-facing macros WAFFLE_SPAN and WAFFLE_EVENT.
 #include "waffle_common_types.hpp" // Provides Id, CausedBy, Attribute, etc.
 #include "waffle_core.hpp"         // Provides all core definitions and types.
+#include "waffle_propagation.hpp"  // Provides RemoteContext, inject/extract_context.
 
 namespace Waffle {
 
@@ -15,22 +16,39 @@ namespace Waffle {
 
 // --- User-Facing Macros ---
 
+// The Domain of every site that does not pass one; define it before
+// including this header (or redefine it) to assign a translation unit's
+// sites to a subsystem's domain. See Waffle::Domain.
+#ifndef WAFFLE_DOMAIN
+#define WAFFLE_DOMAIN Waffle::kDefaultDomain
+#endif
+
+// Both macros are guarded by a runtime-patched static key: until
+// Waffle::setup() runs (and after Waffle::shutdown()) a site is a single NOP
+// and none of its arguments are evaluated. When enabled, every argument is
+// evaluated exactly once; a CausedBy, Priority or Domain among them is picked
+// up by the Tracer (an explicit Domain wins over WAFFLE_DOMAIN).
 #define WAFFLE_SPAN(name, ...)                                                 \
-  static const Waffle::StaticStringSource CONCAT(waffle_span_loc_, __LINE__)(  \
+  static constinit Waffle::StaticStringSource CONCAT(waffle_span_loc_,         \
+                                                     __LINE__)(                \
       name, sizeof(name) - 1);                                                 \
   auto CONCAT(waffle_span_, __LINE__) =                                        \
-      Waffle::detail::g_tracer_instance -> start_span(                         \
-          CONCAT(waffle_span_loc_, __LINE__),                                  \
-          Waffle::context::get_current_span_id(),                              \
-          Waffle::detail::parse_args_impl(__VA_ARGS__).cause, __VA_ARGS__)
+      Waffle::detail::tracing_enabled()                                        \
+          ? Waffle::detail::g_tracer_instance->start_span(                     \
+                CONCAT(waffle_span_loc_, __LINE__),                            \
+                Waffle::context::get_current_span_id(),                        \
+                Waffle::kInvalidId, __VA_ARGS__ __VA_OPT__(, ) WAFFLE_DOMAIN)  \
+          : Waffle::Span {}
 
 #define WAFFLE_EVENT(name, ...)                                                \
-  static const Waffle::StaticStringSource CONCAT(waffle_event_loc_, __LINE__)( \
+  static constinit Waffle::StaticStringSource CONCAT(waffle_event_loc_,        \
+                                                     __LINE__)(                \
       name, sizeof(name) - 1);                                                 \
+  if (Waffle::detail::tracing_enabled())                                       \
   Waffle::detail::g_tracer_instance->create_event(                             \
       CONCAT(waffle_event_loc_, __LINE__),                                     \
       Waffle::context::get_current_span_id(),                                  \
-      Waffle::detail::parse_args_impl(__VA_ARGS__).cause, __VA_ARGS__)
+      Waffle::kInvalidId, __VA_ARGS__ __VA_OPT__(, ) WAFFLE_DOMAIN)
 
 // --- Convenience using declarations ---
 // Expose commonly used types and functions directly in the Waffle namespace
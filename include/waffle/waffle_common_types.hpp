@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <utility>
@@ -27,6 +28,33 @@ struct CausedBy {
   Id value;
 };
 
+/**
+ * @brief The ring lane a record travels in; pass one to WAFFLE_SPAN /
+ * WAFFLE_EVENT like a CausedBy, e.g. `WAFFLE_EVENT("oom", Priority::CRITICAL)`.
+ *
+ * Each lane has its own capacity, so a flood of BULK records can only drop
+ * BULK records. Span ends, thread announcements and records with a cause
+ * travel as CRITICAL without being asked; everything else as NORMAL.
+ */
+enum class Priority : uint8_t { CRITICAL, NORMAL, BULK };
+constexpr size_t kPriorityCount = 3;
+
+/**
+ * @brief A tracing domain: the subsystem a record is accounted to, with its
+ * own ring quota and rate limit (see TracerOptions::domains).
+ *
+ * Ids are static, e.g. `constexpr Waffle::Domain kCommDomain{2};`, and are
+ * passed to WAFFLE_SPAN / WAFFLE_EVENT like a CausedBy. A translation unit
+ * can instead define WAFFLE_DOMAIN (e.g. as `kCommDomain`) before including
+ * waffle.hpp to give all its sites that domain. Ids past kMaxDomains count
+ * as the default domain 0.
+ */
+struct Domain {
+  uint8_t id = 0;
+};
+constexpr Domain kDefaultDomain{0};
+constexpr size_t kMaxDomains = 16;
+
 struct AttributeValue {
   enum class Type : uint8_t { BOOL, INT64, DOUBLE, STRING_ID };
   Type type;
@@ -36,13 +64,16 @@ struct AttributeValue {
     double f64;
     uint64_t string_id;
   };
-  AttributeValue() : type(Type::BOOL), b(false) {}
+  // Trivial so that Tracelet attribute slots are not zero-filled on
+  // construction. Value-initialization (`AttributeValue{}`) still yields a
+  // zeroed BOOL false.
+  AttributeValue() = default;
 };
 
 struct Attribute {
   uint64_t key_id;
   AttributeValue value;
-  Attribute() : key_id(0), value() {}
+  Attribute() = default; // Trivial; `Attribute{}` is zero-initialized.
   Attribute(uint64_t k, AttributeValue v) : key_id(k), value(std::move(v)) {}
 };
 
@@ -61,7 +92,10 @@ constexpr uint64_t fnv1a_hash(const char *str, size_t n) {
 struct StaticStringSource {
   uint64_t hash;
   const char *str;
-  StaticStringSource(const char *s, size_t n)
+  // Epoch of the Tracer that last registered this string (0: none). Lets every
+  // use of a site after the first skip the string table lock.
+  mutable std::atomic<uint32_t> registered_epoch{0};
+  constexpr StaticStringSource(const char *s, size_t n)
       : hash(fnv1a_hash(s, n)), str(s) {}
 };
 
@@ -2,11 +2,26 @@
 
 #include "waffle_common_types.hpp" // For Id, kInvalidId
 
+// The per-thread context is read and written on every span start/end, so it is
+// defined here rather than behind a call into the library. The initial-exec
+// TLS model turns each access into a single %fs/tpidr_el0-relative load
+// instead of a __tls_get_addr call. It requires the variable to live in the
+// executable or a library loaded at startup; define
+// WAFFLE_DISABLE_INITIAL_EXEC_TLS when Waffle is linked into a module that is
+// dlopen()ed.
+#if defined(__GNUC__) && !defined(WAFFLE_DISABLE_INITIAL_EXEC_TLS)
+#define WAFFLE_TLS_INITIAL_EXEC __attribute__((tls_model("initial-exec")))
+#else
+#define WAFFLE_TLS_INITIAL_EXEC
+#endif
+
 namespace Waffle {
 namespace context {
 
-Id get_current_span_id();
-void set_current_span_id(Id id);
+inline thread_local Id g_current_span_id WAFFLE_TLS_INITIAL_EXEC{kInvalidId};
+
+inline Id get_current_span_id() { return g_current_span_id; }
+inline void set_current_span_id(Id id) { g_current_span_id = id; }
 
 } // namespace context
-} // namespace Waffle
\ No newline at end of file
+} // namespace Waffle
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <array>
+#include <chrono>
 #include <cstdint>
 #include <memory>
 #include <mutex>
@@ -7,10 +9,18 @@
 #include <string_view>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "waffle/waffle_common_types.hpp"
-#include "waffle_core_detail.hpp" // Provides detail::extract_attributes, detail::parse_args_impl. Depends on types from waffle_common_types.hpp.
+#include "waffle/waffle_context.hpp"
+#include "waffle_core_detail.hpp" // Provides detail::parse_args_impl, detail::write_attributes. Depends on types from waffle_common_types.hpp.
+#include "waffle_tracelet.hpp"    // Provides Tracelet, the unit of transfer through the ring buffer.
+#include "waffle_thread.hpp"      // Provides detail::t_thread_state, detail::current_cpu.
+#include "waffle_hlc.hpp"         // Provides HybridLogicalClock.
+#include "waffle/waffle_static_key.hpp"
 #include <waffle/helpers/mpsc_ring_buffer.hpp>
+#include <waffle/helpers/per_cpu_ring_buffer.hpp>
 
 namespace Waffle {
 // --- Forward Declarations ---
@@ -18,61 +28,21 @@ namespace Waffle {
 // waffle_common_types.hpp class Tracer; // No longer needed here class Span; //
 // No longer needed here
 
-struct alignas(CACHE_LINE_SIZE) Tracelet {
-  enum class RecordType : uint8_t { SPAN_START, SPAN_END, EVENT };
-
-  uint64_t timestamp;
-  Id trace_id;
-  Id span_id;
-  Id parent_span_id;
-  Id cause_id;
-  uint64_t name_string_hash;
-  RecordType record_type;
-  uint8_t num_attributes;
-  uint8_t padding[6]; // Padding to align the attributes array
-
-  Attribute attributes[MAX_ATTRIBUTES_PER_TRACELET];
-
-  // add a function which returns an iterator to the attributes array
-  const auto attributes_begin() const { return std::begin(attributes); }
-  const auto attributes_end() const {
-    return attributes_begin() + num_attributes;
-  }
 
-  // Constructor for SPAN_START, EVENT (with attributes)
-  Tracelet(uint64_t ts, Id t_id, Id s_id, Id p_span_id, Id c_id,
-           uint64_t name_h, RecordType rtype,
-           const std::array<Attribute, MAX_ATTRIBUTES_PER_TRACELET>
-               &event_attrs_array,
-           uint8_t actual_attr_count)
-      : timestamp(ts), trace_id(t_id), span_id(s_id), parent_span_id(p_span_id),
-        cause_id(c_id), name_string_hash(name_h), record_type(rtype),
-        num_attributes(actual_attr_count) {
-    std::fill_n(padding, sizeof(padding) / sizeof(padding[0]), 0);
-    for (uint8_t i = 0; i < actual_attr_count; ++i) {
-      attributes[i] = event_attrs_array[i];
-    }
-    // Default initialize remaining Attribute objects
-    for (size_t i = actual_attr_count; i < MAX_ATTRIBUTES_PER_TRACELET; ++i) {
-      attributes[i] = {};
-    }
-  }
+namespace detail {
+// Enabled by setup() once g_tracer_instance exists, disabled by shutdown()
+// before it is destroyed. Guards every WAFFLE_SPAN / WAFFLE_EVENT site.
+inline StaticKey g_tracing_key;
 
-  // Constructor for SPAN_END (no attributes)
-  Tracelet(uint64_t ts, Id t_id, Id s_id, Id p_span_id, Id c_id,
-           uint64_t name_h, RecordType rtype)
-      : timestamp(ts), trace_id(t_id), span_id(s_id), parent_span_id(p_span_id),
-        cause_id(c_id), name_string_hash(name_h), record_type(rtype),
-        num_attributes(0) {
-    std::fill_n(padding, sizeof(padding) / sizeof(padding[0]), 0);
-    // Default initialize all Attribute objects
-    for (size_t i = 0; i < MAX_ATTRIBUTES_PER_TRACELET; ++i) {
-      attributes[i] = {};
-    }
-  }
-  // Default constructor
-  Tracelet() : Tracelet(0, {}, {}, {}, {}, 0, RecordType::EVENT) {}
-};
+WAFFLE_ALWAYS_INLINE bool tracing_enabled() {
+  return static_branch_unlikely(g_tracing_key);
+}
+} // namespace detail
+
+// Span id of a span dropped by head sampling (see
+// Tracer::set_sampling_probability()). It becomes the current span, so that
+// its children and events are dropped too without allocating ids.
+constexpr Id kUnsampledId{~0ull};
 
 // --- Span Object ---
 class Span {
@@ -82,14 +52,33 @@ public:
   Span &operator=(Span &&other) noexcept;
   Span(const Span &) = delete;
   Span &operator=(const Span &) = delete;
-  ~Span();
+  // Guarded by the tracing key so that a Span outliving Waffle::shutdown()
+  // never reaches the destroyed Tracer; it still restores the current span.
+  ~Span() { finish(); }
 
-  void end();
+  inline void end();
   Id id() const { return _span_id; }
 
 private:
   friend class Tracer;
-  Span(Tracer *tracer, Id trace_id, Id span_id, Id parent_span_id);
+  // Ends the span if tracing is still enabled. Otherwise only makes its
+  // parent current again, so later spans on this thread do not get a dead
+  // parent after the next setup().
+  void finish() {
+    if (_is_ended || !_tracer)
+      return;
+    if (detail::tracing_enabled()) {
+      end();
+      return;
+    }
+    _is_ended = true;
+    context::set_current_span_id(_parent_span_id);
+  }
+  Span(Tracer *tracer, Id trace_id, Id span_id, Id parent_span_id)
+      : _tracer(tracer), _trace_id(trace_id), _span_id(span_id),
+        _parent_span_id(parent_span_id) {
+    context::set_current_span_id(_span_id);
+  }
   Tracer *_tracer = nullptr;
   Id _trace_id{kInvalidId};
   Id _span_id{kInvalidId};
@@ -97,29 +86,186 @@ private:
   bool _is_ended = false;
 };
 
+class IProcessor;
+
+/**
+ * @brief Overhead limits the processing thread enforces by adjusting the
+ * head-sampling probability.
+ *
+ * Every `interval` the processing thread measures its own CPU time, the ring
+ * occupancy, how far behind the newest record it processed was (lag), the
+ * records queued by processors (IProcessor::backlog()) and the records
+ * producers dropped. The largest of these relative to its limit is the
+ * pressure: above 1 the probability is cut in proportion, well below 1 it
+ * recovers by at most 25% per interval. Producers see the result through one
+ * relaxed atomic load per root span. A limit of 0 is not checked; with every
+ * limit 0 the controller does not run.
+ */
+struct OverheadBudget {
+  double max_cpu = 0;            // Processing-thread share of one core
+  double max_ring_occupancy = 0; // Share of ring_capacity in use
+  std::chrono::milliseconds max_lag{0};
+  size_t max_backlog = 0; // Summed over processors, in their own units
+  double min_probability = 1.0 / 4096;
+  std::chrono::milliseconds interval{50};
+
+  bool enabled() const {
+    return max_cpu > 0 || max_ring_occupancy > 0 || max_lag.count() > 0 ||
+           max_backlog > 0;
+  }
+};
+
+/**
+ * @brief Limits of one tracing domain; TracerOptions::domains[i] configures
+ * Domain{i}.
+ *
+ * Admission is checked per domain before a record enters its lane, so a
+ * domain over its limits drops only its own records. To keep a noisy domain
+ * from filling a lane that others share, give it a quota well below the
+ * lane capacities. Span ends are exempt (their starts were admitted); a
+ * span whose start is dropped is not recorded at all, children included.
+ */
+struct DomainOptions {
+  std::string name;
+  // Records of the domain in the rings at once, over all lanes; 0: no quota.
+  size_t ring_quota = 0;
+  // Sustained rate; bursts of a tenth of a second pass. 0: unlimited.
+  uint64_t max_records_per_second = 0;
+};
+
+/**
+ * @brief Configuration of a Tracer, passed to `Waffle::setup()`.
+ */
+struct TracerOptions {
+  // Receive every record on the processing thread (see IProcessor). When
+  // empty, events are printed to stdout by a ConsoleProcessor.
+  std::vector<std::shared_ptr<IProcessor>> processors;
+  // Records that do not fit are dropped; rounded up to a power of two.
+  // This is the NORMAL lane; see Priority for the other two.
+  size_t ring_capacity = 8192;
+  // Limits for the overhead controller (see OverheadBudget); off by default.
+  OverheadBudget overhead;
+  size_t critical_ring_capacity = 2048;
+  size_t bulk_ring_capacity = 2048;
+  // Records taken per round from the CRITICAL, NORMAL and BULK lanes while
+  // one of them is more than half full (see Tracer::drain()).
+  std::array<uint32_t, kPriorityCount> drain_weights{8, 4, 1};
+  // Indexed by Domain id, at most kMaxDomains; missing domains are
+  // unlimited.
+  std::vector<DomainOptions> domains;
+  // Give every lane one ring per CPU instead of one shared ring, committed
+  // with rseq where the platform allows (see PerCpuRingBuffer). The
+  // capacities above are then per CPU.
+  bool per_cpu_rings = false;
+};
+
 // --- Tracer & Global Provider ---
 class Tracer {
 public:
-  Tracer();
+  explicit Tracer(TracerOptions options = {});
   ~Tracer();
 
-  void end_span(Id trace_id, Id span_id);
+  // Identifies this process in merged traces: the top 24 bits of every span
+  // id it allocates.
+  uint64_t process_tag() const { return _id_base >> 40; }
+
+  // Processor calls that threw. The processing thread catches the exception
+  // and makes no further calls to that processor.
+  uint64_t processor_errors() const {
+    return _processor_errors.load(std::memory_order_relaxed);
+  }
+
+  void end_span(Id trace_id, Id span_id) {
+    // SPAN_END carries no name and no parent: the consumer restores both from
+    // the matching SPAN_START.
+    emit(trace_id, span_id, kInvalidId, kInvalidId, 0,
+         Tracelet::RecordType::SPAN_END);
+  }
+
+  /**
+   * @brief Returns the calling thread's compact index.
+   *
+   * The first call from a thread (per Tracer) announces the thread with a
+   * THREAD_INFO record carrying its OS thread id and name; every later call is
+   * a single TLS compare.
+   */
+  uint16_t current_thread_index() {
+    const detail::ThreadState &state = detail::t_thread_state;
+    if (state.epoch != _epoch) [[unlikely]] {
+      return register_thread();
+    }
+    return state.index;
+  }
 
   // void create_event(std::string_view name, Id parent, Id cause,
   //                   std::initializer_list<Attribute> attrs);
 
-  uint64_t get_string_id(const StaticStringSource &s);
-  uint64_t get_string_id(std::string_view s);
+  uint64_t get_string_id(const StaticStringSource &s) {
+    register_static_string(s);
+    return s.hash;
+  }
+
+  /**
+   * @brief Interns a runtime string and returns its id.
+   *
+   * A small per-thread cache of recently interned hashes lets repeated keys
+   * (e.g. every `"key"_w = value`) skip the string table lock.
+   */
+  uint64_t get_string_id(std::string_view s) {
+    const uint64_t hash = fnv1a_hash(s.data(), s.size());
+    auto &slot = t_intern_cache[hash % kInternCacheSize];
+    if (slot.hash != hash || slot.epoch != _epoch) [[unlikely]] {
+      intern_string(hash, s);
+      slot = {hash, _epoch};
+    }
+    return hash;
+  }
 
   void shutdown();
 
+  /**
+   * @brief Sets the head-sampling probability: the share of root spans that
+   * are recorded, each with its whole subtree of spans and events. Spans with
+   * a parent (including one from a RemoteContext) follow their parent.
+   *
+   * The decision hashes the root's span id, so it costs one relaxed load and
+   * a multiply. With an OverheadBudget the controller overrides this value
+   * every interval.
+   */
+  void set_sampling_probability(double probability);
+  double sampling_probability() const;
+
+  // Records producers could not write because their lane was full.
+  uint64_t dropped_records() const {
+    uint64_t total = 0;
+    for (const auto &dropped : _dropped)
+      total += dropped.load(std::memory_order_relaxed);
+    return total;
+  }
+  uint64_t dropped_records(Priority lane) const {
+    return _dropped[static_cast<size_t>(lane)].load(std::memory_order_relaxed);
+  }
+
+  // Per-domain accounting; see DomainOptions.
+  struct DomainStats {
+    size_t in_ring = 0; // Admitted and not yet processed (with a quota)
+    uint64_t dropped_quota = 0;
+    uint64_t dropped_rate = 0;
+    uint64_t dropped_full = 0; // Admitted, but the lane was full
+  };
+  DomainStats domain_stats(Domain domain) const;
+  const std::string &domain_name(Domain domain) const {
+    return _domains[domain_index(domain.id)].name;
+  }
+
   // --- Template method definitions moved here from .cpp file ---
 
   template <typename... AttrArgs>
   Span start_span(const StaticStringSource &name, Id parent_span_id,
                   Id cause_id, AttrArgs &&...attr_args) {
-    uint64_t new_id_val = _next_id.fetch_add(1, std::memory_order_relaxed);
-    Id new_span_id = {new_id_val};
+    const Id new_span_id = next_span_id(parent_span_id);
+    if (new_span_id == kUnsampledId) [[unlikely]]
+      return Span(this, kInvalidId, kUnsampledId, parent_span_id);
 
     // TODO: Critical: Trace ID Propagation.
     // If parent_span_id is valid, trace_id should be the parent's trace_id.
@@ -134,16 +280,18 @@ public:
                                    ? Id{parent_span_id.value}
                                    : new_span_id; // Needs fix
 
-    auto [attributes_array, actual_attr_count] =
-        Waffle::detail::extract_attributes(
-            std::forward<AttrArgs>(attr_args)...);
+    const Id effective_cause_id = resolve_cause(cause_id, attr_args...);
 
     if (!_shutdown_flag) {
-      register_static_string(name.hash, name.str); // Ensure string is known
-      _queue->try_emplace(get_timestamp(), trace_id_for_new_span, new_span_id,
-                          parent_span_id, cause_id, name.hash,
-                          Tracelet::RecordType::SPAN_START, attributes_array,
-                          actual_attr_count);
+      register_static_string(name); // Ensure string is known
+      // A span whose start was dropped is not recorded at all: no end
+      // without a start, and no children without a parent.
+      if (!emit(trace_id_for_new_span, new_span_id, parent_span_id,
+                effective_cause_id, name.hash,
+                Tracelet::RecordType::SPAN_START,
+                std::forward<AttrArgs>(attr_args)...)) [[unlikely]] {
+        return Span(this, kInvalidId, kUnsampledId, parent_span_id);
+      }
     }
     return Span(this, trace_id_for_new_span, new_span_id, parent_span_id);
   }
@@ -151,23 +299,24 @@ public:
   template <typename... AttrArgs>
   Span start_span(std::string_view name, Id parent_span_id, Id cause_id,
                   AttrArgs &&...attr_args) {
-    uint64_t new_id_val = _next_id.fetch_add(1, std::memory_order_relaxed);
-    Id new_span_id = {new_id_val};
+    const Id new_span_id = next_span_id(parent_span_id);
+    if (new_span_id == kUnsampledId) [[unlikely]]
+      return Span(this, kInvalidId, kUnsampledId, parent_span_id);
     // TODO: Same critical trace_id propagation issue as above.
     Id trace_id_for_new_span = (parent_span_id.value != kInvalidId.value)
                                    ? Id{parent_span_id.value}
                                    : new_span_id; // Needs fix
 
-    auto [attributes_array, actual_attr_count] =
-        Waffle::detail::extract_attributes(
-            std::forward<AttrArgs>(attr_args)...);
+    const Id effective_cause_id = resolve_cause(cause_id, attr_args...);
 
     uint64_t name_hash = get_string_id(name); // Interns the string_view
     if (!_shutdown_flag) {
-      _queue->try_emplace(get_timestamp(), trace_id_for_new_span, new_span_id,
-                          parent_span_id, cause_id, name_hash,
-                          Tracelet::RecordType::SPAN_START, attributes_array,
-                          actual_attr_count);
+      if (!emit(trace_id_for_new_span, new_span_id, parent_span_id,
+                effective_cause_id, name_hash,
+                Tracelet::RecordType::SPAN_START,
+                std::forward<AttrArgs>(attr_args)...)) [[unlikely]] {
+        return Span(this, kInvalidId, kUnsampledId, parent_span_id);
+      }
     }
     return Span(this, trace_id_for_new_span, new_span_id, parent_span_id);
   }
@@ -175,6 +324,8 @@ public:
   template <typename... AttrArgs>
   void create_event(const StaticStringSource &name, Id parent_span_id,
                     Id cause_id, AttrArgs &&...attr_args) {
+    if (parent_span_id == kUnsampledId) [[unlikely]]
+      return;
     // TODO: Trace ID for events should be derived from the parent_span_id's
     // trace. Similar to start_span, this needs a way to get the parent's
     // trace_id. If parent_span_id is kInvalidId, it's an orphaned event,
@@ -186,43 +337,246 @@ public:
         1)}; // Events could have their own IDs or use parent_span_id
              // contextually. Using parent_span_id as the "span_id" for the
              // Tracelet.
-    auto [attributes_array, actual_attr_count] =
-        Waffle::detail::extract_attributes(
-            std::forward<AttrArgs>(attr_args)...);
+    const Id effective_cause_id = resolve_cause(cause_id, attr_args...);
     if (!_shutdown_flag) {
-      register_static_string(name.hash, name.str); // Ensure string is known
-      _queue->try_emplace(get_timestamp(), trace_id_for_event, parent_span_id,
-                          parent_span_id, cause_id, name.hash,
-                          Tracelet::RecordType::EVENT, attributes_array,
-                          actual_attr_count);
+      register_static_string(name); // Ensure string is known
+      emit(trace_id_for_event, parent_span_id, parent_span_id,
+           effective_cause_id, name.hash, Tracelet::RecordType::EVENT,
+           std::forward<AttrArgs>(attr_args)...);
     }
   }
 
+  /**
+   * @brief Merges the hybrid logical clock of a remote context into this
+   * process, so that every later record is stamped after the remote one.
+   */
+  void merge_remote_clock(uint64_t remote_hlc) { _hlc.merge(remote_hlc); }
+
+  // HLC value for a send event, e.g. for a context being injected.
+  uint64_t hlc_now() { return _hlc.tick(get_timestamp()); }
+
 private:
   friend class Span;
-  uint64_t get_timestamp();
-  void register_static_string(uint64_t hash, const char *str);
 
-  std::atomic<uint64_t> _next_id{1};
-  std::unique_ptr<MpscRingBuffer<Tracelet>> _queue;
+  // Writes one record into the ring, stamping the per-record header fields
+  // (wall time, HLC, thread index, CPU). Returns false if the ring was full.
+  template <typename... AttrArgs>
+  bool emit(Id trace_id, Id span_id, Id parent_span_id, Id cause_id,
+            uint64_t name_hash, Tracelet::RecordType type,
+            AttrArgs &&...attr_args) {
+    return emit_from(current_thread_index(), trace_id, span_id, parent_span_id,
+                     cause_id, name_hash, type,
+                     std::forward<AttrArgs>(attr_args)...);
+  }
+
+  template <typename... AttrArgs>
+  bool emit_from(uint16_t thread_index, Id trace_id, Id span_id,
+                 Id parent_span_id, Id cause_id, uint64_t name_hash,
+                 Tracelet::RecordType type, AttrArgs &&...attr_args) {
+    const size_t lane = static_cast<size_t>(lane_of(type, cause_id,
+                                                    attr_args...));
+    const uint64_t ts = get_timestamp();
+    DomainState &domain = _domains[domain_index(
+        Waffle::detail::parse_args_impl(attr_args...).domain.id)];
+    const bool accounted =
+        domain.limited && type != Tracelet::RecordType::SPAN_END;
+    if (accounted && !admit(domain, ts)) [[unlikely]]
+      return false;
+    if (_lanes[lane]->try_emplace(ts, _hlc.tick(ts), trace_id, span_id,
+                                  parent_span_id, cause_id, name_hash, type,
+                                  thread_index, detail::current_cpu(),
+                                  std::forward<AttrArgs>(attr_args)...)) {
+      return true;
+    }
+    if (accounted && domain.quota > 0)
+      domain.in_ring.fetch_sub(1, std::memory_order_relaxed);
+    domain.dropped_full.fetch_add(1, std::memory_order_relaxed);
+    _dropped[lane].fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  struct alignas(CACHE_LINE_SIZE) DomainState {
+    std::atomic<int64_t> in_ring{0};
+    std::atomic<uint64_t> tat{0}; // Rate limit: theoretical arrival time
+    std::atomic<uint64_t> dropped_quota{0};
+    std::atomic<uint64_t> dropped_rate{0};
+    std::atomic<uint64_t> dropped_full{0};
+    // Set by the constructor only.
+    bool limited = false;
+    int64_t quota = 0;
+    uint64_t interval_ns = 0; // At the sustained rate; 0: unlimited
+    uint64_t burst_ns = 0;
+    std::string name;
+  };
+
+  static size_t domain_index(uint8_t id) {
+    return id < kMaxDomains ? id : 0;
+  }
+
+  // Rate limit (GCRA: one CAS on the domain's theoretical arrival time),
+  // then quota. The consumer returns quota in release_domain().
+  bool admit(DomainState &domain, uint64_t ts) {
+    if (domain.interval_ns > 0) {
+      uint64_t tat = domain.tat.load(std::memory_order_relaxed);
+      uint64_t next;
+      do {
+        const uint64_t start = tat > ts ? tat : ts;
+        if (start - ts > domain.burst_ns) {
+          domain.dropped_rate.fetch_add(1, std::memory_order_relaxed);
+          return false;
+        }
+        next = start + domain.interval_ns;
+      } while (!domain.tat.compare_exchange_weak(tat, next,
+                                                 std::memory_order_relaxed));
+    }
+    if (domain.quota > 0 &&
+        domain.in_ring.fetch_add(1, std::memory_order_relaxed) >=
+            domain.quota) {
+      domain.in_ring.fetch_sub(1, std::memory_order_relaxed);
+      domain.dropped_quota.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
+
+  // An explicit Priority argument wins. Otherwise span ends (the consumer's
+  // span table depends on them), thread announcements and causal anchors
+  // are CRITICAL. Both branches fold away for a literal argument pack.
+  template <typename... AttrArgs>
+  static Priority lane_of(Tracelet::RecordType type, Id cause_id,
+                          const AttrArgs &...attr_args) {
+    if constexpr (sizeof...(AttrArgs) > 0) {
+      const auto parsed = Waffle::detail::parse_args_impl(attr_args...);
+      if (parsed.has_priority)
+        return parsed.priority;
+    }
+    return type == Tracelet::RecordType::SPAN_END ||
+                   type == Tracelet::RecordType::THREAD_INFO ||
+                   cause_id != kInvalidId
+               ? Priority::CRITICAL
+               : Priority::NORMAL;
+  }
+
+  // Allocates the id of a new span, or returns kUnsampledId if head sampling
+  // drops it: a root whose id hashes above the threshold, or any descendant
+  // of a dropped root.
+  Id next_span_id(Id parent_span_id) {
+    if (parent_span_id == kUnsampledId) [[unlikely]]
+      return kUnsampledId;
+    const uint64_t id = _next_id.fetch_add(1, std::memory_order_relaxed);
+    if (parent_span_id == kInvalidId) {
+      const uint32_t threshold =
+          _sample_threshold.load(std::memory_order_relaxed);
+      if (threshold != kSampleAll && sample_hash(id) >= threshold)
+        return kUnsampledId;
+    }
+    return Id{id};
+  }
+
+  // Uniform in [0, 2^32) over any pattern of ids. A bare multiply is not:
+  // sampled roots use more ids (children, events) than dropped ones, and
+  // that stride would bias the decision of the next root.
+  static uint32_t sample_hash(uint64_t id) {
+    id *= 0x9E3779B97F4A7C15ull;
+    id ^= id >> 29;
+    id *= 0xBF58476D1CE4E5B9ull;
+    return static_cast<uint32_t>(id >> 32);
+  }
+
+  // An explicit cause argument wins; otherwise the first CausedBy among the
+  // attribute arguments, which the macros no longer evaluate separately.
+  template <typename... AttrArgs>
+  static Id resolve_cause(Id cause_id, const AttrArgs &...attr_args) {
+    return cause_id != kInvalidId
+               ? cause_id
+               : Waffle::detail::parse_args_impl(attr_args...).cause;
+  }
+
+  static uint64_t get_timestamp() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+  }
+
+  void register_static_string(const StaticStringSource &s) {
+    // Acquire pairs with the release in register_static_string_slow(): a
+    // thread that skips the lock still sees the table entry it relies on.
+    if (s.registered_epoch.load(std::memory_order_acquire) != _epoch)
+        [[unlikely]] {
+      register_static_string_slow(s);
+    }
+  }
+  void register_static_string_slow(const StaticStringSource &s);
+  uint16_t register_thread();
+  void intern_string(uint64_t hash, std::string_view s);
+
+  struct InternCacheSlot {
+    uint64_t hash;
+    uint32_t epoch;
+  };
+  static constexpr size_t kInternCacheSize = 32;
+  static inline thread_local InternCacheSlot t_intern_cache
+      [kInternCacheSize] WAFFLE_TLS_INITIAL_EXEC = {};
+
+  // Distinguishes this Tracer from earlier instances so that strings
+  // registered with a destroyed Tracer are registered again.
+  const uint32_t _epoch;
+  const uint64_t _id_base;
+  std::atomic<uint64_t> _next_id;
+  HybridLogicalClock _hlc;
+  // One ring per Priority, indexed by it.
+  struct TimestampOrder {
+    bool operator()(const Tracelet &a, const Tracelet &b) const {
+      return a.timestamp < b.timestamp;
+    }
+  };
+  using Lane = PerCpuRingBuffer<Tracelet, TimestampOrder>;
+  std::array<std::unique_ptr<Lane>, kPriorityCount> _lanes;
+  const std::array<uint32_t, kPriorityCount> _drain_weights;
   std::thread _processing_thread;
   std::atomic<bool> _shutdown_flag{false};
-
+  std::array<std::atomic<uint64_t>, kPriorityCount> _dropped{};
+  std::atomic<uint64_t> _processor_errors{0};
+  std::array<DomainState, kMaxDomains> _domains;
+
+  // Root spans are kept when their id hashes below this, in units of 2^-32;
+  // written by set_sampling_probability() and the overhead controller.
+  static constexpr uint32_t kSampleAll = UINT32_MAX;
+  std::atomic<uint32_t> _sample_threshold{kSampleAll};
+  const OverheadBudget _overhead;
+
+  // Producers intern under _string_mutex and queue each new string for the
+  // processing thread, which moves it into _id_to_string_map; processors
+  // read that map without holding the producers' lock.
   std::mutex _string_mutex;
+  std::unordered_set<uint64_t> _interned;
+  std::vector<std::pair<uint64_t, std::string>> _new_strings;
   std::unordered_map<uint64_t, std::string> _id_to_string_map;
+
+  // Owned by the processing thread once it has started.
+  void process_records();
+  size_t drain(Tracelet *out, size_t max);
+  void release_domain(const Tracelet &record);
+  std::vector<std::shared_ptr<IProcessor>> _processors;
 };
 
+
 namespace detail {
 inline std::unique_ptr<Tracer> g_tracer_instance;
 }
 
 void setup();
+void setup(TracerOptions options);
 void shutdown();
 
-namespace context {
-Id get_current_span_id();
-void set_current_span_id(Id id);
-} // namespace context
+inline void Span::end() {
+  if (_is_ended || !_tracer)
+    return;
+  if (_span_id != kUnsampledId)
+    _tracer->end_span(_trace_id, _span_id);
+  _is_ended = true;
+  context::set_current_span_id(_parent_span_id);
+}
 
 // --- Ergonomic Attribute Creation Helpers ---
 /**
@@ -1,7 +1,6 @@
 #pragma once
 
 #include "waffle_common_types.hpp" // Provides Id, CausedBy, Attribute, MAX_ATTRIBUTES_PER_TRACELET, fnv1a_hash, StaticStringSource, CACHE_LINE_SIZE and forward decls for Tracer, Span.
-#include <array>                   // For std::array
 #include <type_traits>             // For std::is_same_v
 #include <utility>                 // For std::forward, std::pair, std::decay_t
 
@@ -9,17 +8,35 @@ namespace Waffle::detail {
 
 struct ParsedArgs {
   Id cause{kInvalidId};
+  Priority priority = Priority::NORMAL;
+  bool has_priority = false;
+  Domain domain = kDefaultDomain;
+  bool has_domain = false;
 };
 
-inline ParsedArgs parse_args_impl() { return {}; }
-
-template <typename T, typename... Args>
-ParsedArgs parse_args_impl(const T &first, const Args &...rest) {
-  if constexpr (std::is_same_v<T, CausedBy>) {
-    return {first.value};
-  } else {
-    return parse_args_impl(rest...);
-  }
+// The first CausedBy, Priority and Domain among the arguments.
+template <typename... Args>
+ParsedArgs parse_args_impl(const Args &...args) {
+  ParsedArgs parsed;
+  [[maybe_unused]] auto visit = [&parsed](const auto &arg) {
+    using T = std::decay_t<decltype(arg)>;
+    if constexpr (std::is_same_v<T, CausedBy>) {
+      if (parsed.cause == kInvalidId)
+        parsed.cause = arg.value;
+    } else if constexpr (std::is_same_v<T, Priority>) {
+      if (!parsed.has_priority) {
+        parsed.priority = arg;
+        parsed.has_priority = true;
+      }
+    } else if constexpr (std::is_same_v<T, Domain>) {
+      if (!parsed.has_domain) {
+        parsed.domain = arg;
+        parsed.has_domain = true;
+      }
+    }
+  };
+  (visit(args), ...);
+  return parsed;
 }
 
 // --- Variadic Argument Processing Helpers ---
@@ -33,38 +50,54 @@ ParsedArgs parse_args_impl(const T &first, const Args &...rest) {
 template <typename T> inline constexpr bool dependent_false_v = false;
 
 /**
- * @brief Extracts Attribute objects from a parameter pack.
+ * @brief Number of Attribute arguments in a WAFFLE_SPAN/EVENT parameter pack,
+ * capped at MAX_ATTRIBUTES_PER_TRACELET (extra attributes are dropped).
  *
- * This function iterates over the provided arguments, collects instances of
- * Waffle::Attribute into an array, and ignores Waffle::CausedBy objects (as
- * they are handled separately). If any other type of argument is provided, a
- * compile-time error is generated.
+ * Waffle::CausedBy, Waffle::Priority and Waffle::Domain arguments are
+ * skipped (they are handled by parse_args_impl). Any other argument type is
+ * a compile-time error.
  */
-template <typename... Args>
-inline std::pair<std::array<Attribute, MAX_ATTRIBUTES_PER_TRACELET>, uint8_t>
-extract_attributes(Args &&...args) {
-  std::array<Attribute, MAX_ATTRIBUTES_PER_TRACELET> attrs_array;
-  uint8_t count = 0;
-
-  auto process_arg = [&](auto &&arg) {
-    using ArgType = std::decay_t<decltype(arg)>;
+template <typename... Args> constexpr uint8_t count_attributes() {
+  size_t count = 0;
+  [[maybe_unused]] auto visit = [&count]<typename ArgType>() {
     if constexpr (std::is_same_v<ArgType, Attribute>) {
-      if (count < MAX_ATTRIBUTES_PER_TRACELET) {
-        attrs_array[count++] = std::forward<decltype(arg)>(arg);
-      }
-    } else if constexpr (!std::is_same_v<ArgType, CausedBy>) {
+      ++count;
+    } else if constexpr (!std::is_same_v<ArgType, CausedBy> &&
+                         !std::is_same_v<ArgType, Priority> &&
+                         !std::is_same_v<ArgType, Domain>) {
       static_assert(dependent_false_v<ArgType>,
                     "Unsupported argument type for WAFFLE_SPAN/EVENT. Only "
-                    "Attributes and CausedBy are allowed.");
+                    "Attributes, CausedBy, Priority and Domain are allowed.");
     }
   };
+  (visit.template operator()<std::decay_t<Args>>(), ...);
+  return static_cast<uint8_t>(count < MAX_ATTRIBUTES_PER_TRACELET
+                                  ? count
+                                  : MAX_ATTRIBUTES_PER_TRACELET);
+}
 
-  (process_arg(std::forward<Args>(args)), ...);
-
-  for (size_t i = count; i < MAX_ATTRIBUTES_PER_TRACELET; ++i) {
-    attrs_array[i] = {};
+/**
+ * @brief Writes the Attribute arguments of a parameter pack to `out`, in
+ * order, in a single pass.
+ *
+ * Exactly `count_attributes<Args...>()` slots are written; nothing else in
+ * `out` is touched, so callers can point it straight at ring buffer memory
+ * without zero-filling the unused tail first.
+ */
+template <typename... Args>
+inline void write_attributes(Attribute *out, Args &&...args) {
+  constexpr uint8_t kCount = count_attributes<Args...>();
+  if constexpr (kCount > 0) {
+    uint8_t index = 0;
+    auto write = [&](auto &&arg) {
+      if constexpr (std::is_same_v<std::decay_t<decltype(arg)>, Attribute>) {
+        if (index < kCount) {
+          out[index++] = std::forward<decltype(arg)>(arg);
+        }
+      }
+    };
+    (write(std::forward<Args>(args)), ...);
   }
-  return {attrs_array, count};
 }
 
 } // namespace Waffle::detail
\ No newline at end of file
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "waffle_context.hpp"    // For WAFFLE_TLS_INITIAL_EXEC
+#include "waffle_static_key.hpp" // For WAFFLE_ALWAYS_INLINE
+#include <atomic>
+#include <cstdint>
+
+namespace Waffle {
+
+/**
+ * @brief A hybrid logical clock (HLC) packed into 64 bits.
+ *
+ * The upper 48 bits are wall-clock nanoseconds with the low 16 bits cleared;
+ * the low 16 bits are a logical counter. Values therefore compare like plain
+ * integers, stay within one 65.5 us tick of wall time, and never go backwards
+ * across a causal edge: a record taken after a remote context was extracted
+ * is stamped strictly later than the remote sender's record, however far the
+ * two wall clocks drift apart. If the counter overflows it carries into the
+ * physical part, which only moves the clock ahead of wall time by one tick.
+ *
+ * `tick()` is the hot-path update. It touches only a thread-local "last
+ * value" and a read-mostly process-wide floor, so threads never contend on
+ * it. `merge()` raises the floor; it is called when a remote context is
+ * extracted and is the only writer.
+ *
+ * Define WAFFLE_DISABLE_HLC (CMake: -DWAFFLE_HLC=OFF) to compile the clock
+ * out; records are then stamped with 0, which readers treat as "no HLC".
+ */
+class HybridLogicalClock {
+public:
+  static constexpr unsigned kLogicalBits = 16;
+  static constexpr uint64_t kLogicalMask = (uint64_t{1} << kLogicalBits) - 1;
+
+  /**
+   * @brief Returns the HLC value for a local (or send) event that happened at
+   * wall time `wall_ns`.
+   *
+   * Strictly greater than every value previously returned on this thread and
+   * than every value passed to `merge()` before this call.
+   */
+  WAFFLE_ALWAYS_INLINE uint64_t tick(uint64_t wall_ns) {
+#if defined(WAFFLE_DISABLE_HLC)
+    (void)wall_ns;
+    return 0;
+#else
+    uint64_t next = wall_ns & ~kLogicalMask;
+    const uint64_t floor = _floor.load(std::memory_order_relaxed);
+    if (next < floor)
+      next = floor;
+    if (next <= t_last)
+      next = t_last + 1;
+    t_last = next;
+    return next;
+#endif
+  }
+
+  /**
+   * @brief Merges an HLC value received from another process.
+   *
+   * Every later `tick()` in this process, on any thread that is ordered after
+   * this call, returns a value greater than `remote`.
+   */
+  void merge(uint64_t remote) {
+#if !defined(WAFFLE_DISABLE_HLC)
+    if (remote == 0)
+      return; // Sender did not stamp an HLC.
+    uint64_t current = _floor.load(std::memory_order_relaxed);
+    while (current <= remote &&
+           !_floor.compare_exchange_weak(current, remote + 1,
+                                         std::memory_order_relaxed)) {
+    }
+#else
+    (void)remote;
+#endif
+  }
+
+  static constexpr uint64_t physical_ns(uint64_t hlc) {
+    return hlc & ~kLogicalMask;
+  }
+  static constexpr uint16_t logical(uint64_t hlc) {
+    return static_cast<uint16_t>(hlc & kLogicalMask);
+  }
+
+private:
+  std::atomic<uint64_t> _floor{0};
+  static inline thread_local uint64_t t_last WAFFLE_TLS_INITIAL_EXEC = 0;
+};
+
+} // namespace Waffle
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "waffle_common_types.hpp" // For Id, CausedBy
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace Waffle {
+
+/**
+ * @brief The part of a span's context that crosses a process boundary (an
+ * RPC, an MPI message, ...).
+ *
+ * The sender calls `inject_context()` and ships the result (e.g. via
+ * `format()`); the receiver parses it and calls `extract_context()`, which
+ * merges the sender's hybrid logical clock and yields the `CausedBy` link to
+ * attach to the receiving span:
+ *
+ *   WAFFLE_SPAN("handle_request", Waffle::extract_context(ctx));
+ */
+struct RemoteContext {
+  // No trace id: spans do not track one yet (see Tracer::start_span), and a
+  // stand-in would put every hop in a different trace.
+  Id span_id;   // The sending span; becomes the receiver's cause
+  uint64_t hlc; // Sender's HLC at injection time; 0 if it has none
+
+  bool operator==(const RemoteContext &) const = default;
+
+  /**
+   * @brief Text form: two 16-digit lowercase hex fields, `<span_id>-<hlc>`,
+   * suitable for headers and MPI payloads.
+   */
+  std::string format() const;
+  static std::optional<RemoteContext> parse(std::string_view text);
+};
+
+/**
+ * @brief Captures the current span as a RemoteContext to send to another
+ * process. Ticks the HLC: the send is itself an event.
+ *
+ * Without an active tracer the span id is that of the current context and
+ * the HLC is 0.
+ */
+RemoteContext inject_context();
+
+/**
+ * @brief Accepts a RemoteContext received from another process.
+ *
+ * Merges the remote HLC so that every record this process takes from now on
+ * is ordered after the sender's, and returns the causal link to the sending
+ * span.
+ */
+CausedBy extract_context(const RemoteContext &remote);
+
+} // namespace Waffle
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// --- Jump-Label Support Detection ---
+// Runtime-patchable call sites need `asm goto`, a known instruction encoding
+// and an ELF linker that provides __start_/__stop_ symbols for the patch-site
+// section (WAFFLE_HAVE_JUMP_LABEL_PATCHING). Sites additionally encode the key
+// address as an assembler immediate, which is only possible for
+// position-dependent or PIE code: -fPIC translation units (e.g. code built
+// into a shared library) fall back to a relaxed load of the key.
+// Define WAFFLE_DISABLE_JUMP_LABEL (CMake: -DWAFFLE_JUMP_LABEL=OFF) to force
+// the fallback everywhere, e.g. on systems that forbid writable text pages.
+#if !defined(WAFFLE_DISABLE_JUMP_LABEL) && defined(__linux__) &&              \
+    (defined(__x86_64__) || defined(__aarch64__)) && defined(__GNUC__)
+#define WAFFLE_HAVE_JUMP_LABEL_PATCHING 1
+#else
+#define WAFFLE_HAVE_JUMP_LABEL_PATCHING 0
+#endif
+
+#if WAFFLE_HAVE_JUMP_LABEL_PATCHING && (!defined(__PIC__) || defined(__PIE__))
+#define WAFFLE_HAVE_JUMP_LABEL 1
+#else
+#define WAFFLE_HAVE_JUMP_LABEL 0
+#endif
+
+#if defined(__GNUC__)
+#define WAFFLE_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define WAFFLE_ALWAYS_INLINE inline
+#endif
+
+namespace Waffle {
+
+/**
+ * @brief A boolean switch whose check sites are patched at runtime.
+ *
+ * Every `static_branch_unlikely(key)` site compiles down to a single NOP and
+ * records its address in the `__waffle_jump_table` section. `enable()` rewrites
+ * each recorded NOP for this key into a jump to the out-of-line "enabled" path;
+ * `disable()` restores the NOP. A disabled site therefore costs neither a load
+ * nor a branch, only the NOP's I-cache footprint.
+ *
+ * Toggling is expensive (mprotect + instruction-cache maintenance per site)
+ * and is meant for rare transitions such as `Waffle::setup()` and
+ * `Waffle::shutdown()`. On x86-64 a site that straddles an 8-byte boundary is
+ * rewritten with a non-atomic 5-byte copy, so toggles should happen while no
+ * other thread is executing that site. On aarch64 the NOP <-> B rewrite is a
+ * single aligned 4-byte store, which the architecture permits concurrently.
+ *
+ * Keys must have static storage duration: their address is embedded in the
+ * patch-site table at link time.
+ */
+class StaticKey {
+public:
+  constexpr StaticKey() = default;
+  StaticKey(const StaticKey &) = delete;
+  StaticKey &operator=(const StaticKey &) = delete;
+
+  bool is_enabled() const { return _enabled.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief Patches every site of this key into a jump.
+   * @throw std::system_error If the text pages could not be made writable.
+   */
+  void enable();
+
+  /**
+   * @brief Patches every site of this key back into a NOP.
+   * @throw std::system_error If the text pages could not be made writable.
+   */
+  void disable();
+
+private:
+  void set_enabled(bool enabled);
+
+  // Mirrors the patched state. Read directly by fallback (non-jump-label)
+  // sites, so it is kept up to date even when no site was patched.
+  std::atomic<bool> _enabled{false};
+};
+
+namespace detail {
+/**
+ * @brief One entry of the `__waffle_jump_table` section.
+ *
+ * All fields are offsets relative to their own address so the table needs no
+ * dynamic relocations in PIE executables. Entries are emitted into the COMDAT
+ * group of the function containing the site (the `?` section flag), so when
+ * the linker discards a duplicate copy of an inline function its entries go
+ * with it.
+ */
+struct JumpEntry {
+  int64_t code;   // The patchable NOP.
+  int64_t target; // The "enabled" label the NOP is turned into a jump to.
+  int64_t key;    // The StaticKey controlling this site.
+};
+} // namespace detail
+
+/**
+ * @brief Returns the state of `key`, assuming it is usually disabled.
+ *
+ * With jump-label support this is a NOP that falls through to `false`; once
+ * the key is enabled the NOP becomes a jump to the `true` path. This must stay
+ * always-inline: the asm labels refer to the caller's code.
+ */
+WAFFLE_ALWAYS_INLINE bool static_branch_unlikely(StaticKey &key) {
+#if WAFFLE_HAVE_JUMP_LABEL
+#if defined(__x86_64__)
+  // Aligned so that the site can be rewritten with one 8-byte store.
+  __asm__ goto(".balign 8\n\t"
+               "1: .byte 0x0f, 0x1f, 0x44, 0x00, 0x00\n\t" // 5-byte NOP
+               ".pushsection __waffle_jump_table, \"aw?\"\n\t"
+               ".balign 8\n\t"
+               ".quad 1b - ., %l[l_yes] - ., %c0 - .\n\t"
+               ".popsection\n\t"
+               :
+               : "i"(&key)
+               :
+               : l_yes);
+#else // __aarch64__
+  __asm__ goto("1: nop\n\t"
+               ".pushsection __waffle_jump_table, \"aw?\"\n\t"
+               ".balign 8\n\t"
+               ".quad 1b - ., %l[l_yes] - ., %c0 - .\n\t"
+               ".popsection\n\t"
+               :
+               : "S"(&key)
+               :
+               : l_yes);
+#endif
+  return false;
+l_yes:
+  return true;
+#elif defined(__GNUC__)
+  return __builtin_expect(key.is_enabled(), 0);
+#else
+  return key.is_enabled();
+#endif
+}
+
+} // namespace Waffle
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "waffle_context.hpp" // For WAFFLE_TLS_INITIAL_EXEC
+#include <cstdint>
+#include <string_view>
+
+#if defined(__linux__)
+#include <sched.h> // For sched_getcpu
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h> // For struct rseq, __rseq_offset (glibc >= 2.35)
+#endif
+#endif
+
+// --- rseq Support Detection ---
+// glibc 2.35+ registers an rseq area for every thread and exports its offset
+// from the thread pointer. The kernel keeps `cpu_id` in that area up to date
+// on every migration, so reading the current CPU is a plain TLS load instead
+// of a (vDSO) getcpu call. Define WAFFLE_DISABLE_RSEQ to always use the
+// sched_getcpu() fallback.
+#if !defined(WAFFLE_DISABLE_RSEQ) && defined(__linux__) &&                    \
+    defined(__GNUC__) && defined(RSEQ_SIG) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 35)
+#define WAFFLE_HAVE_RSEQ 1
+#endif
+#endif
+#if !defined(WAFFLE_HAVE_RSEQ)
+#define WAFFLE_HAVE_RSEQ 0
+#endif
+
+namespace Waffle {
+
+// Thread index 0 means "not yet registered"; real indices start at 1.
+constexpr uint16_t kInvalidThreadIndex = 0;
+// Shared by every thread past the 65534th, and by records on a CPU that could
+// not be determined.
+constexpr uint16_t kOverflowThreadIndex = 0xFFFF;
+constexpr uint16_t kUnknownCpu = 0xFFFF;
+// Attribute key of the OS thread id in THREAD_INFO records.
+constexpr std::string_view kThreadIdAttribute = "thread.id";
+
+namespace detail {
+
+/**
+ * @brief Per-thread registration state.
+ *
+ * `index` is assigned once per thread for the lifetime of the process.
+ * `epoch` is the epoch of the Tracer that last received this thread's
+ * THREAD_INFO record, so a new Tracer gets the metadata again.
+ */
+struct ThreadState {
+  uint16_t index;
+  uint32_t epoch;
+};
+inline thread_local ThreadState t_thread_state WAFFLE_TLS_INITIAL_EXEC = {
+    kInvalidThreadIndex, 0};
+
+/**
+ * @brief Returns the CPU the calling thread is running on, or kUnknownCpu.
+ *
+ * Read from the thread's rseq area when the kernel has registered one; a
+ * negative `cpu_id` there means registration failed or is disabled (e.g.
+ * GLIBC_TUNABLES=glibc.pthread.rseq=0), in which case sched_getcpu() is used.
+ * The value may be stale by the time it is stored, which is inherent to any
+ * CPU sampling done without preemption disabled.
+ */
+inline uint16_t current_cpu() {
+#if WAFFLE_HAVE_RSEQ
+  const auto *area = reinterpret_cast<const volatile struct rseq *>(
+      static_cast<const char *>(__builtin_thread_pointer()) + __rseq_offset);
+  const auto cpu = static_cast<int32_t>(area->cpu_id);
+  if (cpu >= 0) [[likely]] {
+    return cpu < kUnknownCpu ? static_cast<uint16_t>(cpu) : kUnknownCpu;
+  }
+#endif
+#if defined(__linux__)
+  const int cpu_fallback = sched_getcpu();
+  return (cpu_fallback >= 0 && cpu_fallback < kUnknownCpu)
+             ? static_cast<uint16_t>(cpu_fallback)
+             : kUnknownCpu;
+#else
+  return kUnknownCpu;
+#endif
+}
+
+} // namespace detail
+} // namespace Waffle
@@ -1,16 +1,28 @@
 #pragma once
 
 #include "waffle_common_types.hpp" // For Id, Attribute, MAX_ATTRIBUTES_PER_TRACELET, CACHE_LINE_SIZE
-#include <algorithm> // For std::fill_n
-#include <array>     // For std::array in Tracelet constructor parameter
-#include <cstdint>   // For uint8_t etc.
+#include "waffle_core_detail.hpp"  // For detail::count_attributes, detail::write_attributes
+#include "waffle_thread.hpp"       // For kUnknownCpu
+#include <cstdint>                 // For uint8_t etc.
+#include <iterator>                // For std::begin
+#include <type_traits>             // For std::is_trivially_default_constructible_v
+#include <utility>                 // For std::forward
 
 namespace Waffle {
 
+// Tracelets are constructed directly in ring buffer memory. Attribute must not
+// have a non-trivial default constructor, or every Tracelet would zero-fill
+// all attribute slots before the used ones are written.
+static_assert(std::is_trivially_default_constructible_v<Attribute>);
+
 struct alignas(CACHE_LINE_SIZE) Tracelet {
-  enum class RecordType : uint8_t { SPAN_START, SPAN_END, EVENT };
+  // THREAD_INFO is emitted once per thread and Tracer: its name is the thread
+  // name, its "thread.id" attribute the OS thread id, and its thread_index the
+  // index that all later records of that thread carry.
+  enum class RecordType : uint8_t { SPAN_START, SPAN_END, EVENT, THREAD_INFO };
 
   uint64_t timestamp;
+  uint64_t hlc; // Hybrid logical clock (see HybridLogicalClock); 0 if disabled
   Id trace_id;
   Id span_id;
   Id parent_span_id;
@@ -18,38 +30,44 @@ struct alignas(CACHE_LINE_SIZE) Tracelet {
   uint64_t name_string_hash;
   RecordType record_type;
   uint8_t num_attributes;
-  uint8_t padding[6]; // Padding to align the attributes array
+  uint16_t thread_index; // Compact per-process index of the recording thread
+  uint16_t cpu_id;       // CPU the record was taken on, or kUnknownCpu
+  uint8_t domain;        // Domain id from the arguments; 0 by default
+  uint8_t padding[1];    // Padding to align the attributes array
 
+  // Only the first `num_attributes` entries are initialized.
   Attribute attributes[MAX_ATTRIBUTES_PER_TRACELET];
 
-  Tracelet(uint64_t ts, Id t_id, Id s_id, Id p_span_id, Id c_id,
-           uint64_t name_h, RecordType rtype,
-           const std::array<Attribute, MAX_ATTRIBUTES_PER_TRACELET>
-               &event_attrs_array,
-           uint8_t actual_attr_count)
-      : timestamp(ts), trace_id(t_id), span_id(s_id), parent_span_id(p_span_id),
-        cause_id(c_id), name_string_hash(name_h), record_type(rtype),
-        num_attributes(actual_attr_count) {
-    std::fill_n(padding, sizeof(padding), uint8_t{0});
-    for (uint8_t i = 0; i < actual_attr_count; ++i) {
-      attributes[i] = event_attrs_array[i];
-    }
-    for (size_t i = actual_attr_count; i < MAX_ATTRIBUTES_PER_TRACELET; ++i) {
-      attributes[i] = {};
-    }
+  // add a function which returns an iterator to the attributes array
+  const auto attributes_begin() const { return std::begin(attributes); }
+  const auto attributes_end() const {
+    return attributes_begin() + num_attributes;
   }
 
-  Tracelet(uint64_t ts, Id t_id, Id s_id, Id p_span_id, Id c_id,
-           uint64_t name_h, RecordType rtype)
-      : timestamp(ts), trace_id(t_id), span_id(s_id), parent_span_id(p_span_id),
-        cause_id(c_id), name_string_hash(name_h), record_type(rtype),
-        num_attributes(0) {
-    std::fill_n(padding, sizeof(padding), uint8_t{0});
-    for (size_t i = 0; i < MAX_ATTRIBUTES_PER_TRACELET; ++i) {
-      attributes[i] = {};
-    }
+  /**
+   * @brief Constructs a record from its header fields and the raw
+   * WAFFLE_SPAN/EVENT arguments.
+   *
+   * The attribute count is a compile-time constant of the argument pack, and
+   * exactly that many attributes are written in a single pass; the unused
+   * slots are left untouched. CausedBy and Priority arguments are ignored
+   * here; a Domain sets `domain`. SPAN_END records simply pass no arguments.
+   */
+  template <typename... AttrArgs>
+  Tracelet(uint64_t ts, uint64_t hlc_ts, Id t_id, Id s_id, Id p_span_id,
+           Id c_id, uint64_t name_h, RecordType rtype, uint16_t thread_idx,
+           uint16_t cpu, AttrArgs &&...attr_args) noexcept
+      : timestamp(ts), hlc(hlc_ts), trace_id(t_id), span_id(s_id),
+        parent_span_id(p_span_id), cause_id(c_id), name_string_hash(name_h),
+        record_type(rtype),
+        num_attributes(detail::count_attributes<AttrArgs...>()),
+        thread_index(thread_idx), cpu_id(cpu),
+        domain(detail::parse_args_impl(attr_args...).domain.id), padding{} {
+    detail::write_attributes(attributes, std::forward<AttrArgs>(attr_args)...);
   }
-  Tracelet() : Tracelet(0, {}, {}, {}, {}, 0, RecordType::EVENT) {}
+
+  // Leaves the record uninitialized; used as the target of MpscRingBuffer pops.
+  Tracelet() = default;
 };
 
-} // namespace Waffle
\ No newline at end of file
+} // namespace Waffle
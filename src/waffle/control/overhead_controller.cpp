@@ -0,0 +1,39 @@
+#include "waffle/control/overhead_controller.hpp"
+
+#include <algorithm>
+
+namespace Waffle::control {
+
+double OverheadController::pressure(const OverheadSample &sample) const {
+  double pressure = 0;
+  if (_budget.max_cpu > 0)
+    pressure = std::max(pressure, sample.cpu / _budget.max_cpu);
+  if (_budget.max_ring_occupancy > 0)
+    pressure = std::max(pressure,
+                        sample.ring_occupancy / _budget.max_ring_occupancy);
+  if (_budget.max_lag.count() > 0) {
+    const double max_lag_ns = std::chrono::duration_cast<
+        std::chrono::nanoseconds>(_budget.max_lag).count();
+    pressure = std::max(pressure, sample.lag_ns / max_lag_ns);
+  }
+  if (_budget.max_backlog > 0)
+    pressure = std::max(pressure, static_cast<double>(sample.backlog) /
+                                      _budget.max_backlog);
+  if (sample.drops > 0)
+    pressure = std::max(pressure, 2.0);
+  return pressure;
+}
+
+double OverheadController::update(const OverheadSample &sample) {
+  const double p = pressure(sample);
+  if (p > 1)
+    _probability *= std::max(kTarget / p, kMaxDecrease);
+  else if (p < 0.9 * kTarget)
+    _probability *= p > 0 ? std::min(kTarget / p, kMaxIncrease)
+                          : kMaxIncrease;
+  _probability = std::clamp(_probability,
+                            std::min(_budget.min_probability, 1.0), 1.0);
+  return _probability;
+}
+
+} // namespace Waffle::control
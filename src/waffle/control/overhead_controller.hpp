@@ -0,0 +1,53 @@
+#pragma once
+
+#include "waffle/waffle_core.hpp"
+#include <cstddef>
+#include <cstdint>
+
+namespace Waffle::control {
+
+/**
+ * @brief What the processing thread measured over one controller interval.
+ */
+struct OverheadSample {
+  double cpu = 0;            // Thread CPU time / wall time of the interval
+  double ring_occupancy = 0; // Records in the ring / ring capacity
+  uint64_t lag_ns = 0;       // Age of the newest record processed
+  size_t backlog = 0;        // Summed IProcessor::backlog()
+  uint64_t drops = 0;        // Records producers dropped in the interval
+};
+
+/**
+ * @brief Turns overhead measurements into a head-sampling probability that
+ * keeps them within an OverheadBudget.
+ *
+ * The pressure of a sample is its largest measurement relative to the
+ * limit; records dropped by producers count as a pressure of at least 2.
+ * Record volume is roughly proportional to the probability, so above 1 the
+ * probability is scaled by kTarget / pressure (at most a quarter per step)
+ * to land just inside the budget. Below 0.9 * kTarget it grows by
+ * kTarget / pressure, capped at 25% per step, so that a transient quiet
+ * interval does not immediately undo a cut. The result is clamped to
+ * [min_probability, 1].
+ */
+class OverheadController {
+public:
+  static constexpr double kTarget = 0.8;
+  static constexpr double kMaxIncrease = 1.25;
+  static constexpr double kMaxDecrease = 0.25;
+
+  explicit OverheadController(const OverheadBudget &budget)
+      : _budget(budget) {}
+
+  // Returns the probability to publish after `sample`.
+  double update(const OverheadSample &sample);
+
+  double pressure(const OverheadSample &sample) const;
+  double probability() const { return _probability; }
+
+private:
+  OverheadBudget _budget;
+  double _probability = 1;
+};
+
+} // namespace Waffle::control
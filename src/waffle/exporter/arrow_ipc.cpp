@@ -0,0 +1,469 @@
+#include "waffle/exporter/arrow_ipc.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+namespace Waffle::exporter::arrow {
+
+namespace {
+
+// --- Minimal FlatBuffers encoder ---
+//
+// Arrow's metadata is FlatBuffers. Rather than depend on flatc, the few
+// tables we need are described as a tree of Fb nodes and serialized front to
+// back: every object is written before the objects it references, so all
+// uoffsets point forward as the format requires.
+
+struct Fb {
+  enum class Kind { TABLE, STRING, TABLE_VECTOR, STRUCT_VECTOR };
+  struct Scalar {
+    int id;
+    uint64_t bits;
+    uint8_t size;
+  };
+
+  Kind kind = Kind::TABLE;
+  std::vector<Scalar> scalars;    // TABLE
+  std::vector<int> child_ids;     // TABLE: field ids of child_nodes
+  std::vector<Fb> child_nodes;    // TABLE children, TABLE_VECTOR elements
+  std::vector<uint8_t> bytes;     // STRING, STRUCT_VECTOR
+  uint32_t count = 0;             // STRUCT_VECTOR elements
+
+  template <typename T> Fb &scalar(int id, T value) {
+    uint64_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(T));
+    scalars.push_back({id, bits, sizeof(T)});
+    return *this;
+  }
+  Fb &child(int id, Fb node) {
+    child_ids.push_back(id);
+    child_nodes.push_back(std::move(node));
+    return *this;
+  }
+
+  static Fb string(std::string_view s) {
+    Fb f;
+    f.kind = Kind::STRING;
+    f.bytes.assign(s.begin(), s.end());
+    return f;
+  }
+  static Fb tables(std::vector<Fb> elements) {
+    Fb f;
+    f.kind = Kind::TABLE_VECTOR;
+    f.child_nodes = std::move(elements);
+    return f;
+  }
+  // Vector of 8-byte-aligned structs.
+  static Fb structs(const void *data, size_t size, uint32_t count) {
+    Fb f;
+    f.kind = Kind::STRUCT_VECTOR;
+    f.bytes.assign(static_cast<const uint8_t *>(data),
+                   static_cast<const uint8_t *>(data) + size);
+    f.count = count;
+    return f;
+  }
+};
+
+class FbWriter {
+public:
+  std::vector<uint8_t> finish(const Fb &root) {
+    _out.assign(4, 0); // Root uoffset
+    patch(0, write(root));
+    pad_to(8, 0);
+    return std::move(_out);
+  }
+
+private:
+  void pad_to(size_t align, size_t remainder) {
+    while (_out.size() % align != remainder)
+      _out.push_back(0);
+  }
+  template <typename T> void put(T v) {
+    const size_t at = _out.size();
+    _out.resize(at + sizeof(T));
+    std::memcpy(_out.data() + at, &v, sizeof(T));
+  }
+  void patch(size_t at, size_t target) {
+    const uint32_t rel = static_cast<uint32_t>(target - at);
+    std::memcpy(_out.data() + at, &rel, sizeof(rel));
+  }
+
+  size_t write(const Fb &node) {
+    switch (node.kind) {
+    case Fb::Kind::STRING: {
+      pad_to(4, 0);
+      const size_t pos = _out.size();
+      put(static_cast<uint32_t>(node.bytes.size()));
+      _out.insert(_out.end(), node.bytes.begin(), node.bytes.end());
+      _out.push_back(0);
+      return pos;
+    }
+    case Fb::Kind::STRUCT_VECTOR: {
+      pad_to(8, 4); // Elements start 8-aligned
+      const size_t pos = _out.size();
+      put(node.count);
+      _out.insert(_out.end(), node.bytes.begin(), node.bytes.end());
+      return pos;
+    }
+    case Fb::Kind::TABLE_VECTOR: {
+      pad_to(4, 0);
+      const size_t pos = _out.size();
+      put(static_cast<uint32_t>(node.child_nodes.size()));
+      const size_t slots = _out.size();
+      _out.resize(slots + 4 * node.child_nodes.size());
+      for (size_t i = 0; i < node.child_nodes.size(); ++i)
+        patch(slots + 4 * i, write(node.child_nodes[i]));
+      return pos;
+    }
+    case Fb::Kind::TABLE:
+      return write_table(node);
+    }
+    return 0;
+  }
+
+  size_t write_table(const Fb &node) {
+    // Field layout: widest first, so that with the table start at 4 mod 8
+    // every field is naturally aligned.
+    struct Slot {
+      int id;
+      uint8_t size;
+      uint64_t bits;
+      int child; // Index into child_nodes, or -1
+    };
+    std::vector<Slot> slots;
+    int max_id = -1;
+    for (const auto &s : node.scalars) {
+      slots.push_back({s.id, s.size, s.bits, -1});
+      max_id = std::max(max_id, s.id);
+    }
+    for (size_t i = 0; i < node.child_ids.size(); ++i) {
+      slots.push_back({node.child_ids[i], 4, 0, static_cast<int>(i)});
+      max_id = std::max(max_id, node.child_ids[i]);
+    }
+    std::stable_sort(slots.begin(), slots.end(),
+                     [](const Slot &a, const Slot &b) { return a.size > b.size; });
+
+    std::vector<uint16_t> field_offsets(max_id + 1, 0);
+    uint16_t table_size = 4; // soffset to the vtable
+    for (const Slot &s : slots) {
+      field_offsets[s.id] = table_size;
+      table_size += s.size;
+    }
+
+    pad_to(2, 0);
+    const size_t vtable = _out.size();
+    put(static_cast<uint16_t>(4 + 2 * field_offsets.size()));
+    put(table_size);
+    for (uint16_t off : field_offsets)
+      put(off);
+
+    pad_to(8, 4);
+    const size_t table = _out.size();
+    put(static_cast<int32_t>(table - vtable));
+    std::vector<std::pair<size_t, int>> pending; // (field position, child)
+    for (const Slot &s : slots) {
+      if (s.child >= 0) {
+        pending.emplace_back(_out.size(), s.child);
+        put(uint32_t{0});
+      } else {
+        const size_t at = _out.size();
+        _out.resize(at + s.size);
+        std::memcpy(_out.data() + at, &s.bits, s.size);
+      }
+    }
+    for (const auto &[at, child] : pending)
+      patch(at, write(node.child_nodes[child]));
+    return table;
+  }
+
+  std::vector<uint8_t> _out;
+};
+
+// --- Arrow schema (Schema.fbs / Message.fbs) ---
+
+constexpr int16_t kMetadataV5 = 4;
+constexpr uint8_t kHeaderSchema = 1;
+constexpr uint8_t kHeaderDictionaryBatch = 2;
+constexpr uint8_t kHeaderRecordBatch = 3;
+
+constexpr uint8_t kTypeInt = 2;
+constexpr uint8_t kTypeFloatingPoint = 3;
+constexpr uint8_t kTypeUtf8 = 5;
+constexpr uint8_t kTypeBool = 6;
+constexpr uint8_t kTypeTimestamp = 10;
+constexpr uint8_t kTypeDuration = 18;
+
+constexpr int16_t kPrecisionDouble = 2;
+constexpr int16_t kTimeUnitNanosecond = 3;
+
+struct FieldNode {
+  int64_t length;
+  int64_t null_count;
+};
+struct BufferSpec {
+  int64_t offset;
+  int64_t length;
+};
+
+Fb int_type(int32_t bits, bool is_signed) {
+  Fb t;
+  t.scalar<int32_t>(0, bits).scalar<uint8_t>(1, is_signed);
+  return t;
+}
+
+Fb field(const ColumnBuilder &c) {
+  Fb f;
+  f.child(0, Fb::string(c.name())).scalar<uint8_t>(1, 1); // nullable
+  uint8_t type_id = 0;
+  Fb type;
+  switch (c.type()) {
+  case ColumnType::UINT16:
+    type_id = kTypeInt;
+    type = int_type(16, false);
+    break;
+  case ColumnType::UINT64:
+    type_id = kTypeInt;
+    type = int_type(64, false);
+    break;
+  case ColumnType::INT64:
+    type_id = kTypeInt;
+    type = int_type(64, true);
+    break;
+  case ColumnType::DOUBLE:
+    type_id = kTypeFloatingPoint;
+    type.scalar<int16_t>(0, kPrecisionDouble);
+    break;
+  case ColumnType::BOOL:
+    type_id = kTypeBool;
+    break;
+  case ColumnType::TIMESTAMP_NS:
+    type_id = kTypeTimestamp;
+    type.scalar<int16_t>(0, kTimeUnitNanosecond).child(1, Fb::string("UTC"));
+    break;
+  case ColumnType::DURATION_NS:
+    type_id = kTypeDuration;
+    type.scalar<int16_t>(0, kTimeUnitNanosecond);
+    break;
+  case ColumnType::DICTIONARY_UTF8: {
+    type_id = kTypeUtf8; // The dictionary's value type
+    Fb encoding;
+    encoding.scalar<int64_t>(0, c.dictionary_id())
+        .child(1, int_type(32, true));
+    f.child(4, std::move(encoding));
+    break;
+  }
+  }
+  f.scalar<uint8_t>(2, type_id).child(3, std::move(type));
+  f.child(5, Fb::tables({})); // children
+  return f;
+}
+
+Fb message(uint8_t header_type, Fb header, int64_t body_length) {
+  Fb m;
+  m.scalar<int16_t>(0, kMetadataV5)
+      .scalar<uint8_t>(1, header_type)
+      .child(2, std::move(header))
+      .scalar<int64_t>(3, body_length);
+  return m;
+}
+
+// Appends buffers to a message body, 8-byte aligned, recording their specs.
+class Body {
+public:
+  void add(const uint8_t *data, size_t size) {
+    _buffers.push_back({static_cast<int64_t>(_bytes.size()),
+                        static_cast<int64_t>(size)});
+    _bytes.insert(_bytes.end(), data, data + size);
+    _bytes.resize((_bytes.size() + 7) & ~size_t{7}, 0);
+  }
+  void add(const std::vector<uint8_t> &v) { add(v.data(), v.size()); }
+  void add_empty() { add(nullptr, 0); }
+
+  Fb record_batch(int64_t length, const std::vector<FieldNode> &nodes) const {
+    Fb rb;
+    rb.scalar<int64_t>(0, length)
+        .child(1, Fb::structs(nodes.data(), nodes.size() * sizeof(FieldNode),
+                              static_cast<uint32_t>(nodes.size())))
+        .child(2, Fb::structs(_buffers.data(),
+                              _buffers.size() * sizeof(BufferSpec),
+                              static_cast<uint32_t>(_buffers.size())));
+    return rb;
+  }
+  const std::vector<uint8_t> &bytes() const { return _bytes; }
+
+private:
+  std::vector<uint8_t> _bytes;
+  std::vector<BufferSpec> _buffers;
+};
+
+} // namespace
+
+// --- ColumnBuilder ---
+
+ColumnBuilder::ColumnBuilder(std::string name, ColumnType type,
+                             int64_t dictionary_id)
+    : _name(std::move(name)), _type(type), _dictionary_id(dictionary_id) {}
+
+void ColumnBuilder::set_valid(bool valid) {
+  if (_length % 8 == 0)
+    _validity.push_back(0);
+  if (valid)
+    _validity.back() |= static_cast<uint8_t>(1u << (_length % 8));
+  else
+    ++_null_count;
+}
+
+template <typename T> void ColumnBuilder::append_value(T v) {
+  set_valid(true);
+  const size_t at = _data.size();
+  _data.resize(at + sizeof(T));
+  std::memcpy(_data.data() + at, &v, sizeof(T));
+  ++_length;
+}
+
+void ColumnBuilder::append_null() {
+  set_valid(false);
+  switch (_type) {
+  case ColumnType::UINT16:
+    _data.resize(_data.size() + 2, 0);
+    break;
+  case ColumnType::BOOL:
+    if (_length % 8 == 0)
+      _data.push_back(0);
+    break;
+  case ColumnType::DICTIONARY_UTF8:
+    _data.resize(_data.size() + 4, 0);
+    break;
+  default:
+    _data.resize(_data.size() + 8, 0);
+  }
+  ++_length;
+}
+
+void ColumnBuilder::append_u16(uint16_t v) { append_value(v); }
+void ColumnBuilder::append_u64(uint64_t v) { append_value(v); }
+void ColumnBuilder::append_f64(double v) { append_value(v); }
+
+void ColumnBuilder::append_bool(bool v) {
+  set_valid(true);
+  if (_length % 8 == 0)
+    _data.push_back(0);
+  if (v)
+    _data.back() |= static_cast<uint8_t>(1u << (_length % 8));
+  ++_length;
+}
+
+void ColumnBuilder::append_string(uint64_t hash, std::string_view s) {
+  auto [it, inserted] = _dictionary_index.try_emplace(
+      hash, static_cast<int32_t>(_dictionary.size()));
+  if (inserted)
+    _dictionary.emplace_back(s);
+  append_value(it->second);
+}
+
+void ColumnBuilder::reset() {
+  _length = 0;
+  _null_count = 0;
+  _validity.clear();
+  _data.clear();
+}
+
+void ColumnBuilder::restart_dictionary() {
+  _dictionary_sent = 0;
+  _dictionary_started = false;
+}
+
+// --- StreamWriter ---
+
+void StreamWriter::write_message(const std::vector<uint8_t> &metadata,
+                                 const std::vector<uint8_t> &body) {
+  // Encapsulated message: continuation marker, metadata length (padded so
+  // the body stays 8-byte aligned), metadata, body.
+  const uint32_t header[2] = {0xFFFFFFFF,
+                              static_cast<uint32_t>(metadata.size())};
+  if (std::fwrite(header, sizeof(header), 1, _file) != 1 ||
+      std::fwrite(metadata.data(), 1, metadata.size(), _file) !=
+          metadata.size() ||
+      std::fwrite(body.data(), 1, body.size(), _file) != body.size())
+    throw std::system_error(errno, std::generic_category(),
+                            "Failed writing Arrow stream");
+  _bytes += sizeof(header) + metadata.size() + body.size();
+}
+
+void StreamWriter::write_schema(const std::vector<ColumnBuilder> &columns) {
+  std::vector<Fb> fields;
+  for (const auto &c : columns)
+    fields.push_back(field(c));
+  Fb schema;
+  schema.scalar<int16_t>(0, 0) // Little endian
+      .child(1, Fb::tables(std::move(fields)));
+  write_message(FbWriter().finish(message(kHeaderSchema, std::move(schema), 0)),
+                {});
+}
+
+void StreamWriter::write_batch(std::vector<ColumnBuilder> &columns) {
+  // Dictionaries first: the initial one for each column (even if empty),
+  // then deltas with just the new entries.
+  for (auto &c : columns) {
+    if (c.type() != ColumnType::DICTIONARY_UTF8)
+      continue;
+    const bool initial = !c._dictionary_started;
+    const size_t first = c._dictionary_sent;
+    const size_t count = c._dictionary.size() - first;
+    if (!initial && count == 0)
+      continue;
+    std::vector<int32_t> offsets{0};
+    std::vector<uint8_t> chars;
+    for (size_t i = first; i < c._dictionary.size(); ++i) {
+      chars.insert(chars.end(), c._dictionary[i].begin(),
+                   c._dictionary[i].end());
+      offsets.push_back(static_cast<int32_t>(chars.size()));
+    }
+    Body body;
+    body.add_empty(); // No nulls
+    body.add(reinterpret_cast<const uint8_t *>(offsets.data()),
+             offsets.size() * sizeof(int32_t));
+    body.add(chars);
+    Fb batch;
+    batch.scalar<int64_t>(0, c.dictionary_id())
+        .child(1, body.record_batch(static_cast<int64_t>(count),
+                                    {{static_cast<int64_t>(count), 0}}))
+        .scalar<uint8_t>(2, !initial); // isDelta
+    write_message(FbWriter().finish(message(
+                      kHeaderDictionaryBatch, std::move(batch),
+                      static_cast<int64_t>(body.bytes().size()))),
+                  body.bytes());
+    c._dictionary_sent = c._dictionary.size();
+    c._dictionary_started = true;
+  }
+
+  const int64_t length =
+      columns.empty() ? 0 : static_cast<int64_t>(columns.front().length());
+  Body body;
+  std::vector<FieldNode> nodes;
+  for (const auto &c : columns) {
+    nodes.push_back({static_cast<int64_t>(c.length()),
+                     static_cast<int64_t>(c.null_count())});
+    if (c.null_count() == 0)
+      body.add_empty();
+    else
+      body.add(c._validity);
+    body.add(c._data);
+  }
+  write_message(FbWriter().finish(message(
+                    kHeaderRecordBatch, body.record_batch(length, nodes),
+                    static_cast<int64_t>(body.bytes().size()))),
+                body.bytes());
+}
+
+void StreamWriter::finish() {
+  const uint32_t eos[2] = {0xFFFFFFFF, 0};
+  if (std::fwrite(eos, sizeof(eos), 1, _file) != 1)
+    throw std::system_error(errno, std::generic_category(),
+                            "Failed writing Arrow stream");
+  _bytes += sizeof(eos);
+}
+
+} // namespace Waffle::exporter::arrow
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace Waffle::exporter::arrow {
+
+enum class ColumnType {
+  UINT16,
+  UINT64,
+  INT64,
+  DOUBLE,
+  BOOL,
+  TIMESTAMP_NS,   // int64 ns since the epoch, UTC
+  DURATION_NS,    // int64 ns
+  DICTIONARY_UTF8 // int32 indices into a per-column string dictionary
+};
+
+/**
+ * @brief Accumulates one nullable column of the current record batch in
+ * Arrow's in-memory layout (validity bitmap + little-endian values), so a
+ * batch is written without any per-row conversion.
+ *
+ * A dictionary column keeps its dictionary across batches; only entries
+ * added since the last batch are sent (as a delta).
+ */
+class ColumnBuilder {
+public:
+  ColumnBuilder(std::string name, ColumnType type, int64_t dictionary_id = -1);
+
+  const std::string &name() const { return _name; }
+  ColumnType type() const { return _type; }
+  int64_t dictionary_id() const { return _dictionary_id; }
+  size_t length() const { return _length; }
+  size_t null_count() const { return _null_count; }
+
+  void append_null();
+  void append_u16(uint16_t v);
+  // UINT64, INT64, TIMESTAMP_NS and DURATION_NS (bit pattern).
+  void append_u64(uint64_t v);
+  void append_f64(double v);
+  void append_bool(bool v);
+  // DICTIONARY_UTF8; `hash` identifies the string.
+  void append_string(uint64_t hash, std::string_view s);
+
+  // Clears the values after a batch; keeps the dictionary.
+  void reset();
+  // Forgets which dictionary entries were sent, for a new stream.
+  void restart_dictionary();
+
+private:
+  friend class StreamWriter;
+
+  void set_valid(bool valid);
+  template <typename T> void append_value(T v);
+
+  std::string _name;
+  ColumnType _type;
+  int64_t _dictionary_id;
+  size_t _length = 0;
+  size_t _null_count = 0;
+  std::vector<uint8_t> _validity;
+  std::vector<uint8_t> _data;
+
+  std::unordered_map<uint64_t, int32_t> _dictionary_index;
+  std::vector<std::string> _dictionary;
+  size_t _dictionary_sent = 0; // Entries already in the stream
+  bool _dictionary_started = false; // Initial dictionary batch written
+};
+
+/**
+ * @brief Writes the Arrow IPC streaming format (the `.arrows` files read by
+ * `pyarrow.ipc.open_stream`, pandas and polars): a schema message, then
+ * dictionary and record batch messages, then the end-of-stream marker.
+ *
+ * @throw std::system_error If writing fails.
+ */
+class StreamWriter {
+public:
+  explicit StreamWriter(std::FILE *file) : _file(file) {}
+
+  void write_schema(const std::vector<ColumnBuilder> &columns);
+  // Sends new dictionary entries, then the batch (all columns must have the
+  // same length).
+  void write_batch(std::vector<ColumnBuilder> &columns);
+  void finish();
+
+  uint64_t bytes_written() const { return _bytes; }
+
+private:
+  void write_message(const std::vector<uint8_t> &metadata,
+                     const std::vector<uint8_t> &body);
+
+  std::FILE *_file;
+  uint64_t _bytes = 0;
+};
+
+} // namespace Waffle::exporter::arrow
@@ -0,0 +1,212 @@
+#include "waffle/exporter/arrow_span_exporter.hpp"
+#include "waffle/helpers/open_spans.hpp"
+
+#include <cerrno>
+#include <system_error>
+
+namespace Waffle::exporter {
+
+using arrow::ColumnBuilder;
+using arrow::ColumnType;
+
+namespace {
+enum FixedColumn : size_t {
+  kTraceId,
+  kSpanId,
+  kParentSpanId,
+  kCauseId,
+  kName,
+  kStart,
+  kDuration,
+  kThread,
+  kCpu,
+  kFixedColumns
+};
+
+constexpr std::string_view kUnknownString = "???";
+
+std::string_view
+lookup(const std::unordered_map<uint64_t, std::string> &strings,
+       uint64_t hash) {
+  auto it = strings.find(hash);
+  return it != strings.end() ? std::string_view(it->second) : kUnknownString;
+}
+
+ColumnType column_type(AttributeValue::Type type) {
+  switch (type) {
+  case AttributeValue::Type::BOOL:
+    return ColumnType::BOOL;
+  case AttributeValue::Type::INT64:
+    return ColumnType::INT64;
+  case AttributeValue::Type::DOUBLE:
+    return ColumnType::DOUBLE;
+  case AttributeValue::Type::STRING_ID:
+    break;
+  }
+  return ColumnType::DICTIONARY_UTF8;
+}
+} // namespace
+
+ArrowSpanExporter::ArrowSpanExporter(Options options)
+    : _options(std::move(options)) {
+  _columns.emplace_back("trace_id", ColumnType::UINT64);
+  _columns.emplace_back("span_id", ColumnType::UINT64);
+  _columns.emplace_back("parent_span_id", ColumnType::UINT64);
+  _columns.emplace_back("cause_id", ColumnType::UINT64);
+  _columns.emplace_back("name", ColumnType::DICTIONARY_UTF8, kName);
+  _columns.emplace_back("start", ColumnType::TIMESTAMP_NS);
+  _columns.emplace_back("duration", ColumnType::DURATION_NS);
+  _columns.emplace_back("thread", ColumnType::UINT16);
+  _columns.emplace_back("cpu", ColumnType::UINT16);
+}
+
+ArrowSpanExporter::~ArrowSpanExporter() {
+  try {
+    close_file();
+  } catch (...) {
+    // Destructors must not throw; shutdown() reports write errors.
+  }
+}
+
+void ArrowSpanExporter::on_record(
+    const Tracelet &record,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  if (record.record_type == Tracelet::RecordType::SPAN_START) {
+    _stats.open_spans_evicted += trim_open_spans(
+        _open_spans, _options.max_open_spans,
+        [](const Tracelet &start) { return start.timestamp; });
+    _open_spans.insert_or_assign(record.span_id.value, record);
+  } else if (record.record_type == Tracelet::RecordType::SPAN_END) {
+    auto it = _open_spans.find(record.span_id.value);
+    if (it == _open_spans.end())
+      return;
+    append_row(it->second, record.timestamp, strings);
+    _open_spans.erase(it);
+    if (_columns[kSpanId].length() >= _options.batch_rows)
+      write_batch();
+  }
+}
+
+size_t ArrowSpanExporter::attribute_column(
+    const Attribute &attribute,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  auto it = _attribute_columns.find(attribute.key_id);
+  if (it != _attribute_columns.end())
+    return it->second;
+
+  // The schema of an Arrow stream is fixed: a new key needs a new file.
+  if (_writer) {
+    write_batch();
+    close_file();
+  }
+  std::string name(lookup(strings, attribute.key_id));
+  for (const auto &c : _columns) {
+    if (c.name() == name) {
+      name = "attr." + name;
+      break;
+    }
+  }
+  const size_t index = _columns.size();
+  _columns.emplace_back(std::move(name), column_type(attribute.value.type),
+                        static_cast<int64_t>(index));
+  for (size_t row = 0; row < _columns[kSpanId].length(); ++row)
+    _columns.back().append_null();
+  _attribute_columns.emplace(attribute.key_id, index);
+  return index;
+}
+
+void ArrowSpanExporter::append_row(
+    const Tracelet &start, uint64_t end_timestamp,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  // Resolve columns first: discovering a key may roll over to a new file.
+  size_t columns[MAX_ATTRIBUTES_PER_TRACELET];
+  for (uint8_t i = 0; i < start.num_attributes; ++i)
+    columns[i] = attribute_column(start.attributes[i], strings);
+
+  _columns[kTraceId].append_u64(start.trace_id.value);
+  _columns[kSpanId].append_u64(start.span_id.value);
+  _columns[kParentSpanId].append_u64(start.parent_span_id.value);
+  _columns[kCauseId].append_u64(start.cause_id.value);
+  _columns[kName].append_string(start.name_string_hash,
+                                lookup(strings, start.name_string_hash));
+  _columns[kStart].append_u64(start.timestamp);
+  _columns[kDuration].append_u64(
+      end_timestamp >= start.timestamp ? end_timestamp - start.timestamp : 0);
+  _columns[kThread].append_u16(start.thread_index);
+  _columns[kCpu].append_u16(start.cpu_id);
+
+  _row_has_value.assign(_columns.size(), 0);
+  for (uint8_t i = 0; i < start.num_attributes; ++i) {
+    const AttributeValue &v = start.attributes[i].value;
+    ColumnBuilder &c = _columns[columns[i]];
+    if (_row_has_value[columns[i]] || c.type() != column_type(v.type))
+      continue; // Repeated key or type conflict: left null.
+    _row_has_value[columns[i]] = 1;
+    switch (v.type) {
+    case AttributeValue::Type::BOOL:
+      c.append_bool(v.b);
+      break;
+    case AttributeValue::Type::INT64:
+      c.append_u64(static_cast<uint64_t>(v.i64));
+      break;
+    case AttributeValue::Type::DOUBLE:
+      c.append_f64(v.f64);
+      break;
+    case AttributeValue::Type::STRING_ID:
+      c.append_string(v.string_id, lookup(strings, v.string_id));
+      break;
+    }
+  }
+  for (size_t i = kFixedColumns; i < _columns.size(); ++i)
+    if (!_row_has_value[i])
+      _columns[i].append_null();
+}
+
+void ArrowSpanExporter::write_batch() {
+  if (_columns[kSpanId].length() == 0)
+    return;
+  if (!_writer) {
+    char suffix[32];
+    std::snprintf(suffix, sizeof(suffix), "-%05zu.arrows", _files.size());
+    const std::string path = _options.path_prefix + suffix;
+    _file = std::fopen(path.c_str(), "wb");
+    if (!_file)
+      throw std::system_error(errno, std::generic_category(),
+                              "Cannot create " + path);
+    _files.push_back(path);
+    _writer = std::make_unique<arrow::StreamWriter>(_file);
+    for (auto &c : _columns)
+      c.restart_dictionary();
+    _writer->write_schema(_columns);
+  }
+  _writer->write_batch(_columns);
+  for (auto &c : _columns)
+    c.reset();
+  if (_writer->bytes_written() >= _options.max_file_bytes)
+    close_file();
+}
+
+void ArrowSpanExporter::close_file() {
+  if (!_writer)
+    return;
+  _writer->finish();
+  _writer.reset();
+  const bool closed = std::fclose(_file) == 0;
+  _file = nullptr;
+  if (!closed)
+    throw std::system_error(errno, std::generic_category(),
+                            "Failed closing " + _files.back());
+}
+
+void ArrowSpanExporter::flush() {
+  write_batch();
+  if (_file)
+    std::fflush(_file);
+}
+
+void ArrowSpanExporter::shutdown() {
+  write_batch();
+  close_file();
+}
+
+} // namespace Waffle::exporter
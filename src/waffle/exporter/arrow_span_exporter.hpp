@@ -0,0 +1,78 @@
+#pragma once
+
+#include "waffle/exporter/arrow_ipc.hpp"
+#include "waffle/processor/iprocessor.hpp"
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Waffle::exporter {
+
+/**
+ * @brief Processor that writes completed spans as Arrow IPC stream files
+ * (`<prefix>-00000.arrows`, ...) for pandas / polars:
+ *
+ *   pyarrow.ipc.open_stream(path).read_pandas()
+ *
+ * Columns: trace_id, span_id, parent_span_id, cause_id (uint64), name
+ * (dictionary<int32, utf8>), start (timestamp[ns, UTC]), duration
+ * (duration[ns]), thread and cpu (uint16), then one nullable column per
+ * attribute key, typed by the first value seen (int64, double, bool or
+ * dictionary-encoded string).
+ *
+ * Rows are appended straight into the Arrow column buffers as spans end.
+ * The schema is written with the first batch; an attribute key first seen
+ * after that starts a new file with a widened schema, as does a file
+ * reaching `max_file_bytes`. At most `max_open_spans` started spans wait for
+ * their end; beyond that the older half is evicted and never exported.
+ */
+class ArrowSpanExporter : public IProcessor {
+public:
+  struct Options {
+    std::string path_prefix;
+    size_t batch_rows = 64 * 1024;
+    uint64_t max_file_bytes = uint64_t{256} << 20;
+    size_t max_open_spans = 1 << 16;
+  };
+
+  struct Stats {
+    uint64_t open_spans_evicted = 0; // See Options::max_open_spans
+  };
+
+  explicit ArrowSpanExporter(Options options);
+  ~ArrowSpanExporter() override;
+
+  void on_record(const Tracelet &record,
+                 const std::unordered_map<uint64_t, std::string> &strings)
+      override;
+  void flush() override;
+  void shutdown() override;
+
+  // Files written so far, including the open one.
+  const std::vector<std::string> &files() const { return _files; }
+  const Stats &stats() const { return _stats; }
+
+private:
+  void append_row(const Tracelet &start, uint64_t end_timestamp,
+                  const std::unordered_map<uint64_t, std::string> &strings);
+  size_t attribute_column(const Attribute &attribute,
+                          const std::unordered_map<uint64_t, std::string> &strings);
+  void write_batch();
+  void close_file();
+
+  Options _options;
+  std::unordered_map<uint64_t, Tracelet> _open_spans;
+  Stats _stats;
+
+  std::vector<arrow::ColumnBuilder> _columns;
+  std::unordered_map<uint64_t, size_t> _attribute_columns; // Key -> column
+  std::vector<uint8_t> _row_has_value; // Scratch, one per column
+
+  std::FILE *_file = nullptr;
+  std::unique_ptr<arrow::StreamWriter> _writer;
+  std::vector<std::string> _files;
+};
+
+} // namespace Waffle::exporter
@@ -0,0 +1,200 @@
+#include "waffle/exporter/chrome_trace_writer.hpp"
+
+#include <cstdio>
+
+namespace Waffle::exporter {
+
+namespace {
+void write_json_string(std::ostream &out, std::string_view s) {
+  out << '"';
+  for (char c : s) {
+    switch (c) {
+    case '"':
+      out << "\\\"";
+      break;
+    case '\\':
+      out << "\\\\";
+      break;
+    case '\n':
+      out << "\\n";
+      break;
+    case '\t':
+      out << "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        char buf[8];
+        std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+        out << buf;
+      } else {
+        out << c;
+      }
+    }
+  }
+  out << '"';
+}
+
+// Trace-event timestamps are microseconds; print nanoseconds exactly as a
+// decimal instead of going through a double.
+void write_micros(std::ostream &out, uint64_t ns) {
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%llu.%03llu",
+                static_cast<unsigned long long>(ns / 1000),
+                static_cast<unsigned long long>(ns % 1000));
+  out << buf;
+}
+
+std::string lookup(const std::unordered_map<uint64_t, std::string> &strings,
+                   uint64_t hash) {
+  auto it = strings.find(hash);
+  return it != strings.end() ? it->second : std::string("???");
+}
+} // namespace
+
+ChromeTraceWriter::ChromeTraceWriter(std::ostream &out) : _out(out) {
+  _out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+}
+
+ChromeTraceWriter::~ChromeTraceWriter() { finish(); }
+
+void ChromeTraceWriter::finish() {
+  if (_finished)
+    return;
+  _finished = true;
+  _out << "\n]}\n";
+  _out.flush();
+}
+
+void ChromeTraceWriter::separator() {
+  if (!_first)
+    _out << ",\n";
+  _first = false;
+}
+
+void ChromeTraceWriter::begin_event(const char *phase, const std::string &name,
+                                    uint16_t rank, uint16_t tid,
+                                    uint64_t timestamp) {
+  separator();
+  _out << "{\"ph\":\"" << phase << "\",\"name\":";
+  write_json_string(_out, name);
+  _out << ",\"pid\":" << rank << ",\"tid\":" << tid << ",\"ts\":";
+  write_micros(_out, timestamp);
+}
+
+void ChromeTraceWriter::write_args(
+    const Tracelet &t, const std::unordered_map<uint64_t, std::string> &strings) {
+  _out << ",\"args\":{\"span_id\":" << t.span_id.value;
+  if (t.hlc != 0)
+    _out << ",\"hlc\":" << t.hlc;
+  for (auto it = t.attributes_begin(); it != t.attributes_end(); ++it) {
+    _out << ',';
+    write_json_string(_out, lookup(strings, it->key_id));
+    _out << ':';
+    switch (it->value.type) {
+    case AttributeValue::Type::BOOL:
+      _out << (it->value.b ? "true" : "false");
+      break;
+    case AttributeValue::Type::INT64:
+      _out << it->value.i64;
+      break;
+    case AttributeValue::Type::DOUBLE:
+      _out << it->value.f64;
+      break;
+    case AttributeValue::Type::STRING_ID:
+      write_json_string(_out, lookup(strings, it->value.string_id));
+      break;
+    }
+  }
+  _out << '}';
+}
+
+void ChromeTraceWriter::remember(uint64_t span_id, const SpanLocation &where) {
+  if (_started_spans.emplace(span_id, where).second) {
+    _started_order.push_back(span_id);
+    if (_started_order.size() > kRememberedSpans) {
+      _started_spans.erase(_started_order.front());
+      _started_order.pop_front();
+    }
+  }
+}
+
+void ChromeTraceWriter::write_flow(uint64_t cause_id, const SpanLocation &to) {
+  auto from = _started_spans.find(cause_id);
+  if (from == _started_spans.end())
+    return; // Cause not in this trace (or forgotten): no arrow.
+  // Trace-event JSON need not be time ordered, so the flow start can be
+  // emitted now, at the cause's start. A cause may have many effects, so
+  // every arrow gets its own flow id.
+  const uint64_t flow_id = ++_flow_ids;
+  begin_event("s", "causal", from->second.rank, from->second.thread_index,
+              from->second.timestamp);
+  _out << ",\"cat\":\"causality\",\"id\":" << flow_id << '}';
+  begin_event("f", "causal", to.rank, to.thread_index, to.timestamp);
+  _out << ",\"cat\":\"causality\",\"bp\":\"e\",\"id\":" << flow_id << '}';
+}
+
+void ChromeTraceWriter::write(
+    const trace_file::TraceRecord &record,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  const Tracelet &t = record.tracelet;
+  const uint16_t rank = record.rank;
+
+  if (_named_ranks.insert(rank).second) {
+    separator();
+    _out << "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" << rank
+         << ",\"args\":{\"name\":\"rank " << rank << "\"}}";
+  }
+  if (_threads.size() <= rank)
+    _threads.resize(rank + 1);
+  if (auto migration = _threads[rank].observe(t, strings)) {
+    begin_event("i", "cpu_migration", rank, t.thread_index, t.timestamp);
+    _out << ",\"s\":\"t\",\"args\":{\"from_cpu\":" << migration->from_cpu
+         << ",\"to_cpu\":" << migration->to_cpu << "}}";
+  }
+
+  const SpanLocation here{rank, t.thread_index, t.timestamp};
+  switch (t.record_type) {
+  case Tracelet::RecordType::THREAD_INFO: {
+    const auto *info = _threads[rank].find(t.thread_index);
+    separator();
+    _out << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << rank
+         << ",\"tid\":" << t.thread_index << ",\"args\":{\"name\":";
+    write_json_string(_out, info->name + " (" + std::to_string(info->tid) +
+                                ")");
+    _out << "}}";
+    break;
+  }
+  case Tracelet::RecordType::SPAN_START:
+    begin_event("B", lookup(strings, t.name_string_hash), rank, t.thread_index,
+                t.timestamp);
+    write_args(t, strings);
+    _out << '}';
+    _open_spans[t.span_id.value] = here;
+    remember(t.span_id.value, here);
+    if (t.cause_id != kInvalidId)
+      write_flow(t.cause_id.value, here);
+    break;
+  case Tracelet::RecordType::SPAN_END: {
+    SpanLocation start = here;
+    auto open = _open_spans.find(t.span_id.value);
+    if (open != _open_spans.end()) {
+      start = open->second;
+      _open_spans.erase(open);
+    }
+    begin_event("E", "", start.rank, start.thread_index, t.timestamp);
+    _out << '}';
+    break;
+  }
+  case Tracelet::RecordType::EVENT:
+    begin_event("i", lookup(strings, t.name_string_hash), rank,
+                t.thread_index, t.timestamp);
+    _out << ",\"s\":\"t\"";
+    write_args(t, strings);
+    _out << '}';
+    if (t.cause_id != kInvalidId)
+      write_flow(t.cause_id.value, here);
+    break;
+  }
+}
+
+} // namespace Waffle::exporter
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "waffle/model/thread_tracks.hpp"
+#include "waffle/trace_file/trace_file_format.hpp"
+#include <deque>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace Waffle::exporter {
+
+/**
+ * @brief Streams records as Chrome trace-event JSON, which Perfetto
+ * (ui.perfetto.dev) and chrome://tracing load directly.
+ *
+ * Mapping:
+ * - rank -> process (`pid`), thread index -> thread (`tid`); THREAD_INFO
+ *   records become `thread_name` metadata ("<name> (<os tid>)").
+ * - SPAN_START / SPAN_END -> `B` / `E` slices; an END is placed on the thread
+ *   its START was on.
+ * - EVENT -> thread-scoped instant event.
+ * - CausedBy -> a flow arrow from the cause's start to the caused record.
+ * - A thread changing CPU between records -> `cpu_migration` instant event.
+ *
+ * Attributes become `args`. Memory is bounded by the number of open spans
+ * plus `kRememberedSpans` recently started spans kept for flow lookups.
+ */
+class ChromeTraceWriter {
+public:
+  static constexpr size_t kRememberedSpans = 1 << 20;
+
+  explicit ChromeTraceWriter(std::ostream &out);
+  ~ChromeTraceWriter();
+
+  ChromeTraceWriter(const ChromeTraceWriter &) = delete;
+  ChromeTraceWriter &operator=(const ChromeTraceWriter &) = delete;
+
+  void write(const trace_file::TraceRecord &record,
+             const std::unordered_map<uint64_t, std::string> &strings);
+
+  // Closes the JSON document. Called by the destructor if needed.
+  void finish();
+
+private:
+  struct SpanLocation {
+    uint16_t rank;
+    uint16_t thread_index;
+    uint64_t timestamp;
+  };
+
+  void begin_event(const char *phase, const std::string &name, uint16_t rank,
+                   uint16_t tid, uint64_t timestamp);
+  void write_args(const Tracelet &t,
+                  const std::unordered_map<uint64_t, std::string> &strings);
+  void write_flow(uint64_t cause_id, const SpanLocation &to);
+  void remember(uint64_t span_id, const SpanLocation &where);
+  void separator();
+
+  std::ostream &_out;
+  bool _first = true;
+  bool _finished = false;
+  uint64_t _flow_ids = 0;
+
+  std::unordered_set<uint16_t> _named_ranks;
+  std::vector<model::ThreadTracks> _threads; // Indexed by rank
+  std::unordered_map<uint64_t, SpanLocation> _open_spans;
+  std::unordered_map<uint64_t, SpanLocation> _started_spans;
+  std::deque<uint64_t> _started_order;
+};
+
+} // namespace Waffle::exporter
@@ -0,0 +1,450 @@
+#include "waffle/exporter/ctf_writer.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <system_error>
+#include <unordered_set>
+
+namespace Waffle::exporter {
+
+namespace {
+constexpr uint32_t kPacketMagic = 0xC1FC1FC1;
+
+// Packet header and context, as declared in the metadata:
+//   uint32 magic | uint8 uuid[16] | uint32 stream_id              (24 bytes)
+//   uint64 timestamp_begin, timestamp_end, content_size, packet_size,
+//   int64 tid | uint16 rank | uint16 thread_index | pad to 8     (48 bytes)
+constexpr size_t kUuidOffset = 4;
+constexpr size_t kTimestampBeginOffset = 24;
+constexpr size_t kTimestampEndOffset = 32;
+constexpr size_t kContentSizeOffset = 40;
+constexpr size_t kPacketSizeOffset = 48;
+constexpr size_t kTidOffset = 56;
+constexpr size_t kRankOffset = 64;
+constexpr size_t kThreadIndexOffset = 66;
+constexpr size_t kPacketHeaderBytes = 72;
+
+// Event header (timestamp, id) + context (cpu_id) + padding, then the fixed
+// fields copied from the Tracelet.
+constexpr size_t kEventHeaderBytes = 16;
+constexpr size_t kFixedFieldBytes = 40;
+static_assert(offsetof(Tracelet, cause_id) + sizeof(Id) -
+                  offsetof(Tracelet, hlc) ==
+              kFixedFieldBytes);
+
+// Position in EventClass::order of the record's own name (THREAD_INFO).
+constexpr uint8_t kNameField = 0xFF;
+
+constexpr const char *kFixedFields[] = {"hlc", "trace_id", "span_id",
+                                        "parent_span_id", "cause_id"};
+
+constexpr uint64_t kThreadIdAttributeHash =
+    fnv1a_hash(kThreadIdAttribute.data(), kThreadIdAttribute.size());
+
+constexpr size_t align8(size_t n) { return (n + 7) & ~size_t{7}; }
+
+bool is_numeric(AttributeValue::Type type) {
+  return type == AttributeValue::Type::INT64 ||
+         type == AttributeValue::Type::DOUBLE;
+}
+
+std::string_view
+lookup(const std::unordered_map<uint64_t, std::string> &strings,
+       uint64_t hash) {
+  auto it = strings.find(hash);
+  std::string_view s =
+      it != strings.end() ? std::string_view(it->second) : "???";
+  return s.substr(0, s.find('\0')); // CTF strings are NUL terminated
+}
+
+// Turns an attribute key into a TSDL identifier that clashes with neither a
+// keyword nor another field of the event.
+std::string field_name(std::string_view key,
+                       std::unordered_set<std::string> &taken) {
+  static const std::unordered_set<std::string> keywords = {
+      "align",  "callsite", "const",   "char",      "clock",   "double",
+      "enum",   "env",      "event",   "floating_point",       "float",
+      "integer", "int",     "long",    "short",     "signed",  "stream",
+      "string", "struct",   "trace",   "typealias", "typedef", "unsigned",
+      "variant", "void",    "_Bool",   "_Complex",  "_Imaginary"};
+  std::string name;
+  for (char c : key)
+    name += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+  if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0])))
+    name.insert(name.begin(), '_');
+  while (keywords.count(name) || !taken.insert(name).second)
+    name += '_';
+  return name;
+}
+
+void write_tsdl_string(std::ostream &out, std::string_view s) {
+  out << '"';
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      out << '\\';
+    out << (static_cast<unsigned char>(c) < 0x20 ? ' ' : c);
+  }
+  out << '"';
+}
+} // namespace
+
+CtfWriter::CtfWriter(const std::string &directory, Options options)
+    : _directory(directory), _options(options) {
+  std::error_code error;
+  std::filesystem::create_directories(_directory, error);
+  if (error)
+    throw std::system_error(error, "Cannot create CTF trace " + _directory);
+  std::random_device random;
+  for (size_t i = 0; i < _uuid.size(); i += 4) {
+    const uint32_t r = random();
+    std::memcpy(&_uuid[i], &r, 4);
+  }
+  _uuid[6] = (_uuid[6] & 0x0F) | 0x40; // Version 4 (random)
+  _uuid[8] = (_uuid[8] & 0x3F) | 0x80;
+  write_metadata();
+}
+
+CtfWriter::~CtfWriter() {
+  if (!_finished) {
+    try {
+      finish();
+    } catch (...) {
+      // Destructors must not throw; the error was already unrecoverable.
+    }
+  }
+}
+
+const CtfWriter::EventClass &CtfWriter::event_class(
+    const Tracelet &t,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  // Records with the same type, name and attribute keys/types share a class.
+  uint64_t signature = 0xcbf29ce484222325;
+  auto mix = [&](uint64_t v) {
+    signature = (signature ^ v) * 0x100000001b3;
+    signature ^= signature >> 29;
+  };
+  mix(static_cast<uint64_t>(t.record_type));
+  const bool named = t.record_type == Tracelet::RecordType::SPAN_START ||
+                     t.record_type == Tracelet::RecordType::EVENT;
+  if (named)
+    mix(t.name_string_hash);
+  for (auto it = t.attributes_begin(); it != t.attributes_end(); ++it) {
+    mix(it->key_id);
+    mix(static_cast<uint64_t>(it->value.type));
+  }
+  auto [found, inserted] = _class_ids.try_emplace(
+      signature, static_cast<uint32_t>(_classes.size()));
+  if (!inserted)
+    return _classes[found->second];
+
+  EventClass c;
+  c.id = found->second;
+  switch (t.record_type) {
+  case Tracelet::RecordType::SPAN_START:
+    c.name = "span_start:" + std::string(lookup(strings, t.name_string_hash));
+    break;
+  case Tracelet::RecordType::EVENT:
+    c.name = "event:" + std::string(lookup(strings, t.name_string_hash));
+    break;
+  case Tracelet::RecordType::SPAN_END:
+    c.name = "span_end";
+    break;
+  case Tracelet::RecordType::THREAD_INFO:
+    c.name = "thread_info";
+    break;
+  }
+  std::unordered_set<std::string> taken(std::begin(kFixedFields),
+                                        std::end(kFixedFields));
+  // 8-byte values first, then bytes, then text: no padding inside an event.
+  for (int pass = 0; pass < 3; ++pass) {
+    if (pass == 2 && t.record_type == Tracelet::RecordType::THREAD_INFO) {
+      c.order.push_back(kNameField);
+      c.types.push_back(AttributeValue::Type::STRING_ID);
+      c.fields.push_back(field_name("name", taken));
+    }
+    for (uint8_t i = 0; i < t.num_attributes; ++i) {
+      const AttributeValue::Type type = t.attributes[i].value.type;
+      const int group = is_numeric(type)                    ? 0
+                        : type == AttributeValue::Type::BOOL ? 1
+                                                             : 2;
+      if (group != pass)
+        continue;
+      c.order.push_back(i);
+      c.types.push_back(type);
+      c.fields.push_back(
+          field_name(lookup(strings, t.attributes[i].key_id), taken));
+    }
+  }
+  _classes.push_back(std::move(c));
+  return _classes.back();
+}
+
+CtfWriter::Stream &CtfWriter::stream(uint16_t rank, uint16_t thread_index) {
+  const uint32_t key = uint32_t{rank} << 16 | thread_index;
+  if (_last_stream && _last_key == key)
+    return *_last_stream;
+  auto &slot = _streams[key];
+  if (!slot) {
+    slot = std::make_unique<Stream>();
+    const std::string path = _directory + "/stream_" + std::to_string(rank) +
+                             "_" + std::to_string(thread_index);
+    slot->file = std::fopen(path.c_str(), "wb");
+    if (!slot->file)
+      throw std::system_error(errno, std::generic_category(),
+                              "Cannot create " + path);
+    slot->packet.resize(
+        std::max(_options.packet_bytes, kPacketHeaderBytes + 256));
+    slot->used = kPacketHeaderBytes;
+    slot->rank = rank;
+    slot->thread_index = thread_index;
+  }
+  _last_key = key;
+  _last_stream = slot.get();
+  return *slot;
+}
+
+void CtfWriter::write(
+    const trace_file::TraceRecord &record,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  const Tracelet &t = record.tracelet;
+  Stream &s = stream(record.rank, t.thread_index);
+  const EventClass &c = event_class(t, strings);
+
+  std::string_view texts[MAX_ATTRIBUTES_PER_TRACELET + 1];
+  size_t num_texts = 0;
+  size_t size = kEventHeaderBytes + kFixedFieldBytes;
+  for (size_t f = 0; f < c.order.size(); ++f) {
+    if (is_numeric(c.types[f])) {
+      size += 8;
+    } else if (c.types[f] == AttributeValue::Type::BOOL) {
+      size += 1;
+    } else {
+      texts[num_texts] =
+          lookup(strings, c.order[f] == kNameField
+                              ? t.name_string_hash
+                              : t.attributes[c.order[f]].value.string_id);
+      size += texts[num_texts++].size() + 1;
+    }
+  }
+  if (t.record_type == Tracelet::RecordType::THREAD_INFO)
+    for (auto it = t.attributes_begin(); it != t.attributes_end(); ++it)
+      if (it->key_id == kThreadIdAttributeHash)
+        s.tid = it->value.i64;
+  size = align8(size);
+
+  if (s.used + size > s.packet.size()) {
+    flush_packet(s);
+    if (kPacketHeaderBytes + size > s.packet.size())
+      s.packet.resize(kPacketHeaderBytes + size);
+  }
+  uint8_t *p = s.packet.data() + s.used;
+  std::memcpy(p, &t.timestamp, 8);
+  std::memcpy(p + 8, &c.id, 4);
+  std::memcpy(p + 12, &t.cpu_id, 2);
+  p[14] = p[15] = 0;
+  std::memcpy(p + kEventHeaderBytes, &t.hlc, kFixedFieldBytes);
+  uint8_t *q = p + kEventHeaderBytes + kFixedFieldBytes;
+  size_t text = 0;
+  for (size_t f = 0; f < c.order.size(); ++f) {
+    if (is_numeric(c.types[f])) {
+      // Same bytes for f64
+      std::memcpy(q, &t.attributes[c.order[f]].value.i64, 8);
+      q += 8;
+    } else if (c.types[f] == AttributeValue::Type::BOOL) {
+      *q++ = t.attributes[c.order[f]].value.b ? 1 : 0;
+    } else {
+      std::memcpy(q, texts[text].data(), texts[text].size());
+      q += texts[text++].size();
+      *q++ = 0;
+    }
+  }
+  std::memset(q, 0, p + size - q);
+
+  if (s.events++ == 0)
+    s.first_timestamp = t.timestamp;
+  s.last_timestamp = t.timestamp;
+  s.used += size;
+}
+
+void CtfWriter::flush_packet(Stream &s) {
+  if (s.events == 0)
+    return;
+  uint8_t *p = s.packet.data();
+  const uint32_t stream_id = 0;
+  const uint64_t bits = uint64_t{s.used} * 8;
+  std::memcpy(p, &kPacketMagic, 4);
+  std::memcpy(p + kUuidOffset, _uuid.data(), _uuid.size());
+  std::memcpy(p + 20, &stream_id, 4);
+  std::memcpy(p + kTimestampBeginOffset, &s.first_timestamp, 8);
+  std::memcpy(p + kTimestampEndOffset, &s.last_timestamp, 8);
+  std::memcpy(p + kContentSizeOffset, &bits, 8);
+  std::memcpy(p + kPacketSizeOffset, &bits, 8); // No padding at packet end
+  std::memcpy(p + kTidOffset, &s.tid, 8);
+  std::memcpy(p + kRankOffset, &s.rank, 2);
+  std::memcpy(p + kThreadIndexOffset, &s.thread_index, 2);
+  std::memset(p + kThreadIndexOffset + 2, 0, kPacketHeaderBytes -
+                                                 kThreadIndexOffset - 2);
+  if (std::fwrite(p, 1, s.used, s.file) != s.used)
+    throw std::system_error(errno, std::generic_category(),
+                            "Cannot write CTF stream in " + _directory);
+  s.used = kPacketHeaderBytes;
+  s.events = 0;
+}
+
+void CtfWriter::write_metadata() {
+  char uuid[40];
+  std::snprintf(uuid, sizeof(uuid),
+                "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-"
+                "%02x%02x%02x%02x%02x%02x",
+                _uuid[0], _uuid[1], _uuid[2], _uuid[3], _uuid[4], _uuid[5],
+                _uuid[6], _uuid[7], _uuid[8], _uuid[9], _uuid[10], _uuid[11],
+                _uuid[12], _uuid[13], _uuid[14], _uuid[15]);
+
+  std::ostringstream out;
+  out << "/* CTF 1.8 */\n\n"
+         "typealias integer { size = 8; align = 8; signed = false; } "
+         ":= uint8_t;\n"
+         "typealias integer { size = 16; align = 16; signed = false; } "
+         ":= uint16_t;\n"
+         "typealias integer { size = 32; align = 32; signed = false; } "
+         ":= uint32_t;\n"
+         "typealias integer { size = 64; align = 64; signed = false; } "
+         ":= uint64_t;\n"
+         "typealias integer { size = 64; align = 64; signed = true; } "
+         ":= int64_t;\n"
+         "typealias floating_point { exp_dig = 11; mant_dig = 53; "
+         "align = 64; } := double;\n\n"
+         "trace {\n"
+         "\tmajor = 1;\n"
+         "\tminor = 8;\n"
+         "\tuuid = \""
+      << uuid
+      << "\";\n"
+         "\tbyte_order = le;\n"
+         "\tpacket.header := struct {\n"
+         "\t\tuint32_t magic;\n"
+         "\t\tuint8_t uuid[16];\n"
+         "\t\tuint32_t stream_id;\n"
+         "\t};\n"
+         "};\n\n"
+         "env {\n"
+         "\ttracer_name = \"waffle\";\n"
+         "};\n\n"
+         "clock {\n"
+         "\tname = monotonic;\n"
+         "\tdescription = \"Waffle record timestamps\";\n"
+         "\tfreq = 1000000000;\n"
+         "\toffset = 0;\n"
+         "};\n\n"
+         "typealias integer { size = 64; align = 64; signed = false; "
+         "map = clock.monotonic.value; } := uint64_clock_t;\n\n"
+         "stream {\n"
+         "\tid = 0;\n"
+         "\tevent.header := struct {\n"
+         "\t\tuint64_clock_t timestamp;\n"
+         "\t\tuint32_t id;\n"
+         "\t};\n"
+         "\tpacket.context := struct {\n"
+         "\t\tuint64_clock_t timestamp_begin;\n"
+         "\t\tuint64_clock_t timestamp_end;\n"
+         "\t\tuint64_t content_size;\n"
+         "\t\tuint64_t packet_size;\n"
+         "\t\tint64_t tid;\n"
+         "\t\tuint16_t rank;\n"
+         "\t\tuint16_t thread_index;\n"
+         "\t};\n"
+         "\tevent.context := struct {\n"
+         "\t\tuint16_t cpu_id;\n"
+         "\t};\n"
+         "};\n";
+
+  for (const EventClass &c : _classes) {
+    out << "\nevent {\n\tname = ";
+    write_tsdl_string(out, c.name);
+    out << ";\n\tid = " << c.id
+        << ";\n\tstream_id = 0;\n\tfields := struct {\n";
+    for (const char *field : kFixedFields)
+      out << "\t\tuint64_t " << field << ";\n";
+    for (size_t f = 0; f < c.order.size(); ++f) {
+      switch (c.types[f]) {
+      case AttributeValue::Type::INT64:
+        out << "\t\tint64_t ";
+        break;
+      case AttributeValue::Type::DOUBLE:
+        out << "\t\tdouble ";
+        break;
+      case AttributeValue::Type::BOOL:
+        out << "\t\tuint8_t ";
+        break;
+      case AttributeValue::Type::STRING_ID:
+        out << "\t\tstring ";
+        break;
+      }
+      out << c.fields[f] << ";\n";
+    }
+    out << "\t};\n};\n";
+  }
+
+  // Replace atomically, so readers never see a partial file.
+  const std::string path = _directory + "/metadata";
+  {
+    std::ofstream file(path + ".tmp", std::ios::binary | std::ios::trunc);
+    file << out.str();
+    if (!file.flush())
+      throw std::system_error(errno, std::generic_category(),
+                              "Cannot write " + path);
+  }
+  std::error_code error;
+  std::filesystem::rename(path + ".tmp", path, error);
+  if (error)
+    throw std::system_error(error, "Cannot write " + path);
+}
+
+void CtfWriter::flush() {
+  for (auto &[key, s] : _streams) {
+    flush_packet(*s);
+    std::fflush(s->file);
+  }
+  write_metadata();
+}
+
+void CtfWriter::finish() {
+  if (_finished)
+    return;
+  _finished = true;
+  flush();
+  int error = 0;
+  for (auto &[key, s] : _streams)
+    if (std::fclose(s->file) != 0)
+      error = errno;
+  _streams.clear();
+  _last_stream = nullptr;
+  if (error)
+    throw std::system_error(error, std::generic_category(),
+                            "Cannot close CTF streams in " + _directory);
+}
+
+CtfExporter::CtfExporter(Options options) : _options(std::move(options)) {}
+
+void CtfExporter::on_start(const ProcessorContext &) {
+  _writer = std::make_unique<CtfWriter>(_options.directory, _options.writer);
+}
+
+void CtfExporter::on_record(
+    const Tracelet &record,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  _writer->write({record, 0}, strings);
+}
+
+void CtfExporter::flush() { _writer->flush(); }
+
+void CtfExporter::shutdown() { _writer->finish(); }
+
+} // namespace Waffle::exporter
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "waffle/processor/iprocessor.hpp"
+#include "waffle/trace_file/trace_file_format.hpp"
+#include <array>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Waffle::exporter {
+
+/**
+ * @brief Writes a Common Trace Format (CTF 1.8) trace directory, readable by
+ * Babeltrace and Trace Compass.
+ *
+ * Layout:
+ * - `metadata`: TSDL text describing the trace, the nanosecond clock and one
+ *   event class per (record type, name, attribute keys/types) seen so far.
+ *   It is rewritten on every flush(), so a trace being written stays
+ *   readable up to its last flushed packet.
+ * - `stream_<rank>_<thread index>`: one binary stream per recording thread,
+ *   made of packets of about `packet_bytes`. The packet context carries the
+ *   rank, thread index and OS tid.
+ *
+ * Events are laid out so that a record is mostly copied, not converted:
+ *
+ *   header   uint64 timestamp | uint32 class id     (Tracelet::timestamp)
+ *   context  uint16 cpu_id                          (Tracelet::cpu_id)
+ *   fields   uint64 hlc, trace_id, span_id, parent_span_id, cause_id
+ *            (one 40-byte copy of the same Tracelet fields)
+ *            int64/double attribute values (8-byte copies), then bool
+ *            attributes as uint8, then string attributes as text
+ *
+ * All fields are naturally aligned and every event is padded to 8 bytes.
+ * SPAN_START / EVENT classes are named "span_start:<name>" /
+ * "event:<name>"; SPAN_END records share "span_end", matched by span_id.
+ * Attribute keys become field names, with characters that are not valid in
+ * TSDL identifiers replaced by '_'.
+ */
+class CtfWriter {
+public:
+  static constexpr size_t kDefaultPacketBytes = 64 << 10;
+
+  struct Options {
+    size_t packet_bytes = kDefaultPacketBytes; // Per thread stream
+  };
+
+  // Creates `directory` if needed. @throw std::system_error On I/O errors.
+  CtfWriter(const std::string &directory, Options options);
+  explicit CtfWriter(const std::string &directory)
+      : CtfWriter(directory, Options{}) {}
+  ~CtfWriter();
+
+  CtfWriter(const CtfWriter &) = delete;
+  CtfWriter &operator=(const CtfWriter &) = delete;
+
+  void write(const trace_file::TraceRecord &record,
+             const std::unordered_map<uint64_t, std::string> &strings);
+
+  // Closes the current packet of every stream and rewrites the metadata.
+  void flush();
+  // Flushes and closes all files. Called by the destructor if needed.
+  void finish();
+
+  size_t event_class_count() const { return _classes.size(); }
+
+private:
+  struct EventClass {
+    uint32_t id;
+    std::string name;
+    // Attribute indices in field order (THREAD_INFO adds its own name as a
+    // text field), with their field names and types.
+    std::vector<uint8_t> order;
+    std::vector<std::string> fields;
+    std::vector<AttributeValue::Type> types;
+  };
+  struct Stream {
+    std::FILE *file = nullptr;
+    std::vector<uint8_t> packet;
+    size_t used = 0;
+    uint64_t events = 0;
+    uint64_t first_timestamp = 0;
+    uint64_t last_timestamp = 0;
+    int64_t tid = 0;
+    uint16_t rank = 0;
+    uint16_t thread_index = 0;
+  };
+
+  const EventClass &
+  event_class(const Tracelet &t,
+              const std::unordered_map<uint64_t, std::string> &strings);
+  Stream &stream(uint16_t rank, uint16_t thread_index);
+  void flush_packet(Stream &s);
+  void write_metadata();
+
+  std::string _directory;
+  Options _options;
+  bool _finished = false;
+  std::array<uint8_t, 16> _uuid;
+
+  std::vector<EventClass> _classes;
+  std::unordered_map<uint64_t, uint32_t> _class_ids; // By signature
+  std::unordered_map<uint32_t, std::unique_ptr<Stream>> _streams;
+  Stream *_last_stream = nullptr;
+  uint32_t _last_key = 0;
+};
+
+/**
+ * @brief Processor that writes this process's records as a CTF trace.
+ */
+class CtfExporter : public IProcessor {
+public:
+  struct Options {
+    std::string directory;
+    CtfWriter::Options writer;
+  };
+
+  explicit CtfExporter(Options options);
+
+  void on_start(const ProcessorContext &context) override;
+  void on_record(const Tracelet &record,
+                 const std::unordered_map<uint64_t, std::string> &strings)
+      override;
+  void flush() override;
+  void shutdown() override;
+
+private:
+  Options _options;
+  std::unique_ptr<CtfWriter> _writer;
+};
+
+} // namespace Waffle::exporter
@@ -0,0 +1,485 @@
+#include "waffle/exporter/fxt_writer.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <unistd.h>
+
+namespace Waffle::exporter {
+
+namespace {
+// Record types
+constexpr uint64_t kMetadataRecord = 0;
+constexpr uint64_t kInitializationRecord = 1;
+constexpr uint64_t kStringRecord = 2;
+constexpr uint64_t kThreadRecord = 3;
+constexpr uint64_t kEventRecord = 4;
+constexpr uint64_t kKernelObjectRecord = 7;
+
+// Metadata types
+constexpr uint64_t kProviderInfo = 1;
+constexpr uint64_t kProviderSection = 2;
+
+// Event types
+constexpr unsigned kInstant = 0;
+constexpr unsigned kCounter = 1;
+constexpr unsigned kDurationBegin = 2;
+constexpr unsigned kDurationEnd = 3;
+constexpr unsigned kDurationComplete = 4;
+constexpr unsigned kFlowBegin = 8;
+constexpr unsigned kFlowEnd = 10;
+
+// Argument types
+constexpr uint64_t kInt64Arg = 3;
+constexpr uint64_t kUint64Arg = 4;
+constexpr uint64_t kDoubleArg = 5;
+constexpr uint64_t kStringArg = 6;
+constexpr uint64_t kKoidArg = 8;
+constexpr uint64_t kBoolArg = 9;
+
+// Kernel object types
+constexpr uint64_t kProcessObject = 1;
+constexpr uint64_t kThreadObject = 2;
+
+// The magic number record, in its canonical little-endian word form.
+constexpr uint64_t kMagicRecord = 0x0016547846040010;
+constexpr uint16_t kMaxStringRef = 0x7FFF;
+constexpr size_t kMaxStringLength = 0x7FFF;
+constexpr uint8_t kMaxThreadRef = 0xFF;
+// Thread index 0 is never used, so neither is key 0.
+constexpr uint32_t kNoThread = 0;
+constexpr uint32_t kProviderId = 1;
+// Threads whose THREAD_INFO was not seen still need a distinct koid.
+constexpr uint64_t kSyntheticThreadKoid = uint64_t{1} << 40;
+
+constexpr std::string_view kProviderName = "waffle";
+constexpr std::string_view kCategory = "waffle";
+const uint64_t kCategoryHash = fnv1a_hash(kCategory.data(), kCategory.size());
+
+uint64_t header(uint64_t type, size_t words) {
+  return type | static_cast<uint64_t>(words) << 4;
+}
+
+uint64_t arg_header(uint64_t type, size_t words, uint16_t name) {
+  return header(type, words) | uint64_t{name} << 16;
+}
+
+uint64_t hash_of(std::string_view s) { return fnv1a_hash(s.data(), s.size()); }
+
+// Copies `s` into `words` whole words, zero padded.
+void copy_padded(uint64_t *out, std::string_view s) {
+  const size_t words = (s.size() + 7) / 8;
+  if (words)
+    out[words - 1] = 0;
+  std::memcpy(out, s.data(), s.size());
+}
+
+std::string_view
+lookup(const std::unordered_map<uint64_t, std::string> &strings,
+       uint64_t hash) {
+  auto it = strings.find(hash);
+  return it != strings.end() ? std::string_view(it->second) : "???";
+}
+} // namespace
+
+WordSink::WordSink(std::FILE *file, size_t buffer_bytes)
+    : _file(file), _buffer(std::max<size_t>(buffer_bytes / 8, 512)) {}
+
+void WordSink::flush() {
+  if (_used == 0)
+    return;
+  if (std::fwrite(_buffer.data(), 8, _used, _file) != _used)
+    throw std::system_error(errno, std::generic_category(),
+                            "Cannot write FXT file");
+  _flushed += _used * 8;
+  _used = 0;
+}
+
+void WordSink::drain(size_t need) {
+  flush();
+  if (need > _buffer.size())
+    _buffer.resize(need);
+}
+
+FxtWriter::FxtWriter(const std::string &path, Options options)
+    : _options(options), _string_slots(kMaxStringRef + 1),
+      _string_cache(kStringCacheSize), _thread_slots(kMaxThreadRef + 1),
+      _thread_cache(kThreadCacheSize),
+      _started_spans(kRememberedSpans) {
+  _file = std::fopen(path.c_str(), "wb");
+  if (!_file)
+    throw std::system_error(errno, std::generic_category(),
+                            "Cannot create FXT file " + path);
+  _sink = std::make_unique<WordSink>(_file, _options.buffer_bytes);
+
+  *_sink->reserve(1) = kMagicRecord;
+  const size_t name_words = (kProviderName.size() + 7) / 8;
+  uint64_t *info = _sink->reserve(1 + name_words);
+  info[0] = header(kMetadataRecord, 1 + name_words) | kProviderInfo << 16 |
+            uint64_t{kProviderId} << 20 |
+            static_cast<uint64_t>(kProviderName.size()) << 52;
+  copy_padded(info + 1, kProviderName);
+  *_sink->reserve(1) = header(kMetadataRecord, 1) | kProviderSection << 16 |
+                       uint64_t{kProviderId} << 20;
+  // Waffle timestamps are nanoseconds.
+  uint64_t *init = _sink->reserve(2);
+  init[0] = header(kInitializationRecord, 2);
+  init[1] = 1000000000;
+}
+
+FxtWriter::~FxtWriter() {
+  if (_file) {
+    try {
+      finish();
+    } catch (...) {
+      // Destructors must not throw; the error was already unrecoverable.
+    }
+  }
+}
+
+uint16_t FxtWriter::string_ref(uint64_t hash, std::string_view str) {
+  if (str.empty())
+    return 0; // The empty string is always ref 0
+  CachedRef &cached = _string_cache[hash % kStringCacheSize];
+  if (cached.ref != 0 && cached.hash == hash &&
+      _string_slots[cached.ref] == hash)
+    return cached.ref;
+  auto it = _string_refs.find(hash);
+  if (it != _string_refs.end()) {
+    cached = {hash, it->second};
+    return it->second;
+  }
+
+  // Recycle slots round-robin: a ref is only ever used right after it is
+  // assigned, so the 32K most recent strings are always valid.
+  const uint16_t ref = _next_string;
+  _next_string = ref == kMaxStringRef ? 1 : ref + 1;
+  auto old = _string_refs.find(_string_slots[ref]);
+  if (old != _string_refs.end() && old->second == ref)
+    _string_refs.erase(old);
+  _string_slots[ref] = hash;
+  _string_refs.emplace(hash, ref);
+  cached = {hash, ref};
+
+  str = str.substr(0, kMaxStringLength);
+  const size_t words = 1 + (str.size() + 7) / 8;
+  uint64_t *out = _sink->reserve(words);
+  out[0] = header(kStringRecord, words) | uint64_t{ref} << 16 |
+           static_cast<uint64_t>(str.size()) << 32;
+  copy_padded(out + 1, str);
+  return ref;
+}
+
+uint16_t FxtWriter::string_ref(
+    uint64_t hash, const std::unordered_map<uint64_t, std::string> &strings) {
+  const CachedRef &cached = _string_cache[hash % kStringCacheSize];
+  if (cached.ref != 0 && cached.hash == hash &&
+      _string_slots[cached.ref] == hash)
+    return cached.ref;
+  return string_ref(hash, lookup(strings, hash));
+}
+
+uint64_t FxtWriter::process_koid(uint16_t rank) const {
+  return _options.process_koid ? _options.process_koid : rank;
+}
+
+uint64_t FxtWriter::thread_koid(uint16_t rank, uint16_t thread_index) const {
+  if (rank < _threads.size())
+    if (const auto *info = _threads[rank].find(thread_index); info && info->tid)
+      return static_cast<uint64_t>(info->tid);
+  return kSyntheticThreadKoid | uint64_t{rank} << 16 | thread_index;
+}
+
+uint8_t FxtWriter::thread_ref(uint16_t rank, uint16_t thread_index) {
+  const uint32_t key = uint32_t{rank} << 16 | thread_index;
+  // Consecutive records mostly come from the same few threads.
+  uint8_t &cached = _thread_cache[(key ^ key >> 16) % kThreadCacheSize];
+  if (cached != 0 && _thread_slots[cached] == key)
+    return cached;
+  auto it = _thread_refs.find(key);
+  if (it != _thread_refs.end())
+    return cached = it->second;
+
+  const uint8_t ref = _next_thread;
+  _next_thread = ref == kMaxThreadRef ? 1 : ref + 1;
+  auto old = _thread_refs.find(_thread_slots[ref]);
+  if (old != _thread_refs.end() && old->second == ref)
+    _thread_refs.erase(old);
+  _thread_slots[ref] = key;
+  _thread_refs.emplace(key, ref);
+  cached = ref;
+
+  uint64_t *out = _sink->reserve(3);
+  out[0] = header(kThreadRecord, 3) | uint64_t{ref} << 16;
+  out[1] = process_koid(rank);
+  out[2] = thread_koid(rank, thread_index);
+  return ref;
+}
+
+void FxtWriter::name_process(uint16_t rank) {
+  const std::string name = "rank " + std::to_string(rank);
+  const uint16_t ref = string_ref(hash_of(name), name);
+  uint64_t *out = _sink->reserve(2);
+  out[0] = header(kKernelObjectRecord, 2) | kProcessObject << 16 |
+           uint64_t{ref} << 24;
+  out[1] = process_koid(rank);
+}
+
+void FxtWriter::name_thread(uint16_t rank, const model::ThreadInfo &info) {
+  static const uint64_t process_hash = hash_of("process");
+  const uint16_t ref = string_ref(hash_of(info.name), info.name);
+  const uint16_t process = string_ref(process_hash, "process");
+  uint64_t *out = _sink->reserve(4);
+  out[0] = header(kKernelObjectRecord, 4) | kThreadObject << 16 |
+           uint64_t{ref} << 24 | uint64_t{1} << 40;
+  out[1] = thread_koid(rank, info.index);
+  out[2] = arg_header(kKoidArg, 2, process);
+  out[3] = process_koid(rank);
+}
+
+void FxtWriter::write_event(
+    unsigned type, uint8_t thread, uint16_t name, uint64_t timestamp,
+    const Tracelet *args,
+    const std::unordered_map<uint64_t, std::string> &strings,
+    const uint64_t *trailer) {
+  // Resolve every string ref first: doing so may emit string records, which
+  // must precede the event that uses them.
+  uint64_t arg_words[2 * (MAX_ATTRIBUTES_PER_TRACELET + 2)];
+  size_t num_words = 0;
+  unsigned num_args = 0;
+  auto add = [&](uint64_t type, uint16_t key, uint64_t inline_bits,
+                 const uint64_t *value) {
+    arg_words[num_words++] =
+        arg_header(type, value ? 2 : 1, key) | inline_bits << 32;
+    if (value)
+      arg_words[num_words++] = *value;
+    ++num_args;
+  };
+  if (args) {
+    static const uint64_t span_id_hash = hash_of("span_id");
+    static const uint64_t hlc_hash = hash_of("hlc");
+    add(kUint64Arg, string_ref(span_id_hash, "span_id"), 0,
+        &args->span_id.value);
+    if (args->hlc != 0)
+      add(kUint64Arg, string_ref(hlc_hash, "hlc"), 0, &args->hlc);
+    for (auto it = args->attributes_begin(); it != args->attributes_end();
+         ++it) {
+      const uint16_t key = string_ref(it->key_id, strings);
+      switch (it->value.type) {
+      case AttributeValue::Type::BOOL:
+        add(kBoolArg, key, it->value.b ? 1 : 0, nullptr);
+        break;
+      case AttributeValue::Type::INT64: {
+        const uint64_t v = static_cast<uint64_t>(it->value.i64);
+        add(kInt64Arg, key, 0, &v);
+        break;
+      }
+      case AttributeValue::Type::DOUBLE: {
+        uint64_t v;
+        std::memcpy(&v, &it->value.f64, sizeof(v));
+        add(kDoubleArg, key, 0, &v);
+        break;
+      }
+      case AttributeValue::Type::STRING_ID:
+        add(kStringArg, key, string_ref(it->value.string_id, strings),
+            nullptr);
+        break;
+      }
+    }
+  }
+
+  const uint16_t category = string_ref(kCategoryHash, kCategory);
+  const size_t words = 2 + num_words + (trailer ? 1 : 0);
+  uint64_t *out = _sink->reserve(words);
+  out[0] = header(kEventRecord, words) | uint64_t{type} << 16 |
+           uint64_t{num_args} << 20 | uint64_t{thread} << 24 |
+           uint64_t{category} << 32 | uint64_t{name} << 48;
+  out[1] = timestamp;
+  std::memcpy(out + 2, arg_words, num_words * sizeof(uint64_t));
+  if (trailer)
+    out[2 + num_words] = *trailer;
+}
+
+void FxtWriter::counter(uint16_t rank, uint16_t thread_index,
+                        uint64_t timestamp, std::string_view name,
+                        int64_t value) {
+  static const uint64_t value_hash = hash_of("value");
+  const uint16_t name_ref = string_ref(hash_of(name), name);
+  const uint16_t value_ref = string_ref(value_hash, "value");
+  const uint16_t category = string_ref(kCategoryHash, kCategory);
+  const uint8_t thread = thread_ref(rank, thread_index);
+  // Counter ids are scoped to the process; one series per thread.
+  const uint64_t counter_id = uint64_t{thread_index};
+  uint64_t *out = _sink->reserve(5);
+  out[0] = header(kEventRecord, 5) | uint64_t{kCounter} << 16 |
+           uint64_t{1} << 20 | uint64_t{thread} << 24 |
+           uint64_t{category} << 32 | uint64_t{name_ref} << 48;
+  out[1] = timestamp;
+  out[2] = arg_header(kInt64Arg, 2, value_ref);
+  out[3] = static_cast<uint64_t>(value);
+  out[4] = counter_id;
+}
+
+FxtWriter::RememberedSpan &FxtWriter::remembered(uint64_t span_id) {
+  // Fibonacci hashing spreads ids of different ranks (distinct process tags
+  // in the high bits) that share their low bits.
+  return _started_spans[(span_id * 0x9E3779B97F4A7C15ull) >>
+                        (64 - std::countr_zero(kRememberedSpans))];
+}
+
+void FxtWriter::remember(uint64_t span_id, const SpanLocation &where) {
+  remembered(span_id) = {span_id, where};
+}
+
+void FxtWriter::write_flow(uint64_t cause_id, const SpanLocation &to) {
+  const RememberedSpan &from = remembered(cause_id);
+  if (from.span_id != cause_id)
+    return; // Cause not in this trace (or forgotten): no arrow.
+  // Flow events bind to the slice enclosing them on their thread, so they
+  // sit at the start of the cause and of the effect. Readers sort by time,
+  // which lets the flow begin be written long after the cause started.
+  static const uint64_t causal_hash = hash_of("causal");
+  const uint16_t name = string_ref(causal_hash, "causal");
+  const uint64_t flow_id = ++_flow_ids;
+  write_event(kFlowBegin, thread_ref(from.where.rank, from.where.thread_index),
+              name, from.where.timestamp, nullptr, *_strings, &flow_id);
+  write_event(kFlowEnd, thread_ref(to.rank, to.thread_index), name,
+              to.timestamp, nullptr, *_strings, &flow_id);
+}
+
+void FxtWriter::write(
+    const trace_file::TraceRecord &record,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  const Tracelet &t = record.tracelet;
+  const uint16_t rank = record.rank;
+  _strings = &strings;
+
+  if (_named_ranks.size() <= rank)
+    _named_ranks.resize(rank + 1);
+  if (!_named_ranks[rank]) {
+    _named_ranks[rank] = true;
+    if (_options.process_koid == 0)
+      name_process(rank);
+  }
+  if (_threads.size() <= rank)
+    _threads.resize(rank + 1);
+  if (auto migration = _threads[rank].observe(t, strings))
+    counter(rank, t.thread_index, t.timestamp, "cpu", migration->to_cpu);
+
+  const SpanLocation here{rank, t.thread_index, t.timestamp};
+  switch (t.record_type) {
+  case Tracelet::RecordType::THREAD_INFO: {
+    // The thread's koid is its OS tid from now on: re-announce the ref.
+    auto ref = _thread_refs.find(uint32_t{rank} << 16 | t.thread_index);
+    if (ref != _thread_refs.end()) {
+      _thread_slots[ref->second] = kNoThread;
+      _thread_refs.erase(ref);
+    }
+    name_thread(rank, *_threads[rank].find(t.thread_index));
+    break;
+  }
+  case Tracelet::RecordType::SPAN_START: {
+    auto [open, inserted] = _open_spans.try_emplace(t.span_id.value, 0);
+    if (inserted) {
+      if (_free_slots.empty()) {
+        open->second = static_cast<uint32_t>(_open_slab.size());
+        _open_slab.emplace_back();
+      } else {
+        open->second = _free_slots.back();
+        _free_slots.pop_back();
+      }
+    }
+    OpenSpan &span = _open_slab[open->second];
+    span.start = t;
+    span.rank = rank;
+    if (!_options.complete_events)
+      write_event(kDurationBegin, thread_ref(rank, t.thread_index),
+                  string_ref(t.name_string_hash, strings), t.timestamp, &t,
+                  strings, nullptr);
+    remember(t.span_id.value, here);
+    if (t.cause_id != kInvalidId)
+      write_flow(t.cause_id.value, here);
+    break;
+  }
+  case Tracelet::RecordType::SPAN_END: {
+    auto open = _open_spans.find(t.span_id.value);
+    if (open == _open_spans.end()) {
+      // Start not in this trace: only a begin/end stream can close it.
+      if (!_options.complete_events)
+        write_event(kDurationEnd, thread_ref(rank, t.thread_index), 0,
+                    t.timestamp, nullptr, strings, nullptr);
+      break;
+    }
+    const OpenSpan &span = _open_slab[open->second];
+    const Tracelet &start = span.start;
+    const uint8_t thread = thread_ref(span.rank, start.thread_index);
+    const uint16_t name = string_ref(start.name_string_hash, strings);
+    if (_options.complete_events)
+      write_event(kDurationComplete, thread, name, start.timestamp, &start,
+                  strings, &t.timestamp);
+    else
+      write_event(kDurationEnd, thread, name, t.timestamp, nullptr, strings,
+                  nullptr);
+    _free_slots.push_back(open->second);
+    _open_spans.erase(open);
+    break;
+  }
+  case Tracelet::RecordType::EVENT:
+    write_event(kInstant, thread_ref(rank, t.thread_index),
+                string_ref(t.name_string_hash, strings), t.timestamp, &t,
+                strings, nullptr);
+    if (t.cause_id != kInvalidId)
+      write_flow(t.cause_id.value, here);
+    break;
+  }
+}
+
+void FxtWriter::flush() {
+  _sink->flush();
+  std::fflush(_file);
+}
+
+void FxtWriter::finish() {
+  if (!_file)
+    return;
+  if (_options.complete_events) {
+    // Spans still running keep their start; readers show them unterminated.
+    for (const auto &[id, slot] : _open_spans) {
+      const OpenSpan &open = _open_slab[slot];
+      write_event(kDurationBegin,
+                  thread_ref(open.rank, open.start.thread_index),
+                  string_ref(open.start.name_string_hash, *_strings),
+                  open.start.timestamp, &open.start, *_strings, nullptr);
+    }
+  }
+  _open_spans.clear();
+  _sink->flush();
+  std::FILE *file = _file;
+  _file = nullptr;
+  if (std::fclose(file) != 0)
+    throw std::system_error(errno, std::generic_category(),
+                            "Cannot close FXT file");
+}
+
+FxtExporter::FxtExporter(Options options) : _options(std::move(options)) {}
+
+void FxtExporter::on_start(const ProcessorContext &) {
+  FxtWriter::Options writer = _options.writer;
+  if (writer.process_koid == 0)
+    writer.process_koid = static_cast<uint64_t>(::getpid());
+  _writer = std::make_unique<FxtWriter>(_options.path, writer);
+}
+
+void FxtExporter::on_record(
+    const Tracelet &record,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  _writer->write({record, 0}, strings);
+}
+
+void FxtExporter::flush() { _writer->flush(); }
+
+void FxtExporter::shutdown() { _writer->finish(); }
+
+} // namespace Waffle::exporter
@@ -0,0 +1,194 @@
+#pragma once
+
+#include "waffle/model/thread_tracks.hpp"
+#include "waffle/processor/iprocessor.hpp"
+#include "waffle/trace_file/trace_file_format.hpp"
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace Waffle::exporter {
+
+/**
+ * @brief Append-only buffer of 64-bit words in front of a FILE, flushed in
+ * large writes. Records are built in place: reserve() hands out the words
+ * of a record, so encoding is a few stores per field.
+ *
+ * @throw std::system_error If a write fails.
+ */
+class WordSink {
+public:
+  static constexpr size_t kDefaultBufferBytes = 4 << 20;
+
+  WordSink(std::FILE *file, size_t buffer_bytes = kDefaultBufferBytes);
+
+  uint64_t *reserve(size_t words) {
+    if (_used + words > _buffer.size())
+      drain(words);
+    uint64_t *out = _buffer.data() + _used;
+    _used += words;
+    return out;
+  }
+  void flush();
+  uint64_t bytes_written() const { return _flushed + _used * 8; }
+
+private:
+  void drain(size_t need);
+
+  std::FILE *_file;
+  std::vector<uint64_t> _buffer;
+  size_t _used = 0;
+  uint64_t _flushed = 0;
+};
+
+/**
+ * @brief Writes Fuchsia Trace Format (FXT), the compact word-aligned binary
+ * format that Perfetto (ui.perfetto.dev) loads directly.
+ *
+ * Mapping:
+ * - Interned name / attribute hashes -> FXT string refs (15-bit table,
+ *   recycled round-robin with the string re-sent when a slot is reused).
+ * - (rank, thread index) -> FXT thread refs (8-bit table, recycled the same
+ *   way). Threads take their OS tid as koid once THREAD_INFO is seen, and
+ *   are named by kernel object records.
+ * - rank -> process koid (or Options::process_koid).
+ * - Spans -> duration complete events (one record, written when the span
+ *   ends), or begin/end pairs when `complete_events` is off.
+ * - EVENT -> instant event; attributes -> arguments.
+ * - CausedBy -> flow begin on the cause's thread and flow end on the
+ *   effect's, bound to the enclosing slices.
+ * - A thread changing CPU -> a sample of that thread's "cpu" counter;
+ *   counter() writes any other counter sample.
+ *
+ * Records are encoded in place into a WordSink, and the per-record lookups
+ * (string refs, open spans, flow causes) avoid allocation on the hot path.
+ * Memory is bounded by the open spans plus a direct-mapped table of
+ * `kRememberedSpans` recently started spans for flow lookups; a cause pushed
+ * out of that table by a colliding span loses its arrow.
+ */
+class FxtWriter {
+public:
+  static constexpr size_t kRememberedSpans = 1 << 16;
+
+  struct Options {
+    bool complete_events = true;
+    uint64_t process_koid = 0; // 0: use the record's rank
+    size_t buffer_bytes = WordSink::kDefaultBufferBytes;
+  };
+
+  // @throw std::system_error If the file cannot be created.
+  FxtWriter(const std::string &path, Options options);
+  FxtWriter(const std::string &path) : FxtWriter(path, Options{}) {}
+  ~FxtWriter();
+
+  FxtWriter(const FxtWriter &) = delete;
+  FxtWriter &operator=(const FxtWriter &) = delete;
+
+  void write(const trace_file::TraceRecord &record,
+             const std::unordered_map<uint64_t, std::string> &strings);
+  void counter(uint16_t rank, uint16_t thread_index, uint64_t timestamp,
+               std::string_view name, int64_t value);
+
+  void flush();
+  // Writes still-open spans as unterminated begin events, then flushes and
+  // closes the file. Called by the destructor if needed.
+  void finish();
+
+  uint64_t bytes_written() const { return _sink->bytes_written(); }
+
+private:
+  struct OpenSpan {
+    Tracelet start;
+    uint16_t rank;
+  };
+  struct SpanLocation {
+    uint16_t rank;
+    uint16_t thread_index;
+    uint64_t timestamp;
+  };
+  struct RememberedSpan {
+    uint64_t span_id = kInvalidId.value;
+    SpanLocation where;
+  };
+  struct CachedRef {
+    uint64_t hash;
+    uint16_t ref = 0;
+  };
+  static constexpr size_t kStringCacheSize = 4096;
+  static constexpr size_t kThreadCacheSize = 64;
+
+  uint16_t string_ref(uint64_t hash, std::string_view str);
+  uint16_t string_ref(uint64_t hash,
+                      const std::unordered_map<uint64_t, std::string> &strings);
+  uint8_t thread_ref(uint16_t rank, uint16_t thread_index);
+  uint64_t process_koid(uint16_t rank) const;
+  uint64_t thread_koid(uint16_t rank, uint16_t thread_index) const;
+
+  void write_event(unsigned type, uint8_t thread, uint16_t name,
+                   uint64_t timestamp, const Tracelet *args,
+                   const std::unordered_map<uint64_t, std::string> &strings,
+                   const uint64_t *trailer);
+  void write_flow(uint64_t cause_id, const SpanLocation &to);
+  void name_process(uint16_t rank);
+  void name_thread(uint16_t rank, const model::ThreadInfo &info);
+  void remember(uint64_t span_id, const SpanLocation &where);
+  RememberedSpan &remembered(uint64_t span_id);
+
+  Options _options;
+  std::FILE *_file = nullptr;
+  std::unique_ptr<WordSink> _sink;
+  // The caller's string table, which outlives the writer's use of it.
+  const std::unordered_map<uint64_t, std::string> *_strings = &kNoStrings;
+  static inline const std::unordered_map<uint64_t, std::string> kNoStrings;
+
+  // String table: hash -> ref, and ref -> hash for recycling.
+  std::unordered_map<uint64_t, uint16_t> _string_refs;
+  std::vector<uint64_t> _string_slots;
+  std::vector<CachedRef> _string_cache; // Direct-mapped, checked by slot
+  uint16_t _next_string = 1;
+
+  // Thread table keyed by rank << 16 | thread index.
+  std::unordered_map<uint32_t, uint8_t> _thread_refs;
+  std::vector<uint32_t> _thread_slots;
+  std::vector<uint8_t> _thread_cache; // Direct-mapped, checked by slot
+  uint8_t _next_thread = 1;
+
+  std::vector<bool> _named_ranks;
+  std::vector<model::ThreadTracks> _threads; // Indexed by rank
+  // Open spans live in a slab reused through a free list, so a span costs an
+  // index entry instead of a node holding a whole (over-aligned) Tracelet.
+  std::vector<OpenSpan> _open_slab;
+  std::vector<uint32_t> _free_slots;
+  std::unordered_map<uint64_t, uint32_t> _open_spans; // Span id -> slab slot
+  std::vector<RememberedSpan> _started_spans; // Direct-mapped by span id
+  uint64_t _flow_ids = 0;
+};
+
+/**
+ * @brief Processor that writes this process's records as an FXT file.
+ */
+class FxtExporter : public IProcessor {
+public:
+  struct Options {
+    std::string path;
+    FxtWriter::Options writer;
+  };
+
+  explicit FxtExporter(Options options);
+
+  void on_start(const ProcessorContext &context) override;
+  void on_record(const Tracelet &record,
+                 const std::unordered_map<uint64_t, std::string> &strings)
+      override;
+  void flush() override;
+  void shutdown() override;
+
+private:
+  Options _options;
+  std::unique_ptr<FxtWriter> _writer;
+};
+
+} // namespace Waffle::exporter
@@ -0,0 +1,260 @@
+#include "waffle/exporter/http_client.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace Waffle::exporter {
+
+namespace {
+
+[[noreturn]] void fail(int error, const std::string &what) {
+  throw std::system_error(error, std::generic_category(), what);
+}
+
+bool iequals(std::string_view a, std::string_view b) {
+  return a.size() == b.size() &&
+         std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+           return (x | 0x20) == (y | 0x20);
+         });
+}
+
+std::string_view trim(std::string_view s) {
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+    s.remove_prefix(1);
+  while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+    s.remove_suffix(1);
+  return s;
+}
+
+} // namespace
+
+HttpClient::HttpClient(std::string host, uint16_t port, Options options)
+    : _host(std::move(host)), _port(port), _options(options) {}
+
+HttpClient::~HttpClient() { close(); }
+
+void HttpClient::close() {
+  if (_fd >= 0)
+    ::close(_fd);
+  _fd = -1;
+  _buffer.clear();
+}
+
+void HttpClient::connect() {
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *addresses = nullptr;
+  const std::string port = std::to_string(_port);
+  const int rc = ::getaddrinfo(_host.c_str(), port.c_str(), &hints, &addresses);
+  if (rc != 0)
+    fail(EHOSTUNREACH, "Cannot resolve " + _host + ": " + gai_strerror(rc));
+
+  timeval timeout{};
+  timeout.tv_sec = _options.timeout.count() / 1000;
+  timeout.tv_usec = (_options.timeout.count() % 1000) * 1000;
+  int error = ECONNREFUSED;
+  for (addrinfo *a = addresses; a; a = a->ai_next) {
+    const int fd = ::socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC,
+                            a->ai_protocol);
+    if (fd < 0) {
+      error = errno;
+      continue;
+    }
+    // On Linux SO_SNDTIMEO also bounds connect().
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    const int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (::connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+      _fd = fd;
+      break;
+    }
+    error = errno == EINPROGRESS ? ETIMEDOUT : errno;
+    ::close(fd);
+  }
+  ::freeaddrinfo(addresses);
+  if (_fd < 0)
+    fail(error, "Cannot connect to " + _host + ":" + port);
+  ++_connections;
+}
+
+void HttpClient::send_request(std::string_view path,
+                              std::string_view content_type,
+                              std::string_view body) {
+  _request.clear();
+  _request.append("POST ").append(path).append(" HTTP/1.1\r\nHost: ");
+  _request.append(_host).append(":").append(std::to_string(_port));
+  _request.append("\r\nContent-Type: ").append(content_type);
+  _request.append("\r\nContent-Length: ").append(std::to_string(body.size()));
+  _request.append("\r\nConnection: keep-alive\r\n\r\n");
+
+  // Head and body in one writev: no copy of the body, and no small segment
+  // left waiting for an ACK.
+  iovec parts[2] = {{_request.data(), _request.size()},
+                    {const_cast<char *>(body.data()), body.size()}};
+  iovec *next = parts;
+  int count = body.empty() ? 1 : 2;
+  while (count > 0) {
+    msghdr message{};
+    message.msg_iov = next;
+    message.msg_iovlen = static_cast<size_t>(count);
+    const ssize_t n = ::sendmsg(_fd, &message, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      fail(errno == EAGAIN ? ETIMEDOUT : errno, "Failed sending to " + _host);
+    }
+    size_t sent = static_cast<size_t>(n);
+    while (count > 0 && sent >= next->iov_len) {
+      sent -= next->iov_len;
+      ++next;
+      --count;
+    }
+    if (count > 0) {
+      next->iov_base = static_cast<char *>(next->iov_base) + sent;
+      next->iov_len -= sent;
+    }
+  }
+}
+
+bool HttpClient::fill() {
+  char chunk[16 << 10];
+  while (true) {
+    const ssize_t n = ::recv(_fd, chunk, sizeof(chunk), 0);
+    if (n > 0) {
+      _buffer.append(chunk, static_cast<size_t>(n));
+      return true;
+    }
+    if (n == 0)
+      return false;
+    if (errno != EINTR)
+      fail(errno == EAGAIN ? ETIMEDOUT : errno, "Failed reading from " + _host);
+  }
+}
+
+bool HttpClient::read_response(Response &response) {
+  auto malformed = [&] { fail(EPROTO, "Malformed response from " + _host); };
+  auto need = [&](size_t bytes) {
+    while (_buffer.size() < bytes)
+      if (!fill())
+        fail(ECONNRESET, "Connection to " + _host + " closed mid-response");
+  };
+
+  size_t head_end;
+  while (true) {
+    while ((head_end = _buffer.find("\r\n\r\n")) == std::string::npos) {
+      if (!fill()) {
+        if (_buffer.empty())
+          return false;
+        malformed();
+      }
+    }
+    // "HTTP/1.1 200 OK"
+    if (_buffer.size() < 12 || _buffer.compare(0, 5, "HTTP/") != 0)
+      malformed();
+    response.status = std::atoi(_buffer.c_str() + 9);
+    if (response.status >= 200 || response.status < 100)
+      break;
+    _buffer.erase(0, head_end + 4); // Interim 1xx response
+  }
+
+  const std::string_view head(_buffer.data(), head_end);
+  bool chunked = false;
+  bool close_after = head.compare(0, 8, "HTTP/1.0") == 0;
+  size_t content_length = std::string::npos;
+  for (size_t at = head.find("\r\n"); at != std::string_view::npos;) {
+    const size_t start = at + 2;
+    at = head.find("\r\n", start);
+    const std::string_view line = head.substr(start, at - start);
+    const size_t colon = line.find(':');
+    if (colon == std::string_view::npos)
+      continue;
+    const std::string_view name = trim(line.substr(0, colon));
+    const std::string_view value = trim(line.substr(colon + 1));
+    if (iequals(name, "content-length"))
+      content_length = std::strtoull(std::string(value).c_str(), nullptr, 10);
+    else if (iequals(name, "transfer-encoding"))
+      chunked = iequals(value, "chunked");
+    else if (iequals(name, "connection"))
+      close_after = iequals(value, "close");
+  }
+  _buffer.erase(0, head_end + 4);
+
+  response.body.clear();
+  if (chunked) {
+    while (true) {
+      size_t line_end;
+      while ((line_end = _buffer.find("\r\n")) == std::string::npos)
+        need(_buffer.size() + 1);
+      const size_t size = std::strtoull(_buffer.c_str(), nullptr, 16);
+      _buffer.erase(0, line_end + 2);
+      if (size == 0) {
+        // Skip trailers up to the empty line.
+        while ((line_end = _buffer.find("\r\n")) != 0) {
+          if (line_end == std::string::npos)
+            need(_buffer.size() + 1);
+          else
+            _buffer.erase(0, line_end + 2);
+        }
+        _buffer.erase(0, 2);
+        break;
+      }
+      need(size + 2);
+      response.body.append(_buffer, 0, size);
+      _buffer.erase(0, size + 2);
+    }
+  } else if (content_length != std::string::npos) {
+    need(content_length);
+    response.body.assign(_buffer, 0, content_length);
+    _buffer.erase(0, content_length);
+  } else if (response.status != 204 && response.status != 304) {
+    while (fill()) {
+    } // Body delimited by the end of the connection
+    response.body = std::move(_buffer);
+    close_after = true;
+  }
+  if (close_after)
+    close();
+  return true;
+}
+
+HttpClient::Response HttpClient::post(std::string_view path,
+                                      std::string_view content_type,
+                                      std::string_view body) {
+  Response response;
+  const bool reused = _fd >= 0;
+  if (!reused)
+    connect();
+  try {
+    send_request(path, content_type, body);
+    if (read_response(response))
+      return response;
+    if (!reused)
+      fail(ECONNRESET, "Connection to " + _host + " closed before response");
+  } catch (const std::system_error &e) {
+    close();
+    const int error = e.code().value();
+    if (!reused || (error != EPIPE && error != ECONNRESET))
+      throw;
+  }
+  // The server closed the idle connection: retry once on a new one.
+  close();
+  connect();
+  send_request(path, content_type, body);
+  if (!read_response(response)) {
+    close();
+    fail(ECONNRESET, "Connection to " + _host + " closed before response");
+  }
+  return response;
+}
+
+} // namespace Waffle::exporter
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace Waffle::exporter {
+
+/**
+ * @brief Minimal blocking HTTP/1.1 client for exporters: POSTs to a single
+ * host over one keep-alive connection.
+ *
+ * The connection is opened on the first request and reused until the server
+ * closes it (or answers `Connection: close`); a request that fails on a
+ * reused connection is retried once on a fresh one, since the server may
+ * have dropped it while idle. Responses may use Content-Length or chunked
+ * bodies. No TLS, proxies or redirects: collectors are expected to be
+ * local agents or sidecars.
+ */
+class HttpClient {
+public:
+  struct Options {
+    // Applies to connecting and to every send/receive call.
+    std::chrono::milliseconds timeout{5000};
+  };
+
+  struct Response {
+    int status = 0;
+    std::string body;
+  };
+
+  HttpClient(std::string host, uint16_t port, Options options);
+  HttpClient(std::string host, uint16_t port)
+      : HttpClient(std::move(host), port, Options{}) {}
+  ~HttpClient();
+
+  HttpClient(const HttpClient &) = delete;
+  HttpClient &operator=(const HttpClient &) = delete;
+
+  // @throw std::system_error If the host cannot be reached, on timeouts and
+  // on malformed responses.
+  Response post(std::string_view path, std::string_view content_type,
+                std::string_view body);
+
+  void close();
+
+  // Connections opened so far; stays at 1 while keep-alive works.
+  uint64_t connections_opened() const { return _connections; }
+
+private:
+  void connect();
+  void send_request(std::string_view path, std::string_view content_type,
+                    std::string_view body);
+  // Returns false if the connection was closed before any response byte.
+  bool read_response(Response &response);
+  bool fill(); // Reads more bytes into _buffer; false on EOF.
+
+  std::string _host;
+  uint16_t _port;
+  Options _options;
+  int _fd = -1;
+  uint64_t _connections = 0;
+  std::string _request; // Reused to build request heads
+  std::string _buffer;  // Received bytes not yet consumed
+};
+
+} // namespace Waffle::exporter
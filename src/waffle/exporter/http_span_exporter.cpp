@@ -0,0 +1,133 @@
+#include "waffle/exporter/http_span_exporter.hpp"
+#include "waffle/helpers/open_spans.hpp"
+
+#include <system_error>
+
+namespace Waffle::exporter {
+
+HttpSpanExporter::HttpSpanExporter(Options options)
+    : _options(std::move(options)) {
+  const bool zipkin = _options.format == Format::ZIPKIN_JSON;
+  if (_options.port == 0)
+    _options.port = zipkin ? 9411 : 14268;
+  if (_options.path.empty())
+    _options.path = zipkin ? "/api/v2/spans" : "/api/traces";
+  if (_options.batch_spans == 0)
+    _options.batch_spans = 1;
+}
+
+HttpSpanExporter::~HttpSpanExporter() { shutdown(); }
+
+void HttpSpanExporter::on_start(const ProcessorContext &context) {
+  if (_options.format == Format::ZIPKIN_JSON)
+    _encoder = std::make_unique<ZipkinJsonEncoder>(_options.service_name);
+  else
+    _encoder = std::make_unique<JaegerThriftEncoder>(_options.service_name,
+                                                     context.process_tag);
+  _sender = std::thread([this] { send_loop(); });
+}
+
+void HttpSpanExporter::on_record(
+    const Tracelet &record,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  if (record.record_type == Tracelet::RecordType::SPAN_START) {
+    const size_t evicted = trim_open_spans(
+        _open_spans, _options.max_open_spans,
+        [](const Tracelet &start) { return start.timestamp; });
+    if (evicted > 0)
+      _open_spans_evicted.fetch_add(evicted, std::memory_order_relaxed);
+    _open_spans.insert_or_assign(record.span_id.value, record);
+  } else if (record.record_type == Tracelet::RecordType::SPAN_END) {
+    auto it = _open_spans.find(record.span_id.value);
+    if (it == _open_spans.end())
+      return;
+    _encoder->add(it->second, record.timestamp, strings);
+    _open_spans.erase(it);
+    if (_encoder->size() >= _options.batch_spans)
+      enqueue_batch();
+  }
+}
+
+void HttpSpanExporter::enqueue_batch() {
+  const size_t spans = _encoder->size();
+  if (spans == 0)
+    return;
+  Batch batch{_encoder->take_batch(), spans};
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_queue.size() >= _options.max_queued_batches) {
+      _spans_dropped.fetch_add(spans, std::memory_order_relaxed);
+      return;
+    }
+    _queue.push_back(std::move(batch));
+  }
+  _wakeup.notify_one();
+}
+
+void HttpSpanExporter::send_loop() {
+  HttpClient client(_options.host, _options.port, _options.http);
+  const std::string content_type(_encoder->content_type());
+  while (true) {
+    Batch batch;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _wakeup.wait(lock, [this] { return _stopping || !_queue.empty(); });
+      if (_queue.empty())
+        break; // Stopping, and everything queued has been sent
+      batch = std::move(_queue.front());
+      _queue.pop_front();
+    }
+    bool delivered = false;
+    try {
+      const HttpClient::Response response =
+          client.post(_options.path, content_type, batch.body);
+      delivered = response.status >= 200 && response.status < 300;
+    } catch (const std::system_error &) {
+      // Counted below; the next batch reconnects.
+    }
+    _requests.fetch_add(1, std::memory_order_relaxed);
+    _connections.store(client.connections_opened(),
+                       std::memory_order_relaxed);
+    if (delivered) {
+      _spans_sent.fetch_add(batch.spans, std::memory_order_relaxed);
+    } else {
+      _failed_requests.fetch_add(1, std::memory_order_relaxed);
+      _spans_dropped.fetch_add(batch.spans, std::memory_order_relaxed);
+    }
+  }
+}
+
+void HttpSpanExporter::flush() {
+  if (_encoder)
+    enqueue_batch();
+}
+
+void HttpSpanExporter::shutdown() {
+  if (!_sender.joinable())
+    return;
+  flush();
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stopping = true;
+  }
+  _wakeup.notify_one();
+  _sender.join();
+}
+
+size_t HttpSpanExporter::backlog() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _queue.size();
+}
+
+HttpSpanExporter::Stats HttpSpanExporter::stats() const {
+  Stats s;
+  s.spans_sent = _spans_sent.load(std::memory_order_relaxed);
+  s.spans_dropped = _spans_dropped.load(std::memory_order_relaxed);
+  s.requests = _requests.load(std::memory_order_relaxed);
+  s.failed_requests = _failed_requests.load(std::memory_order_relaxed);
+  s.connections = _connections.load(std::memory_order_relaxed);
+  s.open_spans_evicted = _open_spans_evicted.load(std::memory_order_relaxed);
+  return s;
+}
+
+} // namespace Waffle::exporter
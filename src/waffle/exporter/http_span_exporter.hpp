@@ -0,0 +1,101 @@
+#pragma once
+
+#include "waffle/exporter/http_client.hpp"
+#include "waffle/exporter/span_encoders.hpp"
+#include "waffle/processor/iprocessor.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace Waffle::exporter {
+
+/**
+ * @brief Processor that sends completed spans to a Zipkin or Jaeger
+ * collector over HTTP.
+ *
+ * Spans are encoded as they end, on the processing thread, into a batch of
+ * `batch_spans`. Full batches (and partial ones on flush()) are handed to a
+ * sender thread that POSTs them over one keep-alive connection, so network
+ * latency never stalls the ring buffer. If the collector falls behind by
+ * more than `max_queued_batches`, new batches are dropped and counted
+ * rather than buffered without bound; so are batches the collector rejects
+ * or that cannot be delivered. shutdown() waits for queued batches to be
+ * sent. At most `max_open_spans` started spans wait for their end; beyond
+ * that the older half is evicted and never exported.
+ */
+class HttpSpanExporter : public IProcessor {
+public:
+  enum class Format {
+    ZIPKIN_JSON,   // Zipkin v2 JSON, POST /api/v2/spans
+    JAEGER_THRIFT, // Jaeger Batch, Thrift binary, POST /api/traces
+  };
+
+  struct Options {
+    Format format = Format::ZIPKIN_JSON;
+    std::string host = "127.0.0.1";
+    uint16_t port = 0;     // 0: 9411 for Zipkin, 14268 for Jaeger
+    std::string path;      // Empty: the format's endpoint
+    std::string service_name = "waffle";
+    size_t batch_spans = 1024;
+    size_t max_queued_batches = 16;
+    size_t max_open_spans = 1 << 16;
+    HttpClient::Options http;
+  };
+
+  struct Stats {
+    uint64_t spans_sent = 0;
+    uint64_t spans_dropped = 0; // Queue full, rejected or undeliverable
+    uint64_t requests = 0;      // Including failed ones
+    uint64_t failed_requests = 0;
+    uint64_t connections = 0;
+    uint64_t open_spans_evicted = 0; // See Options::max_open_spans
+  };
+
+  explicit HttpSpanExporter(Options options);
+  ~HttpSpanExporter() override;
+
+  void on_start(const ProcessorContext &context) override;
+  void on_record(const Tracelet &record,
+                 const std::unordered_map<uint64_t, std::string> &strings)
+      override;
+  void flush() override;
+  void shutdown() override;
+  // Batches waiting for the sender thread.
+  size_t backlog() const override;
+
+  // Safe to call from any thread.
+  Stats stats() const;
+
+private:
+  struct Batch {
+    std::string body;
+    size_t spans;
+  };
+
+  void enqueue_batch();
+  void send_loop();
+
+  Options _options;
+  std::unique_ptr<SpanEncoder> _encoder;
+  std::unordered_map<uint64_t, Tracelet> _open_spans;
+
+  mutable std::mutex _mutex;
+  std::condition_variable _wakeup;
+  std::deque<Batch> _queue;
+  bool _stopping = false;
+  std::thread _sender;
+
+  std::atomic<uint64_t> _spans_sent{0};
+  std::atomic<uint64_t> _spans_dropped{0};
+  std::atomic<uint64_t> _requests{0};
+  std::atomic<uint64_t> _failed_requests{0};
+  std::atomic<uint64_t> _connections{0};
+  std::atomic<uint64_t> _open_spans_evicted{0};
+};
+
+} // namespace Waffle::exporter
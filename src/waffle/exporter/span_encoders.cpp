@@ -0,0 +1,340 @@
+#include "waffle/exporter/span_encoders.hpp"
+
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+
+namespace Waffle::exporter {
+
+namespace {
+
+constexpr std::string_view kUnknownString = "???";
+
+std::string_view
+lookup(const std::unordered_map<uint64_t, std::string> &strings,
+       uint64_t hash) {
+  auto it = strings.find(hash);
+  return it != strings.end() ? std::string_view(it->second) : kUnknownString;
+}
+
+uint64_t trace_id_of(const Tracelet &t) {
+  return t.trace_id != kInvalidId ? t.trace_id.value : t.span_id.value;
+}
+
+uint64_t to_micros(uint64_t ns) { return ns / 1000; }
+
+// Rounded up, so that a sub-microsecond span still has a duration.
+uint64_t duration_micros(const Tracelet &start, uint64_t end_timestamp) {
+  const uint64_t ns =
+      end_timestamp > start.timestamp ? end_timestamp - start.timestamp : 0;
+  return ns < 1000 ? 1 : (ns + 999) / 1000;
+}
+
+// --- JSON ---
+
+void append_hex(std::string &out, uint64_t v) {
+  static constexpr char kDigits[] = "0123456789abcdef";
+  char buf[16];
+  for (int i = 15; i >= 0; --i, v >>= 4)
+    buf[i] = kDigits[v & 0xF];
+  out.append(buf, sizeof(buf));
+}
+
+template <typename T> void append_number(std::string &out, T v) {
+  char buf[32];
+  const auto result = std::to_chars(buf, buf + sizeof(buf), v);
+  out.append(buf, result.ptr);
+}
+
+void append_json_string(std::string &out, std::string_view s) {
+  out += '"';
+  size_t run = 0; // Start of the pending run of plain characters
+  for (size_t i = 0; i < s.size(); ++i) {
+    const unsigned char c = static_cast<unsigned char>(s[i]);
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+    out.append(s.data() + run, i - run);
+    run = i + 1;
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default: {
+      char buf[8];
+      std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    }
+    }
+  }
+  out.append(s.data() + run, s.size() - run);
+  out += '"';
+}
+
+void append_json_value(std::string &out, const AttributeValue &v,
+                       const std::unordered_map<uint64_t, std::string> &strings) {
+  switch (v.type) {
+  case AttributeValue::Type::BOOL:
+    out += v.b ? "\"true\"" : "\"false\"";
+    return;
+  case AttributeValue::Type::INT64:
+    out += '"';
+    append_number(out, v.i64);
+    out += '"';
+    return;
+  case AttributeValue::Type::DOUBLE:
+    out += '"';
+    append_number(out, v.f64);
+    out += '"';
+    return;
+  case AttributeValue::Type::STRING_ID:
+    append_json_string(out, lookup(strings, v.string_id));
+    return;
+  }
+}
+
+// --- Thrift binary protocol (big-endian) ---
+
+enum ThriftType : uint8_t {
+  kStop = 0,
+  kBool = 2,
+  kDouble = 4,
+  kI32 = 8,
+  kI64 = 10,
+  kString = 11,
+  kStruct = 12,
+  kList = 15,
+};
+
+// jaeger.thrift enums
+enum JaegerTagType : int32_t {
+  kTagString = 0,
+  kTagDouble = 1,
+  kTagBool = 2,
+  kTagLong = 3,
+};
+enum JaegerRefType : int32_t { kChildOf = 0, kFollowsFrom = 1 };
+
+void put_i32(std::string &out, int32_t v) {
+  const uint32_t be = __builtin_bswap32(static_cast<uint32_t>(v));
+  out.append(reinterpret_cast<const char *>(&be), sizeof(be));
+}
+
+void put_i64(std::string &out, uint64_t v) {
+  const uint64_t be = __builtin_bswap64(v);
+  out.append(reinterpret_cast<const char *>(&be), sizeof(be));
+}
+
+void put_field(std::string &out, ThriftType type, int16_t id) {
+  const char header[3] = {static_cast<char>(type), static_cast<char>(id >> 8),
+                          static_cast<char>(id & 0xFF)};
+  out.append(header, sizeof(header));
+}
+
+void put_string(std::string &out, std::string_view s) {
+  put_i32(out, static_cast<int32_t>(s.size()));
+  out.append(s);
+}
+
+void put_list(std::string &out, int16_t id, ThriftType element,
+              int32_t count) {
+  put_field(out, kList, id);
+  out += static_cast<char>(element);
+  put_i32(out, count);
+}
+
+void put_long_tag(std::string &out, std::string_view key, int64_t v) {
+  put_field(out, kString, 1);
+  put_string(out, key);
+  put_field(out, kI32, 2);
+  put_i32(out, kTagLong);
+  put_field(out, kI64, 6);
+  put_i64(out, static_cast<uint64_t>(v));
+  out += static_cast<char>(kStop);
+}
+
+void put_tag(std::string &out, std::string_view key, const AttributeValue &v,
+             const std::unordered_map<uint64_t, std::string> &strings) {
+  if (v.type == AttributeValue::Type::INT64) {
+    put_long_tag(out, key, v.i64);
+    return;
+  }
+  put_field(out, kString, 1);
+  put_string(out, key);
+  put_field(out, kI32, 2);
+  switch (v.type) {
+  case AttributeValue::Type::DOUBLE: {
+    put_i32(out, kTagDouble);
+    put_field(out, kDouble, 4);
+    uint64_t bits;
+    std::memcpy(&bits, &v.f64, sizeof(bits));
+    put_i64(out, bits);
+    break;
+  }
+  case AttributeValue::Type::BOOL:
+    put_i32(out, kTagBool);
+    put_field(out, kBool, 5);
+    out += static_cast<char>(v.b ? 1 : 0);
+    break;
+  case AttributeValue::Type::STRING_ID:
+  case AttributeValue::Type::INT64:
+    put_i32(out, kTagString);
+    put_field(out, kString, 3);
+    put_string(out, lookup(strings, v.string_id));
+    break;
+  }
+  out += static_cast<char>(kStop);
+}
+
+void put_reference(std::string &out, JaegerRefType type, uint64_t trace_id,
+                   uint64_t span_id) {
+  put_field(out, kI32, 1);
+  put_i32(out, type);
+  put_field(out, kI64, 2);
+  put_i64(out, trace_id);
+  put_field(out, kI64, 3);
+  put_i64(out, 0);
+  put_field(out, kI64, 4);
+  put_i64(out, span_id);
+  out += static_cast<char>(kStop);
+}
+
+} // namespace
+
+ZipkinJsonEncoder::ZipkinJsonEncoder(std::string service_name) {
+  _endpoint = ",\"localEndpoint\":{\"serviceName\":";
+  append_json_string(_endpoint, service_name);
+  _endpoint += '}';
+}
+
+void ZipkinJsonEncoder::add(
+    const Tracelet &start, uint64_t end_timestamp,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  std::string &out = _body;
+  out += _spans++ == 0 ? '[' : ',';
+  out += "{\"traceId\":\"";
+  append_hex(out, trace_id_of(start));
+  out += "\",\"id\":\"";
+  append_hex(out, start.span_id.value);
+  if (start.parent_span_id != kInvalidId) {
+    out += "\",\"parentId\":\"";
+    append_hex(out, start.parent_span_id.value);
+  }
+  out += "\",\"name\":";
+  append_json_string(out, lookup(strings, start.name_string_hash));
+  out += ",\"timestamp\":";
+  append_number(out, to_micros(start.timestamp));
+  out += ",\"duration\":";
+  append_number(out, duration_micros(start, end_timestamp));
+  out += _endpoint;
+  out += ",\"tags\":{\"thread.index\":\"";
+  append_number(out, start.thread_index);
+  out += "\",\"cpu\":\"";
+  append_number(out, start.cpu_id);
+  out += '"';
+  if (start.cause_id != kInvalidId) {
+    out += ",\"waffle.cause_id\":\"";
+    append_hex(out, start.cause_id.value);
+    out += '"';
+  }
+  for (uint8_t i = 0; i < start.num_attributes; ++i) {
+    out += ',';
+    append_json_string(out, lookup(strings, start.attributes[i].key_id));
+    out += ':';
+    append_json_value(out, start.attributes[i].value, strings);
+  }
+  out += "}}";
+}
+
+std::string ZipkinJsonEncoder::take_batch() {
+  std::string body;
+  body.swap(_body);
+  body += _spans == 0 ? "[]" : "]";
+  _body.reserve(body.size()); // Batches are about the same size
+  _spans = 0;
+  return body;
+}
+
+JaegerThriftEncoder::JaegerThriftEncoder(std::string service_name,
+                                         uint64_t process_tag) {
+  put_field(_process, kStruct, 1); // Batch.process
+  put_field(_process, kString, 1); // Process.serviceName
+  put_string(_process, service_name);
+  if (process_tag != 0) {
+    put_list(_process, 2, kStruct, 1); // Process.tags
+    put_long_tag(_process, "waffle.process_tag",
+                 static_cast<int64_t>(process_tag));
+  }
+  _process += static_cast<char>(kStop);
+  start_batch();
+}
+
+// The span count precedes the spans: it is patched in by take_batch(), so
+// spans are encoded in place and the body is never copied.
+void JaegerThriftEncoder::start_batch() {
+  _body = _process;
+  put_list(_body, 2, kStruct, 0); // Batch.spans
+}
+
+void JaegerThriftEncoder::add(
+    const Tracelet &start, uint64_t end_timestamp,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  std::string &out = _body;
+  const uint64_t trace_id = trace_id_of(start);
+  put_field(out, kI64, 1); // traceIdLow
+  put_i64(out, trace_id);
+  put_field(out, kI64, 2); // traceIdHigh
+  put_i64(out, 0);
+  put_field(out, kI64, 3); // spanId
+  put_i64(out, start.span_id.value);
+  put_field(out, kI64, 4); // parentSpanId
+  put_i64(out, start.parent_span_id.value);
+  put_field(out, kString, 5); // operationName
+  put_string(out, lookup(strings, start.name_string_hash));
+
+  const bool has_parent = start.parent_span_id != kInvalidId;
+  const bool has_cause = start.cause_id != kInvalidId;
+  if (has_parent || has_cause) {
+    put_list(out, 6, kStruct, has_parent + has_cause); // references
+    if (has_parent)
+      put_reference(out, kChildOf, trace_id, start.parent_span_id.value);
+    if (has_cause)
+      put_reference(out, kFollowsFrom, trace_id, start.cause_id.value);
+  }
+  put_field(out, kI32, 7); // flags: sampled
+  put_i32(out, 1);
+  put_field(out, kI64, 8); // startTime
+  put_i64(out, to_micros(start.timestamp));
+  put_field(out, kI64, 9); // duration
+  put_i64(out, duration_micros(start, end_timestamp));
+
+  put_list(out, 10, kStruct, 2 + start.num_attributes); // tags
+  put_long_tag(out, "thread.index", start.thread_index);
+  put_long_tag(out, "cpu", start.cpu_id);
+  for (uint8_t i = 0; i < start.num_attributes; ++i)
+    put_tag(out, lookup(strings, start.attributes[i].key_id),
+            start.attributes[i].value, strings);
+  out += static_cast<char>(kStop);
+  ++_spans;
+}
+
+std::string JaegerThriftEncoder::take_batch() {
+  const uint32_t count = __builtin_bswap32(static_cast<uint32_t>(_spans));
+  std::memcpy(&_body[_process.size() + 4], &count, sizeof(count));
+  _body += static_cast<char>(kStop);
+  std::string body = std::move(_body);
+  _spans = 0;
+  start_batch();
+  _body.reserve(body.size());
+  return body;
+}
+
+} // namespace Waffle::exporter
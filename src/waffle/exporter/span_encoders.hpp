@@ -0,0 +1,90 @@
+#pragma once
+
+#include "waffle/waffle_core.hpp"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace Waffle::exporter {
+
+/**
+ * @brief Serializes completed spans into the request body of a collector
+ * API, one batch at a time.
+ *
+ * add() appends a span (its SPAN_START record plus the end timestamp)
+ * straight into the encoded batch; take_batch() completes the body and
+ * starts the next batch. Every span carries the Waffle thread index and CPU
+ * as tags next to its attributes.
+ */
+class SpanEncoder {
+public:
+  virtual ~SpanEncoder() = default;
+
+  virtual void add(const Tracelet &start, uint64_t end_timestamp,
+                   const std::unordered_map<uint64_t, std::string> &strings) = 0;
+
+  // Returns the body for the spans added since the last call.
+  virtual std::string take_batch() = 0;
+
+  virtual std::string_view content_type() const = 0;
+
+  size_t size() const { return _spans; }
+
+protected:
+  size_t _spans = 0;
+};
+
+/**
+ * @brief Zipkin v2 JSON (`POST /api/v2/spans`, port 9411), also accepted by
+ * Jaeger collectors with Zipkin ingestion enabled.
+ *
+ * Ids are 16 hex digits, times are microseconds since the epoch (durations
+ * round up to 1 us, which Zipkin treats as "measured"). Tags are strings,
+ * so attribute values are formatted. A causal link has no Zipkin
+ * equivalent and becomes the tag `waffle.cause_id`.
+ */
+class ZipkinJsonEncoder : public SpanEncoder {
+public:
+  explicit ZipkinJsonEncoder(std::string service_name);
+
+  void add(const Tracelet &start, uint64_t end_timestamp,
+           const std::unordered_map<uint64_t, std::string> &strings) override;
+  std::string take_batch() override;
+  std::string_view content_type() const override {
+    return "application/json";
+  }
+
+private:
+  std::string _endpoint; // Pre-encoded "localEndpoint" member
+  std::string _body;
+};
+
+/**
+ * @brief Jaeger `Batch` in Thrift binary protocol (`POST /api/traces`,
+ * port 14268), the collector's native HTTP ingestion format.
+ *
+ * Tags keep their attribute types (long, double, bool, string). The parent
+ * is both `parentSpanId` and a CHILD_OF reference; a causal link becomes a
+ * FOLLOWS_FROM reference.
+ */
+class JaegerThriftEncoder : public SpanEncoder {
+public:
+  explicit JaegerThriftEncoder(std::string service_name,
+                               uint64_t process_tag = 0);
+
+  void add(const Tracelet &start, uint64_t end_timestamp,
+           const std::unordered_map<uint64_t, std::string> &strings) override;
+  std::string take_batch() override;
+  std::string_view content_type() const override {
+    return "application/x-thrift";
+  }
+
+private:
+  void start_batch();
+
+  std::string _process; // Pre-encoded Batch.process field
+  std::string _body;
+};
+
+} // namespace Waffle::exporter
@@ -0,0 +1,269 @@
+#pragma once
+
+/**
+ * @file broadcast_ring_buffer.hpp
+ * @brief A lock-free, bounded, multi-producer ring buffer whose items are
+ * read by every subscribed reader (broadcast), each at its own cursor.
+ *
+ * Where several consumers need the same stream (a flight recorder, a live
+ * tap, an exporter), an MpscRingBuffer per consumer costs the producer one
+ * copy per consumer. Here a producer writes each item once; readers copy it
+ * out independently.
+ *
+ * Readers are LOSSLESS or LOSSY:
+ * - A slot is reused only once every LOSSLESS reader has read it. While the
+ *   slowest one is a full capacity behind, `try_emplace` fails (the item is
+ *   dropped), as with a full MpscRingBuffer.
+ * - LOSSY readers never hold producers back. A LOSSY reader that falls more
+ *   than a capacity behind finds its next items overwritten, skips to the
+ *   oldest item still in the ring and counts what it missed.
+ * With no LOSSLESS reader the buffer is an overwriting flight recorder.
+ *
+ * Implementation Details:
+ * - `_tail`: The next ticket to claim; producers advance it with a CAS.
+ * - Each slot carries a sequence number: ticket + 1 once the item of that
+ *   ticket is published, kBusy while a producer writes it. A reader at
+ *   cursor c takes the item if the sequence is c + 1, waits if it is lower
+ *   (or kBusy), and knows it was lapped if it is higher.
+ * - Readers copy an item out and then re-check the sequence (a seqlock), so
+ *   T must be trivially copyable: a LOSSY reader may copy a slot while a
+ *   producer overwrites it, and discards the copy if so.
+ * - `_gate`: A lower bound on the cursors of LOSSLESS readers, cached for
+ *   producers. Producers compare their ticket against it and only scan the
+ *   reader table when it says the ring is full, so their fast path (two
+ *   CAS and one load) does not depend on the number of readers.
+ * - The reader table is a fixed array of kMaxReaders cache-line-sized
+ *   entries; `subscribe()` takes a free one and the Reader releases it.
+ */
+
+#include "waffle/helpers/mpsc_ring_buffer.hpp" // CACHE_LINE_SIZE, next_power_of_two
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+template <typename T> class BroadcastRingBuffer {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "Readers copy items out while producers may overwrite them");
+
+  static constexpr uint64_t kBusy = ~0ull;
+  static constexpr uint8_t kFree = 0;
+  static constexpr uint8_t kClaimed = 1; // Being set up by subscribe()
+  static constexpr uint8_t kLossless = 2;
+  static constexpr uint8_t kLossy = 3;
+
+  struct Slot {
+    std::atomic<uint64_t> seq{0};
+    alignas(T) unsigned char item[sizeof(T)];
+  };
+
+  struct alignas(CACHE_LINE_SIZE) ReaderEntry {
+    std::atomic<uint64_t> cursor{0};
+    std::atomic<uint8_t> mode{kFree};
+  };
+
+public:
+  static constexpr size_t kMaxReaders = 16;
+
+  enum class ReaderMode : uint8_t { LOSSLESS, LOSSY };
+
+  /**
+   * @brief One subscription; move-only, used by a single thread.
+   *
+   * Starts at the items published after subscribe(); unsubscribes on
+   * destruction, so it must not outlive its buffer.
+   */
+  class Reader {
+  public:
+    Reader() = default;
+    Reader(Reader &&other) noexcept
+        : _rb(std::exchange(other._rb, nullptr)), _entry(other._entry),
+          _cursor(other._cursor), _skipped(other._skipped) {}
+    Reader &operator=(Reader &&other) noexcept {
+      if (this != &other) {
+        release();
+        _rb = std::exchange(other._rb, nullptr);
+        _entry = other._entry;
+        _cursor = other._cursor;
+        _skipped = other._skipped;
+      }
+      return *this;
+    }
+    ~Reader() { release(); }
+
+    explicit operator bool() const { return _rb != nullptr; }
+
+    // Copies the next item into `out`. Returns false if it is not
+    // published yet.
+    bool try_read(T &out) {
+      while (true) {
+        const Slot &slot = _rb->_slots[_cursor & _rb->_mask];
+        const uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq == _cursor + 1) {
+          std::memcpy(static_cast<void *>(&out), slot.item, sizeof(T));
+          // Order the copy before the re-check of the sequence.
+          std::atomic_thread_fence(std::memory_order_acquire);
+          if (slot.seq.load(std::memory_order_relaxed) == seq) {
+            _entry->cursor.store(++_cursor, std::memory_order_release);
+            return true;
+          }
+        } else if (seq == kBusy || seq <= _cursor) {
+          return false; // Not published yet
+        }
+        skip_overwritten();
+      }
+    }
+
+    // Items published but not read yet; items this reader will skip
+    // included.
+    size_t available() const {
+      return _rb->_tail.load(std::memory_order_relaxed) - _cursor;
+    }
+    // Items this reader missed because they were overwritten.
+    uint64_t skipped() const { return _skipped; }
+
+  private:
+    friend class BroadcastRingBuffer;
+    Reader(BroadcastRingBuffer *rb, ReaderEntry *entry, uint64_t cursor)
+        : _rb(rb), _entry(entry), _cursor(cursor) {}
+
+    // Lapped: jump to the oldest ticket that may still be intact.
+    void skip_overwritten() {
+      const uint64_t tail = _rb->_tail.load(std::memory_order_relaxed);
+      const uint64_t oldest = tail - _rb->_capacity;
+      const uint64_t next =
+          tail > _rb->_capacity && oldest > _cursor ? oldest : _cursor + 1;
+      _skipped += next - _cursor;
+      _cursor = next;
+      _entry->cursor.store(_cursor, std::memory_order_release);
+    }
+
+    void release() {
+      if (_rb)
+        _entry->mode.store(kFree, std::memory_order_release);
+      _rb = nullptr;
+    }
+
+    BroadcastRingBuffer *_rb = nullptr;
+    ReaderEntry *_entry = nullptr;
+    uint64_t _cursor = 0;
+    uint64_t _skipped = 0;
+  };
+
+  explicit BroadcastRingBuffer(size_t capacity) {
+    if (capacity == 0) {
+      throw std::invalid_argument("Capacity cannot be zero.");
+    }
+    _capacity = next_power_of_two(capacity);
+    _mask = _capacity - 1;
+    _slots = new Slot[_capacity];
+  }
+
+  ~BroadcastRingBuffer() { delete[] _slots; }
+
+  BroadcastRingBuffer(const BroadcastRingBuffer &) = delete;
+  BroadcastRingBuffer &operator=(const BroadcastRingBuffer &) = delete;
+
+  // Throws std::runtime_error if kMaxReaders readers are subscribed.
+  Reader subscribe(ReaderMode mode) {
+    for (ReaderEntry &entry : _readers) {
+      uint8_t expected = kFree;
+      if (!entry.mode.compare_exchange_strong(expected, kClaimed,
+                                              std::memory_order_acq_rel))
+        continue;
+      entry.cursor.store(_tail.load(std::memory_order_relaxed),
+                         std::memory_order_relaxed);
+      entry.mode.store(mode == ReaderMode::LOSSLESS ? kLossless : kLossy,
+                       std::memory_order_seq_cst);
+      // A producer whose gate scan missed the entry read _tail before this
+      // load (all seq_cst), so its gate is at most `cursor`: the reader
+      // starts at an item no producer can overwrite before it reads it.
+      const uint64_t cursor = _tail.load(std::memory_order_seq_cst);
+      entry.cursor.store(cursor, std::memory_order_release);
+      return Reader(this, &entry, cursor);
+    }
+    throw std::runtime_error("BroadcastRingBuffer: too many readers");
+  }
+
+  template <typename... Args> bool try_emplace(Args &&...args) {
+    uint64_t ticket;
+    if (!claim_ticket(ticket))
+      return false; // A LOSSLESS reader is a full capacity behind
+    Slot &slot = _slots[ticket & _mask];
+    uint64_t seq = slot.seq.load(std::memory_order_acquire);
+    while (true) {
+      if (seq == kBusy) {
+        // The producer of the previous lap is still writing.
+        seq = slot.seq.load(std::memory_order_acquire);
+        continue;
+      }
+      if (seq > ticket) {
+        // Lapped by a producer a capacity ahead (only without LOSSLESS
+        // readers); readers skip this ticket.
+        _lapped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      if (slot.seq.compare_exchange_weak(seq, kBusy,
+                                         std::memory_order_acquire))
+        break;
+    }
+    // Readers that see the new bytes must also see kBusy.
+    std::atomic_thread_fence(std::memory_order_release);
+    new (slot.item) T(std::forward<Args>(args)...);
+    slot.seq.store(ticket + 1, std::memory_order_release);
+    return true;
+  }
+
+  size_t capacity() const { return _capacity; }
+  // Items dropped because their producer was lapped; see try_emplace().
+  uint64_t lapped() const { return _lapped.load(std::memory_order_relaxed); }
+
+private:
+  bool claim_ticket(uint64_t &ticket) {
+    ticket = _tail.load(std::memory_order_relaxed);
+    while (true) {
+      if (ticket - _gate.load(std::memory_order_acquire) >= _capacity &&
+          ticket - refresh_gate(ticket) >= _capacity) {
+        return false;
+      }
+      // seq_cst for subscribe(); as cheap as relaxed on x86.
+      if (_tail.compare_exchange_weak(ticket, ticket + 1,
+                                      std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+  }
+
+  // The slow path: the slowest LOSSLESS cursor, or `ticket` if there is no
+  // LOSSLESS reader. Every value stored is a valid lower bound, so racing
+  // producers may store them in any order.
+  uint64_t refresh_gate(uint64_t ticket) {
+    uint64_t gate = std::min<uint64_t>(
+        ticket, _tail.load(std::memory_order_seq_cst));
+    for (const ReaderEntry &entry : _readers) {
+      if (entry.mode.load(std::memory_order_seq_cst) != kLossless)
+        continue;
+      const uint64_t cursor = entry.cursor.load(std::memory_order_acquire);
+      if (cursor < gate)
+        gate = cursor;
+    }
+    _gate.store(gate, std::memory_order_release);
+    return gate;
+  }
+
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> _tail{0};
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> _gate{0};
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> _lapped{0};
+  std::array<ReaderEntry, kMaxReaders> _readers;
+
+  size_t _capacity;
+  size_t _mask;
+  Slot *_slots;
+};
@@ -25,8 +25,8 @@
  *   Only modified by the consumer. Read by producers.
  * - `_tail`: An atomic counter indicating the next slot to be written by a producer.
  *   Modified by producers (atomically). Read by the consumer and producers.
- * - `_ready_flags`: An array of atomic booleans, one for each slot in `_buffer`.
- *   A flag `_ready_flags[i]` being `true` signifies that the item in `_buffer[i]`
+ * - `_ready_flags`: An array of atomic slot states, one for each slot in `_buffer`.
+ *   A flag `_ready_flags[i]` being `kReady` signifies that the item in `_buffer[i]`
  *   has been fully constructed and is ready for consumption. This is crucial for
  *   correctly synchronizing data visibility between producers and the consumer.
  * - `_mask`: Used for efficient index calculation (`index & _mask`) due to the
@@ -39,20 +39,31 @@
  *      The `relaxed` ordering is sufficient as `_tail` only reserves a slot; data publication is separate.
  * 2. Producer Data Publication (`try_emplace`):
  *    - After constructing the item in the claimed buffer slot, the producer executes
- *      `_ready_flags[slot_index].store(true, std::memory_order_release)`.
+ *      `_ready_flags[slot_index].store(kReady, std::memory_order_release)`.
  *    - This `release` ensures prior writes (item construction) are visible before the flag is set.
  * 3. Consumer Data Consumption (`try_pop`):
  *    - The consumer checks `_ready_flags[slot_index].load(std::memory_order_acquire)`.
- *    - This `acquire` synchronizes with the producer's `release` store on the flag. If true, the item is visible.
- *    - After consuming, `_ready_flags[slot_index].store(false, std::memory_order_relaxed)` resets the flag.
+ *    - This `acquire` synchronizes with the producer's `release` store on the flag. If kReady, the item is visible.
+ *    - After consuming, `_ready_flags[slot_index].store(kEmpty, std::memory_order_relaxed)` resets the flag.
  * 4. Consumer Slot Freeing & Producer Space Check:
  *    - Consumer advances `_head` with `std::memory_order_release`. This publishes slot availability.
  *    - Producers read `_head` with `std::memory_order_acquire` to check for space, synchronizing with the consumer.
+ * 5. Multi-Slot Claims (`try_claim`):
+ *    - One CAS advances `_tail` by n; the n tickets are consecutive, so the
+ *      slots are contiguous modulo the capacity (they may wrap).
+ *    - `Claim::publish()` stores the flags of a group last-to-first. The
+ *      consumer stops at the first slot that is not ready, so it sees either
+ *      none or all of the group.
+ *    - Slots a Claim leaves unfilled are flagged as skipped when it is
+ *      destroyed; the consumer steps over them.
  */
 
 #include <atomic>
+#include <cstdint>
 #include <new> // For placement new, ::operator new, ::operator delete
 #include <stdexcept>
+#include <type_traits> // For std::is_nothrow_constructible_v
+#include <utility>
 
 // Helper to determine cache line size
 #ifdef __cpp_lib_hardware_interference_size
@@ -94,8 +105,8 @@ public:
     _mask = _capacity - 1;
     // Allocate raw memory for the buffer and ready flags.
     _buffer = static_cast<T*>(::operator new(_capacity * sizeof(T)));
-    // Allocate and initialize ready flags. std::atomic<bool> default constructs to false.
-    _ready_flags = new std::atomic<bool>[_capacity]();
+    // Allocate and initialize ready flags; value-initialized to kEmpty.
+    _ready_flags = new std::atomic<uint8_t>[_capacity]();
   }
 
   ~MpscRingBuffer() {
@@ -105,7 +116,8 @@ public:
     const size_t current_tail = _tail.load(std::memory_order_relaxed);
 
     for (size_t i = current_head; i != current_tail; ++i) {
-      _buffer[i & _mask].~T();
+      if (_ready_flags[i & _mask].load(std::memory_order_relaxed) == kReady)
+        _buffer[i & _mask].~T();
     }
 
     // Deallocate the raw memory for buffer and flags.
@@ -117,44 +129,120 @@ public:
   MpscRingBuffer &operator=(const MpscRingBuffer &) = delete;
 
   template <typename... Args> bool try_emplace(Args &&...args) {
-    // Construct the object on the producer's stack before manipulating
-    // shared state. If T's constructor throws, buffer remains consistent.
-    T temp_obj(std::forward<Args>(args)...);
-
-    size_t current_tail_ticket; // Candidate slot index.
-
-    while (true) { // Loop for CAS-based slot acquisition.
-      current_tail_ticket = _tail.load(
-          std::memory_order_relaxed); // Atomically read current tail.
-      const size_t current_head = _head.load(std::memory_order_acquire);
-
-      // Buffer is full if the distance between tail and head reaches capacity.
-      if (current_tail_ticket - current_head >= _capacity) {
+    if constexpr (std::is_nothrow_constructible_v<T, Args &&...>) {
+      // Construction cannot fail once a slot is claimed, so build the item
+      // directly in the buffer: no stack temporary and no extra move. This is
+      // what lets large records (e.g. Tracelets) be written straight into
+      // ring memory.
+      size_t ticket;
+      if (!claim_slot(ticket)) {
         return false; // Buffer is full
       }
+      new (&_buffer[ticket & _mask]) T(std::forward<Args>(args)...);
+      publish_slot(ticket);
+      return true;
+    } else {
+      // Construct the object on the producer's stack before manipulating
+      // shared state. If T's constructor throws, buffer remains consistent.
+      T temp_obj(std::forward<Args>(args)...);
 
-      // Attempt to claim the slot by advancing _tail.
-      // Relaxed ordering is used as _tail only claims slot; _ready_flags publishes data.
-      size_t expected_tail = current_tail_ticket;
-      if (_tail.compare_exchange_weak(expected_tail, current_tail_ticket + 1,
-                                      std::memory_order_relaxed, // success
-                                      std::memory_order_relaxed  // failure
-                                      )) {
-        // Successfully claimed slot at 'current_tail_ticket'.
-        // Construct the object in the buffer by moving from temp_obj.
-        new (&_buffer[current_tail_ticket & _mask]) T(std::move(temp_obj));
+      size_t ticket;
+      if (!claim_slot(ticket)) {
+        return false; // Buffer is full
+      }
+      // Construct the object in the buffer by moving from temp_obj.
+      new (&_buffer[ticket & _mask]) T(std::move(temp_obj));
+      publish_slot(ticket);
+      return true;
+    }
+  }
 
-        // Publish that the data in this slot is ready.
-        // This release store synchronizes with the acquire load in try_pop.
-        _ready_flags[current_tail_ticket & _mask].store(true, std::memory_order_release);
-        return true;
-      } else {
-        // CAS failed: _tail was modified by another producer. Loop to retry.
+  /**
+   * @brief n contiguous slots reserved by try_claim(), filled in order.
+   *
+   * emplace() constructs the next slot; publish() makes everything emplaced
+   * since the previous publish() visible to the consumer as one group. Call
+   * it after every emplace() to publish slots individually. The destructor
+   * publishes what is left and marks unfilled slots as skipped, so a Claim
+   * must not outlive its buffer. Producer thread only; move-only.
+   */
+  class Claim {
+  public:
+    Claim() = default;
+    Claim(Claim &&other) noexcept
+        : _rb(std::exchange(other._rb, nullptr)), _ticket(other._ticket),
+          _size(other._size), _filled(other._filled),
+          _published(other._published) {}
+    Claim &operator=(Claim &&other) noexcept {
+      if (this != &other) {
+        release();
+        _rb = std::exchange(other._rb, nullptr);
+        _ticket = other._ticket;
+        _size = other._size;
+        _filled = other._filled;
+        _published = other._published;
       }
+      return *this;
+    }
+    ~Claim() { release(); }
+
+    explicit operator bool() const { return _rb != nullptr; }
+    size_t size() const { return _size; }
+    size_t filled() const { return _filled; }
+
+    // Constructs the next slot. Requires filled() < size(). If T's
+    // constructor throws, the slot stays unfilled.
+    template <typename... Args> T &emplace(Args &&...args) {
+      T *item = new (&_rb->_buffer[(_ticket + _filled) & _rb->_mask])
+          T(std::forward<Args>(args)...);
+      ++_filled;
+      return *item;
+    }
+
+    void publish() {
+      if (_filled == _published)
+        return;
+      for (size_t i = _filled; i-- > _published + 1;)
+        _rb->_ready_flags[(_ticket + i) & _rb->_mask].store(
+            kReady, std::memory_order_relaxed);
+      _rb->_ready_flags[(_ticket + _published) & _rb->_mask].store(
+          kReady, std::memory_order_release);
+      _published = _filled;
     }
+
+  private:
+    friend class MpscRingBuffer;
+    Claim(MpscRingBuffer *rb, size_t ticket, size_t size)
+        : _rb(rb), _ticket(ticket), _size(size) {}
+
+    void release() {
+      if (!_rb)
+        return;
+      publish();
+      for (size_t i = _filled; i < _size; ++i)
+        _rb->_ready_flags[(_ticket + i) & _rb->_mask].store(
+            kSkipped, std::memory_order_release);
+      _rb = nullptr;
+    }
+
+    MpscRingBuffer *_rb = nullptr;
+    size_t _ticket = 0;
+    size_t _size = 0;
+    size_t _filled = 0;
+    size_t _published = 0;
+  };
+
+  // Reserves n contiguous slots with a single CAS on _tail. Returns an
+  // empty Claim if fewer than n slots are free (or n is 0).
+  Claim try_claim(size_t n) {
+    size_t ticket;
+    if (n == 0 || !claim_slots(ticket, n))
+      return Claim();
+    return Claim(this, ticket, n);
   }
 
   bool try_pop(T &out_value) {
+    skip_abandoned();
     const size_t current_head = _head.load(std::memory_order_relaxed);
     // Relaxed load of _tail for initial check; _ready_flag is the true gate.
     if (current_head == _tail.load(std::memory_order_relaxed)) {
@@ -165,14 +253,16 @@ public:
     // A slot at current_head has been claimed by a producer.
     // Check if the data is actually ready using an acquire load on the flag.
     // This synchronizes with the producer's release store on this flag.
-    if (_ready_flags[current_head & _mask].load(std::memory_order_acquire)) {
+    if (_ready_flags[current_head & _mask].load(std::memory_order_acquire) ==
+        kReady) {
       // Data is ready.
       out_value = std::move(_buffer[current_head & _mask]);
       _buffer[current_head & _mask].~T();
 
       // Reset the ready flag for this slot. Relaxed is fine as this doesn't publish
       // new data; the subsequent _head.store(release) publishes slot availability.
-      _ready_flags[current_head & _mask].store(false, std::memory_order_relaxed);
+      _ready_flags[current_head & _mask].store(kEmpty,
+                                               std::memory_order_relaxed);
 
       // Advance _head, publishing that this slot (and its flag) is now fully processed and free.
       _head.store(current_head + 1, std::memory_order_release);
@@ -182,12 +272,87 @@ public:
     return false;
   }
 
+  // The item the next try_pop() returns, or nullptr if it is not ready yet.
+  // Consumer only; valid until that try_pop().
+  const T *front() {
+    skip_abandoned();
+    const size_t current_head = _head.load(std::memory_order_relaxed);
+    if (current_head == _tail.load(std::memory_order_relaxed) ||
+        _ready_flags[current_head & _mask].load(std::memory_order_acquire) !=
+            kReady) {
+      return nullptr;
+    }
+    return &_buffer[current_head & _mask];
+  }
+
+  size_t capacity() const { return _capacity; }
+
+  // Slots claimed but not yet popped. Exact only when no producer or
+  // consumer is active; otherwise a snapshot for monitoring.
+  size_t size() const {
+    const size_t head = _head.load(std::memory_order_relaxed);
+    const size_t tail = _tail.load(std::memory_order_relaxed);
+    return tail - head <= _capacity ? tail - head : 0;
+  }
+
 private:
+  // Slot states in _ready_flags.
+  static constexpr uint8_t kEmpty = 0;
+  static constexpr uint8_t kReady = 1;
+  static constexpr uint8_t kSkipped = 2; // Claimed, but never filled
+
+  // Consumer: frees the slots at the head that a Claim left unfilled.
+  void skip_abandoned() {
+    size_t current_head = _head.load(std::memory_order_relaxed);
+    while (current_head != _tail.load(std::memory_order_relaxed) &&
+           _ready_flags[current_head & _mask].load(
+               std::memory_order_acquire) == kSkipped) {
+      _ready_flags[current_head & _mask].store(kEmpty,
+                                               std::memory_order_relaxed);
+      _head.store(++current_head, std::memory_order_release);
+    }
+  }
+
+  // Claims the next slot for a producer. Returns false if the buffer is full.
+  bool claim_slot(size_t &ticket) { return claim_slots(ticket, 1); }
+
+  // Claims n consecutive tickets, the first in `ticket`. Returns false if
+  // fewer than n slots are free.
+  bool claim_slots(size_t &ticket, size_t n) {
+    while (true) { // Loop for CAS-based slot acquisition.
+      ticket = _tail.load(std::memory_order_relaxed); // Candidate slot index.
+      const size_t current_head = _head.load(std::memory_order_acquire);
+
+      // Buffer is full if the distance between tail and head would exceed
+      // capacity.
+      if (ticket - current_head + n > _capacity) {
+        return false;
+      }
+
+      // Attempt to claim the slot by advancing _tail.
+      // Relaxed ordering is used as _tail only claims slot; _ready_flags publishes data.
+      size_t expected_tail = ticket;
+      if (_tail.compare_exchange_weak(expected_tail, ticket + n,
+                                      std::memory_order_relaxed, // success
+                                      std::memory_order_relaxed  // failure
+                                      )) {
+        return true;
+      }
+      // CAS failed: _tail was modified by another producer. Loop to retry.
+    }
+  }
+
+  // Publish that the data in this slot is ready.
+  // This release store synchronizes with the acquire load in try_pop.
+  void publish_slot(size_t ticket) {
+    _ready_flags[ticket & _mask].store(kReady, std::memory_order_release);
+  }
+
   alignas(CACHE_LINE_SIZE) std::atomic<size_t> _head{0};
   alignas(CACHE_LINE_SIZE) std::atomic<size_t> _tail{0};
 
   size_t _capacity;
   size_t _mask;
   T *_buffer;
-  std::atomic<bool>* _ready_flags; // One flag per slot in _buffer
+  std::atomic<uint8_t> *_ready_flags; // One state per slot in _buffer
 };
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Bounds a table of open spans (span id -> what the processor keeps
+ * until the span ends).
+ *
+ * A span whose end is dropped, or that never ends, would otherwise stay in
+ * the table for the life of the process. Call this before inserting: once
+ * the table holds `max` entries it erases the older half by start time, so
+ * the cost is amortized O(1) per insertion. Returns the number erased.
+ */
+template <typename Map, typename StartTime>
+size_t trim_open_spans(Map &open, size_t max, StartTime start_time) {
+  if (open.size() < std::max<size_t>(max, 1))
+    return 0;
+  std::vector<uint64_t> starts;
+  starts.reserve(open.size());
+  for (const auto &[id, span] : open)
+    starts.push_back(start_time(span));
+  auto middle = starts.begin() + starts.size() / 2;
+  std::nth_element(starts.begin(), middle, starts.end());
+  const uint64_t cutoff = *middle;
+  const size_t before = open.size();
+  for (auto it = open.begin(); it != open.end();) {
+    if (start_time(it->second) < cutoff)
+      it = open.erase(it);
+    else
+      ++it;
+  }
+  // All starts equal: nothing is older than the cutoff.
+  if (open.size() == before)
+    open.clear();
+  return before - open.size();
+}
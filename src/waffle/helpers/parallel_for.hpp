@@ -0,0 +1,57 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Calls `fn(i)` for every i in [0, count) on up to `threads` threads
+ * (0 = hardware concurrency). Indices are handed out dynamically, so uneven
+ * work items (e.g. trace files of different sizes) balance themselves.
+ *
+ * The first exception thrown by `fn` stops the hand-out of new indices and is
+ * rethrown on the calling thread once all workers have finished.
+ */
+template <typename Fn>
+void parallel_for(size_t count, unsigned threads, Fn &&fn) {
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  const size_t workers = std::min<size_t>(threads, count);
+  if (workers <= 1) {
+    for (size_t i = 0; i < count; ++i)
+      fn(i);
+    return;
+  }
+
+  std::atomic<size_t> next{0};
+  std::atomic<bool> failed{false};
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  auto work = [&]() {
+    for (size_t i = next.fetch_add(1); i < count && !failed.load();
+         i = next.fetch_add(1)) {
+      try {
+        fn(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error)
+          error = std::current_exception();
+        failed.store(true);
+      }
+    }
+  };
+
+  std::vector<std::thread> pool;
+  pool.reserve(workers - 1);
+  for (size_t t = 1; t < workers; ++t)
+    pool.emplace_back(work);
+  work();
+  for (auto &thread : pool)
+    thread.join();
+  if (error)
+    std::rethrow_exception(error);
+}
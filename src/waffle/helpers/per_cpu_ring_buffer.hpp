@@ -0,0 +1,407 @@
+#pragma once
+
+/**
+ * @file per_cpu_ring_buffer.hpp
+ * @brief A bounded multi-producer, single-consumer queue made of one ring per
+ * CPU, committed with restartable sequences (rseq) where available.
+ *
+ * Producers on different CPUs never touch the same cache line, and with
+ * rseq a producer commits with plain loads and stores: the kernel restarts
+ * the critical section if the thread is preempted, migrated or signalled
+ * before its commit, so at most one producer per CPU is ever inside it. The
+ * cost does not depend on the number of threads, which per-thread buffers
+ * cannot offer to thousands of threads or fibers.
+ *
+ * Modes (see mode()):
+ * - SHARED: one MpscRingBuffer, as if this class were not there; used when
+ *   a single ring is requested.
+ * - RSEQ: one single-producer ring per CPU. A record is built on
+ *   the producer's stack and copied into the slot inside the critical
+ *   section; storing the new tail is the commit. Threads without a
+ *   registered rseq area, and CPUs beyond the ring count, use one extra
+ *   MpscRingBuffer.
+ * - ATOMIC: the fallback where rseq is unavailable (not x86-64, glibc older
+ *   than 2.35, rseq disabled, or WAFFLE_DISABLE_RSEQ): one MpscRingBuffer
+ *   per CPU, picked by the CPU a thread last ran on. Contention is per CPU
+ *   rather than global, but every record costs a CAS.
+ *
+ * The consumer merges the rings with `Before`: front() and try_pop() yield
+ * the head that orders first. Records a thread published on one CPU before
+ * migrating are visible once its later records on another CPU are (the
+ * commit is a release store), so if a ring looked empty the heads are read
+ * a second time before one is chosen. The chosen ring then yields a run,
+ * without reading the others again, while its head orders before the
+ * runner-up's and was visible at the first read (see scans()).
+ */
+
+#include "waffle/helpers/mpsc_ring_buffer.hpp"
+#include "waffle/waffle_thread.hpp" // WAFFLE_HAVE_RSEQ, detail::current_cpu
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#if defined(__linux__)
+#include <unistd.h> // For sysconf
+#endif
+
+// The critical section is an asm goto with outputs: GCC 11, Clang 11.
+#if WAFFLE_HAVE_RSEQ && defined(__x86_64__) &&                                \
+    (defined(__clang__) ? __clang_major__ >= 11 : __GNUC__ >= 11)
+#define WAFFLE_HAVE_RSEQ_RINGS 1
+#else
+#define WAFFLE_HAVE_RSEQ_RINGS 0
+#endif
+
+#if WAFFLE_HAVE_RSEQ_RINGS
+namespace per_cpu_detail {
+
+inline volatile struct rseq *rseq_area() {
+  return reinterpret_cast<volatile struct rseq *>(
+      static_cast<char *>(__builtin_thread_pointer()) + __rseq_offset);
+}
+
+enum class RseqPush { COMMITTED, FULL, RESTART };
+
+// Copies `size` bytes from `src` into the next slot of a per-CPU ring and
+// advances `tail`, unless `head` is a capacity behind. Critical section
+// [1, 2), abort handler at 4: between the store of the descriptor and the
+// commit the thread either runs on `cpu` without interruption, or the
+// kernel moves it to 4 and the caller retries.
+//
+// The descriptor (3) and the abort handler go to sections of their own,
+// in the section group of the code (the `?` flag), so they are kept or
+// discarded with the COMDAT function this is inlined into. `tail` and
+// the area's rseq_cs are written, so they are outputs; the slot mask is
+// derived from `capacity` in place to leave a register for `tail`.
+inline RseqPush rseq_push(volatile struct rseq *area, int32_t cpu,
+                          uint64_t &tail, const uint64_t &head,
+                          uint64_t capacity, void *slots, const void *src,
+                          size_t size) {
+  asm goto(".pushsection __rseq_cs, \"aw?\"\n\t"
+           ".balign 32\n\t"
+           "3:\n\t"
+           ".long 0x0, 0x0\n\t"
+           ".quad 1f, (2f - 1f), 4f\n\t"
+           ".popsection\n\t"
+           "leaq 3b(%%rip), %%rax\n\t"
+           "movq %%rax, %[rseq_cs]\n\t"
+           "1:\n\t"
+           "cmpl %[cpu], %[cpu_id]\n\t"
+           "jnz %l[restart]\n\t"
+           "movq %[tail], %%rax\n\t"
+           "movq %%rax, %%rcx\n\t"
+           "subq %[head], %%rcx\n\t"
+           "cmpq %[capacity], %%rcx\n\t"
+           "jae %l[full]\n\t"
+           "movq %[capacity], %%rdi\n\t"
+           "decq %%rdi\n\t"
+           "andq %%rax, %%rdi\n\t"
+           "imulq %[size], %%rdi\n\t"
+           "addq %[slots], %%rdi\n\t"
+           "movq %[src], %%rsi\n\t"
+           "movq %[size], %%rcx\n\t"
+           "rep movsb\n\t"
+           "incq %%rax\n\t"
+           "movq %%rax, %[tail]\n\t" // Commit
+           "2:\n\t"
+           ".pushsection __rseq_failure, \"ax?\"\n\t"
+           // ud1 with the signature as its displacement, which the
+           // kernel checks right before the abort handler.
+           ".byte 0x0f, 0xb9, 0x3d\n\t"
+           ".long %c[sig]\n\t"
+           "4:\n\t"
+           "jmp %l[restart]\n\t"
+           ".popsection\n\t"
+           : [rseq_cs] "=m"(area->rseq_cs), [tail] "+m"(tail)
+           : [cpu] "r"(cpu), [cpu_id] "m"(area->cpu_id),
+             [head] "m"(head), [capacity] "r"(capacity),
+             [size] "ri"(size), [slots] "r"(slots), [src] "r"(src),
+             [sig] "i"(RSEQ_SIG)
+           : "memory", "cc", "rax", "rcx", "rdi", "rsi"
+           : restart, full);
+  return RseqPush::COMMITTED;
+full:
+  return RseqPush::FULL;
+restart:
+  return RseqPush::RESTART;
+}
+
+} // namespace per_cpu_detail
+#endif
+
+template <typename T, typename Before = std::less<T>> class PerCpuRingBuffer {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "Records are copied into per-CPU slots inside the critical "
+                "section");
+
+public:
+  enum class Mode : uint8_t { SHARED, RSEQ, ATOMIC };
+
+  // `capacity` is per ring (rounded up to a power of two). `cpus` rings
+  // are made, normally configured_cpus(); with 1 there is only the SHARED
+  // ring. `allow_rseq` false forces the ATOMIC mode.
+  PerCpuRingBuffer(size_t capacity, size_t cpus, bool allow_rseq = true,
+                   Before before = Before())
+      : _before(before) {
+    if (cpus <= 1) {
+      _mode = Mode::SHARED;
+      _shared.push_back(std::make_unique<MpscRingBuffer<T>>(capacity));
+    } else if (allow_rseq && rseq_usable()) {
+      _mode = Mode::RSEQ;
+      _ring_capacity = next_power_of_two(capacity);
+      _cpu_rings.reset(new CpuRing[cpus]);
+      _cpu_ring_count = cpus;
+      for (size_t cpu = 0; cpu < cpus; ++cpu)
+        _cpu_rings[cpu].slots = static_cast<T *>(
+            ::operator new(_ring_capacity * sizeof(T)));
+      _shared.push_back(std::make_unique<MpscRingBuffer<T>>(capacity));
+    } else {
+      _mode = Mode::ATOMIC;
+      for (size_t cpu = 0; cpu < cpus; ++cpu)
+        _shared.push_back(std::make_unique<MpscRingBuffer<T>>(capacity));
+    }
+    _ring_capacity = _shared[0]->capacity();
+  }
+
+  ~PerCpuRingBuffer() {
+    for (size_t cpu = 0; cpu < _cpu_ring_count; ++cpu)
+      ::operator delete(_cpu_rings[cpu].slots);
+  }
+
+  PerCpuRingBuffer(const PerCpuRingBuffer &) = delete;
+  PerCpuRingBuffer &operator=(const PerCpuRingBuffer &) = delete;
+
+  template <typename... Args> bool try_emplace(Args &&...args) {
+    if (_mode == Mode::SHARED) [[likely]]
+      return _shared[0]->try_emplace(std::forward<Args>(args)...);
+#if WAFFLE_HAVE_RSEQ_RINGS
+    if (_mode == Mode::RSEQ) {
+      const T item(std::forward<Args>(args)...);
+      return push_rseq(item);
+    }
+#endif
+    const uint16_t cpu = Waffle::detail::current_cpu();
+    return _shared[cpu % _shared.size()]->try_emplace(
+        std::forward<Args>(args)...);
+  }
+
+  // Consumer only. The head that orders first over all rings, or nullptr if
+  // they are all empty; valid until the next try_pop().
+  const T *front() {
+    if (_mode == Mode::SHARED) {
+      ++_scans;
+      return _shared[0]->front();
+    }
+    if (_selected || continue_run())
+      return _selected_head;
+    ++_scans;
+    bool any_empty = false;
+    select(any_empty, true);
+    if (_selected && any_empty)
+      select(any_empty, false);
+    _run_open = _selected && !any_empty;
+    return _selected ? _selected_head : nullptr;
+  }
+
+  // Consumer only.
+  bool try_pop(T &out) {
+    if (_mode == Mode::SHARED)
+      return _shared[0]->try_pop(out);
+    if (!_selected && !front())
+      return false;
+    const bool popped = _selected->pop(out, *this);
+    _run = popped ? _selected : nullptr;
+    _selected = nullptr;
+    return popped;
+  }
+
+  // Consumer only. Counts the times front() read every ring. A head it
+  // returns while this is unchanged was visible when it last did, so a
+  // caller merging several of these can take runs as front() does.
+  uint64_t scans() const { return _scans; }
+
+  static size_t configured_cpus() {
+#if defined(__linux__)
+    const long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    return cpus > 0 ? static_cast<size_t>(cpus) : 1;
+#else
+    return 1;
+#endif
+  }
+
+  Mode mode() const { return _mode; }
+  size_t ring_count() const { return _cpu_ring_count + _shared.size(); }
+  // Capacity of each ring.
+  size_t capacity() const { return _ring_capacity; }
+  // Records in all rings; a snapshot while producers are active.
+  size_t size() const {
+    size_t total = 0;
+    for (const auto &ring : _shared)
+      total += ring->size();
+    for (size_t cpu = 0; cpu < _cpu_ring_count; ++cpu)
+      total += _cpu_rings[cpu].size();
+    return total;
+  }
+  // Fill level of the fullest ring, in [0, 1]: one busy CPU can fill its
+  // ring while the others are empty.
+  double occupancy() const {
+    size_t fullest = 0;
+    for (const auto &ring : _shared)
+      fullest = std::max(fullest, ring->size());
+    for (size_t cpu = 0; cpu < _cpu_ring_count; ++cpu)
+      fullest = std::max(fullest, _cpu_rings[cpu].size());
+    return static_cast<double>(fullest) / _ring_capacity;
+  }
+
+private:
+  // A ring with one producer at a time per CPU. `tail` is written by the
+  // critical section, `head` by the consumer; each is read by the other
+  // side through std::atomic_ref.
+  struct CpuRing {
+    alignas(CACHE_LINE_SIZE) uint64_t tail = 0;
+    alignas(CACHE_LINE_SIZE) uint64_t head = 0;
+    uint64_t seen = 0; // Consumer: the tail at the last first read
+    T *slots = nullptr;
+
+    size_t size() const {
+      auto &self = const_cast<CpuRing &>(*this);
+      return std::atomic_ref<uint64_t>(self.tail).load(
+                 std::memory_order_relaxed) -
+             std::atomic_ref<uint64_t>(self.head).load(
+                 std::memory_order_relaxed);
+    }
+  };
+
+  // What front() chose: a CpuRing or a shared ring.
+  struct Source {
+    CpuRing *cpu_ring = nullptr;
+    MpscRingBuffer<T> *shared = nullptr;
+
+    bool pop(T &out, PerCpuRingBuffer &rb) const {
+      if (shared)
+        return shared->try_pop(out);
+      const uint64_t head = cpu_ring->head;
+      std::memcpy(static_cast<void *>(&out),
+                  &cpu_ring->slots[head & (rb._ring_capacity - 1)],
+                  sizeof(T));
+      std::atomic_ref<uint64_t>(cpu_ring->head)
+          .store(head + 1, std::memory_order_release);
+      return true;
+    }
+  };
+
+#if WAFFLE_HAVE_RSEQ_RINGS
+  // glibc registers rseq for every thread or for none (the tunable is
+  // process-wide), so the constructing thread speaks for all of them.
+  static bool rseq_usable() {
+    return __rseq_size > 0 &&
+           static_cast<int32_t>(per_cpu_detail::rseq_area()->cpu_id) >= 0;
+  }
+
+  bool push_rseq(const T &item) {
+    volatile struct rseq *area = per_cpu_detail::rseq_area();
+    while (true) {
+      const auto cpu = static_cast<int32_t>(area->cpu_id);
+      if (cpu < 0 || static_cast<size_t>(cpu) >= _cpu_ring_count)
+        return _shared[0]->try_emplace(item);
+      CpuRing &ring = _cpu_rings[cpu];
+      switch (per_cpu_detail::rseq_push(area, cpu, ring.tail, ring.head,
+                                        _ring_capacity, ring.slots, &item,
+                                        sizeof(T))) {
+      case per_cpu_detail::RseqPush::COMMITTED:
+        return true;
+      case per_cpu_detail::RseqPush::FULL:
+        return false;
+      case per_cpu_detail::RseqPush::RESTART:
+        break; // Preempted, migrated or signalled: read the CPU again
+      }
+    }
+  }
+#else
+  static bool rseq_usable() { return false; }
+#endif
+
+  // Reads every head and keeps the first two. On the `first` read of a
+  // front() each CpuRing remembers its tail, which bounds the run taken
+  // from it: a record a thread published before migrating is visible by
+  // the second read if its later ones were by the first.
+  void select(bool &any_empty, bool first) {
+    _selected = nullptr;
+    _selected_head = nullptr;
+    _runner_up = nullptr;
+    auto consider = [&](const T *head, Source source) {
+      any_empty |= !head;
+      if (!head)
+        return;
+      if (!_selected_head || _before(*head, *_selected_head)) {
+        _runner_up = _selected_head;
+        _selected_head = head;
+        _selected_source = source;
+        _selected = &_selected_source;
+      } else if (!_runner_up || _before(*head, *_runner_up)) {
+        _runner_up = head;
+      }
+    };
+    for (size_t cpu = 0; cpu < _cpu_ring_count; ++cpu) {
+      CpuRing &ring = _cpu_rings[cpu];
+      const uint64_t head = ring.head;
+      const uint64_t tail =
+          std::atomic_ref<uint64_t>(ring.tail).load(std::memory_order_acquire);
+      if (first)
+        ring.seen = tail;
+      consider(tail != head ? &ring.slots[head & (_ring_capacity - 1)]
+                            : nullptr,
+               Source{&ring, nullptr});
+    }
+    for (const auto &ring : _shared)
+      consider(ring->front(), Source{nullptr, ring.get()});
+  }
+
+  // After a pop: selects the next head of the same ring if it still orders
+  // before the runner-up, whose ring has not been popped since. A shared
+  // ring has no tail to bound the run by, so it continues only if no ring
+  // looked empty.
+  bool continue_run() {
+    const Source *run = _run;
+    _run = nullptr;
+    if (!run)
+      return false;
+    const T *head = nullptr;
+    if (run->cpu_ring) {
+      CpuRing &ring = *run->cpu_ring;
+      if (ring.head < ring.seen)
+        head = &ring.slots[ring.head & (_ring_capacity - 1)];
+    } else if (_run_open) {
+      head = run->shared->front();
+    }
+    if (!head || (_runner_up && _before(*_runner_up, *head)))
+      return false;
+    _selected_head = head;
+    _selected = run;
+    return true;
+  }
+
+  Mode _mode = Mode::SHARED;
+  Before _before;
+  size_t _ring_capacity = 0;
+  std::unique_ptr<CpuRing[]> _cpu_rings;
+  size_t _cpu_ring_count = 0;
+  // SHARED: the ring; RSEQ: the overflow ring; ATOMIC: one per CPU.
+  std::vector<std::unique_ptr<MpscRingBuffer<T>>> _shared;
+
+  // Consumer state between front() and try_pop(), and of the run the last
+  // try_pop() continues (_run, same as _selected_source when set).
+  const T *_selected_head = nullptr;
+  Source _selected_source;
+  const Source *_selected = nullptr;
+  const T *_runner_up = nullptr;
+  const Source *_run = nullptr;
+  bool _run_open = false;
+  uint64_t _scans = 0;
+};
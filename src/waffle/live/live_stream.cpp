@@ -0,0 +1,495 @@
+#include "waffle/live/live_stream.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace Waffle::live {
+
+using trace_file::ChunkHeader;
+using trace_file::ChunkType;
+using trace_file::FileAttribute;
+using trace_file::RecordHeader;
+using trace_file::TraceRecord;
+
+namespace {
+
+// Records between checks for new connections and subscriptions while the
+// ring is busy (flush() checks when it is idle).
+constexpr uint32_t kServiceInterval = 4096;
+// Bound on remembered matching spans per client, whose SPAN_END records are
+// forwarded; spans that never end must not grow it forever.
+constexpr size_t kMaxOpenSpans = 1 << 16;
+constexpr size_t kMaxRequestBytes = 4096;
+
+uint64_t hash_of(std::string_view s) { return fnv1a_hash(s.data(), s.size()); }
+
+[[noreturn]] void fail(int error, const std::string &what) {
+  throw std::system_error(error, std::generic_category(), what);
+}
+
+sockaddr_un socket_address(const std::string &path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(address.sun_path))
+    fail(ENAMETOOLONG, "Invalid live stream socket path '" + path + "'");
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  return address;
+}
+
+void append(std::vector<char> &out, const void *data, size_t size) {
+  const char *bytes = static_cast<const char *>(data);
+  out.insert(out.end(), bytes, bytes + size);
+}
+
+bool value_equals(const LiveFilter::AttributeMatch &m,
+                  const AttributeValue &v) {
+  switch (v.type) {
+  case AttributeValue::Type::STRING_ID:
+    return v.string_id == m.string_id;
+  case AttributeValue::Type::INT64:
+    return m.is_integer && v.i64 == m.integer;
+  case AttributeValue::Type::DOUBLE:
+    return m.is_number && v.f64 == m.number;
+  case AttributeValue::Type::BOOL:
+    return m.is_bool && v.b == m.boolean;
+  }
+  return false;
+}
+
+} // namespace
+
+// --- LiveFilter ---
+
+LiveFilter LiveFilter::parse(std::string_view spec) {
+  LiveFilter filter;
+  size_t at = 0;
+  while (true) {
+    at = spec.find_first_not_of(" \t\r\n", at);
+    if (at == std::string_view::npos)
+      break;
+    size_t end = spec.find_first_of(" \t\r\n", at);
+    if (end == std::string_view::npos)
+      end = spec.size();
+    const std::string_view term = spec.substr(at, end - at);
+    at = end;
+
+    const size_t eq = term.find('=');
+    if (eq == std::string_view::npos || eq == 0 || eq + 1 == term.size())
+      throw std::invalid_argument("Not a filter term: " + std::string(term));
+    const std::string_view field = term.substr(0, eq);
+    std::string_view value = term.substr(eq + 1);
+    if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+      value = value.substr(1, value.size() - 2);
+
+    if (field == "name") {
+      filter.names.push_back(hash_of(value));
+    } else if (field == "trace") {
+      const std::string text(value);
+      char *parsed_end = nullptr;
+      const uint64_t id = std::strtoull(text.c_str(), &parsed_end, 0);
+      if (*parsed_end != '\0' || id == 0)
+        throw std::invalid_argument("Not a trace id: " + text);
+      filter.trace_ids.push_back(id);
+    } else if (field.starts_with("attr.") && field.size() > 5) {
+      AttributeMatch m{};
+      m.key_id = hash_of(field.substr(5));
+      m.string_id = hash_of(value);
+      const char *first = value.data();
+      const char *last = value.data() + value.size();
+      m.is_integer = std::from_chars(first, last, m.integer).ptr == last;
+      m.is_number = std::from_chars(first, last, m.number).ptr == last;
+      m.is_bool = value == "true" || value == "false";
+      m.boolean = value == "true";
+      filter.attributes.push_back(m);
+    } else {
+      throw std::invalid_argument("Unknown filter field: " +
+                                  std::string(field));
+    }
+  }
+  return filter;
+}
+
+bool LiveFilter::matches(const Tracelet &record) const {
+  if (!names.empty() && std::find(names.begin(), names.end(),
+                                  record.name_string_hash) == names.end())
+    return false;
+  if (!trace_ids.empty() &&
+      std::find(trace_ids.begin(), trace_ids.end(), record.trace_id.value) ==
+          trace_ids.end())
+    return false;
+  for (const AttributeMatch &m : attributes) {
+    bool found = false;
+    for (auto it = record.attributes_begin(); it != record.attributes_end();
+         ++it) {
+      if (it->key_id == m.key_id && value_equals(m, it->value)) {
+        found = true;
+        break;
+      }
+    }
+    if (!found)
+      return false;
+  }
+  return true;
+}
+
+// --- LiveStreamServer ---
+
+struct LiveStreamServer::Client {
+  int fd;
+  bool subscribed = false;
+  bool closed = false;
+  std::string request; // Filter spec, until its '\n'
+  LiveFilter filter;
+  std::unordered_set<uint64_t> open_spans; // Matched, not yet ended
+
+  // Chunks being built.
+  std::unordered_set<uint64_t> strings_sent;
+  std::vector<char> strings;
+  uint32_t string_count = 0;
+  std::vector<TraceRecord> records;
+  size_t record_bytes = 0;
+
+  // Encoded bytes not yet accepted by the socket.
+  std::vector<char> out;
+  size_t out_offset = 0;
+
+  uint64_t records_sent = 0;
+  uint64_t records_dropped = 0;
+
+  size_t buffered() const { return out.size() - out_offset; }
+};
+
+LiveStreamServer::LiveStreamServer(Options options)
+    : _options(std::move(options)) {}
+
+LiveStreamServer::~LiveStreamServer() {
+  if (_listen_fd >= 0)
+    shutdown();
+}
+
+void LiveStreamServer::on_start(const ProcessorContext &context) {
+  std::memcpy(_header.magic, trace_file::kMagic, sizeof(trace_file::kMagic));
+  _header.version = trace_file::kVersion;
+  _header.header_size = sizeof(trace_file::FileHeader);
+  _header.process_tag = context.process_tag;
+  _header.start_wall_ns = context.start_wall_ns;
+  _header.rank = trace_file::kNoRank;
+
+  const sockaddr_un address = socket_address(_options.socket_path);
+  // A socket left behind by an earlier run would make bind() fail.
+  struct stat st;
+  if (::lstat(address.sun_path, &st) == 0 && S_ISSOCK(st.st_mode))
+    ::unlink(address.sun_path);
+
+  _listen_fd =
+      ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (_listen_fd < 0)
+    fail(errno, "Cannot create live stream socket");
+  if (::bind(_listen_fd, reinterpret_cast<const sockaddr *>(&address),
+             sizeof(address)) != 0 ||
+      ::listen(_listen_fd, 16) != 0) {
+    const int error = errno;
+    ::close(_listen_fd);
+    _listen_fd = -1;
+    fail(error, "Cannot listen on " + _options.socket_path);
+  }
+}
+
+void LiveStreamServer::accept_clients() {
+  while (true) {
+    const int fd =
+        ::accept4(_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+      return; // EAGAIN: no more pending connections
+    if (_clients.size() >= _options.max_clients) {
+      static constexpr char kBusy[] = "ERR too many clients\n";
+      ::send(fd, kBusy, sizeof(kBusy) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+      ::close(fd);
+      ++_clients_rejected;
+      continue;
+    }
+    auto client = std::make_unique<Client>();
+    client->fd = fd;
+    _clients.push_back(std::move(client));
+  }
+}
+
+void LiveStreamServer::read_subscription(Client &client) {
+  char buffer[512];
+  while (true) {
+    const ssize_t n = ::recv(client.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return;
+    if (n <= 0) {
+      client.closed = true;
+      return;
+    }
+    client.request.append(buffer, static_cast<size_t>(n));
+    const size_t newline = client.request.find('\n');
+    if (newline == std::string::npos) {
+      if (client.request.size() <= kMaxRequestBytes)
+        continue;
+      client.request = "ERR filter too long\n";
+    } else {
+      try {
+        client.filter = LiveFilter::parse(
+            std::string_view(client.request).substr(0, newline));
+        client.subscribed = true;
+        append(client.out, &_header, sizeof(_header));
+        send_pending(client);
+        return;
+      } catch (const std::invalid_argument &e) {
+        client.request = std::string("ERR ") + e.what() + "\n";
+      }
+    }
+    ::send(client.fd, client.request.data(), client.request.size(),
+           MSG_DONTWAIT | MSG_NOSIGNAL);
+    client.closed = true;
+    ++_clients_rejected;
+    return;
+  }
+}
+
+void LiveStreamServer::add_string(
+    Client &client, uint64_t hash,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  if (client.strings_sent.count(hash))
+    return;
+  auto it = strings.find(hash);
+  if (it == strings.end())
+    return;
+  client.strings_sent.insert(hash);
+  const uint32_t length = static_cast<uint32_t>(it->second.size());
+  append(client.strings, &hash, sizeof(hash));
+  append(client.strings, &length, sizeof(length));
+  append(client.strings, it->second.data(), length);
+  ++client.string_count;
+}
+
+void LiveStreamServer::on_record(
+    const Tracelet &record,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  if (++_records_since_service >= kServiceInterval) {
+    _records_since_service = 0;
+    flush();
+  }
+  for (auto &c : _clients) {
+    Client &client = *c;
+    if (!client.subscribed || client.closed)
+      continue;
+    bool match;
+    switch (record.record_type) {
+    case Tracelet::RecordType::THREAD_INFO:
+      match = true;
+      break;
+    case Tracelet::RecordType::SPAN_END:
+      match = client.filter.empty() ||
+              client.open_spans.erase(record.span_id.value) > 0;
+      break;
+    case Tracelet::RecordType::SPAN_START:
+      match = client.filter.matches(record);
+      if (match && !client.filter.empty()) {
+        if (client.open_spans.size() >= kMaxOpenSpans)
+          client.open_spans.clear();
+        client.open_spans.insert(record.span_id.value);
+      }
+      break;
+    default:
+      match = client.filter.matches(record);
+      break;
+    }
+    if (!match)
+      continue;
+
+    add_string(client, record.name_string_hash, strings);
+    for (auto it = record.attributes_begin(); it != record.attributes_end();
+         ++it) {
+      add_string(client, it->key_id, strings);
+      if (it->value.type == AttributeValue::Type::STRING_ID)
+        add_string(client, it->value.string_id, strings);
+    }
+    client.records.push_back(TraceRecord{record, 0});
+    client.record_bytes += sizeof(RecordHeader) +
+                           record.num_attributes * sizeof(FileAttribute);
+    if (client.record_bytes >= _options.chunk_bytes) {
+      seal_chunk(client);
+      send_pending(client);
+    }
+  }
+}
+
+void LiveStreamServer::seal_chunk(Client &client) {
+  // Strings are always queued, even past the buffer bound: they are few,
+  // and later chunks may reference them.
+  if (client.string_count > 0) {
+    const ChunkHeader chunk{ChunkType::STRINGS, client.string_count,
+                            client.strings.size(), 0, 0};
+    append(client.out, &chunk, sizeof(chunk));
+    append(client.out, client.strings.data(), client.strings.size());
+    client.strings.clear();
+    client.string_count = 0;
+  }
+  if (client.records.empty())
+    return;
+  if (client.buffered() + client.record_bytes > _options.max_buffered_bytes) {
+    client.records_dropped += client.records.size();
+  } else {
+    std::stable_sort(client.records.begin(), client.records.end(),
+                     [](const TraceRecord &a, const TraceRecord &b) {
+                       return a.tracelet.timestamp < b.tracelet.timestamp;
+                     });
+    const ChunkHeader chunk{ChunkType::RECORDS,
+                            static_cast<uint32_t>(client.records.size()),
+                            client.record_bytes,
+                            client.records.front().tracelet.timestamp,
+                            client.records.back().tracelet.timestamp};
+    append(client.out, &chunk, sizeof(chunk));
+    for (const TraceRecord &r : client.records) {
+      const RecordHeader header = trace_file::encode_header(r.tracelet, 0);
+      append(client.out, &header, sizeof(header));
+      for (auto it = r.tracelet.attributes_begin();
+           it != r.tracelet.attributes_end(); ++it) {
+        const FileAttribute attr = trace_file::encode_attribute(*it);
+        append(client.out, &attr, sizeof(attr));
+      }
+    }
+    client.records_sent += client.records.size();
+  }
+  client.records.clear();
+  client.record_bytes = 0;
+}
+
+void LiveStreamServer::send_pending(Client &client) {
+  while (client.buffered() > 0) {
+    const ssize_t n =
+        ::send(client.fd, client.out.data() + client.out_offset,
+               client.buffered(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n > 0) {
+      client.out_offset += static_cast<size_t>(n);
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else {
+      if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        client.closed = true; // Gone (EPIPE, ECONNRESET)
+      break;
+    }
+  }
+  if (client.out_offset == client.out.size()) {
+    client.out.clear();
+    client.out_offset = 0;
+  } else if (client.out_offset > client.out.size() / 2) {
+    client.out.erase(client.out.begin(),
+                     client.out.begin() +
+                         static_cast<std::ptrdiff_t>(client.out_offset));
+    client.out_offset = 0;
+  }
+}
+
+void LiveStreamServer::remove_closed_clients() {
+  size_t kept = 0;
+  for (auto &client : _clients) {
+    if (!client->closed) {
+      _clients[kept++] = std::move(client);
+      continue;
+    }
+    ::close(client->fd);
+    _records_sent_closed += client->records_sent;
+    _records_dropped_closed += client->records_dropped;
+  }
+  _clients.resize(kept);
+}
+
+void LiveStreamServer::flush() {
+  if (_listen_fd < 0)
+    return;
+  accept_clients();
+  for (auto &client : _clients) {
+    if (client->closed)
+      continue;
+    if (!client->subscribed) {
+      read_subscription(*client);
+    } else {
+      seal_chunk(*client);
+      send_pending(*client);
+    }
+  }
+  remove_closed_clients();
+}
+
+void LiveStreamServer::shutdown() {
+  if (_listen_fd < 0)
+    return;
+  flush();
+  for (auto &client : _clients)
+    client->closed = true;
+  remove_closed_clients();
+  ::close(_listen_fd);
+  _listen_fd = -1;
+  ::unlink(_options.socket_path.c_str());
+}
+
+LiveStreamServer::Stats LiveStreamServer::stats() const {
+  Stats s;
+  s.clients = _clients.size();
+  s.records_sent = _records_sent_closed;
+  s.records_dropped = _records_dropped_closed;
+  for (const auto &client : _clients) {
+    s.records_sent += client->records_sent;
+    s.records_dropped += client->records_dropped;
+  }
+  s.clients_rejected = _clients_rejected;
+  return s;
+}
+
+// --- LiveStreamClient ---
+
+LiveStreamClient::LiveStreamClient(const std::string &socket_path,
+                                   std::string_view filter) {
+  const sockaddr_un address = socket_address(socket_path);
+  const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    fail(errno, "Cannot create socket");
+  std::string request(filter);
+  request += '\n';
+  if (::connect(fd, reinterpret_cast<const sockaddr *>(&address),
+                sizeof(address)) != 0 ||
+      ::send(fd, request.data(), request.size(), MSG_NOSIGNAL) !=
+          static_cast<ssize_t>(request.size())) {
+    const int error = errno;
+    ::close(fd);
+    fail(error, "Cannot subscribe to " + socket_path);
+  }
+
+  // The reply is either a trace file header or an "ERR ..." line.
+  char peek[4] = {};
+  const ssize_t n = ::recv(fd, peek, 3, MSG_PEEK | MSG_WAITALL);
+  if (n == 3 && std::memcmp(peek, "ERR", 3) == 0) {
+    std::string message;
+    char c;
+    while (::recv(fd, &c, 1, 0) == 1 && c != '\n')
+      message += c;
+    ::close(fd);
+    throw std::invalid_argument(socket_path + ": " +
+                                (message.size() > 4 ? message.substr(4) : ""));
+  }
+  std::FILE *file = ::fdopen(fd, "rb");
+  if (!file) {
+    const int error = errno;
+    ::close(fd);
+    fail(error, "Cannot read " + socket_path);
+  }
+  _reader = std::make_unique<trace_file::TraceFileReader>(file, socket_path);
+}
+
+} // namespace Waffle::live
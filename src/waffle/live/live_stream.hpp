@@ -0,0 +1,151 @@
+#pragma once
+
+#include "waffle/processor/iprocessor.hpp"
+#include "waffle/trace_file/trace_file_reader.hpp"
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace Waffle::live {
+
+/**
+ * @brief Which records a live stream subscriber receives.
+ *
+ * Parsed from whitespace-separated terms:
+ *
+ *   name=NAME            record name (repeatable: any of them)
+ *   trace=ID             trace id, decimal or 0x-hex (repeatable: any)
+ *   attr.KEY=VALUE       attribute equality (repeatable: all of them);
+ *                        VALUE is an integer, decimal, true/false or string
+ *
+ * An empty filter matches everything. Matching compares hashes and raw
+ * values only: no string table lookups on the processing thread.
+ */
+struct LiveFilter {
+  struct AttributeMatch {
+    uint64_t key_id;
+    uint64_t string_id; // Hash of the value text
+    bool is_integer;
+    int64_t integer;
+    bool is_number;
+    double number;
+    bool is_bool;
+    bool boolean;
+  };
+
+  std::vector<uint64_t> names;
+  std::vector<uint64_t> trace_ids;
+  std::vector<AttributeMatch> attributes;
+
+  // @throw std::invalid_argument On an unknown or malformed term.
+  static LiveFilter parse(std::string_view spec);
+
+  bool empty() const {
+    return names.empty() && trace_ids.empty() && attributes.empty();
+  }
+
+  // SPAN_END records carry no name or attributes; the server forwards them
+  // for the spans whose start matched.
+  bool matches(const Tracelet &record) const;
+};
+
+/**
+ * @brief Processor serving records live on a Unix domain socket, so a
+ * running process can be watched without changing its exporters.
+ *
+ * A client connects, sends a LiveFilter spec terminated by '\n', and
+ * receives a Waffle trace file stream (FileHeader, then STRINGS and RECORDS
+ * chunks) of the matching records from then on. THREAD_INFO records always
+ * pass. An invalid spec is answered with "ERR <message>\n" and the
+ * connection is closed.
+ *
+ * Everything runs on the processing thread with non-blocking sockets: the
+ * filter is evaluated as records arrive, and chunks are sent when they
+ * reach `chunk_bytes` or on flush(). A client that reads too slowly is
+ * never waited for: once `max_buffered_bytes` are queued for it, further
+ * RECORDS chunks are dropped for that client (and counted), so its stream
+ * stays well-formed but has gaps. New connections are accepted on flush()
+ * and every few thousand records.
+ */
+class LiveStreamServer : public IProcessor {
+public:
+  struct Options {
+    std::string socket_path;
+    size_t max_clients = 8;
+    size_t chunk_bytes = 64 << 10;
+    size_t max_buffered_bytes = 4 << 20; // Per client
+  };
+
+  struct Stats {
+    size_t clients = 0;
+    uint64_t records_sent = 0;    // Summed over clients
+    uint64_t records_dropped = 0; // For slow clients
+    uint64_t clients_rejected = 0;
+  };
+
+  explicit LiveStreamServer(Options options);
+  ~LiveStreamServer() override;
+
+  // Creates the socket, replacing a stale one at the same path.
+  // @throw std::system_error If the socket cannot be created.
+  void on_start(const ProcessorContext &context) override;
+  void on_record(const Tracelet &record,
+                 const std::unordered_map<uint64_t, std::string> &strings)
+      override;
+  void flush() override;
+  // Sends what is buffered, as far as clients accept it without blocking,
+  // then disconnects them and removes the socket.
+  void shutdown() override;
+
+  // Processing thread only (or after shutdown()).
+  Stats stats() const;
+
+private:
+  struct Client;
+
+  void accept_clients();
+  void read_subscription(Client &client);
+  void add_string(Client &client, uint64_t hash,
+                  const std::unordered_map<uint64_t, std::string> &strings);
+  void seal_chunk(Client &client);
+  void send_pending(Client &client);
+  void remove_closed_clients();
+
+  Options _options;
+  int _listen_fd = -1;
+  trace_file::FileHeader _header{};
+  std::vector<std::unique_ptr<Client>> _clients;
+  uint32_t _records_since_service = 0;
+  uint64_t _records_sent_closed = 0; // By clients already gone
+  uint64_t _records_dropped_closed = 0;
+  uint64_t _clients_rejected = 0;
+};
+
+/**
+ * @brief Subscribes to a LiveStreamServer and reads the records it sends.
+ * Also fetches traces from a TraceCache control socket, which answers the
+ * same requests with a stream that ends after the trace.
+ *
+ * @throw std::system_error If the socket cannot be reached.
+ * @throw std::invalid_argument If the server rejects the filter.
+ */
+class LiveStreamClient {
+public:
+  LiveStreamClient(const std::string &socket_path, std::string_view filter);
+
+  // Blocks until a record arrives; false once the server has gone away.
+  bool next(trace_file::TraceRecord &out) { return _reader->next(out); }
+
+  const std::unordered_map<uint64_t, std::string> &strings() const {
+    return _reader->strings();
+  }
+  const trace_file::FileHeader &header() const { return _reader->header(); }
+
+private:
+  std::unique_ptr<trace_file::TraceFileReader> _reader;
+};
+
+} // namespace Waffle::live
@@ -0,0 +1,488 @@
+#include "waffle/live/trace_cache.hpp"
+
+#include "waffle/helpers/open_spans.hpp"
+#include "waffle/live/live_stream.hpp"
+#include "waffle/trace_file/trace_file_writer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <shared_mutex>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace Waffle::live {
+
+namespace {
+
+// One index slot per this many segment bytes; a segment is sealed once its
+// index is three quarters full, even if it has room for more spans.
+constexpr size_t kBytesPerIndexSlot = 128;
+constexpr size_t kMaxRequestBytes = 4096;
+constexpr int kPollIntervalMs = 100;
+
+[[noreturn]] void fail(int error, const std::string &what) {
+  throw std::system_error(error, std::generic_category(), what);
+}
+
+sockaddr_un socket_address(const std::string &path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(address.sun_path))
+    fail(ENAMETOOLONG, "Invalid trace cache socket path '" + path + "'");
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  return address;
+}
+
+uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+size_t round_up_pow2(size_t n) {
+  size_t p = 1;
+  while (p < n)
+    p <<= 1;
+  return p;
+}
+
+void send_all(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    const ssize_t n = ::send(fd, data, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return; // The client went away
+    data += n;
+    size -= static_cast<size_t>(n);
+  }
+}
+
+} // namespace
+
+// Followed by `num_attributes` Attributes.
+struct TraceCache::Entry {
+  uint64_t trace_id;
+  uint64_t span_id;
+  uint64_t parent_span_id;
+  uint64_t cause_id;
+  uint64_t name_hash;
+  uint64_t start_ns;
+  uint64_t end_ns;
+  uint64_t hlc;
+  uint32_t previous; // Offset + 1 of the trace's previous entry, 0 if none
+  uint16_t thread_index;
+  uint16_t cpu_id;
+  Tracelet::RecordType record_type;
+  uint8_t num_attributes;
+  uint8_t padding[6];
+};
+
+struct TraceCache::Segment {
+  struct Slot {
+    std::atomic<uint64_t> trace_id{0}; // 0: empty
+    std::atomic<uint32_t> head{0};     // Offset + 1 of the newest entry
+  };
+
+  explicit Segment(size_t bytes)
+      : capacity(bytes), data(new char[bytes]),
+        slot_count(round_up_pow2(std::max<size_t>(
+            bytes / kBytesPerIndexSlot, 16))),
+        slots(new Slot[slot_count]) {}
+
+  size_t slot_of(uint64_t trace_id) const {
+    // Span ids are sequential per process: mix before masking.
+    return (trace_id * 0x9E3779B97F4A7C15ull >> 32) & (slot_count - 1);
+  }
+
+  const size_t capacity;
+  const std::unique_ptr<char[]> data;
+  const size_t slot_count;
+  const std::unique_ptr<Slot[]> slots;
+
+  // Writer only.
+  size_t used = 0;
+  size_t traces = 0;
+
+  // Read by lookups to skip expired segments.
+  std::atomic<uint64_t> newest_end{0};
+  // Exclusive while the segment is cleared for reuse.
+  mutable std::shared_mutex reuse_mutex;
+};
+
+TraceCache::TraceCache(Options options) : _options(std::move(options)) {
+  _options.segment_bytes =
+      std::max(_options.segment_bytes, sizeof(Entry) * 64) & ~size_t{7};
+  const size_t count =
+      std::max<size_t>(_options.max_bytes / _options.segment_bytes, 2);
+  for (size_t i = 0; i < count; ++i)
+    _segments.push_back(std::make_unique<Segment>(_options.segment_bytes));
+}
+
+TraceCache::~TraceCache() { shutdown(); }
+
+void TraceCache::on_start(const ProcessorContext &context) {
+  std::memcpy(_header.magic, trace_file::kMagic, sizeof(trace_file::kMagic));
+  _header.version = trace_file::kVersion;
+  _header.header_size = sizeof(trace_file::FileHeader);
+  _header.process_tag = context.process_tag;
+  _header.start_wall_ns = context.start_wall_ns;
+  _header.rank = trace_file::kNoRank;
+
+  if (_options.control_socket.empty())
+    return;
+  const sockaddr_un address = socket_address(_options.control_socket);
+  // A socket left behind by an earlier run would make bind() fail.
+  struct stat st;
+  if (::lstat(address.sun_path, &st) == 0 && S_ISSOCK(st.st_mode))
+    ::unlink(address.sun_path);
+  _listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (_listen_fd < 0)
+    fail(errno, "Cannot create trace cache socket");
+  if (::bind(_listen_fd, reinterpret_cast<const sockaddr *>(&address),
+             sizeof(address)) != 0 ||
+      ::listen(_listen_fd, 16) != 0) {
+    const int error = errno;
+    ::close(_listen_fd);
+    _listen_fd = -1;
+    fail(error, "Cannot listen on " + _options.control_socket);
+  }
+  _server = std::thread([this] { serve(); });
+}
+
+void TraceCache::copy_strings(
+    const Tracelet &record,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  auto copy = [&](uint64_t hash) {
+    // Only this thread inserts, so checking without the lock is safe.
+    if (_strings.count(hash))
+      return;
+    auto it = strings.find(hash);
+    if (it == strings.end())
+      return;
+    std::lock_guard<std::mutex> lock(_strings_mutex);
+    _strings.emplace(hash, it->second);
+  };
+  copy(record.name_string_hash);
+  for (auto it = record.attributes_begin(); it != record.attributes_end();
+       ++it) {
+    copy(it->key_id);
+    if (it->value.type == AttributeValue::Type::STRING_ID)
+      copy(it->value.string_id);
+  }
+}
+
+void TraceCache::on_record(
+    const Tracelet &record,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  switch (record.record_type) {
+  case Tracelet::RecordType::SPAN_START: {
+    const size_t evicted = trim_open_spans(
+        _open, _options.max_open_spans,
+        [](const Tracelet &start) { return start.timestamp; });
+    if (evicted > 0)
+      _open_spans_evicted.fetch_add(evicted, std::memory_order_relaxed);
+    _open.insert_or_assign(record.span_id.value, record);
+    break;
+  }
+  case Tracelet::RecordType::SPAN_END: {
+    auto it = _open.find(record.span_id.value);
+    if (it == _open.end())
+      return; // Its start was dropped or preceded this processor
+    copy_strings(it->second, strings);
+    append(it->second, record.timestamp);
+    _open.erase(it);
+    break;
+  }
+  case Tracelet::RecordType::EVENT:
+    copy_strings(record, strings);
+    append(record, record.timestamp);
+    break;
+  default:
+    break;
+  }
+}
+
+void TraceCache::append(const Tracelet &start, uint64_t end_ns) {
+  static_assert(sizeof(Entry) == 80);
+  static_assert(sizeof(Entry) % alignof(Attribute) == 0);
+  const size_t size =
+      sizeof(Entry) + start.num_attributes * sizeof(Attribute);
+  if (start.trace_id == kInvalidId || size > _options.segment_bytes) {
+    _spans_dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  Segment *segment = _segments[_active].get();
+  if (segment->used + size > segment->capacity ||
+      segment->traces * 4 >= segment->slot_count * 3) {
+    advance();
+    segment = _segments[_active].get();
+  }
+
+  Entry entry;
+  entry.trace_id = start.trace_id.value;
+  entry.span_id = start.span_id.value;
+  entry.parent_span_id = start.parent_span_id.value;
+  entry.cause_id = start.cause_id.value;
+  entry.name_hash = start.name_string_hash;
+  entry.start_ns = start.timestamp;
+  entry.end_ns = end_ns;
+  entry.hlc = start.hlc;
+  entry.thread_index = start.thread_index;
+  entry.cpu_id = start.cpu_id;
+  entry.record_type = start.record_type;
+  entry.num_attributes = start.num_attributes;
+  std::memset(entry.padding, 0, sizeof(entry.padding));
+
+  const uint32_t offset = static_cast<uint32_t>(segment->used);
+  for (size_t i = segment->slot_of(entry.trace_id);;
+       i = (i + 1) & (segment->slot_count - 1)) {
+    Segment::Slot &slot = segment->slots[i];
+    const uint64_t key = slot.trace_id.load(std::memory_order_relaxed);
+    if (key != entry.trace_id && key != 0)
+      continue;
+    entry.previous =
+        key == 0 ? 0 : slot.head.load(std::memory_order_relaxed);
+    char *out = segment->data.get() + offset;
+    std::memcpy(out, &entry, sizeof(entry));
+    std::memcpy(out + sizeof(entry), start.attributes,
+                start.num_attributes * sizeof(Attribute));
+    // Release: a lookup that sees the new head (or the new key) also sees
+    // the entry written above.
+    if (key == 0) {
+      slot.head.store(offset + 1, std::memory_order_relaxed);
+      slot.trace_id.store(entry.trace_id, std::memory_order_release);
+      ++segment->traces;
+    } else {
+      slot.head.store(offset + 1, std::memory_order_release);
+    }
+    break;
+  }
+  segment->used += size;
+  if (end_ns > segment->newest_end.load(std::memory_order_relaxed))
+    segment->newest_end.store(end_ns, std::memory_order_relaxed);
+  _spans_cached.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TraceCache::advance() {
+  _active = (_active + 1) % _segments.size();
+  recycle(*_segments[_active]);
+}
+
+void TraceCache::recycle(Segment &segment) {
+  if (segment.used == 0)
+    return;
+  std::unique_lock<std::shared_mutex> lock(segment.reuse_mutex);
+  for (size_t i = 0; i < segment.slot_count; ++i) {
+    segment.slots[i].trace_id.store(0, std::memory_order_relaxed);
+    segment.slots[i].head.store(0, std::memory_order_relaxed);
+  }
+  segment.used = 0;
+  segment.traces = 0;
+  segment.newest_end.store(0, std::memory_order_relaxed);
+  _segments_recycled.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t TraceCache::cutoff_ns() const {
+  const uint64_t max_age =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(_options.max_age)
+          .count();
+  const uint64_t now = now_ns();
+  return max_age == 0 || now < max_age ? 0 : now - max_age;
+}
+
+void TraceCache::flush() {
+  const uint64_t cutoff = cutoff_ns();
+  if (cutoff == 0)
+    return;
+  for (auto &segment : _segments)
+    if (segment->newest_end.load(std::memory_order_relaxed) < cutoff)
+      recycle(*segment);
+}
+
+void TraceCache::collect(const Segment &segment, Id trace_id,
+                         std::vector<CachedSpan> &out) const {
+  for (size_t i = segment.slot_of(trace_id.value), probes = 0;
+       probes < segment.slot_count;
+       i = (i + 1) & (segment.slot_count - 1), ++probes) {
+    const uint64_t key =
+        segment.slots[i].trace_id.load(std::memory_order_acquire);
+    if (key == 0)
+      return;
+    if (key != trace_id.value)
+      continue;
+    for (uint32_t at = segment.slots[i].head.load(std::memory_order_acquire);
+         at != 0;) {
+      Entry entry;
+      const char *in = segment.data.get() + (at - 1);
+      std::memcpy(&entry, in, sizeof(entry));
+      CachedSpan span{Tracelet(entry.start_ns, entry.hlc, Id{entry.trace_id},
+                               Id{entry.span_id}, Id{entry.parent_span_id},
+                               Id{entry.cause_id}, entry.name_hash,
+                               entry.record_type, entry.thread_index,
+                               entry.cpu_id),
+                      entry.end_ns};
+      span.start.num_attributes = entry.num_attributes;
+      std::memcpy(span.start.attributes, in + sizeof(entry),
+                  entry.num_attributes * sizeof(Attribute));
+      out.push_back(span);
+      at = entry.previous;
+    }
+    return;
+  }
+}
+
+CachedTrace TraceCache::get_trace(Id trace_id) const {
+  _lookups.fetch_add(1, std::memory_order_relaxed);
+  CachedTrace trace;
+  if (trace_id == kInvalidId)
+    return trace;
+  const uint64_t cutoff = cutoff_ns();
+  for (const auto &segment : _segments) {
+    std::shared_lock<std::shared_mutex> lock(segment->reuse_mutex);
+    if (segment->newest_end.load(std::memory_order_relaxed) < cutoff)
+      continue;
+    collect(*segment, trace_id, trace.spans);
+  }
+  std::sort(trace.spans.begin(), trace.spans.end(),
+            [](const CachedSpan &a, const CachedSpan &b) {
+              return a.start.timestamp < b.start.timestamp;
+            });
+
+  std::lock_guard<std::mutex> lock(_strings_mutex);
+  auto copy = [&](uint64_t hash) {
+    auto it = _strings.find(hash);
+    if (it != _strings.end())
+      trace.strings.emplace(hash, it->second);
+  };
+  for (const CachedSpan &span : trace.spans) {
+    copy(span.start.name_string_hash);
+    for (auto a = span.start.attributes_begin();
+         a != span.start.attributes_end(); ++a) {
+      copy(a->key_id);
+      if (a->value.type == AttributeValue::Type::STRING_ID)
+        copy(a->value.string_id);
+    }
+  }
+  return trace;
+}
+
+size_t TraceCache::write_traces(const std::vector<uint64_t> &trace_ids,
+                                const LiveFilter *filter, std::FILE *file,
+                                const std::string &name) const {
+  trace_file::TraceFileEncoder encoder(file, name, _header);
+  size_t written = 0;
+  for (uint64_t id : trace_ids) {
+    const CachedTrace trace = get_trace(Id{id});
+    for (const auto &[hash, str] : trace.strings)
+      encoder.add_string(hash, str);
+    for (const CachedSpan &span : trace.spans) {
+      if (filter && !filter->matches(span.start))
+        continue;
+      encoder.add_record(span.start);
+      if (span.start.record_type == Tracelet::RecordType::SPAN_START)
+        encoder.add_record(Tracelet(span.end_ns, 0, span.start.trace_id,
+                                    span.start.span_id, kInvalidId,
+                                    kInvalidId, 0,
+                                    Tracelet::RecordType::SPAN_END,
+                                    span.start.thread_index,
+                                    span.start.cpu_id));
+      ++written;
+    }
+  }
+  encoder.close();
+  return written;
+}
+
+size_t TraceCache::export_trace(Id trace_id, const std::string &path) const {
+  std::FILE *file = std::fopen(path.c_str(), "wb");
+  if (!file)
+    fail(errno, "Cannot create trace file " + path);
+  return write_traces({trace_id.value}, nullptr, file, path);
+}
+
+void TraceCache::serve() {
+  while (!_stopping.load(std::memory_order_relaxed)) {
+    pollfd listener{_listen_fd, POLLIN, 0};
+    if (::poll(&listener, 1, kPollIntervalMs) <= 0)
+      continue;
+    const int fd = ::accept4(_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0)
+      continue;
+    handle_request(fd);
+    ::close(fd);
+  }
+}
+
+void TraceCache::handle_request(int fd) {
+  // A client that never finishes its request line must not stall others
+  // for long.
+  const timeval timeout{1, 0};
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  std::string request;
+  char c;
+  while (request.size() < kMaxRequestBytes && ::recv(fd, &c, 1, 0) == 1 &&
+         c != '\n')
+    request += c;
+
+  LiveFilter filter;
+  std::string error;
+  try {
+    filter = LiveFilter::parse(request);
+    if (filter.trace_ids.empty())
+      error = "A trace cache request needs a trace=ID term";
+  } catch (const std::invalid_argument &e) {
+    error = e.what();
+  }
+  if (!error.empty()) {
+    const std::string reply = "ERR " + error + "\n";
+    send_all(fd, reply.data(), reply.size());
+    return;
+  }
+
+  // Encoded in memory first: writing to the socket through stdio could
+  // raise SIGPIPE if the client goes away.
+  char *buffer = nullptr;
+  size_t size = 0;
+  std::FILE *file = ::open_memstream(&buffer, &size);
+  try {
+    write_traces(filter.trace_ids, &filter, file, _options.control_socket);
+    send_all(fd, buffer, size);
+  } catch (const std::system_error &) {
+    // Out of memory for the stream; the client sees an empty reply.
+  }
+  std::free(buffer);
+  _requests_served.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TraceCache::shutdown() {
+  if (_server.joinable()) {
+    _stopping.store(true, std::memory_order_relaxed);
+    _server.join();
+  }
+  if (_listen_fd >= 0) {
+    ::close(_listen_fd);
+    _listen_fd = -1;
+    ::unlink(_options.control_socket.c_str());
+  }
+}
+
+TraceCache::Stats TraceCache::stats() const {
+  Stats s;
+  s.spans_cached = _spans_cached.load(std::memory_order_relaxed);
+  s.spans_dropped = _spans_dropped.load(std::memory_order_relaxed);
+  s.segments_recycled = _segments_recycled.load(std::memory_order_relaxed);
+  s.lookups = _lookups.load(std::memory_order_relaxed);
+  s.open_spans_evicted = _open_spans_evicted.load(std::memory_order_relaxed);
+  s.requests_served = _requests_served.load(std::memory_order_relaxed);
+  return s;
+}
+
+} // namespace Waffle::live
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "waffle/processor/iprocessor.hpp"
+#include "waffle/trace_file/trace_file_format.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace Waffle::live {
+
+struct LiveFilter;
+
+/**
+ * @brief A completed span, or an event, as kept by TraceCache.
+ */
+struct CachedSpan {
+  Tracelet start; // The SPAN_START or EVENT record
+  uint64_t end_ns; // The start timestamp for events
+};
+
+struct CachedTrace {
+  std::vector<CachedSpan> spans; // By start time
+  // Names, attribute keys and string values of the spans.
+  std::unordered_map<uint64_t, std::string> strings;
+};
+
+/**
+ * @brief Processor that keeps the most recent completed spans in memory,
+ * indexed by trace id, so that the trace of a failed request can be fetched
+ * after the fact without exporting every trace.
+ *
+ * Spans are appended as they end to a ring of fixed-size segments
+ * (Options::max_bytes in total). A span takes 80 bytes plus 24 per
+ * attribute, about a third of a Tracelet. When the active segment is full
+ * the oldest one is cleared and reused; segments whose newest span is older
+ * than Options::max_age are cleared on flush() and skipped by lookups. At
+ * most Options::max_open_spans started spans wait for their end; beyond
+ * that the older half is evicted and never cached.
+ *
+ * Each segment has its own open-addressing index from trace id to the last
+ * span of that trace in the segment; spans of a trace are chained
+ * backwards. get_trace() may be called from any thread while records are
+ * being added: appends publish the chain head with a release store, so
+ * lookups take no lock that the processing thread takes per span. Clearing
+ * a segment excludes its lookups through a per-segment shared mutex. A
+ * lookup probes one slot per segment and takes microseconds.
+ *
+ * With Options::control_socket set, a thread serves the cache on that Unix
+ * socket using the LiveStreamServer request format: a client sends a
+ * LiveFilter spec with at least one trace=ID term, receives the matching
+ * spans as a Waffle trace file stream, and the connection is closed. So
+ * `LiveStreamClient(path, "trace=0x2a")` and waffle-tail work unchanged.
+ */
+class TraceCache : public IProcessor {
+public:
+  struct Options {
+    size_t max_bytes = 64 << 20;
+    size_t segment_bytes = 1 << 20;
+    // 0 keeps spans until their segment is reused.
+    std::chrono::seconds max_age{300};
+    size_t max_open_spans = 1 << 16;
+    std::string control_socket; // Empty: no socket
+  };
+
+  struct Stats {
+    uint64_t spans_cached = 0;
+    uint64_t spans_dropped = 0; // Larger than a segment, or no trace id
+    uint64_t segments_recycled = 0;
+    uint64_t lookups = 0;
+    uint64_t requests_served = 0; // On the control socket
+    uint64_t open_spans_evicted = 0; // See Options::max_open_spans
+  };
+
+  explicit TraceCache(Options options);
+  TraceCache() : TraceCache(Options{}) {}
+  ~TraceCache() override;
+
+  // @throw std::system_error If the control socket cannot be created.
+  void on_start(const ProcessorContext &context) override;
+  void on_record(const Tracelet &record,
+                 const std::unordered_map<uint64_t, std::string> &strings)
+      override;
+  void flush() override;
+  // Stops serving the control socket and removes it. The cached spans stay
+  // readable.
+  void shutdown() override;
+
+  // Safe to call from any thread.
+  CachedTrace get_trace(Id trace_id) const;
+
+  /**
+   * @brief Writes one trace to a Waffle trace file.
+   * @return The number of spans and events written; 0 if the trace is not
+   * cached (the file is still written).
+   * @throw std::system_error If the file cannot be written.
+   */
+  size_t export_trace(Id trace_id, const std::string &path) const;
+
+  Stats stats() const;
+
+private:
+  struct Segment;
+  struct Entry;
+
+  void append(const Tracelet &start, uint64_t end_ns);
+  void advance();
+  void recycle(Segment &segment);
+  void copy_strings(const Tracelet &record,
+                    const std::unordered_map<uint64_t, std::string> &strings);
+  uint64_t cutoff_ns() const;
+  void collect(const Segment &segment, Id trace_id,
+               std::vector<CachedSpan> &out) const;
+  // Writes the traces' spans and events that match `filter` (all if
+  // null) as a trace file; returns how many were written.
+  size_t write_traces(const std::vector<uint64_t> &trace_ids,
+                      const LiveFilter *filter, std::FILE *file,
+                      const std::string &name) const;
+  void serve();
+  void handle_request(int fd);
+
+  Options _options;
+  trace_file::FileHeader _header{};
+
+  // Segments are allocated up front; only their contents change.
+  std::vector<std::unique_ptr<Segment>> _segments;
+  size_t _active = 0;                            // Processing thread only
+  std::unordered_map<uint64_t, Tracelet> _open; // Processing thread only
+
+  mutable std::mutex _strings_mutex; // Taken by the writer to insert
+  std::unordered_map<uint64_t, std::string> _strings;
+
+  std::atomic<uint64_t> _spans_cached{0};
+  std::atomic<uint64_t> _spans_dropped{0};
+  std::atomic<uint64_t> _segments_recycled{0};
+  mutable std::atomic<uint64_t> _lookups{0};
+  std::atomic<uint64_t> _requests_served{0};
+  std::atomic<uint64_t> _open_spans_evicted{0};
+
+  int _listen_fd = -1;
+  std::atomic<bool> _stopping{false};
+  std::thread _server;
+};
+
+} // namespace Waffle::live
@@ -0,0 +1,539 @@
+#include "waffle/merge/trace_merge.hpp"
+
+#include "waffle/exporter/chrome_trace_writer.hpp"
+#include "waffle/exporter/ctf_writer.hpp"
+#include "waffle/exporter/fxt_writer.hpp"
+#include "waffle/helpers/parallel_for.hpp"
+#include "waffle/trace_file/trace_file_reader.hpp"
+#include "waffle/trace_file/trace_file_writer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace Waffle::merge {
+
+using trace_file::TraceFileReader;
+using trace_file::TraceRecord;
+
+namespace {
+
+// Span ids carry the allocating process in their top 24 bits (see
+// Tracer::process_tag()).
+constexpr uint64_t tag_of(uint64_t id) { return id >> 40; }
+
+bool is_receive(const Tracelet &t) {
+  return t.cause_id != kInvalidId &&
+         (t.record_type == Tracelet::RecordType::SPAN_START ||
+          t.record_type == Tracelet::RecordType::EVENT);
+}
+
+// Minimum of (receive time - send time) over all messages on one link.
+struct Link {
+  int64_t min_delta = std::numeric_limits<int64_t>::max();
+  size_t count = 0;
+};
+
+// --- Offset propagation ---
+
+struct Edge {
+  size_t to;
+  int64_t estimate; // offset[to] - offset[from]
+  int quality;      // 2: messages both ways, 1: one way
+  size_t count;
+};
+
+std::vector<int64_t>
+solve_offsets(size_t n,
+              const std::vector<std::unordered_map<size_t, Link>> &links) {
+  std::vector<std::vector<Edge>> adjacency(n);
+  for (size_t a = 0; a < n; ++a) {
+    for (const auto &[b, ab] : links[a]) {
+      if (b == a)
+        continue;
+      auto reverse = links[b].find(a);
+      const bool both = reverse != links[b].end();
+      if (both && b < a)
+        continue; // Handled from the other side.
+      int64_t estimate; // offset[b] - offset[a]
+      int quality;
+      size_t count = ab.count;
+      if (both) {
+        estimate = (ab.min_delta - reverse->second.min_delta) / 2;
+        quality = 2;
+        count += reverse->second.count;
+      } else {
+        // Receives must not precede sends: offset[b] - offset[a] <= min_delta.
+        estimate = std::min<int64_t>(ab.min_delta, 0);
+        quality = 1;
+      }
+      adjacency[a].push_back({b, estimate, quality, count});
+      adjacency[b].push_back({a, -estimate, quality, count});
+    }
+  }
+
+  // Prim's algorithm over the best links: a maximum spanning forest rooted at
+  // the lowest input of each connected group.
+  std::vector<int64_t> offsets(n, 0);
+  std::vector<bool> placed(n, false);
+  struct Candidate {
+    int quality;
+    size_t count;
+    size_t from;
+    const Edge *edge;
+    bool operator<(const Candidate &o) const {
+      return quality != o.quality ? quality < o.quality : count < o.count;
+    }
+  };
+  for (size_t root = 0; root < n; ++root) {
+    if (placed[root])
+      continue;
+    placed[root] = true;
+    std::priority_queue<Candidate> frontier;
+    auto expand = [&](size_t u) {
+      for (const Edge &e : adjacency[u])
+        if (!placed[e.to])
+          frontier.push({e.quality, e.count, u, &e});
+    };
+    expand(root);
+    while (!frontier.empty()) {
+      const Candidate c = frontier.top();
+      frontier.pop();
+      if (placed[c.edge->to])
+        continue;
+      placed[c.edge->to] = true;
+      offsets[c.edge->to] = offsets[c.from] + c.edge->estimate;
+      expand(c.edge->to);
+    }
+  }
+  return offsets;
+}
+
+// --- Merge plumbing ---
+
+// Records of one merge group, plus the strings they introduce.
+struct Batch {
+  std::vector<std::pair<uint64_t, std::string>> strings;
+  std::vector<TraceRecord> records;
+};
+
+// Bounded single-producer / single-consumer hand-off between a group merger
+// and the final merge.
+class BatchQueue {
+public:
+  explicit BatchQueue(size_t capacity) : _capacity(capacity) {}
+
+  // Returns false once the consumer has aborted.
+  bool push(Batch batch) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _not_full.wait(lock, [&] { return _batches.size() < _capacity || _abort; });
+    if (_abort)
+      return false;
+    _batches.push_back(std::move(batch));
+    _not_empty.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _closed = true;
+    _not_empty.notify_one();
+  }
+
+  // Unblocks a producer when the consumer bails out on an error.
+  void abort() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _abort = true;
+    _not_full.notify_one();
+  }
+
+  bool pop(Batch &out) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _not_empty.wait(lock, [&] { return !_batches.empty() || _closed; });
+    if (_batches.empty())
+      return false;
+    out = std::move(_batches.front());
+    _batches.pop_front();
+    _not_full.notify_one();
+    return true;
+  }
+
+private:
+  std::mutex _mutex;
+  std::condition_variable _not_full;
+  std::condition_variable _not_empty;
+  std::deque<Batch> _batches;
+  size_t _capacity;
+  bool _closed = false;
+  bool _abort = false;
+};
+
+struct Input {
+  std::unique_ptr<TraceFileReader> reader;
+  int64_t offset = 0;
+  uint16_t rank = 0;
+  TraceRecord current;
+
+  bool advance() {
+    if (!reader->next(current))
+      return false;
+    const int64_t aligned = static_cast<int64_t>(current.tracelet.timestamp) -
+                            offset;
+    current.tracelet.timestamp = aligned < 0 ? 0 : static_cast<uint64_t>(aligned);
+    current.rank = rank;
+    return true;
+  }
+};
+
+bool later(const TraceRecord &a, const TraceRecord &b) {
+  return a.tracelet.timestamp != b.tracelet.timestamp
+             ? a.tracelet.timestamp > b.tracelet.timestamp
+             : a.rank > b.rank;
+}
+
+constexpr size_t kBatchRecords = 1024;
+constexpr size_t kQueueBatches = 4;
+
+// Merges `inputs` into `queue`, attaching each string to the first batch
+// that needs it.
+void merge_group(std::vector<Input *> inputs, BatchQueue &queue) {
+  auto cmp = [](const Input *a, const Input *b) {
+    return later(a->current, b->current);
+  };
+  std::priority_queue<Input *, std::vector<Input *>, decltype(cmp)> heap(cmp);
+  for (Input *in : inputs)
+    if (in->advance())
+      heap.push(in);
+
+  std::unordered_set<uint64_t> sent;
+  Batch batch;
+  batch.records.reserve(kBatchRecords);
+  auto need = [&](const Input &in, uint64_t hash) {
+    if (!sent.insert(hash).second)
+      return;
+    auto it = in.reader->strings().find(hash);
+    if (it != in.reader->strings().end())
+      batch.strings.emplace_back(hash, it->second);
+  };
+
+  while (!heap.empty()) {
+    Input *in = heap.top();
+    heap.pop();
+    const Tracelet &t = in->current.tracelet;
+    need(*in, t.name_string_hash);
+    for (auto it = t.attributes_begin(); it != t.attributes_end(); ++it) {
+      need(*in, it->key_id);
+      if (it->value.type == AttributeValue::Type::STRING_ID)
+        need(*in, it->value.string_id);
+    }
+    batch.records.push_back(in->current);
+    if (batch.records.size() == kBatchRecords) {
+      if (!queue.push(std::move(batch)))
+        return;
+      batch = Batch{};
+      batch.records.reserve(kBatchRecords);
+    }
+    if (in->advance())
+      heap.push(in);
+  }
+  if (!batch.records.empty() || !batch.strings.empty())
+    queue.push(std::move(batch));
+}
+
+class Sink {
+public:
+  virtual ~Sink() = default;
+  virtual void add_string(uint64_t hash, const std::string &str) = 0;
+  virtual void add_record(const TraceRecord &record) = 0;
+  virtual void finish() = 0;
+};
+
+class WaffleSink : public Sink {
+public:
+  explicit WaffleSink(const std::string &path)
+      : _encoder(path, merged_header()) {}
+  void add_string(uint64_t hash, const std::string &str) override {
+    _encoder.add_string(hash, str);
+  }
+  void add_record(const TraceRecord &record) override {
+    _encoder.add_record(record.tracelet, record.rank);
+  }
+  void finish() override { _encoder.close(); }
+
+private:
+  static trace_file::FileHeader merged_header() {
+    trace_file::FileHeader header{};
+    std::memcpy(header.magic, trace_file::kMagic, sizeof(header.magic));
+    header.version = trace_file::kVersion;
+    header.header_size = sizeof(header);
+    header.flags = trace_file::kFlagMerged;
+    header.rank = trace_file::kNoRank;
+    return header;
+  }
+  trace_file::TraceFileEncoder _encoder;
+};
+
+class PerfettoSink : public Sink {
+public:
+  explicit PerfettoSink(const std::string &path)
+      : _out(path, std::ios::binary), _writer(_out) {
+    if (!_out)
+      throw std::system_error(errno, std::generic_category(),
+                              "Cannot create " + path);
+  }
+  void add_string(uint64_t hash, const std::string &str) override {
+    _strings.emplace(hash, str);
+  }
+  void add_record(const TraceRecord &record) override {
+    _writer.write(record, _strings);
+  }
+  void finish() override {
+    _writer.finish();
+    if (!_out)
+      throw std::runtime_error("Failed writing the Perfetto trace");
+  }
+
+private:
+  std::ofstream _out;
+  exporter::ChromeTraceWriter _writer;
+  std::unordered_map<uint64_t, std::string> _strings;
+};
+
+class FxtSink : public Sink {
+public:
+  explicit FxtSink(const std::string &path) : _writer(path) {}
+  void add_string(uint64_t hash, const std::string &str) override {
+    _strings.emplace(hash, str);
+  }
+  void add_record(const TraceRecord &record) override {
+    _writer.write(record, _strings);
+  }
+  void finish() override { _writer.finish(); }
+
+private:
+  exporter::FxtWriter _writer;
+  std::unordered_map<uint64_t, std::string> _strings;
+};
+
+class CtfSink : public Sink {
+public:
+  explicit CtfSink(const std::string &directory) : _writer(directory) {}
+  void add_string(uint64_t hash, const std::string &str) override {
+    _strings.emplace(hash, str);
+  }
+  void add_record(const TraceRecord &record) override {
+    _writer.write(record, _strings);
+  }
+  void finish() override { _writer.finish(); }
+
+private:
+  exporter::CtfWriter _writer;
+  std::unordered_map<uint64_t, std::string> _strings;
+};
+
+} // namespace
+
+ClockOffsets estimate_clock_offsets(const std::vector<std::string> &inputs,
+                                    unsigned threads,
+                                    size_t max_pairs_per_link) {
+  const size_t n = inputs.size();
+  ClockOffsets result;
+  result.offsets_ns.assign(n, 0);
+
+  // Pass 1: every receive from another process, keyed by the sending span.
+  std::vector<uint64_t> tags(n);
+  std::vector<std::unordered_map<uint64_t, uint64_t>> receives(n);
+  parallel_for(n, threads, [&](size_t i) {
+    TraceFileReader reader(inputs[i]);
+    tags[i] = reader.header().process_tag;
+    std::unordered_map<uint64_t, size_t> per_sender;
+    TraceRecord record;
+    while (reader.next(record)) {
+      const Tracelet &t = record.tracelet;
+      if (!is_receive(t) || tag_of(t.cause_id.value) == tags[i])
+        continue;
+      auto [it, inserted] = receives[i].try_emplace(t.cause_id.value, 0);
+      if (!inserted) {
+        it->second = std::min(it->second, t.timestamp);
+      } else if (per_sender[tag_of(t.cause_id.value)]++ < max_pairs_per_link) {
+        it->second = t.timestamp;
+      } else {
+        receives[i].erase(it);
+      }
+    }
+  });
+
+  // Route each receive to the input that allocated its cause.
+  std::unordered_map<uint64_t, size_t> input_of_tag;
+  for (size_t i = 0; i < n; ++i)
+    input_of_tag.emplace(tags[i], i);
+  struct Receive {
+    size_t input;
+    uint64_t timestamp;
+  };
+  std::vector<std::unordered_map<uint64_t, std::vector<Receive>>> wanted(n);
+  for (size_t i = 0; i < n; ++i) {
+    for (const auto &[cause, ts] : receives[i]) {
+      auto sender = input_of_tag.find(tag_of(cause));
+      if (sender != input_of_tag.end())
+        wanted[sender->second][cause].push_back({i, ts});
+    }
+    receives[i] = {};
+  }
+
+  // Pass 2: find the sending spans and keep the minimum delta per link.
+  std::vector<std::unordered_map<size_t, Link>> links(n);
+  parallel_for(n, threads, [&](size_t j) {
+    if (wanted[j].empty())
+      return;
+    TraceFileReader reader(inputs[j]);
+    TraceRecord record;
+    while (reader.next(record)) {
+      const Tracelet &t = record.tracelet;
+      if (t.record_type != Tracelet::RecordType::SPAN_START)
+        continue;
+      auto it = wanted[j].find(t.span_id.value);
+      if (it == wanted[j].end())
+        continue;
+      for (const Receive &r : it->second) {
+        Link &link = links[j][r.input];
+        const int64_t delta = static_cast<int64_t>(r.timestamp - t.timestamp);
+        link.min_delta = std::min(link.min_delta, delta);
+        ++link.count;
+      }
+    }
+  });
+
+  for (const auto &from : links)
+    for (const auto &[to, link] : from)
+      result.matched_pairs += link.count;
+  result.offsets_ns = solve_offsets(n, links);
+  return result;
+}
+
+MergeStats merge_traces(const MergeOptions &options) {
+  const size_t n = options.inputs.size();
+  if (n == 0)
+    throw std::invalid_argument("waffle-merge: no input files");
+  if (n > std::numeric_limits<uint16_t>::max())
+    throw std::invalid_argument("waffle-merge: at most 65535 ranks");
+
+  MergeStats stats;
+  if (options.align_clocks)
+    stats.clocks = estimate_clock_offsets(options.inputs, options.threads,
+                                          options.max_pairs_per_link);
+  else
+    stats.clocks.offsets_ns.assign(n, 0);
+
+  std::vector<Input> inputs(n);
+  for (size_t i = 0; i < n; ++i) {
+    inputs[i].reader = std::make_unique<TraceFileReader>(options.inputs[i]);
+    const auto &header = inputs[i].reader->header();
+    if (header.flags & trace_file::kFlagMerged)
+      throw std::invalid_argument(options.inputs[i] +
+                                  " is already a merged trace");
+    inputs[i].rank = static_cast<uint16_t>(
+        header.rank != trace_file::kNoRank ? header.rank : i);
+    inputs[i].offset = stats.clocks.offsets_ns[i];
+  }
+
+  std::unique_ptr<Sink> sink;
+  if (options.format == MergeOptions::Format::PERFETTO)
+    sink = std::make_unique<PerfettoSink>(options.output);
+  else if (options.format == MergeOptions::Format::FXT)
+    sink = std::make_unique<FxtSink>(options.output);
+  else if (options.format == MergeOptions::Format::CTF)
+    sink = std::make_unique<CtfSink>(options.output);
+  else
+    sink = std::make_unique<WaffleSink>(options.output);
+
+  unsigned threads = options.threads;
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  const size_t groups = std::min<size_t>(threads, n);
+  std::vector<std::vector<Input *>> members(groups);
+  for (size_t i = 0; i < n; ++i)
+    members[i % groups].push_back(&inputs[i]);
+
+  std::vector<std::unique_ptr<BatchQueue>> queues;
+  std::vector<std::thread> workers;
+  std::vector<std::exception_ptr> errors(groups);
+  for (size_t g = 0; g < groups; ++g)
+    queues.push_back(std::make_unique<BatchQueue>(kQueueBatches));
+  for (size_t g = 0; g < groups; ++g) {
+    workers.emplace_back([&, g] {
+      try {
+        merge_group(members[g], *queues[g]);
+      } catch (...) {
+        errors[g] = std::current_exception();
+      }
+      queues[g]->close();
+    });
+  }
+
+  // Final merge over the group outputs.
+  struct Head {
+    Batch batch;
+    size_t pos = 0;
+    size_t group = 0;
+  };
+  std::vector<Head> heads(groups);
+  auto fetch = [&](Head &head) {
+    while (queues[head.group]->pop(head.batch)) {
+      head.pos = 0;
+      for (const auto &[hash, str] : head.batch.strings)
+        sink->add_string(hash, str);
+      if (!head.batch.records.empty())
+        return true;
+    }
+    return false;
+  };
+  auto cmp = [](const Head *a, const Head *b) {
+    return later(a->batch.records[a->pos], b->batch.records[b->pos]);
+  };
+  std::priority_queue<Head *, std::vector<Head *>, decltype(cmp)> heap(cmp);
+
+  try {
+    for (size_t g = 0; g < groups; ++g) {
+      heads[g].group = g;
+      if (fetch(heads[g]))
+        heap.push(&heads[g]);
+    }
+    while (!heap.empty()) {
+      Head *head = heap.top();
+      heap.pop();
+      sink->add_record(head->batch.records[head->pos]);
+      ++stats.records;
+      if (++head->pos < head->batch.records.size() || fetch(*head))
+        heap.push(head);
+    }
+    sink->finish();
+  } catch (...) {
+    for (auto &queue : queues)
+      queue->abort();
+    for (auto &worker : workers)
+      worker.join();
+    throw;
+  }
+
+  for (auto &worker : workers)
+    worker.join();
+  for (auto &error : errors)
+    if (error)
+      std::rethrow_exception(error);
+  return stats;
+}
+
+} // namespace Waffle::merge
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Waffle::merge {
+
+/**
+ * @brief Per-input clock offsets recovered from cross-rank causal links.
+ *
+ * `offsets_ns[i]` is how far input i's clock runs ahead of the reference
+ * clock (input 0, or the lowest-numbered input of each group of inputs that
+ * exchange messages); aligned timestamps are `timestamp - offsets_ns[i]`.
+ */
+struct ClockOffsets {
+  std::vector<int64_t> offsets_ns;
+  size_t matched_pairs = 0; // Send/receive pairs that contributed
+};
+
+/**
+ * @brief Estimates clock offsets between trace files, NTP-style, from
+ * `CausedBy` links that cross processes.
+ *
+ * A record on rank B caused by span S of rank A is a message from A to B:
+ * its receive time on B's clock minus S's start on A's clock is
+ * `offset_B - offset_A + delay`. The minimum over all such pairs bounds the
+ * offset difference from above; with messages in both directions the two
+ * minima give the estimate `(min_AB - min_BA) / 2`, assuming equal minimum
+ * delays. With messages in one direction only, the offset is corrected just
+ * enough to keep every receive after its send. Offsets are propagated from
+ * the reference input along the best-connected links (bidirectional first,
+ * then by number of pairs).
+ *
+ * Runs two parallel passes over the inputs. Memory is bounded by
+ * `max_pairs_per_link` remembered receives per sending rank.
+ *
+ * @throw std::runtime_error / std::system_error If an input cannot be read.
+ */
+ClockOffsets estimate_clock_offsets(const std::vector<std::string> &inputs,
+                                    unsigned threads = 0,
+                                    size_t max_pairs_per_link = 1 << 16);
+
+struct MergeOptions {
+  enum class Format {
+    WAFFLE,  // A single merged trace file (readable by all Waffle tools)
+    PERFETTO, // Chrome trace-event JSON, loadable by ui.perfetto.dev
+    FXT,      // Fuchsia trace format, compact binary also loaded by Perfetto
+    CTF       // CTF 1.8 trace directory for Babeltrace / Trace Compass
+  };
+
+  std::vector<std::string> inputs; // One trace file per rank
+  std::string output;
+  Format format = Format::WAFFLE;
+  unsigned threads = 0; // 0 = hardware concurrency
+  bool align_clocks = true;
+  size_t max_pairs_per_link = 1 << 16;
+};
+
+struct MergeStats {
+  size_t records = 0;
+  ClockOffsets clocks;
+};
+
+/**
+ * @brief k-way merges per-rank trace files into one timeline ordered by
+ * (aligned) timestamp.
+ *
+ * Input i becomes rank `header.rank` if the writer recorded one, else i.
+ * Inputs are split into groups that are merged concurrently, each feeding a
+ * bounded queue of record batches into the final merge, so memory stays at
+ * roughly one chunk per input plus a few batches per group regardless of
+ * trace size.
+ *
+ * @throw std::invalid_argument If there are no inputs, an input is itself a
+ * merged file, or there are more than 65535 ranks.
+ */
+MergeStats merge_traces(const MergeOptions &options);
+
+} // namespace Waffle::merge
@@ -0,0 +1,64 @@
+#include "waffle/model/duration_sketch.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Waffle::model {
+
+namespace {
+
+constexpr double kGamma = (1 + DurationSketch::kRelativeAccuracy) /
+                          (1 - DurationSketch::kRelativeAccuracy);
+const double kInverseLogGamma = 1 / std::log(kGamma);
+
+} // namespace
+
+size_t DurationSketch::bucket_of(uint64_t duration_ns) {
+  if (duration_ns <= 1)
+    return 0;
+  const double index =
+      std::ceil(std::log(static_cast<double>(duration_ns)) *
+                kInverseLogGamma);
+  return std::min(static_cast<size_t>(index), kBuckets - 1);
+}
+
+uint64_t DurationSketch::value_of(size_t bucket) {
+  if (bucket == 0)
+    return 1;
+  return static_cast<uint64_t>(2 * std::pow(kGamma, bucket) / (kGamma + 1));
+}
+
+uint64_t DurationSketch::quantile(double q) const {
+  if (_count == 0)
+    return 0;
+  const uint64_t rank =
+      static_cast<uint64_t>(std::clamp(q, 0.0, 1.0) * (_count - 1));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBuckets; ++i) {
+    seen += _counts[i];
+    if (seen > rank)
+      return value_of(i);
+  }
+  return value_of(kBuckets - 1);
+}
+
+void DurationSketch::merge(const DurationSketch &other) {
+  for (size_t i = 0; i < kBuckets; ++i)
+    _counts[i] += other._counts[i];
+  _count += other._count;
+}
+
+void DurationSketch::decay() {
+  _count = 0;
+  for (uint32_t &c : _counts) {
+    c /= 2;
+    _count += c;
+  }
+}
+
+void DurationSketch::clear() {
+  _counts.fill(0);
+  _count = 0;
+}
+
+} // namespace Waffle::model
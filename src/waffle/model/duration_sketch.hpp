@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace Waffle::model {
+
+/**
+ * @brief Fixed-size quantile sketch of durations (DDSketch with a
+ * logarithmic bucket mapping).
+ *
+ * Bucket i counts the durations in (gamma^(i-1), gamma^i] nanoseconds, so
+ * every quantile is returned with a relative error of at most
+ * kRelativeAccuracy. The bucket array is fixed, making the memory constant
+ * (about 4 KiB) regardless of how many durations are added; the last
+ * bucket (past 18 years) also counts anything longer.
+ *
+ * Counts can be halved with decay() to let old observations fade.
+ */
+class DurationSketch {
+public:
+  static constexpr double kRelativeAccuracy = 0.02;
+  static constexpr size_t kBuckets = 1024;
+
+  void add(uint64_t duration_ns) {
+    ++_counts[bucket_of(duration_ns)];
+    ++_count;
+  }
+
+  /**
+   * @brief Returns the estimated q-quantile in nanoseconds, 0 when empty.
+   * @param q In [0, 1].
+   */
+  uint64_t quantile(double q) const;
+
+  // Adds the counts of `other`, e.g. to combine per-thread sketches.
+  void merge(const DurationSketch &other);
+
+  // Halves every count, rounding down.
+  void decay();
+
+  void clear();
+
+  uint64_t count() const { return _count; }
+  // Durations counted in `bucket`; see bucket_of().
+  uint32_t bucket_count(size_t bucket) const { return _counts[bucket]; }
+
+  static size_t bucket_of(uint64_t duration_ns);
+  // Midpoint of the bucket in the relative sense: within kRelativeAccuracy
+  // of every duration it counts.
+  static uint64_t value_of(size_t bucket);
+
+private:
+  std::array<uint32_t, kBuckets> _counts{};
+  uint64_t _count = 0;
+};
+
+} // namespace Waffle::model
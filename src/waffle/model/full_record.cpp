@@ -1,5 +1,7 @@
 #include "waffle/model/full_record.hpp"
 
+#include <algorithm>
+
 std::optional<Waffle::model::FullRecord> Waffle::model::tracelet_to_full_record(
     const Tracelet &tracelet,
     const std::unordered_map<uint64_t, std::string> &id_to_string_map) {
@@ -15,6 +17,10 @@ std::optional<Waffle::model::FullRecord> Waffle::model::tracelet_to_full_record(
   record.span_id = tracelet.span_id;
   record.parent_id = tracelet.parent_span_id;
   record.cause_id = tracelet.cause_id;
+  record.timestamp = tracelet.timestamp;
+  record.hlc = tracelet.hlc;
+  record.thread_index = tracelet.thread_index;
+  record.cpu_id = tracelet.cpu_id;
 
   // use the tracelet attributes iteraror to populate the data map. Use a
   // function programming style.
@@ -18,6 +18,10 @@ struct FullRecord {
   Id span_id;
   std::optional<Id> parent_id;
   std::optional<Id> cause_id;
+  uint64_t timestamp;
+  uint64_t hlc; // 0 if the producer was built without the HLC
+  uint16_t thread_index; // See ThreadTracks for the thread's tid and name
+  uint16_t cpu_id;       // kUnknownCpu if it could not be determined
   std::unordered_map<std::string, RecordDataValue> data;
 };
 
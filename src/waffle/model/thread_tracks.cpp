@@ -0,0 +1,43 @@
+#include "waffle/model/thread_tracks.hpp"
+
+namespace Waffle::model {
+namespace {
+constexpr uint64_t kThreadIdAttributeHash =
+    fnv1a_hash(kThreadIdAttribute.data(), kThreadIdAttribute.size());
+} // namespace
+
+std::optional<CpuMigration> ThreadTracks::observe(
+    const Tracelet &tracelet,
+    const std::unordered_map<uint64_t, std::string> &id_to_string_map) {
+  if (tracelet.record_type == Tracelet::RecordType::THREAD_INFO) {
+    ThreadInfo info{tracelet.thread_index, 0, {}};
+    auto name = id_to_string_map.find(tracelet.name_string_hash);
+    if (name != id_to_string_map.end())
+      info.name = name->second;
+    for (auto it = tracelet.attributes_begin(); it != tracelet.attributes_end();
+         ++it) {
+      if (it->key_id == kThreadIdAttributeHash)
+        info.tid = it->value.i64;
+    }
+    _threads[tracelet.thread_index] = std::move(info);
+  }
+
+  if (tracelet.cpu_id == kUnknownCpu)
+    return std::nullopt;
+  auto [last, inserted] =
+      _last_cpu.try_emplace(tracelet.thread_index, tracelet.cpu_id);
+  if (inserted || last->second == tracelet.cpu_id)
+    return std::nullopt;
+
+  CpuMigration migration{tracelet.thread_index, last->second, tracelet.cpu_id,
+                         tracelet.timestamp};
+  last->second = tracelet.cpu_id;
+  return migration;
+}
+
+const ThreadInfo *ThreadTracks::find(uint16_t thread_index) const {
+  auto it = _threads.find(thread_index);
+  return it != _threads.end() ? &it->second : nullptr;
+}
+
+} // namespace Waffle::model
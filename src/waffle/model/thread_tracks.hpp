@@ -0,0 +1,63 @@
+#pragma once
+
+#include "waffle/waffle_core.hpp"
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace Waffle::model {
+
+/**
+ * @brief Metadata of one recording thread, as announced by its THREAD_INFO
+ * record.
+ */
+struct ThreadInfo {
+  uint16_t index;
+  int64_t tid;
+  std::string name;
+};
+
+/**
+ * @brief A thread was seen on a different CPU than its previous record.
+ */
+struct CpuMigration {
+  uint16_t thread_index;
+  uint16_t from_cpu;
+  uint16_t to_cpu;
+  uint64_t timestamp; // Timestamp of the first record on `to_cpu`
+};
+
+/**
+ * @brief Maps the thread index / CPU id carried by every Tracelet to
+ * per-thread tracks and CPU-migration events.
+ *
+ * Exporters feed every tracelet they consume through `observe()`, in ring
+ * order. THREAD_INFO records populate the thread table; all other records
+ * update the thread's last known CPU.
+ */
+class ThreadTracks {
+public:
+  /**
+   * @brief Observes one tracelet.
+   * @return The migration if this record's thread was last seen on another
+   * known CPU, std::nullopt otherwise.
+   */
+  std::optional<CpuMigration>
+  observe(const Tracelet &tracelet,
+          const std::unordered_map<uint64_t, std::string> &id_to_string_map);
+
+  // Returns the metadata for `thread_index`, or nullptr if its THREAD_INFO
+  // record has not been seen (e.g. it was dropped).
+  const ThreadInfo *find(uint16_t thread_index) const;
+
+  const std::unordered_map<uint16_t, ThreadInfo> &threads() const {
+    return _threads;
+  }
+
+private:
+  std::unordered_map<uint16_t, ThreadInfo> _threads;
+  std::unordered_map<uint16_t, uint16_t> _last_cpu;
+};
+
+} // namespace Waffle::model
@@ -0,0 +1,146 @@
+#include "waffle/processor/anomaly_detector.hpp"
+#include "waffle/helpers/open_spans.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Waffle {
+
+namespace {
+
+// Bounds the anomalies waiting for the next flush(); more are reported to
+// the callback but not recorded as events.
+constexpr size_t kMaxPendingEvents = 1024;
+
+constinit StaticStringSource kAnomalyEvent("waffle.anomaly",
+                                           sizeof("waffle.anomaly") - 1);
+
+} // namespace
+
+AnomalyDetector::AnomalyDetector(Options options)
+    : _options(std::move(options)),
+      _cooldown_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       _options.cooldown)
+                       .count()) {
+  _options.refresh = std::max<uint32_t>(_options.refresh, 1);
+  _options.window = std::max<uint32_t>(_options.window, 2);
+}
+
+AnomalyDetector::NameState *AnomalyDetector::state_for(uint64_t name_hash) {
+  auto it = _names.find(name_hash);
+  if (it != _names.end())
+    return it->second.get();
+  if (_names.size() >= _options.max_names)
+    return nullptr;
+  return _names.emplace(name_hash, std::make_unique<NameState>())
+      .first->second.get();
+}
+
+void AnomalyDetector::on_record(
+    const Tracelet &record,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  if (record.record_type == Tracelet::RecordType::SPAN_START) {
+    _stats.open_spans_evicted +=
+        trim_open_spans(_open, _options.max_open_spans,
+                        [](const OpenSpan &open) { return open.start; });
+    _open.insert_or_assign(
+        record.span_id.value,
+        OpenSpan{record.timestamp, record.trace_id, record.parent_span_id,
+                 record.name_string_hash,
+                 state_for(record.name_string_hash)});
+  } else if (record.record_type == Tracelet::RecordType::SPAN_END) {
+    auto it = _open.find(record.span_id.value);
+    if (it == _open.end())
+      return; // Its start was dropped or preceded this processor
+    observe(it->second, record.span_id, record.timestamp, strings);
+    _open.erase(it);
+  }
+}
+
+void AnomalyDetector::observe(
+    const OpenSpan &open, Id span_id, uint64_t end,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  ++_stats.spans;
+  NameState *state = open.state;
+  if (state == nullptr) {
+    ++_stats.untracked_spans;
+    return;
+  }
+  const uint64_t duration = end > open.start ? end - open.start : 0;
+
+  // Judged against what was learned before this span.
+  if (state->threshold != 0 && duration > state->threshold) {
+    if (state->last_anomaly_end != 0 &&
+        end - state->last_anomaly_end < _cooldown_ns) {
+      ++_stats.suppressed;
+    } else {
+      state->last_anomaly_end = end;
+      ++_stats.anomalies;
+      auto name = strings.find(open.name_hash);
+      Anomaly anomaly{open.trace_id,
+                      span_id,
+                      open.parent_span_id,
+                      open.name_hash,
+                      name != strings.end() ? name->second : std::string(),
+                      open.start,
+                      duration,
+                      state->threshold,
+                      state->tail,
+                      static_cast<uint64_t>(state->mean)};
+      if (_options.on_anomaly)
+        _options.on_anomaly(anomaly);
+      if (_options.emit_events && _pending_events.size() < kMaxPendingEvents)
+        _pending_events.push_back(std::move(anomaly));
+    }
+  }
+
+  state->sketch.add(duration);
+  if (state->sketch.count() >= _options.window)
+    state->sketch.decay();
+  const double x = static_cast<double>(duration);
+  if (state->samples++ == 0) {
+    state->mean = x;
+  } else {
+    // Incremental exponentially weighted mean and variance.
+    const double delta = x - state->mean;
+    state->mean += _options.ewma_alpha * delta;
+    state->variance = (1 - _options.ewma_alpha) *
+                      (state->variance + _options.ewma_alpha * delta * delta);
+  }
+  if (state->samples >= _options.min_samples &&
+      state->until_refresh-- == 0) {
+    refresh(*state);
+    state->until_refresh = _options.refresh - 1;
+  }
+}
+
+void AnomalyDetector::refresh(NameState &state) const {
+  state.tail = state.sketch.quantile(_options.quantile);
+  const double by_tail = _options.tail_factor * static_cast<double>(state.tail);
+  const double by_spread =
+      state.mean + _options.sigmas * std::sqrt(state.variance);
+  state.threshold = static_cast<uint64_t>(std::max(by_tail, by_spread));
+}
+
+uint64_t AnomalyDetector::threshold_ns(uint64_t name_hash) const {
+  auto it = _names.find(name_hash);
+  return it != _names.end() ? it->second->threshold : 0;
+}
+
+void AnomalyDetector::flush() {
+  if (_pending_events.empty())
+    return;
+  if (detail::tracing_enabled()) {
+    using namespace literals;
+    Tracer &tracer = *detail::g_tracer_instance;
+    for (const Anomaly &a : _pending_events)
+      tracer.create_event(
+          kAnomalyEvent, a.span_id, a.span_id, "span"_w = a.name.c_str(),
+          "duration_ns"_w = static_cast<long long>(a.duration_ns),
+          "threshold_ns"_w = static_cast<long long>(a.threshold_ns),
+          "baseline_ns"_w = static_cast<long long>(a.baseline_ns));
+  }
+  _pending_events.clear();
+}
+
+} // namespace Waffle
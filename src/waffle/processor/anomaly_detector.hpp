@@ -0,0 +1,125 @@
+#pragma once
+
+#include "waffle/model/duration_sketch.hpp"
+#include "waffle/processor/iprocessor.hpp"
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Waffle {
+
+/**
+ * @brief A span that took much longer than its name's learned tail.
+ */
+struct Anomaly {
+  Id trace_id;
+  Id span_id;
+  Id parent_span_id;
+  uint64_t name_hash;
+  std::string name;
+  uint64_t start_ns;
+  uint64_t duration_ns;
+  uint64_t threshold_ns; // The duration had to exceed this
+  uint64_t tail_ns;      // Learned Options::quantile of the name
+  uint64_t baseline_ns;  // EWMA of the name's durations
+};
+
+/**
+ * @brief Processor that learns the duration distribution of every span name
+ * and reports spans far outside it as they end.
+ *
+ * Per name it keeps a DurationSketch, decayed every Options::window spans
+ * so that it follows the recent past, and an exponentially weighted mean
+ * and variance. Once a name has Options::min_samples spans, a span is an
+ * anomaly when its duration exceeds
+ *
+ *   max(tail_factor * quantile(q), mean + sigmas * stddev).
+ *
+ * The threshold is recomputed every Options::refresh spans, so the cost per
+ * span is two hash lookups, a logarithm and a comparison. Memory is
+ * constant per name (about 4 KiB); names beyond Options::max_names are not
+ * tracked. At most Options::max_open_spans spans wait for their end; beyond
+ * that the older half is evicted unobserved.
+ *
+ * Each anomaly is passed to Options::on_anomaly on the processing thread.
+ * With Options::emit_events, it is also recorded as a "waffle.anomaly"
+ * event parented to and CausedBy the offending span, carrying the span name
+ * and the durations as attributes. These events are emitted on the next
+ * flush(), when the ring runs empty, so they do not add to a backlog the
+ * processing thread is still working through.
+ */
+class AnomalyDetector : public IProcessor {
+public:
+  struct Options {
+    double quantile = 0.999;
+    double tail_factor = 1.5;
+    double sigmas = 6;
+    double ewma_alpha = 0.01;
+    uint32_t min_samples = 1000;
+    uint32_t window = 1 << 16;
+    uint32_t refresh = 1024;
+    size_t max_names = 4096;
+    size_t max_open_spans = 1 << 16;
+    // At most one anomaly per name in this much span time; the rest are
+    // counted as suppressed.
+    std::chrono::milliseconds cooldown{1000};
+    bool emit_events = true;
+    std::function<void(const Anomaly &)> on_anomaly;
+  };
+
+  struct Stats {
+    uint64_t spans = 0;
+    uint64_t anomalies = 0;
+    uint64_t suppressed = 0;
+    uint64_t untracked_spans = 0; // Of names beyond max_names
+    uint64_t open_spans_evicted = 0; // See Options::max_open_spans
+  };
+
+  explicit AnomalyDetector(Options options);
+  AnomalyDetector() : AnomalyDetector(Options{}) {}
+
+  void on_record(const Tracelet &record,
+                 const std::unordered_map<uint64_t, std::string> &strings)
+      override;
+  void flush() override;
+
+  const Stats &stats() const { return _stats; }
+  // Current threshold of a name in nanoseconds; 0 while it is learning.
+  uint64_t threshold_ns(uint64_t name_hash) const;
+
+private:
+  struct NameState {
+    model::DurationSketch sketch;
+    double mean = 0;
+    double variance = 0;
+    uint64_t samples = 0; // Since tracking began; never decayed
+    uint64_t threshold = 0;
+    uint64_t tail = 0;
+    uint64_t last_anomaly_end = 0;
+    uint32_t until_refresh = 0;
+  };
+  struct OpenSpan {
+    uint64_t start;
+    Id trace_id;
+    Id parent_span_id;
+    uint64_t name_hash;
+    NameState *state; // nullptr if the name is not tracked
+  };
+
+  NameState *state_for(uint64_t name_hash);
+  void observe(const OpenSpan &open, Id span_id, uint64_t end,
+               const std::unordered_map<uint64_t, std::string> &strings);
+  void refresh(NameState &state) const;
+
+  Options _options;
+  uint64_t _cooldown_ns;
+  std::unordered_map<uint64_t, OpenSpan> _open;
+  std::unordered_map<uint64_t, std::unique_ptr<NameState>> _names;
+  std::vector<Anomaly> _pending_events;
+  Stats _stats;
+};
+
+} // namespace Waffle
@@ -0,0 +1,124 @@
+#include "waffle/processor/console_processor.hpp"
+
+namespace Waffle {
+
+namespace {
+void print_attribute(std::ostream &out, const std::string &key,
+                     const AttributeValue &val,
+                     const std::unordered_map<uint64_t, std::string> &id_map) {
+  out << key << ": ";
+  switch (val.type) {
+  case AttributeValue::Type::BOOL:
+    out << (val.b ? "true" : "false");
+    break;
+  case AttributeValue::Type::INT64:
+    out << val.i64;
+    break;
+  case AttributeValue::Type::DOUBLE:
+    out << val.f64;
+    break;
+  case AttributeValue::Type::STRING_ID:
+    out << "'" << id_map.at(val.string_id) << "'";
+    break;
+  }
+}
+} // namespace
+
+ConsoleProcessor::ConsoleProcessor(std::ostream &out) : _out(out) {}
+
+void ConsoleProcessor::on_record(
+    const Tracelet &tracelet,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  _threads.observe(tracelet, strings);
+
+  switch (tracelet.record_type) {
+  case Tracelet::RecordType::SPAN_START: {
+    ReadableSpanData data;
+    data.name_hash = tracelet.name_string_hash;
+    data.parent_id = tracelet.parent_span_id;
+    data.cause_id = tracelet.cause_id;
+    data.attributes.assign(tracelet.attributes_begin(),
+                           tracelet.attributes_end());
+    _active_spans[tracelet.span_id.value] = std::move(data);
+    break;
+  }
+  case Tracelet::RecordType::SPAN_END:
+    _active_spans.erase(tracelet.span_id.value);
+    break;
+  case Tracelet::RecordType::THREAD_INFO:
+    break; // Recorded by `_threads` above.
+  case Tracelet::RecordType::EVENT:
+    print_event(tracelet, strings);
+    break;
+  }
+}
+
+void ConsoleProcessor::flush() { _out.flush(); }
+
+void ConsoleProcessor::print_event(
+    const Tracelet &tracelet,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  auto get_name = [&](uint64_t hash) {
+    auto it = strings.find(hash);
+    return it != strings.end() ? it->second : std::string("???");
+  };
+
+  _out << "\n[Processor] EVENT '" << get_name(tracelet.name_string_hash)
+       << "'";
+  if (const auto *thread = _threads.find(tracelet.thread_index)) {
+    _out << " on thread '" << thread->name << "' (tid " << thread->tid << ")";
+  }
+  if (tracelet.cpu_id != kUnknownCpu) {
+    _out << ", cpu " << tracelet.cpu_id;
+  }
+  _out << "\n";
+
+  // --- Implicit Causality Tracking Logic ---
+  Id effective_cause_id = tracelet.cause_id;
+  bool is_implicit_cause = false;
+  if (effective_cause_id.value == kInvalidId.value) {
+    // No explicit cause, so search up the parent chain.
+    Id current_id = tracelet.parent_span_id;
+    while (current_id.value != kInvalidId.value &&
+           _active_spans.count(current_id.value)) {
+      const auto &parent_span_data = _active_spans.at(current_id.value);
+      if (parent_span_data.cause_id.value != kInvalidId.value) {
+        effective_cause_id = parent_span_data.cause_id;
+        is_implicit_cause = true;
+        break; // Found the first ancestor with a cause
+      }
+      current_id = parent_span_data.parent_id; // Go up one level
+    }
+  }
+
+  _out << "  { Causal Link: " << effective_cause_id.value
+       << (is_implicit_cause ? " (Implicit)" : " (Explicit)") << ",\n";
+
+  _out << "    Event Attributes: { ";
+  for (uint8_t i = 0; i < tracelet.num_attributes; ++i) {
+    print_attribute(_out, get_name(tracelet.attributes[i].key_id),
+                    tracelet.attributes[i].value, strings);
+    if (i < tracelet.num_attributes - 1)
+      _out << ", ";
+  }
+  _out << " },\n";
+
+  _out << "    Span Context: {\n";
+  Id current_span_id = tracelet.parent_span_id;
+  while (current_span_id.value != kInvalidId.value &&
+         _active_spans.count(current_span_id.value)) {
+    const auto &span_data = _active_spans.at(current_span_id.value);
+    _out << "      '" << get_name(span_data.name_hash) << "': { ";
+    for (size_t i = 0; i < span_data.attributes.size(); ++i) {
+      print_attribute(_out, get_name(span_data.attributes[i].key_id),
+                      span_data.attributes[i].value, strings);
+      if (i < span_data.attributes.size() - 1)
+        _out << ", ";
+    }
+    _out << " },\n";
+    current_span_id = span_data.parent_id;
+  }
+  _out << "    }\n  }\n";
+}
+
+} // namespace Waffle
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "waffle/model/thread_tracks.hpp"
+#include "waffle/processor/iprocessor.hpp"
+#include <map>
+#include <ostream>
+#include <vector>
+
+namespace Waffle {
+
+/**
+ * @brief Prints every EVENT to a stream, together with its effective cause
+ * (explicit, or implicitly inherited from the nearest ancestor span that has
+ * one) and the attributes of its enclosing spans.
+ *
+ * This is what `Waffle::setup()` installs when no processors are given.
+ */
+class ConsoleProcessor : public IProcessor {
+public:
+  explicit ConsoleProcessor(std::ostream &out);
+
+  void on_record(const Tracelet &record,
+                 const std::unordered_map<uint64_t, std::string> &strings)
+      override;
+  void flush() override;
+
+private:
+  struct ReadableSpanData {
+    uint64_t name_hash;
+    Id parent_id;
+    Id cause_id;
+    std::vector<Attribute> attributes;
+  };
+
+  void print_event(const Tracelet &record,
+                   const std::unordered_map<uint64_t, std::string> &strings);
+
+  std::ostream &_out;
+  std::map<uint64_t, ReadableSpanData> _active_spans;
+  model::ThreadTracks _threads;
+};
+
+} // namespace Waffle
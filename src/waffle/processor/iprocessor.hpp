@@ -0,0 +1,59 @@
+#pragma once
+
+#include "waffle/waffle_core.hpp"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+namespace Waffle {
+
+/**
+ * @brief What a processor learns about the tracing process before the first
+ * record.
+ */
+struct ProcessorContext {
+  // Top 24 bits of every span id this process allocates (see
+  // Tracer::process_tag()); identifies the process in merged traces.
+  uint64_t process_tag;
+  uint64_t start_wall_ns;
+};
+
+/**
+ * @brief Interface for a component that receives every record leaving the
+ * ring buffer, e.g. an exporter or a trace file writer.
+ *
+ * All methods are called on the Tracer's processing thread, never
+ * concurrently. Records arrive in ring order, which is timestamp order up to
+ * the small skew between producers that claim slots concurrently. While
+ * `on_record()` runs, the string table is stable: strings referenced by the
+ * record (name, attribute keys, string values) are guaranteed to be present.
+ *
+ * Processors must not block for long: the ring buffer is not drained while
+ * they run, and producers drop records once it is full.
+ *
+ * A processor whose method throws receives no further calls; the Tracer
+ * counts it in Tracer::processor_errors().
+ */
+class IProcessor {
+public:
+  virtual ~IProcessor() = default;
+
+  virtual void on_start(const ProcessorContext &context) { (void)context; }
+
+  virtual void
+  on_record(const Tracelet &record,
+            const std::unordered_map<uint64_t, std::string> &strings) = 0;
+
+  // Called when the ring runs empty and on shutdown, after the last record.
+  virtual void flush() {}
+
+  // Called once after the final flush().
+  virtual void shutdown() {}
+
+  // Work accepted but not yet delivered, e.g. batches waiting for a sender
+  // thread, in the processor's own units. Read by the overhead controller
+  // (see OverheadBudget::max_backlog).
+  virtual size_t backlog() const { return 0; }
+};
+
+} // namespace Waffle
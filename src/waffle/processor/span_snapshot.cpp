@@ -0,0 +1,312 @@
+#include "waffle/processor/span_snapshot.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <sstream>
+
+namespace Waffle {
+
+std::atomic<uint32_t> SpanSnapshotProcessor::s_signal_count{0};
+
+namespace {
+
+// Bounds parent-chain walks in case of a (corrupt) cycle.
+constexpr unsigned kMaxDepth = 256;
+
+uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+std::string format_ns(uint64_t ns) {
+  char buf[32];
+  if (ns < 1'000)
+    std::snprintf(buf, sizeof(buf), "%lluns",
+                  static_cast<unsigned long long>(ns));
+  else if (ns < 1'000'000)
+    std::snprintf(buf, sizeof(buf), "%.2fus", ns / 1e3);
+  else if (ns < 1'000'000'000)
+    std::snprintf(buf, sizeof(buf), "%.2fms", ns / 1e6);
+  else
+    std::snprintf(buf, sizeof(buf), "%.2fs", ns / 1e9);
+  return buf;
+}
+
+std::string_view
+lookup(const std::unordered_map<uint64_t, std::string> &strings,
+       uint64_t hash) {
+  auto it = strings.find(hash);
+  return it != strings.end() ? std::string_view(it->second) : "???";
+}
+
+} // namespace
+
+// --- SpanSnapshot ---
+
+void SpanSnapshot::format(std::ostream &out) const {
+  size_t open = 0;
+  for (const Thread &t : threads)
+    open += t.stack.size();
+  out << "=== Waffle span snapshot (" << reason << "): " << open
+      << " open spans on " << threads.size() << " threads ===\n";
+  for (const Thread &t : threads) {
+    out << "thread " << t.index;
+    if (!t.name.empty())
+      out << " \"" << t.name << "\"";
+    if (t.tid != 0)
+      out << " (tid " << t.tid << ")";
+    out << "\n";
+    for (const OpenSpan &s : t.stack) {
+      out << std::string(2 + 2 * s.depth, ' ')
+          << lookup(strings, s.start.name_string_hash) << "  open "
+          << format_ns(s.age_ns) << "  span=" << std::hex
+          << s.start.span_id.value << " trace=" << s.start.trace_id.value
+          << std::dec;
+      for (auto it = s.start.attributes_begin();
+           it != s.start.attributes_end(); ++it) {
+        out << " " << lookup(strings, it->key_id) << "=";
+        switch (it->value.type) {
+        case AttributeValue::Type::BOOL:
+          out << (it->value.b ? "true" : "false");
+          break;
+        case AttributeValue::Type::INT64:
+          out << it->value.i64;
+          break;
+        case AttributeValue::Type::DOUBLE:
+          out << it->value.f64;
+          break;
+        case AttributeValue::Type::STRING_ID:
+          out << lookup(strings, it->value.string_id);
+          break;
+        }
+      }
+      out << "\n";
+    }
+  }
+  if (!pending_links.empty()) {
+    out << "causal links of open spans:\n";
+    for (const CausalLink &link : pending_links) {
+      out << "  " << std::hex << link.span_id.value << " <- "
+          << link.cause_id.value << std::dec;
+      if (link.cause_open)
+        out << " (cause still open on thread " << link.cause_thread << ")\n";
+      else
+        out << " (cause ended or not seen)\n";
+    }
+  }
+}
+
+// --- SpanSnapshotProcessor ---
+
+SpanSnapshotProcessor::SpanSnapshotProcessor(Options options)
+    : _options(std::move(options)) {}
+
+SpanSnapshotProcessor::~SpanSnapshotProcessor() { shutdown(); }
+
+void SpanSnapshotProcessor::on_signal(int) {
+  s_signal_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void SpanSnapshotProcessor::on_start(const ProcessorContext &) {
+  if (_options.dump_signal != 0) {
+    struct sigaction action {};
+    action.sa_handler = &SpanSnapshotProcessor::on_signal;
+    action.sa_flags = SA_RESTART; // Do not disturb the application's calls
+    sigemptyset(&action.sa_mask);
+    if (sigaction(_options.dump_signal, &action, &_previous_action) == 0)
+      _installed_signal = _options.dump_signal;
+  }
+  if (_options.deadline.count() > 0 || _options.dump_signal != 0)
+    _watchdog = std::thread([this] { watch(); });
+}
+
+void SpanSnapshotProcessor::copy_string(
+    uint64_t hash, const std::unordered_map<uint64_t, std::string> &strings) {
+  if (_strings.count(hash))
+    return;
+  auto it = strings.find(hash);
+  if (it != strings.end())
+    _strings.emplace(hash, it->second);
+}
+
+void SpanSnapshotProcessor::on_record(
+    const Tracelet &record,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  switch (record.record_type) {
+  case Tracelet::RecordType::SPAN_START: {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _open.insert_or_assign(record.span_id.value, record);
+    copy_string(record.name_string_hash, strings);
+    for (auto it = record.attributes_begin(); it != record.attributes_end();
+         ++it) {
+      copy_string(it->key_id, strings);
+      if (it->value.type == AttributeValue::Type::STRING_ID)
+        copy_string(it->value.string_id, strings);
+    }
+    break;
+  }
+  case Tracelet::RecordType::SPAN_END: {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _open.erase(record.span_id.value);
+    break;
+  }
+  case Tracelet::RecordType::THREAD_INFO: {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _threads.observe(record, strings);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+size_t SpanSnapshotProcessor::open_spans() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _open.size();
+}
+
+SpanSnapshot SpanSnapshotProcessor::snapshot(std::string reason) const {
+  SpanSnapshot s;
+  s.reason = std::move(reason);
+  std::vector<Tracelet> open;
+  std::unordered_map<uint16_t, model::ThreadInfo> infos;
+  {
+    // Only copies: the processing thread waits for no longer than this.
+    std::lock_guard<std::mutex> lock(_mutex);
+    s.taken_at_ns = now_ns();
+    open.reserve(_open.size());
+    for (const auto &[id, start] : _open)
+      open.push_back(start);
+    infos = _threads.threads();
+    auto copy = [&](uint64_t hash) {
+      auto it = _strings.find(hash);
+      if (it != _strings.end())
+        s.strings.emplace(hash, it->second);
+    };
+    for (const Tracelet &t : open) {
+      copy(t.name_string_hash);
+      for (auto it = t.attributes_begin(); it != t.attributes_end(); ++it) {
+        copy(it->key_id);
+        if (it->value.type == AttributeValue::Type::STRING_ID)
+          copy(it->value.string_id);
+      }
+    }
+  }
+
+  std::sort(open.begin(), open.end(), [](const Tracelet &a, const Tracelet &b) {
+    return a.timestamp < b.timestamp;
+  });
+  std::unordered_map<uint64_t, const Tracelet *> by_id;
+  for (const Tracelet &t : open)
+    by_id.emplace(t.span_id.value, &t);
+
+  std::map<uint16_t, SpanSnapshot::Thread> threads;
+  for (const Tracelet &t : open) {
+    unsigned depth = 0;
+    for (auto p = by_id.find(t.parent_span_id.value);
+         p != by_id.end() && p->second->thread_index == t.thread_index &&
+         depth < kMaxDepth;
+         p = by_id.find(p->second->parent_span_id.value))
+      ++depth;
+    SpanSnapshot::Thread &thread = threads[t.thread_index];
+    thread.index = t.thread_index;
+    thread.stack.push_back(
+        {t, s.taken_at_ns > t.timestamp ? s.taken_at_ns - t.timestamp : 0,
+         depth});
+
+    if (t.cause_id != kInvalidId) {
+      auto cause = by_id.find(t.cause_id.value);
+      s.pending_links.push_back(
+          {t.span_id, t.cause_id, cause != by_id.end(),
+           cause != by_id.end() ? cause->second->thread_index
+                                : uint16_t{0}});
+    }
+  }
+  for (auto &[index, thread] : threads) {
+    auto info = infos.find(index);
+    if (info != infos.end()) {
+      thread.tid = info->second.tid;
+      thread.name = info->second.name;
+    }
+    s.threads.push_back(std::move(thread));
+  }
+  return s;
+}
+
+void SpanSnapshotProcessor::dump(std::string reason) const {
+  std::ostringstream text;
+  snapshot(std::move(reason)).format(text);
+  const std::string out = text.str();
+  if (_options.dump_path.empty()) {
+    std::fwrite(out.data(), 1, out.size(), stderr);
+  } else if (std::FILE *file = std::fopen(_options.dump_path.c_str(), "a")) {
+    std::fwrite(out.data(), 1, out.size(), file);
+    std::fclose(file);
+  }
+  _dumps.fetch_add(1, std::memory_order_relaxed);
+}
+
+void SpanSnapshotProcessor::watch() {
+  uint32_t signals_seen = s_signal_count.load(std::memory_order_relaxed);
+  const uint64_t deadline_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(_options.deadline)
+          .count();
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(_watch_mutex);
+      if (_watch_wakeup.wait_for(lock, _options.poll_interval,
+                                 [this] { return _stopping; }))
+        return;
+    }
+    const uint32_t signals = s_signal_count.load(std::memory_order_relaxed);
+    if (signals != signals_seen) {
+      signals_seen = signals;
+      dump("signal " + std::to_string(_options.dump_signal));
+    }
+    if (deadline_ns == 0)
+      continue;
+
+    // Dump when some span newly crossed the deadline; spans already
+    // reported do not trigger again while they stay open.
+    std::unordered_set<uint64_t> overdue;
+    std::string culprit;
+    uint64_t culprit_age = 0;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      const uint64_t now = now_ns();
+      for (const auto &[id, start] : _open) {
+        const uint64_t age = now > start.timestamp ? now - start.timestamp : 0;
+        if (age <= deadline_ns)
+          continue;
+        overdue.insert(id);
+        if (!_reported.count(id) && age > culprit_age) {
+          culprit_age = age;
+          culprit = lookup(_strings, start.name_string_hash);
+        }
+      }
+    }
+    _reported = std::move(overdue);
+    if (culprit_age > 0)
+      dump("span '" + culprit + "' open for " + format_ns(culprit_age) +
+           ", deadline " + format_ns(deadline_ns));
+  }
+}
+
+void SpanSnapshotProcessor::shutdown() {
+  if (_watchdog.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(_watch_mutex);
+      _stopping = true;
+    }
+    _watch_wakeup.notify_one();
+    _watchdog.join();
+  }
+  if (_installed_signal != 0) {
+    sigaction(_installed_signal, &_previous_action, nullptr);
+    _installed_signal = 0;
+  }
+}
+
+} // namespace Waffle
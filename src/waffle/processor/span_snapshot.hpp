@@ -0,0 +1,125 @@
+#pragma once
+
+#include "waffle/model/thread_tracks.hpp"
+#include "waffle/processor/iprocessor.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace Waffle {
+
+/**
+ * @brief The spans open at one instant, per thread, for hang diagnosis.
+ */
+struct SpanSnapshot {
+  struct OpenSpan {
+    Tracelet start;
+    uint64_t age_ns;
+    unsigned depth; // Open ancestors on the same thread
+  };
+  struct Thread {
+    uint16_t index;
+    int64_t tid = 0; // 0 if its THREAD_INFO was not seen
+    std::string name;
+    std::vector<OpenSpan> stack; // Outermost first
+  };
+  // An open span caused by another span, and whether that one is still
+  // open (e.g. a receive still waiting on its send).
+  struct CausalLink {
+    Id span_id;
+    Id cause_id;
+    bool cause_open;
+    uint16_t cause_thread; // Valid if cause_open
+  };
+
+  std::string reason;
+  uint64_t taken_at_ns = 0; // Wall clock, as record timestamps
+  std::vector<Thread> threads; // By thread index
+  std::vector<CausalLink> pending_links;
+  // Names, attribute keys and string values of the spans above.
+  std::unordered_map<uint64_t, std::string> strings;
+
+  void format(std::ostream &out) const;
+};
+
+/**
+ * @brief Processor that mirrors every open span so that a snapshot of them
+ * can be taken at any time: through snapshot()/dump(), on a signal, or by a
+ * watchdog when a span stays open past a deadline.
+ *
+ * Producers are never stopped. The processing thread updates the open-span
+ * table under a mutex that only a snapshot contends, and a snapshot holds
+ * it just long enough to copy the table; formatting happens afterwards.
+ * Records still in the ring are not reflected yet, which is at most a few
+ * milliseconds of activity.
+ *
+ * The watchdog and signal handling run on a thread of their own because a
+ * hung process often stops emitting records, and processors are only
+ * called when records arrive. The signal handler merely bumps an atomic
+ * counter that this thread polls.
+ */
+class SpanSnapshotProcessor : public IProcessor {
+public:
+  struct Options {
+    // Dump when a span has been open longer than this (once per span);
+    // 0 disables the watchdog.
+    std::chrono::milliseconds deadline{0};
+    std::chrono::milliseconds poll_interval{100};
+    int dump_signal = 0;   // e.g. SIGUSR2; 0 installs no handler
+    std::string dump_path; // Appended to; empty writes to stderr
+  };
+
+  explicit SpanSnapshotProcessor(Options options);
+  SpanSnapshotProcessor() : SpanSnapshotProcessor(Options{}) {}
+  ~SpanSnapshotProcessor() override;
+
+  void on_start(const ProcessorContext &context) override;
+  void on_record(const Tracelet &record,
+                 const std::unordered_map<uint64_t, std::string> &strings)
+      override;
+  void shutdown() override;
+
+  // Safe to call from any thread.
+  SpanSnapshot snapshot(std::string reason = "requested") const;
+  // Takes a snapshot and writes it to the dump destination.
+  void dump(std::string reason = "requested") const;
+
+  size_t open_spans() const;
+  uint64_t dumps() const { return _dumps.load(std::memory_order_relaxed); }
+
+private:
+  void copy_string(uint64_t hash,
+                   const std::unordered_map<uint64_t, std::string> &strings);
+  void watch();
+  static void on_signal(int);
+
+  Options _options;
+
+  mutable std::mutex _mutex; // Guards the members up to _threads
+  std::unordered_map<uint64_t, Tracelet> _open;
+  std::unordered_map<uint64_t, std::string> _strings;
+  model::ThreadTracks _threads;
+
+  std::unordered_set<uint64_t> _reported; // Watchdog thread only
+  mutable std::atomic<uint64_t> _dumps{0};
+
+  std::mutex _watch_mutex;
+  std::condition_variable _watch_wakeup;
+  bool _stopping = false;
+  std::thread _watchdog;
+  int _installed_signal = 0;
+  struct sigaction _previous_action {};
+
+  // Bumped by the signal handler; lock-free, so async-signal-safe.
+  static std::atomic<uint32_t> s_signal_count;
+};
+
+} // namespace Waffle
@@ -0,0 +1,210 @@
+#include "waffle/profile/flame_graph.hpp"
+#include "waffle/helpers/open_spans.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <system_error>
+
+namespace Waffle::profile {
+
+namespace {
+constexpr uint32_t kRoot = 0;
+constexpr uint32_t kNoFrame = 0xFFFFFFFF;
+
+void write_json_string(std::ostream &out, std::string_view s) {
+  out << '"';
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buf[8];
+      std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out << buf;
+    } else {
+      out << c;
+    }
+  }
+  out << '"';
+}
+} // namespace
+
+FlameGraph::FlameGraph(size_t max_nodes, size_t max_open_spans)
+    : _max_nodes(std::max<size_t>(max_nodes, 2)),
+      _max_open_spans(max_open_spans) {
+  _nodes.push_back({kNoFrame, kRoot});
+  _truncated_frame = 0;
+  _frames.emplace_back(kTruncatedFrame);
+}
+
+uint32_t FlameGraph::intern_frame(
+    uint64_t hash, const std::unordered_map<uint64_t, std::string> &strings) {
+  auto [it, inserted] =
+      _frame_ids.try_emplace(hash, static_cast<uint32_t>(_frames.size()));
+  if (inserted) {
+    auto s = strings.find(hash);
+    _frames.push_back(s != strings.end() ? s->second : "???");
+  }
+  return it->second;
+}
+
+uint32_t FlameGraph::child(
+    uint32_t parent, uint64_t name_hash,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  // A name without a frame has no node yet either.
+  auto known = _frame_ids.find(name_hash);
+  if (known != _frame_ids.end()) {
+    auto it = _children.find((uint64_t{parent} << 32) | known->second);
+    if (it != _children.end())
+      return it->second;
+  }
+  uint32_t frame;
+  if (_nodes.size() >= _max_nodes) {
+    // Out of nodes: fold the rest of the path into one "[truncated]" child
+    // per existing node, so the trie never exceeds twice the limit, and
+    // intern nothing new.
+    if (_nodes[parent].frame == _truncated_frame)
+      return parent;
+    frame = _truncated_frame;
+    auto it = _children.find((uint64_t{parent} << 32) | frame);
+    if (it != _children.end())
+      return it->second;
+  } else {
+    frame = known != _frame_ids.end() ? known->second
+                                      : intern_frame(name_hash, strings);
+  }
+  const uint32_t node = static_cast<uint32_t>(_nodes.size());
+  _nodes.push_back({frame, parent});
+  _children.emplace((uint64_t{parent} << 32) | frame, node);
+  return node;
+}
+
+void FlameGraph::add(const Tracelet &record,
+                     const std::unordered_map<uint64_t, std::string> &strings) {
+  if (record.record_type == Tracelet::RecordType::SPAN_START) {
+    // A parent still open holds the path; otherwise this is a root span.
+    uint32_t parent_node = kRoot;
+    auto parent = _open.find(record.parent_span_id.value);
+    if (record.parent_span_id != kInvalidId && parent != _open.end())
+      parent_node = parent->second.node;
+    const uint32_t node = child(parent_node, record.name_string_hash, strings);
+    _open_spans_evicted +=
+        trim_open_spans(_open, _max_open_spans,
+                        [](const OpenSpan &open) { return open.start; });
+    _open.insert_or_assign(record.span_id.value,
+                           OpenSpan{node, record.parent_span_id.value,
+                                    record.timestamp});
+  } else if (record.record_type == Tracelet::RecordType::SPAN_END) {
+    auto it = _open.find(record.span_id.value);
+    if (it == _open.end())
+      return;
+    const OpenSpan &span = it->second;
+    const uint64_t duration =
+        record.timestamp > span.start ? record.timestamp - span.start : 0;
+    // Children on other threads may outlive or overlap their parent.
+    const uint64_t self =
+        duration > span.children_ns ? duration - span.children_ns : 0;
+    Node &node = _nodes[span.node];
+    node.self_ns += self;
+    ++node.count;
+    auto parent = _open.find(span.parent_span_id);
+    if (span.parent_span_id != kInvalidId.value && parent != _open.end())
+      parent->second.children_ns += duration;
+    _open.erase(it);
+  }
+}
+
+uint64_t FlameGraph::total_ns() const {
+  uint64_t total = 0;
+  for (const Node &n : _nodes)
+    total += n.self_ns;
+  return total;
+}
+
+std::vector<uint32_t> FlameGraph::path(uint32_t node) const {
+  std::vector<uint32_t> frames;
+  for (; node != kRoot; node = _nodes[node].parent)
+    frames.push_back(_nodes[node].frame);
+  std::reverse(frames.begin(), frames.end());
+  return frames;
+}
+
+void FlameGraph::write_folded(std::ostream &out) const {
+  for (uint32_t n = 1; n < _nodes.size(); ++n) {
+    if (_nodes[n].self_ns == 0)
+      continue;
+    bool first = true;
+    for (uint32_t frame : path(n)) {
+      if (!first)
+        out << ';';
+      first = false;
+      // ';' separates frames and the last ' ' the weight: keep names safe.
+      for (char c : _frames[frame])
+        out << (c == ';' ? ':' : c == '\n' ? ' ' : c);
+    }
+    out << ' ' << _nodes[n].self_ns << '\n';
+  }
+}
+
+void FlameGraph::write_speedscope(std::ostream &out,
+                                  const std::string &name) const {
+  out << "{\"$schema\":\"https://www.speedscope.app/file-format-schema.json\","
+         "\"exporter\":\"waffle\",\"name\":";
+  write_json_string(out, name);
+  out << ",\"shared\":{\"frames\":[";
+  for (size_t f = 0; f < _frames.size(); ++f) {
+    out << (f ? ",{\"name\":" : "{\"name\":");
+    write_json_string(out, _frames[f]);
+    out << '}';
+  }
+  out << "]},\"profiles\":[{\"type\":\"sampled\",\"name\":";
+  write_json_string(out, name);
+  out << ",\"unit\":\"nanoseconds\",\"startValue\":0,\"endValue\":"
+      << total_ns() << ",\"samples\":[";
+  bool first = true;
+  for (uint32_t n = 1; n < _nodes.size(); ++n) {
+    if (_nodes[n].self_ns == 0)
+      continue;
+    out << (first ? "[" : ",[");
+    first = false;
+    bool first_frame = true;
+    for (uint32_t frame : path(n)) {
+      out << (first_frame ? "" : ",") << frame;
+      first_frame = false;
+    }
+    out << ']';
+  }
+  out << "],\"weights\":[";
+  first = true;
+  for (uint32_t n = 1; n < _nodes.size(); ++n) {
+    if (_nodes[n].self_ns == 0)
+      continue;
+    out << (first ? "" : ",") << _nodes[n].self_ns;
+    first = false;
+  }
+  out << "]}]}\n";
+}
+
+FlameGraphProcessor::FlameGraphProcessor(Options options)
+    : _options(std::move(options)),
+      _graph(_options.max_nodes, _options.max_open_spans) {}
+
+void FlameGraphProcessor::on_record(
+    const Tracelet &record,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  _graph.add(record, strings);
+}
+
+void FlameGraphProcessor::shutdown() {
+  std::ofstream out(_options.path);
+  if (!out)
+    throw std::system_error(errno, std::generic_category(),
+                            "Cannot create " + _options.path);
+  if (_options.format == Format::SPEEDSCOPE)
+    _graph.write_speedscope(out, "waffle");
+  else
+    _graph.write_folded(out);
+}
+
+} // namespace Waffle::profile
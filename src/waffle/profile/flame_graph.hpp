@@ -0,0 +1,108 @@
+#pragma once
+
+#include "waffle/processor/iprocessor.hpp"
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Waffle::profile {
+
+/**
+ * @brief Aggregates span trees into a stack trie weighted by self time,
+ * incrementally as spans end.
+ *
+ * Each span maps to the trie node reached by following its ancestors' names
+ * from the root; when it ends, its duration minus the time spent in its
+ * (already ended) children is added to that node. Names are interned as
+ * frames, so a node is a few words no matter how many spans share the path.
+ * Once `max_nodes` nodes exist, new paths are folded into a single
+ * "[truncated]" child of the deepest existing ancestor, and a name is only
+ * interned when it gets a node, so memory stays bounded on traces with
+ * unbounded name variety. At most `max_open_spans` spans wait for their end;
+ * beyond that the older half is evicted and never added.
+ */
+class FlameGraph {
+public:
+  static constexpr size_t kDefaultMaxNodes = 1 << 20;
+  static constexpr size_t kDefaultMaxOpenSpans = 1 << 16;
+  static constexpr const char *kTruncatedFrame = "[truncated]";
+
+  explicit FlameGraph(size_t max_nodes = kDefaultMaxNodes,
+                      size_t max_open_spans = kDefaultMaxOpenSpans);
+
+  // Feeds a record; SPAN_START / SPAN_END update the trie, others are ignored.
+  void add(const Tracelet &record,
+           const std::unordered_map<uint64_t, std::string> &strings);
+
+  // One line per stack with self time: "a;b;c <ns>", for flamegraph.pl.
+  void write_folded(std::ostream &out) const;
+  // A speedscope "sampled" profile weighted in nanoseconds.
+  void write_speedscope(std::ostream &out, const std::string &name) const;
+
+  size_t node_count() const { return _nodes.size(); }
+  size_t frame_count() const { return _frames.size(); }
+  uint64_t open_spans_evicted() const { return _open_spans_evicted; }
+  uint64_t total_ns() const; // Sum of all self times
+
+private:
+  struct Node {
+    uint32_t frame;
+    uint32_t parent;
+    uint64_t self_ns = 0;
+    uint64_t count = 0;
+  };
+  struct OpenSpan {
+    uint32_t node;
+    uint64_t parent_span_id;
+    uint64_t start;
+    uint64_t children_ns = 0;
+  };
+
+  uint32_t intern_frame(uint64_t hash,
+                        const std::unordered_map<uint64_t, std::string> &strings);
+  uint32_t child(uint32_t parent, uint64_t name_hash,
+                 const std::unordered_map<uint64_t, std::string> &strings);
+  std::vector<uint32_t> path(uint32_t node) const; // Frames, root first
+
+  size_t _max_nodes;
+  size_t _max_open_spans;
+  std::vector<Node> _nodes; // _nodes[0] is the root
+  std::unordered_map<uint64_t, uint32_t> _children; // (parent<<32|frame)
+  std::vector<std::string> _frames;
+  std::unordered_map<uint64_t, uint32_t> _frame_ids; // Name hash -> frame
+  uint32_t _truncated_frame;
+  std::unordered_map<uint64_t, OpenSpan> _open; // By span id
+  uint64_t _open_spans_evicted = 0;
+};
+
+/**
+ * @brief Processor that builds a FlameGraph of this process and writes it on
+ * shutdown.
+ */
+class FlameGraphProcessor : public IProcessor {
+public:
+  enum class Format { FOLDED, SPEEDSCOPE };
+  struct Options {
+    std::string path;
+    Format format = Format::FOLDED;
+    size_t max_nodes = FlameGraph::kDefaultMaxNodes;
+    size_t max_open_spans = FlameGraph::kDefaultMaxOpenSpans;
+  };
+
+  explicit FlameGraphProcessor(Options options);
+
+  void on_record(const Tracelet &record,
+                 const std::unordered_map<uint64_t, std::string> &strings)
+      override;
+  void shutdown() override;
+
+  const FlameGraph &graph() const { return _graph; }
+
+private:
+  Options _options;
+  FlameGraph _graph;
+};
+
+} // namespace Waffle::profile
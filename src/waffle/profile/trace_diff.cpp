@@ -0,0 +1,306 @@
+#include "waffle/profile/trace_diff.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace Waffle::profile {
+
+namespace {
+
+// Chains a name onto a parent path; order-sensitive, never 0.
+uint64_t path_id(uint64_t parent, uint64_t name_hash) {
+  uint64_t h = parent ^ (name_hash + 0x9E3779B97F4A7C15ull + (parent << 6) +
+                         (parent >> 2));
+  h *= 0xBF58476D1CE4E5B9ull;
+  h ^= h >> 31;
+  return h != 0 ? h : 1;
+}
+
+std::string format_ns(double ns) {
+  char buf[32];
+  const double abs = std::abs(ns);
+  if (abs < 1e3)
+    std::snprintf(buf, sizeof(buf), "%.0fns", ns);
+  else if (abs < 1e6)
+    std::snprintf(buf, sizeof(buf), "%.2fus", ns / 1e3);
+  else if (abs < 1e9)
+    std::snprintf(buf, sizeof(buf), "%.2fms", ns / 1e6);
+  else
+    std::snprintf(buf, sizeof(buf), "%.2fs", ns / 1e9);
+  return buf;
+}
+
+void write_diff_line(std::ostream &out, const PathDiff &d) {
+  char line[160];
+  std::snprintf(line, sizeof(line),
+                "%10s %+7.1f%%  P(slower)=%.2f  p=%-8.2g  n=%llu/%llu  ",
+                ((d.impact_ns >= 0 ? "+" : "") + format_ns(d.impact_ns))
+                    .c_str(),
+                d.change * 100, d.test.prob_greater, d.test.p_value,
+                static_cast<unsigned long long>(d.base_count),
+                static_cast<unsigned long long>(d.target_count));
+  out << line << "p50 " << format_ns(d.base_p50_ns) << " -> "
+      << format_ns(d.target_p50_ns) << "  p99 " << format_ns(d.base_p99_ns)
+      << " -> " << format_ns(d.target_p99_ns) << "  " << d.frames << '\n';
+}
+
+} // namespace
+
+// --- SpanPathProfile ---
+
+SpanPathProfile::SpanPathProfile(size_t max_paths)
+    : _max_paths(std::max<size_t>(max_paths, 1)),
+      _truncated_hash(fnv1a_hash(kTruncatedFrame,
+                                 std::char_traits<char>::length(
+                                     kTruncatedFrame))) {
+  _names.emplace(_truncated_hash, kTruncatedFrame);
+}
+
+std::pair<const uint64_t, SpanPathProfile::Path> &SpanPathProfile::child(
+    uint64_t parent, uint64_t name_hash,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  auto it = _paths.find(path_id(parent, name_hash));
+  if (it != _paths.end())
+    return *it;
+  if (_paths.size() >= _max_paths) {
+    // Out of paths: one "[truncated]" child per existing path at most.
+    auto p = _paths.find(parent);
+    if (p != _paths.end() && p->second.name_hash == _truncated_hash)
+      return *p;
+    name_hash = _truncated_hash;
+  }
+  auto [inserted, _] = _paths.try_emplace(path_id(parent, name_hash));
+  inserted->second.parent = parent;
+  inserted->second.name_hash = name_hash;
+  if (!_names.count(name_hash)) {
+    auto s = strings.find(name_hash);
+    _names.emplace(name_hash, s != strings.end() ? s->second : "???");
+  }
+  return *inserted;
+}
+
+void SpanPathProfile::add(
+    const Tracelet &record,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  if (record.record_type == Tracelet::RecordType::SPAN_START) {
+    // A parent still open holds the path; otherwise this is a root span.
+    uint64_t parent_path = 0;
+    if (record.parent_span_id != kInvalidId) {
+      auto parent = _open.find(record.parent_span_id.value);
+      if (parent != _open.end())
+        parent_path = parent->second.path->first;
+    }
+    auto &path = child(parent_path, record.name_string_hash, strings);
+    _open.insert_or_assign(record.span_id.value,
+                           OpenSpan{&path, record.parent_span_id.value,
+                                    record.timestamp});
+  } else if (record.record_type == Tracelet::RecordType::SPAN_END) {
+    auto it = _open.find(record.span_id.value);
+    if (it == _open.end())
+      return;
+    const OpenSpan &span = it->second;
+    const uint64_t duration =
+        record.timestamp > span.start ? record.timestamp - span.start : 0;
+    Path &path = span.path->second;
+    ++path.count;
+    path.total_ns += duration;
+    // Children on other threads may outlive or overlap their parent.
+    path.self_ns +=
+        duration > span.children_ns ? duration - span.children_ns : 0;
+    path.durations.add(duration);
+    if (span.parent_span_id != kInvalidId.value) {
+      auto parent = _open.find(span.parent_span_id);
+      if (parent != _open.end())
+        parent->second.children_ns += duration;
+    }
+    _open.erase(it);
+    ++_spans;
+  }
+}
+
+void SpanPathProfile::merge(const SpanPathProfile &other) {
+  for (const auto &[id, theirs] : other._paths) {
+    auto [it, inserted] = _paths.try_emplace(id);
+    Path &ours = it->second;
+    if (inserted) {
+      ours.parent = theirs.parent;
+      ours.name_hash = theirs.name_hash;
+    }
+    ours.count += theirs.count;
+    ours.total_ns += theirs.total_ns;
+    ours.self_ns += theirs.self_ns;
+    ours.durations.merge(theirs.durations);
+  }
+  _names.insert(other._names.begin(), other._names.end());
+  _spans += other._spans;
+}
+
+std::string SpanPathProfile::frames(uint64_t path) const {
+  std::vector<const std::string *> names;
+  for (auto it = _paths.find(path); it != _paths.end();
+       it = _paths.find(it->second.parent))
+    names.push_back(&_names.at(it->second.name_hash));
+  std::string out;
+  for (auto name = names.rbegin(); name != names.rend(); ++name) {
+    if (!out.empty())
+      out += ';';
+    // ';' separates frames and the last ' ' the weights: keep names safe.
+    for (char c : **name)
+      out += c == ';' ? ':' : c == '\n' ? ' ' : c;
+  }
+  return out;
+}
+
+// --- Statistics ---
+
+RankTest mann_whitney(const model::DurationSketch &a,
+                      const model::DurationSketch &b) {
+  RankTest result;
+  const double na = static_cast<double>(a.count());
+  const double nb = static_cast<double>(b.count());
+  if (na == 0 || nb == 0)
+    return result;
+  // U counts the pairs in which b's duration is the larger, ties as half.
+  double u = 0, below_a = 0, ties = 0;
+  for (size_t i = 0; i < model::DurationSketch::kBuckets; ++i) {
+    const double ai = a.bucket_count(i), bi = b.bucket_count(i);
+    u += bi * (below_a + ai / 2);
+    below_a += ai;
+    const double t = ai + bi;
+    ties += t * t * t - t;
+  }
+  const double n = na + nb;
+  const double variance =
+      na * nb / 12 * ((n + 1) - (n > 1 ? ties / (n * (n - 1)) : 0));
+  result.prob_greater = u / (na * nb);
+  if (variance <= 0)
+    return result; // Everything in one bucket: no evidence either way
+  result.z = (u - na * nb / 2) / std::sqrt(variance);
+  result.p_value = std::erfc(std::abs(result.z) / std::sqrt(2.0));
+  return result;
+}
+
+double ks_distance(const model::DurationSketch &a,
+                   const model::DurationSketch &b) {
+  if (a.count() == 0 || b.count() == 0)
+    return 0;
+  double cdf_a = 0, cdf_b = 0, distance = 0;
+  for (size_t i = 0; i < model::DurationSketch::kBuckets; ++i) {
+    cdf_a += static_cast<double>(a.bucket_count(i)) / a.count();
+    cdf_b += static_cast<double>(b.bucket_count(i)) / b.count();
+    distance = std::max(distance, std::abs(cdf_a - cdf_b));
+  }
+  return distance;
+}
+
+// --- Diff ---
+
+std::vector<PathDiff> diff_profiles(const SpanPathProfile &base,
+                                    const SpanPathProfile &target,
+                                    const DiffOptions &options) {
+  std::vector<PathDiff> diffs;
+  for (const auto &[id, b] : base.paths()) {
+    auto it = target.paths().find(id);
+    if (it == target.paths().end())
+      continue;
+    const SpanPathProfile::Path &t = it->second;
+    if (b.count < options.min_count || t.count < options.min_count)
+      continue;
+    PathDiff d;
+    d.path = id;
+    d.frames = target.frames(id);
+    d.base_count = b.count;
+    d.target_count = t.count;
+    d.base_mean_ns = static_cast<double>(b.total_ns) / b.count;
+    d.target_mean_ns = static_cast<double>(t.total_ns) / t.count;
+    d.base_p50_ns = b.durations.quantile(0.5);
+    d.target_p50_ns = t.durations.quantile(0.5);
+    d.base_p99_ns = b.durations.quantile(0.99);
+    d.target_p99_ns = t.durations.quantile(0.99);
+    d.change = d.base_mean_ns > 0 ? d.target_mean_ns / d.base_mean_ns - 1 : 0;
+    d.test = mann_whitney(b.durations, t.durations);
+    d.ks = ks_distance(b.durations, t.durations);
+    d.impact_ns = (d.target_mean_ns - d.base_mean_ns) * t.count;
+    d.significant = d.test.p_value < options.alpha &&
+                    std::abs(d.change) >= options.min_change;
+    diffs.push_back(std::move(d));
+  }
+  std::sort(diffs.begin(), diffs.end(),
+            [](const PathDiff &x, const PathDiff &y) {
+              return x.impact_ns > y.impact_ns;
+            });
+  return diffs;
+}
+
+void write_diff_report(std::ostream &out, const std::vector<PathDiff> &diffs,
+                       const SpanPathProfile &base,
+                       const SpanPathProfile &target, size_t top) {
+  out << "Regressions by added time (impact, mean change, P(slower), "
+         "p-value, spans base/target):\n";
+  size_t shown = 0;
+  for (const PathDiff &d : diffs)
+    if (d.significant && d.change > 0 && shown++ < top)
+      write_diff_line(out, d);
+  if (shown == 0)
+    out << "  none\n";
+
+  out << "\nImprovements by saved time:\n";
+  shown = 0;
+  for (auto d = diffs.rbegin(); d != diffs.rend(); ++d)
+    if (d->significant && d->change < 0 && shown++ < top)
+      write_diff_line(out, *d);
+  if (shown == 0)
+    out << "  none\n";
+
+  auto only_in = [&](const SpanPathProfile &in, const SpanPathProfile &not_in,
+                     const char *title) {
+    std::vector<std::pair<uint64_t, uint64_t>> paths; // Total time, id
+    for (const auto &[id, p] : in.paths())
+      if (p.count > 0 && !not_in.paths().count(id))
+        paths.emplace_back(p.total_ns, id);
+    if (paths.empty())
+      return;
+    std::sort(paths.rbegin(), paths.rend());
+    out << '\n' << title << '\n';
+    for (size_t i = 0; i < paths.size() && i < top; ++i) {
+      const auto &p = in.paths().at(paths[i].second);
+      out << "  " << format_ns(static_cast<double>(p.total_ns)) << " in "
+          << p.count << " spans  " << in.frames(paths[i].second) << '\n';
+    }
+  };
+  only_in(target, base, "Only in target:");
+  only_in(base, target, "Only in base:");
+}
+
+void write_diff_folded(std::ostream &out, const SpanPathProfile &base,
+                       const SpanPathProfile &target, bool normalize) {
+  double scale = 1;
+  if (normalize) {
+    uint64_t base_total = 0, target_total = 0;
+    for (const auto &[id, p] : base.paths())
+      base_total += p.self_ns;
+    for (const auto &[id, p] : target.paths())
+      target_total += p.self_ns;
+    if (base_total > 0)
+      scale = static_cast<double>(target_total) / base_total;
+  }
+  for (const auto &[id, t] : target.paths()) {
+    auto b = base.paths().find(id);
+    const uint64_t base_self =
+        b != base.paths().end()
+            ? static_cast<uint64_t>(std::llround(b->second.self_ns * scale))
+            : 0;
+    if (base_self == 0 && t.self_ns == 0)
+      continue;
+    out << target.frames(id) << ' ' << base_self << ' ' << t.self_ns << '\n';
+  }
+  for (const auto &[id, b] : base.paths()) {
+    if (target.paths().count(id) || b.self_ns == 0)
+      continue;
+    out << base.frames(id) << ' '
+        << static_cast<uint64_t>(std::llround(b.self_ns * scale)) << " 0\n";
+  }
+}
+
+} // namespace Waffle::profile
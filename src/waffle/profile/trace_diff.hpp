@@ -0,0 +1,151 @@
+#pragma once
+
+#include "waffle/model/duration_sketch.hpp"
+#include "waffle/waffle_core.hpp"
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Waffle::profile {
+
+/**
+ * @brief Duration statistics of a recording per span path: a span's name
+ * and the names of its ancestors, e.g. "request;checkout;query".
+ *
+ * Paths are identified by a hash chained from the root over the name hashes,
+ * so the same path gets the same id in every recording and two profiles
+ * align without comparing strings. Each path keeps a DurationSketch of its
+ * spans' durations plus exact totals of duration and self time (duration
+ * minus that of the children), which is what a differential flame graph
+ * needs. As in FlameGraph, once `max_paths` paths exist new ones are folded
+ * into a "[truncated]" child of their parent.
+ */
+class SpanPathProfile {
+public:
+  static constexpr size_t kDefaultMaxPaths = 1 << 16;
+  static constexpr const char *kTruncatedFrame = "[truncated]";
+
+  struct Path {
+    uint64_t parent = 0; // Path id of the parent; 0 for a root span
+    uint64_t name_hash = 0;
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    uint64_t self_ns = 0;
+    model::DurationSketch durations;
+  };
+
+  explicit SpanPathProfile(size_t max_paths = kDefaultMaxPaths);
+
+  // Feeds a record; SPAN_START / SPAN_END are used, others are ignored.
+  void add(const Tracelet &record,
+           const std::unordered_map<uint64_t, std::string> &strings);
+  // Adds the paths of `other`, e.g. the profile of another rank's file.
+  // Spans still open in either are not carried over.
+  void merge(const SpanPathProfile &other);
+
+  const std::unordered_map<uint64_t, Path> &paths() const { return _paths; }
+  // Names from the root to `path`, separated by ';'.
+  std::string frames(uint64_t path) const;
+  uint64_t span_count() const { return _spans; }
+
+private:
+  struct OpenSpan {
+    std::pair<const uint64_t, Path> *path; // Id and statistics
+    uint64_t parent_span_id;
+    uint64_t start;
+    uint64_t children_ns = 0;
+  };
+
+  std::pair<const uint64_t, Path> &
+  child(uint64_t parent, uint64_t name_hash,
+        const std::unordered_map<uint64_t, std::string> &strings);
+
+  size_t _max_paths;
+  uint64_t _truncated_hash;
+  std::unordered_map<uint64_t, Path> _paths;
+  std::unordered_map<uint64_t, std::string> _names; // Of path frames
+  std::unordered_map<uint64_t, OpenSpan> _open;     // By span id
+  uint64_t _spans = 0;
+};
+
+/**
+ * @brief Mann-Whitney U test of two sketches with the same bucket mapping.
+ *
+ * Durations in one bucket count as ties, so the test is exact for the
+ * bucketed data and takes one pass over the buckets however many spans were
+ * added. `prob_greater` is U / (n_a n_b): the probability that a random
+ * duration of `b` exceeds one of `a` (ties counting half), 0.5 when the
+ * distributions agree. `p_value` is two-sided, from the normal
+ * approximation with tie correction.
+ */
+struct RankTest {
+  double prob_greater = 0.5;
+  double z = 0;
+  double p_value = 1;
+};
+RankTest mann_whitney(const model::DurationSketch &a,
+                      const model::DurationSketch &b);
+
+// Kolmogorov-Smirnov distance of two sketches: the largest gap between
+// their cumulative distributions, in [0, 1].
+double ks_distance(const model::DurationSketch &a,
+                   const model::DurationSketch &b);
+
+struct DiffOptions {
+  double alpha = 0.001;       // Significance level of the rank test
+  double min_change = 0.05;   // Relative change of the mean duration
+  uint64_t min_count = 30;    // Spans needed on each side to compare
+};
+
+/**
+ * @brief The change of one span path between a base and a target recording.
+ *
+ * `impact_ns` is the time the change adds to the target recording,
+ * (target mean - base mean) * target count: a small regression of a hot
+ * path outranks a large one of a path that rarely runs.
+ */
+struct PathDiff {
+  uint64_t path = 0;
+  std::string frames;
+  uint64_t base_count = 0;
+  uint64_t target_count = 0;
+  double base_mean_ns = 0;
+  double target_mean_ns = 0;
+  uint64_t base_p50_ns = 0;
+  uint64_t target_p50_ns = 0;
+  uint64_t base_p99_ns = 0;
+  uint64_t target_p99_ns = 0;
+  double change = 0; // target mean / base mean - 1
+  RankTest test;
+  double ks = 0;
+  double impact_ns = 0;
+  bool significant = false; // p < alpha and |change| >= min_change
+};
+
+// Paths with at least `min_count` spans on both sides, by impact_ns
+// (largest regression first, largest improvement last).
+std::vector<PathDiff> diff_profiles(const SpanPathProfile &base,
+                                    const SpanPathProfile &target,
+                                    const DiffOptions &options = {});
+
+// Ranked table of the significant regressions, then the improvements, at
+// most `top` of each; paths found in only one recording are listed last.
+void write_diff_report(std::ostream &out, const std::vector<PathDiff> &diffs,
+                       const SpanPathProfile &base,
+                       const SpanPathProfile &target, size_t top = 20);
+
+/**
+ * @brief Writes a differential flame graph in the two-column folded format
+ * of difffolded.pl ("a;b;c <base self ns> <target self ns>"), which
+ * `flamegraph.pl` colors by the change of each stack.
+ *
+ * With `normalize`, base self times are scaled so that both recordings
+ * total the same time, comparing shares rather than absolute times.
+ */
+void write_diff_folded(std::ostream &out, const SpanPathProfile &base,
+                       const SpanPathProfile &target, bool normalize);
+
+} // namespace Waffle::profile
@@ -0,0 +1,105 @@
+#include "waffle/query/scan_kernels.hpp"
+
+#if defined(__x86_64__) && defined(__linux__) && defined(__GNUC__)
+#define WAFFLE_SIMD_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define WAFFLE_SIMD_CLONES
+#endif
+
+namespace Waffle::query::kernels {
+
+namespace {
+
+// Elements per vectorized block. A constant trip count lets GCC's cheap -O2
+// vectorizer cost model accept the loop; the remainder runs scalar.
+constexpr size_t kBlock = 64;
+
+template <typename T, typename Cmp>
+[[gnu::always_inline]] inline void apply(const T *column, size_t n, T value,
+                                         uint8_t *mask, Cmp cmp) {
+  size_t i = 0;
+  for (; i + kBlock <= n; i += kBlock)
+    for (size_t j = 0; j < kBlock; ++j)
+      mask[i + j] &= static_cast<uint8_t>(cmp(column[i + j], value));
+  for (; i < n; ++i)
+    mask[i] &= static_cast<uint8_t>(cmp(column[i], value));
+}
+
+template <typename T>
+[[gnu::always_inline]] inline void filter(const T *column, size_t n,
+                                          CompareOp op, T value,
+                                          uint8_t *mask) {
+  switch (op) {
+  case CompareOp::EQ:
+    apply(column, n, value, mask, [](T a, T b) { return a == b; });
+    break;
+  case CompareOp::NE:
+    apply(column, n, value, mask, [](T a, T b) { return a != b; });
+    break;
+  case CompareOp::LT:
+    apply(column, n, value, mask, [](T a, T b) { return a < b; });
+    break;
+  case CompareOp::LE:
+    apply(column, n, value, mask, [](T a, T b) { return a <= b; });
+    break;
+  case CompareOp::GT:
+    apply(column, n, value, mask, [](T a, T b) { return a > b; });
+    break;
+  case CompareOp::GE:
+    apply(column, n, value, mask, [](T a, T b) { return a >= b; });
+    break;
+  }
+}
+
+} // namespace
+
+WAFFLE_SIMD_CLONES
+void filter_u32(const uint32_t *column, size_t n, CompareOp op, uint32_t value,
+                uint8_t *mask) {
+  filter(column, n, op, value, mask);
+}
+
+WAFFLE_SIMD_CLONES
+void filter_u64(const uint64_t *column, size_t n, CompareOp op, uint64_t value,
+                uint8_t *mask) {
+  filter(column, n, op, value, mask);
+}
+
+WAFFLE_SIMD_CLONES
+void filter_i64(const int64_t *column, size_t n, CompareOp op, int64_t value,
+                uint8_t *mask) {
+  filter(column, n, op, value, mask);
+}
+
+WAFFLE_SIMD_CLONES
+void filter_f64(const double *column, size_t n, CompareOp op, double value,
+                uint8_t *mask) {
+  filter(column, n, op, value, mask);
+}
+
+WAFFLE_SIMD_CLONES
+void and_mask(const uint8_t *other, size_t n, uint8_t *mask) {
+  size_t i = 0;
+  for (; i + kBlock <= n; i += kBlock)
+    for (size_t j = 0; j < kBlock; ++j)
+      mask[i + j] &= other[i + j];
+  for (; i < n; ++i)
+    mask[i] &= other[i];
+}
+
+WAFFLE_SIMD_CLONES
+size_t count(const uint8_t *mask, size_t n) {
+  size_t total = 0;
+  size_t i = 0;
+  for (; i + kBlock <= n; i += kBlock) {
+    uint32_t block = 0;
+    for (size_t j = 0; j < kBlock; ++j)
+      block += mask[i + j];
+    total += block;
+  }
+  for (; i < n; ++i)
+    total += mask[i];
+  return total;
+}
+
+} // namespace Waffle::query::kernels
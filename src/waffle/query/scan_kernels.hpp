@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Waffle::query {
+
+enum class CompareOp { EQ, NE, LT, LE, GT, GE };
+
+/**
+ * @brief Column scan kernels: `mask[i] &= (column[i] <op> value)` for
+ * i in [0, n).
+ *
+ * The loops work on fixed-size blocks so the compiler vectorizes them even
+ * at -O2. On x86-64 Linux every kernel is additionally built for AVX2 and
+ * picked at load time (GCC/Clang `target_clones`), so one binary runs
+ * everywhere and still uses 256-bit compares where available.
+ */
+namespace kernels {
+
+void filter_u32(const uint32_t *column, size_t n, CompareOp op, uint32_t value,
+                uint8_t *mask);
+void filter_u64(const uint64_t *column, size_t n, CompareOp op, uint64_t value,
+                uint8_t *mask);
+void filter_i64(const int64_t *column, size_t n, CompareOp op, int64_t value,
+                uint8_t *mask);
+void filter_f64(const double *column, size_t n, CompareOp op, double value,
+                uint8_t *mask);
+
+// mask[i] &= other[i]
+void and_mask(const uint8_t *other, size_t n, uint8_t *mask);
+
+// Number of set entries (each 0 or 1).
+size_t count(const uint8_t *mask, size_t n);
+
+} // namespace kernels
+} // namespace Waffle::query
@@ -0,0 +1,370 @@
+#include "waffle/query/span_query.hpp"
+
+#include "waffle/helpers/parallel_for.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace Waffle::query {
+
+namespace {
+
+std::string_view trim(std::string_view s) {
+  while (!s.empty() && s.front() == ' ')
+    s.remove_prefix(1);
+  while (!s.empty() && s.back() == ' ')
+    s.remove_suffix(1);
+  return s;
+}
+
+// Nanoseconds per unit, or 0 if `unit` is not a time unit.
+int64_t time_unit(std::string_view unit) {
+  if (unit == "ns")
+    return 1;
+  if (unit == "us")
+    return 1'000;
+  if (unit == "ms")
+    return 1'000'000;
+  if (unit == "s")
+    return 1'000'000'000;
+  return 0;
+}
+
+Predicate::Value parse_value(std::string_view text) {
+  if (text.size() >= 2 && text.front() == '"' && text.back() == '"')
+    return std::string(text.substr(1, text.size() - 2));
+  if (text == "true")
+    return int64_t{1};
+  if (text == "false")
+    return int64_t{0};
+
+  const char *begin = text.data();
+  const char *end = begin + text.size();
+  int64_t i = 0;
+  auto [int_end, int_error] = std::from_chars(begin, end, i);
+  double d = 0;
+  auto [dbl_end, dbl_error] = std::from_chars(begin, end, d);
+  if (int_error == std::errc() && int_end == dbl_end) {
+    if (int_end == end)
+      return i;
+    if (int64_t unit = time_unit({int_end, size_t(end - int_end)}))
+      return i * unit;
+  } else if (dbl_error == std::errc()) {
+    if (dbl_end == end)
+      return d;
+    if (int64_t unit = time_unit({dbl_end, size_t(end - dbl_end)}))
+      return d * static_cast<double>(unit);
+  }
+  return std::string(text);
+}
+
+// --- Literal normalization ---
+
+// How a predicate applies to one column once its literal has been converted
+// to the column's type.
+enum class Outcome { SCAN, ALL, NONE };
+
+struct IntCompare {
+  Outcome outcome;
+  CompareOp op;
+  int64_t value;
+};
+
+// Converts a literal for a comparison against integers. Non-integral
+// decimals become the equivalent integer bound (x < 2.5 <=> x <= 2).
+IntCompare int_compare(CompareOp op, const Predicate::Value &value) {
+  if (const int64_t *i = std::get_if<int64_t>(&value))
+    return {Outcome::SCAN, op, *i};
+  const double *d = std::get_if<double>(&value);
+  if (!d || std::isnan(*d))
+    return {Outcome::NONE, op, 0};
+  constexpr double kLimit = 9.2e18; // Within int64_t
+  const double clamped = std::clamp(*d, -kLimit, kLimit);
+  if (std::floor(clamped) == clamped)
+    return {Outcome::SCAN, op, static_cast<int64_t>(clamped)};
+  switch (op) {
+  case CompareOp::EQ:
+    return {Outcome::NONE, op, 0};
+  case CompareOp::NE:
+    return {Outcome::ALL, op, 0};
+  case CompareOp::LT:
+  case CompareOp::LE:
+    return {Outcome::SCAN, CompareOp::LE,
+            static_cast<int64_t>(std::floor(clamped))};
+  case CompareOp::GT:
+  case CompareOp::GE:
+    return {Outcome::SCAN, CompareOp::GE,
+            static_cast<int64_t>(std::ceil(clamped))};
+  }
+  return {Outcome::NONE, op, 0};
+}
+
+// Narrows an integer comparison to an unsigned column whose values lie in
+// [0, max].
+template <typename T> IntCompare unsigned_compare(IntCompare c) {
+  if (c.outcome != Outcome::SCAN)
+    return c;
+  const uint64_t max = std::numeric_limits<T>::max();
+  const bool below = c.value < 0;
+  const bool above = !below && static_cast<uint64_t>(c.value) > max;
+  if (!below && !above)
+    return c;
+  switch (c.op) {
+  case CompareOp::EQ:
+    return {Outcome::NONE, c.op, 0};
+  case CompareOp::NE:
+    return {Outcome::ALL, c.op, 0};
+  case CompareOp::LT:
+  case CompareOp::LE:
+    return {above ? Outcome::ALL : Outcome::NONE, c.op, 0};
+  case CompareOp::GT:
+  case CompareOp::GE:
+    return {below ? Outcome::ALL : Outcome::NONE, c.op, 0};
+  }
+  return c;
+}
+
+// Resolves a string literal against the dictionary (ids are unordered, so
+// only equality makes sense).
+IntCompare string_compare(const Predicate &p, const Dictionary &strings) {
+  if (p.op != CompareOp::EQ && p.op != CompareOp::NE)
+    throw std::invalid_argument("Strings only support = and !=");
+  const std::string *s = std::get_if<std::string>(&p.value);
+  const uint32_t id = s ? strings.find(*s) : Dictionary::kNotFound;
+  if (id == Dictionary::kNotFound)
+    return {p.op == CompareOp::EQ ? Outcome::NONE : Outcome::ALL, p.op, 0};
+  return {Outcome::SCAN, p.op, id};
+}
+
+template <typename T>
+void filter_unsigned(const std::vector<T> &column, IntCompare c,
+                     uint8_t *mask) {
+  c = unsigned_compare<T>(c);
+  if (c.outcome == Outcome::NONE) {
+    std::memset(mask, 0, column.size());
+  } else if (c.outcome == Outcome::SCAN) {
+    if constexpr (sizeof(T) == 4)
+      kernels::filter_u32(column.data(), column.size(), c.op,
+                          static_cast<uint32_t>(c.value), mask);
+    else
+      kernels::filter_u64(column.data(), column.size(), c.op,
+                          static_cast<uint64_t>(c.value), mask);
+  }
+}
+
+void filter_attribute(const SpanChunk &chunk, const Dictionary &strings,
+                      const Predicate &p, uint8_t *mask) {
+  auto it = chunk.attributes.find(
+      fnv1a_hash(p.attribute.data(), p.attribute.size()));
+  if (it == chunk.attributes.end()) {
+    std::memset(mask, 0, chunk.rows);
+    return;
+  }
+  const AttributeColumn &col = it->second;
+  const size_t n = col.present.size();
+
+  IntCompare c{Outcome::NONE, p.op, 0};
+  switch (col.type) {
+  case AttributeValue::Type::DOUBLE: {
+    double value;
+    if (const double *d = std::get_if<double>(&p.value))
+      value = *d;
+    else if (const int64_t *i = std::get_if<int64_t>(&p.value))
+      value = static_cast<double>(*i);
+    else
+      break;
+    c.outcome = Outcome::SCAN;
+    kernels::filter_f64(col.f64.data(), n, p.op, value, mask);
+    break;
+  }
+  case AttributeValue::Type::STRING_ID:
+    c = string_compare(p, strings);
+    if (c.outcome == Outcome::SCAN)
+      kernels::filter_i64(col.i64.data(), n, c.op, c.value, mask);
+    break;
+  case AttributeValue::Type::BOOL:
+  case AttributeValue::Type::INT64:
+    c = int_compare(p.op, p.value);
+    if (c.outcome == Outcome::SCAN)
+      kernels::filter_i64(col.i64.data(), n, c.op, c.value, mask);
+    break;
+  }
+  if (c.outcome == Outcome::NONE)
+    std::memset(mask, 0, n);
+  kernels::and_mask(col.present.data(), n, mask);
+  std::memset(mask + n, 0, chunk.rows - n); // Rows past the column: absent
+}
+
+void filter(const SpanChunk &chunk, const Dictionary &strings,
+            const Predicate &p, uint8_t *mask) {
+  switch (p.field) {
+  case Predicate::Field::NAME: {
+    IntCompare c = string_compare(p, strings);
+    if (c.outcome == Outcome::NONE)
+      std::memset(mask, 0, chunk.rows);
+    else if (c.outcome == Outcome::SCAN)
+      kernels::filter_u32(chunk.name.data(), chunk.rows, c.op,
+                          static_cast<uint32_t>(c.value), mask);
+    break;
+  }
+  case Predicate::Field::START:
+    filter_unsigned(chunk.start, int_compare(p.op, p.value), mask);
+    break;
+  case Predicate::Field::DURATION:
+    filter_unsigned(chunk.duration, int_compare(p.op, p.value), mask);
+    break;
+  case Predicate::Field::RANK:
+    filter_unsigned(chunk.rank, int_compare(p.op, p.value), mask);
+    break;
+  case Predicate::Field::THREAD:
+    filter_unsigned(chunk.thread, int_compare(p.op, p.value), mask);
+    break;
+  case Predicate::Field::ATTRIBUTE:
+    filter_attribute(chunk, strings, p, mask);
+    break;
+  }
+}
+
+// --- Aggregation ---
+
+struct Partial {
+  size_t count = 0;
+  uint64_t total = 0;
+  uint64_t min = std::numeric_limits<uint64_t>::max();
+  uint64_t max = 0;
+  std::vector<uint64_t> durations; // Only when percentiles are wanted
+
+  void add(uint64_t d, bool keep) {
+    ++count;
+    total += d;
+    min = std::min(min, d);
+    max = std::max(max, d);
+    if (keep)
+      durations.push_back(d);
+  }
+  void merge(Partial &&o) {
+    count += o.count;
+    total += o.total;
+    min = std::min(min, o.min);
+    max = std::max(max, o.max);
+    durations.insert(durations.end(), o.durations.begin(), o.durations.end());
+  }
+};
+
+constexpr uint32_t kAllSpans = 0xFFFFFFFF; // Group key without group-by
+
+} // namespace
+
+Predicate Predicate::parse(std::string_view text) {
+  const size_t at = text.find_first_of("<>=!");
+  if (at == std::string_view::npos || at == 0)
+    throw std::invalid_argument("Not a predicate: " + std::string(text));
+
+  Predicate p;
+  const std::string_view field = trim(text.substr(0, at));
+  std::string_view rest = text.substr(at);
+  static constexpr std::pair<std::string_view, CompareOp> kOps[] = {
+      {"==", CompareOp::EQ}, {"!=", CompareOp::NE}, {"<=", CompareOp::LE},
+      {">=", CompareOp::GE}, {"=", CompareOp::EQ},  {"<", CompareOp::LT},
+      {">", CompareOp::GT}};
+  bool found = false;
+  for (const auto &[token, op] : kOps) {
+    if (rest.starts_with(token)) {
+      p.op = op;
+      rest.remove_prefix(token.size());
+      found = true;
+      break;
+    }
+  }
+  const std::string_view value = trim(rest);
+  if (!found || field.empty() || value.empty())
+    throw std::invalid_argument("Not a predicate: " + std::string(text));
+
+  if (field == "name") {
+    p.field = Field::NAME;
+  } else if (field == "start") {
+    p.field = Field::START;
+  } else if (field == "duration") {
+    p.field = Field::DURATION;
+  } else if (field == "rank") {
+    p.field = Field::RANK;
+  } else if (field == "thread") {
+    p.field = Field::THREAD;
+  } else {
+    p.field = Field::ATTRIBUTE;
+    p.attribute = field.starts_with("attr.") ? field.substr(5) : field;
+  }
+
+  // Names are always strings, even if they look like numbers.
+  if (p.field == Field::NAME && !(value.size() >= 2 && value.front() == '"'))
+    p.value = std::string(value);
+  else
+    p.value = parse_value(value);
+  return p;
+}
+
+QueryResult run_query(const SpanTable &table, const Query &query) {
+  const auto &chunks = table.chunks();
+  const bool keep = !query.percentiles.empty();
+  std::vector<std::unordered_map<uint32_t, Partial>> partials(chunks.size());
+  std::vector<size_t> matched(chunks.size(), 0);
+
+  parallel_for(chunks.size(), query.threads, [&](size_t i) {
+    const SpanChunk &chunk = *chunks[i];
+    std::vector<uint8_t> mask(chunk.rows, 1);
+    for (const Predicate &p : query.where)
+      filter(chunk, table.strings(), p, mask.data());
+    matched[i] = kernels::count(mask.data(), chunk.rows);
+    if (matched[i] == 0)
+      return;
+    auto &groups = partials[i];
+    for (size_t row = 0; row < chunk.rows; ++row) {
+      if (!mask[row])
+        continue;
+      const uint32_t key = query.group_by_name ? chunk.name[row] : kAllSpans;
+      groups[key].add(chunk.duration[row], keep);
+    }
+  });
+
+  QueryResult result;
+  result.scanned = table.rows();
+  std::unordered_map<uint32_t, Partial> groups;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    result.matched += matched[i];
+    for (auto &[key, partial] : partials[i])
+      groups[key].merge(std::move(partial));
+  }
+
+  for (auto &[key, g] : groups) {
+    GroupStats stats;
+    stats.name = key == kAllSpans ? "*" : table.strings().at(key);
+    stats.count = g.count;
+    stats.total_ns = g.total;
+    stats.min_ns = g.min;
+    stats.max_ns = g.max;
+    for (double pct : query.percentiles) {
+      // Nearest rank: the smallest value with at least pct% at or below it.
+      const double clamped = std::clamp(pct, 0.0, 100.0);
+      size_t rank = static_cast<size_t>(
+          std::ceil(clamped / 100.0 * static_cast<double>(g.count)));
+      rank = std::clamp<size_t>(rank, 1, g.count) - 1;
+      std::nth_element(g.durations.begin(), g.durations.begin() + rank,
+                       g.durations.end());
+      stats.percentiles_ns.push_back(g.durations[rank]);
+    }
+    result.groups.push_back(std::move(stats));
+  }
+  std::sort(result.groups.begin(), result.groups.end(),
+            [](const GroupStats &a, const GroupStats &b) {
+              return a.total_ns != b.total_ns ? a.total_ns > b.total_ns
+                                              : a.name < b.name;
+            });
+  return result;
+}
+
+} // namespace Waffle::query
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "waffle/query/scan_kernels.hpp"
+#include "waffle/query/span_table.hpp"
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+namespace Waffle::query {
+
+/**
+ * @brief One `field <op> value` condition on spans.
+ *
+ * Fields are `name`, `start`, `duration`, `rank`, `thread`, or an attribute
+ * key (`attr.<key>` when the key collides with a built-in field). A span
+ * without the attribute never matches, whatever the operator.
+ */
+struct Predicate {
+  enum class Field { NAME, START, DURATION, RANK, THREAD, ATTRIBUTE };
+  using Value = std::variant<int64_t, double, std::string>;
+
+  Field field = Field::NAME;
+  std::string attribute; // Key, for Field::ATTRIBUTE
+  CompareOp op = CompareOp::EQ;
+  Value value;
+
+  /**
+   * @brief Parses `field<op>value` with op one of = == != < <= > >=.
+   *
+   * Values are integers, decimals, `true`/`false`, or strings (optionally
+   * double-quoted). Integers may carry a time unit (`ns`, `us`, `ms`, `s`)
+   * and are then nanoseconds, e.g. `duration>10ms`.
+   *
+   * @throw std::invalid_argument If `text` is not a predicate.
+   */
+  static Predicate parse(std::string_view text);
+};
+
+struct Query {
+  std::vector<Predicate> where; // All must hold
+  bool group_by_name = true;    // Else one group, named "*"
+  std::vector<double> percentiles = {50, 90, 99};
+  unsigned threads = 0; // 0 = hardware concurrency
+};
+
+struct GroupStats {
+  std::string name;
+  size_t count = 0;
+  uint64_t total_ns = 0;
+  uint64_t min_ns = 0;
+  uint64_t max_ns = 0;
+  std::vector<uint64_t> percentiles_ns; // Matches Query::percentiles
+};
+
+struct QueryResult {
+  std::vector<GroupStats> groups; // By total time, descending
+  size_t scanned = 0;             // Spans scanned
+  size_t matched = 0;             // Spans that satisfied every predicate
+};
+
+/**
+ * @brief Filters the spans of `table` and aggregates their durations.
+ *
+ * Every chunk is filtered column by column into a selection mask with the
+ * SIMD scan kernels, chunks in parallel; the matches are then grouped.
+ * Percentiles are exact (nearest rank), so memory grows with the number of
+ * matching spans.
+ *
+ * @throw std::invalid_argument For an ordering comparison on strings.
+ */
+QueryResult run_query(const SpanTable &table, const Query &query);
+
+} // namespace Waffle::query
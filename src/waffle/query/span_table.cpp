@@ -0,0 +1,170 @@
+#include "waffle/query/span_table.hpp"
+
+#include "waffle/helpers/parallel_for.hpp"
+#include "waffle/trace_file/trace_file_reader.hpp"
+
+namespace Waffle::query {
+
+namespace {
+constexpr std::string_view kUnknownString = "???";
+
+std::string_view
+lookup(const std::unordered_map<uint64_t, std::string> &strings,
+       uint64_t hash) {
+  auto it = strings.find(hash);
+  return it != strings.end() ? std::string_view(it->second) : kUnknownString;
+}
+
+// Open spans are keyed by (rank, span id): ranks of a merged file allocate
+// ids independently.
+struct OpenKey {
+  uint64_t span_id;
+  uint16_t rank;
+  bool operator==(const OpenKey &) const = default;
+};
+struct OpenKeyHash {
+  size_t operator()(const OpenKey &k) const {
+    return std::hash<uint64_t>{}(k.span_id ^ (uint64_t{k.rank} << 48));
+  }
+};
+
+SpanTable load_file(const std::string &path) {
+  trace_file::TraceFileReader reader(path);
+  const bool merged = reader.header().flags & trace_file::kFlagMerged;
+  const uint32_t file_rank = reader.header().rank != trace_file::kNoRank
+                                 ? reader.header().rank
+                                 : 0;
+  SpanTable table;
+  std::unordered_map<OpenKey, Tracelet, OpenKeyHash> open;
+  trace_file::TraceRecord record;
+  while (reader.next(record)) {
+    const Tracelet &t = record.tracelet;
+    const OpenKey key{t.span_id.value, record.rank};
+    if (t.record_type == Tracelet::RecordType::SPAN_START) {
+      open.insert_or_assign(key, t);
+    } else if (t.record_type == Tracelet::RecordType::SPAN_END) {
+      auto it = open.find(key);
+      if (it == open.end())
+        continue; // Started before the recording did.
+      const Tracelet &s = it->second;
+      SpanTable::Span span{s.name_string_hash,
+                           s.timestamp,
+                           t.timestamp >= s.timestamp ? t.timestamp - s.timestamp
+                                                      : 0,
+                           merged ? record.rank : file_rank,
+                           s.thread_index,
+                           s.trace_id.value,
+                           s.span_id.value};
+      table.append(span, s.attributes_begin(), s.attributes_end(),
+                   reader.strings());
+      open.erase(it);
+    }
+  }
+  return table;
+}
+} // namespace
+
+uint32_t Dictionary::intern(uint64_t hash, std::string_view str) {
+  auto [it, inserted] =
+      _ids.try_emplace(hash, static_cast<uint32_t>(_strings.size()));
+  if (inserted)
+    _strings.emplace_back(str);
+  return it->second;
+}
+
+uint32_t Dictionary::find(std::string_view str) const {
+  auto it = _ids.find(fnv1a_hash(str.data(), str.size()));
+  return it != _ids.end() ? it->second : kNotFound;
+}
+
+size_t SpanTable::rows() const {
+  size_t total = 0;
+  for (const auto &chunk : _chunks)
+    total += chunk->rows;
+  return total;
+}
+
+SpanChunk &SpanTable::writable_chunk() {
+  if (_chunks.empty() || _chunks.back()->rows == SpanChunk::kChunkRows)
+    _chunks.push_back(std::make_unique<SpanChunk>());
+  return *_chunks.back();
+}
+
+void SpanTable::append(
+    const Span &span, const Attribute *attributes_begin,
+    const Attribute *attributes_end,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  SpanChunk &c = writable_chunk();
+  const size_t row = c.rows++;
+  c.name.push_back(
+      _strings.intern(span.name_hash, lookup(strings, span.name_hash)));
+  c.start.push_back(span.start);
+  c.duration.push_back(span.duration);
+  c.rank.push_back(span.rank);
+  c.thread.push_back(span.thread);
+  c.trace_id.push_back(span.trace_id);
+  c.span_id.push_back(span.span_id);
+
+  for (const Attribute *a = attributes_begin; a != attributes_end; ++a) {
+    auto [it, inserted] = c.attributes.try_emplace(a->key_id);
+    AttributeColumn &col = it->second;
+    if (inserted)
+      col.type = a->value.type;
+    // Columns grow lazily: rows before this one without the key are absent.
+    const bool is_double = col.type == AttributeValue::Type::DOUBLE;
+    if (is_double)
+      col.f64.resize(row + 1, 0.0);
+    else
+      col.i64.resize(row + 1, 0);
+    col.present.resize(row + 1, 0);
+    if (a->value.type != col.type)
+      continue;
+    col.present[row] = 1;
+    switch (col.type) {
+    case AttributeValue::Type::BOOL:
+      col.i64[row] = a->value.b ? 1 : 0;
+      break;
+    case AttributeValue::Type::INT64:
+      col.i64[row] = a->value.i64;
+      break;
+    case AttributeValue::Type::DOUBLE:
+      col.f64[row] = a->value.f64;
+      break;
+    case AttributeValue::Type::STRING_ID:
+      col.i64[row] = _strings.intern(a->value.string_id,
+                                     lookup(strings, a->value.string_id));
+      break;
+    }
+  }
+}
+
+void SpanTable::absorb(SpanTable &&other) {
+  std::vector<uint32_t> remap(other._strings.size());
+  for (uint32_t id = 0; id < remap.size(); ++id) {
+    const std::string &s = other._strings.at(id);
+    remap[id] = _strings.intern(fnv1a_hash(s.data(), s.size()), s);
+  }
+  for (auto &chunk : other._chunks) {
+    for (uint32_t &id : chunk->name)
+      id = remap[id];
+    for (auto &[key, col] : chunk->attributes)
+      if (col.type == AttributeValue::Type::STRING_ID)
+        for (size_t i = 0; i < col.i64.size(); ++i)
+          if (col.present[i])
+            col.i64[i] = remap[static_cast<uint32_t>(col.i64[i])];
+    _chunks.push_back(std::move(chunk));
+  }
+}
+
+SpanTable SpanTable::load(const std::vector<std::string> &paths,
+                          unsigned threads) {
+  std::vector<SpanTable> parts(paths.size());
+  parallel_for(paths.size(), threads,
+               [&](size_t i) { parts[i] = load_file(paths[i]); });
+  SpanTable table;
+  for (auto &part : parts)
+    table.absorb(std::move(part));
+  return table;
+}
+
+} // namespace Waffle::query
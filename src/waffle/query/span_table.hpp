@@ -0,0 +1,112 @@
+#pragma once
+
+#include "waffle/waffle_common_types.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace Waffle::query {
+
+/**
+ * @brief Interns every string of a SpanTable (span names, string attribute
+ * values) as a dense 32-bit id, so that string columns are arrays of ids and
+ * an equality predicate is one integer compare per row.
+ */
+class Dictionary {
+public:
+  static constexpr uint32_t kNotFound = 0xFFFFFFFF;
+
+  // `hash` is the string's fnv1a hash, as used for trace string ids.
+  uint32_t intern(uint64_t hash, std::string_view str);
+  uint32_t find(std::string_view str) const; // kNotFound if absent
+  const std::string &at(uint32_t id) const { return _strings[id]; }
+  size_t size() const { return _strings.size(); }
+
+private:
+  std::vector<std::string> _strings;
+  std::unordered_map<uint64_t, uint32_t> _ids; // String hash -> id
+};
+
+/**
+ * @brief All values of one attribute key within a chunk.
+ *
+ * The column takes the type of the first value seen for the key; a value of
+ * another type is stored as absent. BOOL is stored as 0/1 and STRING_ID as a
+ * Dictionary id, both in `i64`; DOUBLE uses `f64`.
+ */
+struct AttributeColumn {
+  AttributeValue::Type type;
+  std::vector<int64_t> i64;
+  std::vector<double> f64;
+  std::vector<uint8_t> present; // 1 if the span has a value of `type`
+};
+
+/**
+ * @brief Up to kChunkRows completed spans, stored column-wise.
+ *
+ * Chunks are the unit of parallelism for scans.
+ */
+struct SpanChunk {
+  static constexpr size_t kChunkRows = 1 << 16;
+
+  size_t rows = 0;
+  std::vector<uint32_t> name;       // Dictionary id
+  std::vector<uint64_t> start;      // ns, aligned in merged files
+  std::vector<uint64_t> duration;   // ns
+  std::vector<uint32_t> rank;
+  std::vector<uint32_t> thread;     // Thread index
+  std::vector<uint64_t> trace_id;
+  std::vector<uint64_t> span_id;
+  std::unordered_map<uint64_t, AttributeColumn> attributes; // By key hash
+};
+
+/**
+ * @brief Completed spans of one or more trace files, column-wise.
+ *
+ * A span is a SPAN_START with its matching SPAN_END; spans that never ended
+ * are left out. Attributes are those recorded on the start.
+ */
+class SpanTable {
+public:
+  /**
+   * @brief Loads trace files (one per rank, or merged files), one file per
+   * thread (0 = hardware concurrency).
+   *
+   * @throw std::runtime_error / std::system_error If a file cannot be read.
+   */
+  static SpanTable load(const std::vector<std::string> &paths,
+                        unsigned threads = 0);
+
+  const Dictionary &strings() const { return _strings; }
+  const std::vector<std::unique_ptr<SpanChunk>> &chunks() const {
+    return _chunks;
+  }
+  size_t rows() const;
+
+  // Appends a completed span; used by load() and by tests.
+  struct Span {
+    uint64_t name_hash; // Resolved through `strings`
+    uint64_t start;
+    uint64_t duration;
+    uint32_t rank;
+    uint32_t thread;
+    uint64_t trace_id;
+    uint64_t span_id;
+  };
+  void append(const Span &span, const Attribute *attributes_begin,
+              const Attribute *attributes_end,
+              const std::unordered_map<uint64_t, std::string> &strings);
+
+private:
+  SpanChunk &writable_chunk();
+  // Moves `other`'s chunks into this table, remapping dictionary ids.
+  void absorb(SpanTable &&other);
+
+  Dictionary _strings;
+  std::vector<std::unique_ptr<SpanChunk>> _chunks;
+};
+
+} // namespace Waffle::query
@@ -0,0 +1,747 @@
+#include "waffle/store/segment_store.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace Waffle::store {
+
+using trace_file::ChunkHeader;
+using trace_file::ChunkType;
+using trace_file::FileAttribute;
+using trace_file::RecordHeader;
+using trace_file::SegmentIndexHeader;
+using trace_file::SegmentIndexTrailer;
+using trace_file::SegmentNameCount;
+using trace_file::TraceRecord;
+
+namespace {
+
+constexpr auto kRetentionInterval = std::chrono::seconds(1);
+
+[[noreturn]] void fail(int error, const std::string &what) {
+  throw std::system_error(error, std::generic_category(), what);
+}
+
+uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+void append(std::vector<char> &out, const void *data, size_t size) {
+  const char *bytes = static_cast<const char *>(data);
+  out.insert(out.end(), bytes, bytes + size);
+}
+
+std::string part_path(const std::string &directory, uint64_t sequence) {
+  char name[40];
+  std::snprintf(name, sizeof(name), "%010" PRIu64 ".wseg.part", sequence);
+  return (std::filesystem::path(directory) / name).string();
+}
+
+std::string sealed_path(const std::string &directory, uint64_t sequence,
+                        uint64_t min_ts, uint64_t max_ts) {
+  char name[80];
+  std::snprintf(name, sizeof(name), "%010" PRIu64 "-%" PRIu64 "-%" PRIu64
+                ".wseg", sequence, min_ts, max_ts);
+  return (std::filesystem::path(directory) / name).string();
+}
+
+bool pwrite_all(int fd, const char *data, size_t size, uint64_t offset) {
+  while (size > 0) {
+    const ssize_t n = ::pwrite(fd, data, size, static_cast<off_t>(offset));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    size -= static_cast<size_t>(n);
+    offset += static_cast<uint64_t>(n);
+  }
+  return true;
+}
+
+void parse_strings(const char *data, const ChunkHeader &chunk,
+                   std::unordered_map<uint64_t, std::string> &out) {
+  size_t offset = 0;
+  for (uint32_t i = 0; i < chunk.record_count; ++i) {
+    uint64_t hash;
+    uint32_t length;
+    if (offset + sizeof(hash) + sizeof(length) > chunk.payload_size)
+      return;
+    std::memcpy(&hash, data + offset, sizeof(hash));
+    std::memcpy(&length, data + offset + sizeof(hash), sizeof(length));
+    offset += sizeof(hash) + sizeof(length);
+    if (offset + length > chunk.payload_size)
+      return;
+    out.emplace(hash, std::string(data + offset, length));
+    offset += length;
+  }
+}
+
+} // namespace
+
+std::vector<SegmentInfo> list_segments(const std::string &directory) {
+  std::vector<SegmentInfo> segments;
+  std::error_code ec;
+  for (const auto &entry :
+       std::filesystem::directory_iterator(directory, ec)) {
+    const std::string name = entry.path().filename().string();
+    SegmentInfo info;
+    info.path = entry.path().string();
+    unsigned long long sequence = 0, min_ts = 0, max_ts = 0;
+    int used = 0;
+    if (std::sscanf(name.c_str(), "%llu-%llu-%llu.wseg%n", &sequence,
+                    &min_ts, &max_ts, &used) == 3 &&
+        static_cast<size_t>(used) == name.size()) {
+      info.sealed = true;
+      info.min_timestamp = min_ts;
+      info.max_timestamp = max_ts;
+    } else if (!(std::sscanf(name.c_str(), "%llu.wseg.part%n", &sequence,
+                             &used) == 1 &&
+                 static_cast<size_t>(used) == name.size())) {
+      continue;
+    }
+    info.sequence = sequence;
+    info.bytes = entry.file_size(ec);
+    segments.push_back(std::move(info));
+  }
+  std::sort(segments.begin(), segments.end(),
+            [](const SegmentInfo &a, const SegmentInfo &b) {
+              return a.sequence < b.sequence;
+            });
+  return segments;
+}
+
+// --- SegmentStore ---
+
+struct SegmentStore::Operation {
+  enum class Kind { OPEN, WRITE, SEAL } kind;
+  uint64_t sequence;
+  std::vector<char> bytes; // WRITE: a chunk pair; SEAL: the footer chunk
+  uint64_t records = 0;
+  uint64_t min_timestamp = 0;
+  uint64_t max_timestamp = 0;
+};
+
+SegmentStore::SegmentStore(Options options)
+    : _options(std::move(options)), _segment_traces(_options.bloom_bits) {}
+
+SegmentStore::~SegmentStore() {
+  if (_writer.joinable())
+    shutdown();
+}
+
+void SegmentStore::on_start(const ProcessorContext &context) {
+  std::memcpy(_header.magic, trace_file::kMagic, sizeof(trace_file::kMagic));
+  _header.version = trace_file::kVersion;
+  _header.header_size = sizeof(trace_file::FileHeader);
+  _header.process_tag = context.process_tag;
+  _header.start_wall_ns = context.start_wall_ns;
+  _header.rank = _options.rank;
+
+  std::error_code ec;
+  std::filesystem::create_directories(_options.directory, ec);
+  if (ec)
+    fail(ec.value(), "Cannot create segment directory " + _options.directory);
+
+  // A .part segment means an earlier run did not shut down: keep what it
+  // wrote under its recovered time range.
+  for (SegmentInfo &info : list_segments(_options.directory)) {
+    _sequence = std::max(_sequence, info.sequence);
+    if (!info.sealed) {
+      try {
+        MappedSegment segment(info.path);
+        if (segment.max_timestamp() == 0) {
+          std::filesystem::remove(info.path, ec);
+          continue;
+        }
+        info.min_timestamp = segment.min_timestamp();
+        info.max_timestamp = segment.max_timestamp();
+      } catch (const std::system_error &) {
+        continue; // Not ours to delete
+      }
+      const std::string sealed =
+          sealed_path(_options.directory, info.sequence, info.min_timestamp,
+                      info.max_timestamp);
+      std::filesystem::rename(info.path, sealed, ec);
+      if (ec)
+        continue;
+      info.path = sealed;
+      info.sealed = true;
+    }
+    _sealed.push_back(std::move(info));
+  }
+  apply_retention();
+  _writer = std::thread([this] { write_loop(); });
+}
+
+void SegmentStore::remember_strings(
+    const Tracelet &record,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  auto copy = [&](uint64_t hash) {
+    if (_strings.count(hash))
+      return;
+    auto it = strings.find(hash);
+    if (it != strings.end())
+      _strings.emplace(hash, it->second);
+  };
+  copy(record.name_string_hash);
+  for (auto it = record.attributes_begin(); it != record.attributes_end();
+       ++it) {
+    copy(it->key_id);
+    if (it->value.type == AttributeValue::Type::STRING_ID)
+      copy(it->value.string_id);
+  }
+}
+
+void SegmentStore::on_record(
+    const Tracelet &record,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  remember_strings(record, strings);
+  _pending.push_back(TraceRecord{record, 0});
+  _pending_bytes += sizeof(RecordHeader) +
+                    record.num_attributes * sizeof(FileAttribute);
+  if (_pending_bytes >= _options.chunk_bytes)
+    seal_chunk();
+}
+
+void SegmentStore::encode_chunk(std::vector<char> &out,
+                                std::vector<uint64_t> &added) {
+  std::vector<char> strings;
+  auto add = [&](uint64_t hash) {
+    if (_segment_strings.count(hash) ||
+        std::find(added.begin(), added.end(), hash) != added.end())
+      return;
+    auto it = _strings.find(hash);
+    if (it == _strings.end())
+      return;
+    const uint32_t length = static_cast<uint32_t>(it->second.size());
+    append(strings, &hash, sizeof(hash));
+    append(strings, &length, sizeof(length));
+    append(strings, it->second.data(), length);
+    added.push_back(hash);
+  };
+  for (const TraceRecord &r : _pending) {
+    add(r.tracelet.name_string_hash);
+    for (auto it = r.tracelet.attributes_begin();
+         it != r.tracelet.attributes_end(); ++it) {
+      add(it->key_id);
+      if (it->value.type == AttributeValue::Type::STRING_ID)
+        add(it->value.string_id);
+    }
+  }
+  if (!added.empty()) {
+    const ChunkHeader chunk{ChunkType::STRINGS,
+                            static_cast<uint32_t>(added.size()),
+                            strings.size(), 0, 0};
+    append(out, &chunk, sizeof(chunk));
+    append(out, strings.data(), strings.size());
+  }
+  const ChunkHeader chunk{ChunkType::RECORDS,
+                          static_cast<uint32_t>(_pending.size()),
+                          _pending_bytes, _pending.front().tracelet.timestamp,
+                          _pending.back().tracelet.timestamp};
+  append(out, &chunk, sizeof(chunk));
+  for (const TraceRecord &r : _pending) {
+    const RecordHeader header = trace_file::encode_header(r.tracelet, 0);
+    append(out, &header, sizeof(header));
+    for (auto it = r.tracelet.attributes_begin();
+         it != r.tracelet.attributes_end(); ++it) {
+      const FileAttribute attr = trace_file::encode_attribute(*it);
+      append(out, &attr, sizeof(attr));
+    }
+  }
+}
+
+size_t SegmentStore::footer_bytes(size_t extra_names) const {
+  return sizeof(ChunkHeader) + sizeof(SegmentIndexHeader) +
+         _segment_traces.byte_size() +
+         (_segment_names.size() + extra_names) * sizeof(SegmentNameCount) +
+         sizeof(SegmentIndexTrailer);
+}
+
+void SegmentStore::seal_chunk() {
+  if (_pending.empty())
+    return;
+  const size_t records = _pending.size();
+  {
+    // Only this thread adds chunks, so there is still room below.
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_queued_chunks >= _options.max_queued_chunks) {
+      _records_dropped.fetch_add(records, std::memory_order_relaxed);
+      _pending.clear();
+      _pending_bytes = 0;
+      return;
+    }
+  }
+  std::stable_sort(_pending.begin(), _pending.end(),
+                   [](const TraceRecord &a, const TraceRecord &b) {
+                     return a.tracelet.timestamp < b.tracelet.timestamp;
+                   });
+
+  auto new_names = [&] {
+    std::unordered_set<uint64_t> names;
+    for (const TraceRecord &r : _pending)
+      if (r.tracelet.name_string_hash != 0 &&
+          !_segment_names.count(r.tracelet.name_string_hash))
+        names.insert(r.tracelet.name_string_hash);
+    return names.size();
+  };
+  if (!_segment_open)
+    open_segment();
+  Operation write{Operation::Kind::WRITE, _sequence, {}, records};
+  std::vector<uint64_t> added;
+  encode_chunk(write.bytes, added);
+  if (_segment_records > 0 &&
+      _segment_used + write.bytes.size() + footer_bytes(new_names()) >
+          _options.segment_bytes) {
+    // Re-encoded for the next segment, which needs its own strings.
+    finish_segment();
+    open_segment();
+    write.sequence = _sequence;
+    write.bytes.clear();
+    added.clear();
+    encode_chunk(write.bytes, added);
+  }
+
+  _segment_strings.insert(added.begin(), added.end());
+  for (const TraceRecord &r : _pending) {
+    const Tracelet &t = r.tracelet;
+    if (t.trace_id != kInvalidId)
+      _segment_traces.add(t.trace_id.value);
+    if (t.name_string_hash != 0 &&
+        (t.record_type == Tracelet::RecordType::SPAN_START ||
+         t.record_type == Tracelet::RecordType::EVENT))
+      ++_segment_names[t.name_string_hash];
+  }
+  _segment_min = std::min(_segment_min, _pending.front().tracelet.timestamp);
+  _segment_max = std::max(_segment_max, _pending.back().tracelet.timestamp);
+  _segment_records += records;
+  _segment_used += write.bytes.size();
+  enqueue(std::move(write));
+  _pending.clear();
+  _pending_bytes = 0;
+}
+
+void SegmentStore::open_segment() {
+  ++_sequence;
+  enqueue(Operation{Operation::Kind::OPEN, _sequence, {}});
+  _segment_open = true;
+  _segment_used = sizeof(trace_file::FileHeader);
+  _segment_strings.clear();
+  _segment_traces.clear();
+  _segment_names.clear();
+  _segment_records = 0;
+  _segment_min = UINT64_MAX;
+  _segment_max = 0;
+}
+
+void SegmentStore::finish_segment() {
+  std::vector<SegmentNameCount> names;
+  names.reserve(_segment_names.size());
+  for (const auto &[hash, count] : _segment_names)
+    names.push_back({hash, count});
+  std::sort(names.begin(), names.end(),
+            [](const SegmentNameCount &a, const SegmentNameCount &b) {
+              return a.name_hash < b.name_hash;
+            });
+
+  Operation seal{Operation::Kind::SEAL, _sequence, {}};
+  seal.min_timestamp = _segment_min;
+  seal.max_timestamp = _segment_max;
+  const SegmentIndexHeader index{
+      _segment_records,
+      _segment_min,
+      _segment_max,
+      static_cast<uint32_t>(_segment_traces.byte_size()),
+      _segment_traces.hashes(),
+      static_cast<uint32_t>(names.size()),
+      0};
+  const ChunkHeader chunk{
+      ChunkType::SEGMENT_INDEX, static_cast<uint32_t>(names.size()),
+      sizeof(index) + _segment_traces.byte_size() +
+          names.size() * sizeof(SegmentNameCount),
+      _segment_min, _segment_max};
+  append(seal.bytes, &chunk, sizeof(chunk));
+  append(seal.bytes, &index, sizeof(index));
+  append(seal.bytes, _segment_traces.data(), _segment_traces.byte_size());
+  append(seal.bytes, names.data(), names.size() * sizeof(SegmentNameCount));
+  enqueue(std::move(seal));
+  _segment_open = false;
+}
+
+void SegmentStore::enqueue(Operation operation) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (operation.kind == Operation::Kind::WRITE)
+      ++_queued_chunks;
+    _queue.push_back(std::move(operation));
+  }
+  _wakeup.notify_one();
+}
+
+void SegmentStore::flush() { seal_chunk(); }
+
+void SegmentStore::shutdown() {
+  seal_chunk();
+  if (_segment_open)
+    finish_segment();
+  if (_writer.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopping = true;
+    }
+    _wakeup.notify_one();
+    _writer.join();
+  }
+}
+
+void SegmentStore::write_loop() {
+  int fd = -1;
+  uint64_t offset = 0;
+  std::string path;
+  while (true) {
+    Operation op;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      if (!_wakeup.wait_for(lock, kRetentionInterval, [this] {
+            return !_queue.empty() || _stopping;
+          })) {
+        lock.unlock();
+        apply_retention(); // Ages out segments while no records arrive
+        continue;
+      }
+      if (_queue.empty())
+        break; // Stopping, and everything is written
+      op = std::move(_queue.front());
+      _queue.pop_front();
+      if (op.kind == Operation::Kind::WRITE)
+        --_queued_chunks;
+    }
+
+    switch (op.kind) {
+    case Operation::Kind::OPEN:
+      path = part_path(_options.directory, op.sequence);
+      fd = ::open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC,
+                  0644);
+      if (fd < 0) {
+        _write_errors.fetch_add(1, std::memory_order_relaxed);
+        break;
+      }
+      // Reserves the blocks up front: appends do not allocate, and a full
+      // disk shows at the segment's start rather than in the middle.
+      // Without support (e.g. some network file systems) the file grows.
+      ::fallocate(fd, 0, 0, static_cast<off_t>(_options.segment_bytes));
+      if (!pwrite_all(fd, reinterpret_cast<const char *>(&_header),
+                      sizeof(_header), 0))
+        _write_errors.fetch_add(1, std::memory_order_relaxed);
+      offset = sizeof(_header);
+      break;
+    case Operation::Kind::WRITE:
+      if (fd >= 0 && pwrite_all(fd, op.bytes.data(), op.bytes.size(), offset))
+        _records_written.fetch_add(op.records, std::memory_order_relaxed);
+      else
+        _write_errors.fetch_add(1, std::memory_order_relaxed);
+      offset += op.bytes.size();
+      break;
+    case Operation::Kind::SEAL: {
+      if (fd < 0)
+        break;
+      const SegmentIndexTrailer trailer = [&] {
+        SegmentIndexTrailer t{offset, {}};
+        std::memcpy(t.magic, trace_file::kSegmentIndexMagic, sizeof(t.magic));
+        return t;
+      }();
+      const uint64_t end = offset + op.bytes.size();
+      const uint64_t trailer_at =
+          std::max<uint64_t>(end, _options.segment_bytes - sizeof(trailer));
+      if (!pwrite_all(fd, op.bytes.data(), op.bytes.size(), offset) ||
+          !pwrite_all(fd, reinterpret_cast<const char *>(&trailer),
+                      sizeof(trailer), trailer_at))
+        _write_errors.fetch_add(1, std::memory_order_relaxed);
+      ::close(fd);
+      fd = -1;
+      SegmentInfo info;
+      info.path = sealed_path(_options.directory, op.sequence,
+                              op.min_timestamp, op.max_timestamp);
+      info.sequence = op.sequence;
+      info.min_timestamp = op.min_timestamp;
+      info.max_timestamp = op.max_timestamp;
+      info.sealed = true;
+      info.bytes = trailer_at + sizeof(trailer);
+      if (::rename(path.c_str(), info.path.c_str()) != 0) {
+        _write_errors.fetch_add(1, std::memory_order_relaxed);
+        break;
+      }
+      _sealed.push_back(std::move(info));
+      _segments_sealed.fetch_add(1, std::memory_order_relaxed);
+      apply_retention();
+      break;
+    }
+    }
+  }
+  if (fd >= 0)
+    ::close(fd);
+}
+
+void SegmentStore::apply_retention() {
+  const uint64_t max_age_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(_options.max_age)
+          .count();
+  const uint64_t now = now_ns();
+  uint64_t total = 0;
+  for (const SegmentInfo &info : _sealed)
+    total += info.bytes;
+  size_t expired = 0;
+  for (const SegmentInfo &info : _sealed) {
+    const bool too_old =
+        max_age_ns > 0 && info.max_timestamp + max_age_ns < now;
+    const bool too_big =
+        _options.max_total_bytes > 0 && total > _options.max_total_bytes;
+    if (!too_old && !too_big)
+      break;
+    std::error_code ec;
+    std::filesystem::remove(info.path, ec);
+    total -= info.bytes;
+    ++expired;
+    _segments_deleted.fetch_add(1, std::memory_order_relaxed);
+  }
+  _sealed.erase(_sealed.begin(), _sealed.begin() + expired);
+}
+
+size_t SegmentStore::backlog() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _queued_chunks;
+}
+
+SegmentStore::Stats SegmentStore::stats() const {
+  Stats s;
+  s.records_written = _records_written.load(std::memory_order_relaxed);
+  s.records_dropped = _records_dropped.load(std::memory_order_relaxed);
+  s.segments_sealed = _segments_sealed.load(std::memory_order_relaxed);
+  s.segments_deleted = _segments_deleted.load(std::memory_order_relaxed);
+  s.write_errors = _write_errors.load(std::memory_order_relaxed);
+  return s;
+}
+
+// --- MappedSegment ---
+
+MappedSegment::MappedSegment(const std::string &path) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    fail(errno, "Cannot open segment " + path);
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    const int error = errno;
+    ::close(fd);
+    fail(error, "Cannot open segment " + path);
+  }
+  _size = static_cast<size_t>(st.st_size);
+  if (_size < sizeof(_header)) {
+    ::close(fd);
+    fail(EINVAL, "Not a Waffle trace segment: " + path);
+  }
+  void *data = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED)
+    fail(errno, "Cannot map segment " + path);
+  _data = static_cast<const char *>(data);
+  std::memcpy(&_header, _data, sizeof(_header));
+  if (std::memcmp(_header.magic, trace_file::kMagic,
+                  sizeof(_header.magic)) != 0) {
+    // A .part segment whose header is not written yet reads as empty.
+    if (!std::all_of(_data, _data + sizeof(_header),
+                     [](char c) { return c == 0; })) {
+      ::munmap(const_cast<char *>(_data), _size);
+      fail(EINVAL, "Not a Waffle trace segment: " + path);
+    }
+    _chunks_begin = _chunks_end = _data + _size;
+    return;
+  }
+  if (_header.header_size < sizeof(_header) || _header.header_size > _size) {
+    ::munmap(const_cast<char *>(_data), _size);
+    fail(EINVAL, "Corrupt segment header: " + path);
+  }
+  _chunks_begin = _data + _header.header_size;
+
+  // Every bound is checked as a difference, so a corrupt offset can neither
+  // wrap nor point outside the mapping.
+  SegmentIndexTrailer trailer;
+  const size_t trailer_at = _size - sizeof(trailer);
+  std::memcpy(&trailer, _data + trailer_at, sizeof(trailer));
+  if (trailer_at >= _header.header_size &&
+      std::memcmp(trailer.magic, trace_file::kSegmentIndexMagic,
+                  sizeof(trailer.magic)) == 0 &&
+      trailer.chunk_offset >= _header.header_size &&
+      trailer.chunk_offset <= trailer_at &&
+      trailer_at - trailer.chunk_offset >=
+          sizeof(ChunkHeader) + sizeof(SegmentIndexHeader)) {
+    _chunks_end = _data + trailer.chunk_offset;
+    _index = _chunks_end + sizeof(ChunkHeader);
+    SegmentIndexHeader index;
+    std::memcpy(&index, _index, sizeof(index));
+    _min = index.min_timestamp;
+    _max = index.max_timestamp;
+    return;
+  }
+
+  // No footer: walk the chunk headers up to the unwritten tail.
+  const char *cursor = _chunks_begin;
+  const char *end = _data + _size;
+  _min = UINT64_MAX;
+  while (cursor + sizeof(ChunkHeader) <= end) {
+    ChunkHeader chunk;
+    std::memcpy(&chunk, cursor, sizeof(chunk));
+    if (chunk.type == ChunkType{0} ||
+        chunk.payload_size > static_cast<size_t>(end - cursor) -
+                                 sizeof(ChunkHeader))
+      break;
+    if (chunk.type == ChunkType::RECORDS && chunk.record_count > 0) {
+      _min = std::min(_min, chunk.min_timestamp);
+      _max = std::max(_max, chunk.max_timestamp);
+    }
+    cursor += sizeof(ChunkHeader) + chunk.payload_size;
+  }
+  _chunks_end = cursor;
+  if (_max == 0)
+    _min = 0;
+}
+
+MappedSegment::~MappedSegment() {
+  if (_data)
+    ::munmap(const_cast<char *>(_data), _size);
+}
+
+bool MappedSegment::may_contain_trace(Id trace_id) const {
+  if (!_index)
+    return true;
+  SegmentIndexHeader index;
+  std::memcpy(&index, _index, sizeof(index));
+  const size_t available = static_cast<size_t>(_data + _size - _index);
+  if (index.bloom_bytes > available - sizeof(index))
+    return true;
+  return trace_file::BloomFilter::may_contain(
+      _index + sizeof(index), index.bloom_bytes, index.bloom_hashes,
+      trace_id.value);
+}
+
+uint64_t MappedSegment::name_count(uint64_t name_hash) const {
+  if (!_index)
+    return 0;
+  SegmentIndexHeader index;
+  std::memcpy(&index, _index, sizeof(index));
+  const size_t available = static_cast<size_t>(_data + _size - _index);
+  if (index.bloom_bytes > available - sizeof(index) ||
+      index.name_count > (available - sizeof(index) - index.bloom_bytes) /
+                             sizeof(SegmentNameCount))
+    return 0;
+  const char *names = _index + sizeof(index) + index.bloom_bytes;
+  // Sorted by hash: binary search.
+  size_t lo = 0, hi = index.name_count;
+  while (lo < hi) {
+    const size_t mid = (lo + hi) / 2;
+    SegmentNameCount entry;
+    std::memcpy(&entry, names + mid * sizeof(entry), sizeof(entry));
+    if (entry.name_hash == name_hash)
+      return entry.count;
+    if (entry.name_hash < name_hash)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return 0;
+}
+
+// --- SegmentReader ---
+
+SegmentReader::SegmentReader(const std::string &directory, uint64_t from_ns,
+                             uint64_t to_ns, Id trace_id)
+    : _from(from_ns), _to(to_ns), _trace_id(trace_id) {
+  for (SegmentInfo &info : list_segments(directory))
+    if (!info.sealed ||
+        (info.max_timestamp >= from_ns && info.min_timestamp <= to_ns))
+      _candidates.push_back(std::move(info));
+}
+
+SegmentReader::~SegmentReader() = default;
+
+bool SegmentReader::open_next_segment() {
+  _segment.reset();
+  while (_next_candidate < _candidates.size()) {
+    const SegmentInfo &info = _candidates[_next_candidate++];
+    std::unique_ptr<MappedSegment> segment;
+    try {
+      segment = std::make_unique<MappedSegment>(info.path);
+    } catch (const std::system_error &) {
+      // Deleted by retention, or sealed (renamed) since it was listed.
+      continue;
+    }
+    ++_segments_opened;
+    if (_trace_id != kInvalidId && !segment->may_contain_trace(_trace_id))
+      continue;
+    if (segment->max_timestamp() < _from || segment->min_timestamp() > _to)
+      continue;
+    _segment = std::move(segment);
+    _cursor = _segment->chunks_begin();
+    return true;
+  }
+  return false;
+}
+
+bool SegmentReader::load_chunk() {
+  const char *end = _segment->chunks_end();
+  while (_cursor + sizeof(ChunkHeader) <= end) {
+    ChunkHeader chunk;
+    std::memcpy(&chunk, _cursor, sizeof(chunk));
+    const char *payload = _cursor + sizeof(ChunkHeader);
+    if (chunk.type == ChunkType{0} ||
+        chunk.payload_size > static_cast<size_t>(end - payload))
+      return false;
+    _cursor = payload + chunk.payload_size;
+    if (chunk.type == ChunkType::STRINGS) {
+      parse_strings(payload, chunk, _strings);
+    } else if (chunk.type == ChunkType::RECORDS &&
+               chunk.max_timestamp >= _from && chunk.min_timestamp <= _to) {
+      _record = payload;
+      _records_end = _cursor;
+      _remaining = chunk.record_count;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SegmentReader::next(TraceRecord &out) {
+  while (true) {
+    while (_remaining > 0) {
+      const size_t used = trace_file::decode_record(
+          _record, static_cast<size_t>(_records_end - _record), out);
+      if (used == 0) {
+        _remaining = 0; // Corrupt chunk: drop the rest of it.
+        break;
+      }
+      _record += used;
+      --_remaining;
+      const Tracelet &t = out.tracelet;
+      if (t.timestamp >= _from && t.timestamp <= _to &&
+          (_trace_id == kInvalidId || t.trace_id == _trace_id))
+        return true;
+    }
+    if (_segment && load_chunk())
+      continue;
+    if (!open_next_segment())
+      return false;
+  }
+}
+
+} // namespace Waffle::store
@@ -0,0 +1,233 @@
+#pragma once
+
+#include "waffle/processor/iprocessor.hpp"
+#include "waffle/trace_file/bloom_filter.hpp"
+#include "waffle/trace_file/trace_file_format.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace Waffle::store {
+
+/**
+ * @brief One segment file of a SegmentStore directory, as known from its
+ * name.
+ *
+ * Sealed segments are named `<sequence>-<min ts>-<max ts>.wseg` (decimal,
+ * the sequence zero-padded), so that a time range selects segments without
+ * opening any. The segment being written is `<sequence>.wseg.part`.
+ */
+struct SegmentInfo {
+  std::string path;
+  uint64_t sequence = 0;
+  uint64_t min_timestamp = 0; // Unknown (0) for a .part segment
+  uint64_t max_timestamp = 0; // Unknown (0) for a .part segment
+  bool sealed = false;
+  uint64_t bytes = 0;
+};
+
+// Segment files of `directory` by sequence; other files are ignored.
+std::vector<SegmentInfo> list_segments(const std::string &directory);
+
+/**
+ * @brief Processor that writes every record to a directory of fixed-size
+ * trace file segments, keeping it bounded by age and total size.
+ *
+ * Each segment is a self-contained Waffle trace file (its own STRINGS),
+ * preallocated with fallocate() to `segment_bytes`. When the next chunk
+ * would not fit, the segment is sealed: a SEGMENT_INDEX footer with its time
+ * range, a trace-id bloom filter and a histogram of span names is appended,
+ * and the file is renamed to carry its time range. Files keep their
+ * preallocated size, so a reader that mapped a segment while it was being
+ * written never finds it shorter. Sealing is followed by retention: the
+ * oldest sealed segments are deleted while the directory exceeds
+ * `max_total_bytes`, and any whose newest record is older than `max_age`
+ * (also checked every second while idle).
+ *
+ * Appends never wait for the disk. The processing thread encodes chunks in
+ * memory and queues them for a writer thread, which owns all file
+ * operations. If the writer falls `max_queued_chunks` behind, new chunks
+ * are dropped and counted instead.
+ */
+class SegmentStore : public IProcessor {
+public:
+  struct Options {
+    std::string directory; // Created if missing
+    size_t segment_bytes = 64 << 20;
+    size_t chunk_bytes = 1 << 20;
+    uint64_t max_total_bytes = 1ull << 30; // 0: unbounded
+    std::chrono::seconds max_age{24 * 3600}; // 0: unbounded
+    size_t bloom_bits = 1 << 20;            // Per segment
+    size_t max_queued_chunks = 64;
+    uint32_t rank = trace_file::kNoRank;
+  };
+
+  struct Stats {
+    uint64_t records_written = 0;
+    uint64_t records_dropped = 0; // The writer was too far behind
+    uint64_t segments_sealed = 0;
+    uint64_t segments_deleted = 0;
+    uint64_t write_errors = 0;
+  };
+
+  explicit SegmentStore(Options options);
+  ~SegmentStore() override;
+
+  // Creates the directory and starts the writer. Segments left as .part by
+  // an earlier run are renamed as sealed (without a footer) first.
+  // @throw std::system_error If the directory cannot be created.
+  void on_start(const ProcessorContext &context) override;
+  void on_record(const Tracelet &record,
+                 const std::unordered_map<uint64_t, std::string> &strings)
+      override;
+  // Queues the records buffered so far as a chunk.
+  void flush() override;
+  // Seals the last segment and waits for the writer to finish.
+  void shutdown() override;
+  // Chunks waiting for the writer thread.
+  size_t backlog() const override;
+
+  Stats stats() const;
+
+private:
+  struct Operation;
+
+  void remember_strings(
+      const Tracelet &record,
+      const std::unordered_map<uint64_t, std::string> &strings);
+  void seal_chunk();
+  // Encodes _pending as the next chunk of the open segment, listing in
+  // `added` the strings it writes that the segment did not have yet.
+  void encode_chunk(std::vector<char> &out, std::vector<uint64_t> &added);
+  size_t footer_bytes(size_t extra_names) const;
+  void open_segment();
+  void finish_segment();
+  void enqueue(Operation operation);
+  void write_loop();
+  void apply_retention();
+
+  Options _options;
+  trace_file::FileHeader _header{};
+
+  // Processing thread: the chunk being built and the segment it goes to.
+  std::unordered_map<uint64_t, std::string> _strings;
+  std::vector<trace_file::TraceRecord> _pending;
+  size_t _pending_bytes = 0;
+  uint64_t _sequence = 0;
+  bool _segment_open = false;
+  size_t _segment_used = 0;
+  std::unordered_set<uint64_t> _segment_strings;
+  trace_file::BloomFilter _segment_traces;
+  std::unordered_map<uint64_t, uint64_t> _segment_names;
+  uint64_t _segment_records = 0;
+  uint64_t _segment_min = 0;
+  uint64_t _segment_max = 0;
+
+  // Writer thread.
+  mutable std::mutex _mutex;
+  std::condition_variable _wakeup;
+  std::deque<Operation> _queue; // Guarded by _mutex
+  size_t _queued_chunks = 0;    // Guarded by _mutex
+  bool _stopping = false;       // Guarded by _mutex
+  std::thread _writer;
+  std::vector<SegmentInfo> _sealed; // Writer only, oldest first
+
+  std::atomic<uint64_t> _records_written{0};
+  std::atomic<uint64_t> _records_dropped{0};
+  std::atomic<uint64_t> _segments_sealed{0};
+  std::atomic<uint64_t> _segments_deleted{0};
+  std::atomic<uint64_t> _write_errors{0};
+};
+
+/**
+ * @brief A segment file mapped into memory.
+ *
+ * @throw std::system_error If the file cannot be opened or mapped.
+ */
+class MappedSegment {
+public:
+  explicit MappedSegment(const std::string &path);
+  ~MappedSegment();
+
+  MappedSegment(const MappedSegment &) = delete;
+  MappedSegment &operator=(const MappedSegment &) = delete;
+
+  const trace_file::FileHeader &header() const { return _header; }
+  // False for .part segments and segments recovered after a crash.
+  bool has_index() const { return _index != nullptr; }
+  // Exact when has_index(); otherwise from the RECORDS chunk headers.
+  uint64_t min_timestamp() const { return _min; }
+  uint64_t max_timestamp() const { return _max; }
+  // Always true without an index.
+  bool may_contain_trace(Id trace_id) const;
+  // Number of starts and events named `name_hash`; 0 without an index.
+  uint64_t name_count(uint64_t name_hash) const;
+
+  // The chunk area: from after the FileHeader to the footer or the
+  // unwritten tail.
+  const char *chunks_begin() const { return _chunks_begin; }
+  const char *chunks_end() const { return _chunks_end; }
+
+private:
+  const char *_data = nullptr;
+  size_t _size = 0;
+  trace_file::FileHeader _header{};
+  const char *_chunks_begin = nullptr;
+  const char *_chunks_end = nullptr;
+  const char *_index = nullptr; // SegmentIndexHeader, if any
+  uint64_t _min = 0;
+  uint64_t _max = 0;
+};
+
+/**
+ * @brief Reads the records of a SegmentStore directory within a time range,
+ * optionally of one trace only.
+ *
+ * Only segments whose name-encoded range overlaps [from_ns, to_ns] are
+ * opened (plus a .part segment, whose range is unknown), one at a time, by
+ * mapping them. With a trace id, segments whose bloom filter excludes it
+ * are skipped; within a segment, RECORDS chunks outside the range are
+ * skipped by their headers. Records come in segment order, then chunk
+ * order.
+ */
+class SegmentReader {
+public:
+  SegmentReader(const std::string &directory, uint64_t from_ns,
+                uint64_t to_ns, Id trace_id = kInvalidId);
+  ~SegmentReader();
+
+  bool next(trace_file::TraceRecord &out);
+
+  // Strings of the segments read so far.
+  const std::unordered_map<uint64_t, std::string> &strings() const {
+    return _strings;
+  }
+  size_t segments_opened() const { return _segments_opened; }
+
+private:
+  bool open_next_segment();
+  bool load_chunk();
+
+  std::vector<SegmentInfo> _candidates;
+  size_t _next_candidate = 0;
+  uint64_t _from;
+  uint64_t _to;
+  Id _trace_id;
+  std::unique_ptr<MappedSegment> _segment;
+  const char *_cursor = nullptr; // Next chunk of the segment
+  const char *_record = nullptr; // Next record of the current chunk
+  const char *_records_end = nullptr;
+  uint32_t _remaining = 0;
+  std::unordered_map<uint64_t, std::string> _strings;
+  size_t _segments_opened = 0;
+};
+
+} // namespace Waffle::store
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace Waffle::trace_file {
+
+/**
+ * @brief Bloom filter over 64-bit keys (trace ids, name hashes), stored as
+ * it is written to trace files: little-endian 64-bit words.
+ *
+ * Probe i of a key sets bit (h1 + i * h2) >> (64 - log2(bits)), with h1 and
+ * h2 two multiplicative mixes of the key. With 10 bits per key and 4
+ * hashes the false positive rate is about 1.2%.
+ */
+class BloomFilter {
+public:
+  // `bits` is rounded up to a power of two, at least 64.
+  explicit BloomFilter(size_t bits = 1 << 16, uint32_t hashes = 4)
+      : _words(std::bit_ceil(bits < 64 ? size_t{64} : bits) / 64),
+        _hashes(hashes),
+        _shift(64 - std::countr_zero(_words.size() * 64)) {}
+
+  void add(uint64_t key) {
+    Probe p(key, _shift);
+    for (uint32_t i = 0; i < _hashes; ++i, p.next())
+      _words[p.bit >> 6] |= uint64_t{1} << (p.bit & 63);
+  }
+
+  bool may_contain(uint64_t key) const {
+    return may_contain(reinterpret_cast<const char *>(_words.data()),
+                       _words.size() * 8, _hashes, key);
+  }
+
+  // Tests a filter in its serialized form, e.g. in a mapped file.
+  static bool may_contain(const char *bytes, size_t byte_count,
+                          uint32_t hashes, uint64_t key) {
+    if (byte_count < 8 || !std::has_single_bit(byte_count))
+      return true; // Not a filter this class wrote: cannot exclude
+    Probe p(key, 64 - std::countr_zero(byte_count * 8));
+    for (uint32_t i = 0; i < hashes; ++i, p.next()) {
+      uint64_t word;
+      std::memcpy(&word, bytes + (p.bit >> 6) * 8, sizeof(word));
+      if (!(word & (uint64_t{1} << (p.bit & 63))))
+        return false;
+    }
+    return true;
+  }
+
+  void clear() { std::fill(_words.begin(), _words.end(), 0); }
+
+  const char *data() const {
+    return reinterpret_cast<const char *>(_words.data());
+  }
+  size_t byte_size() const { return _words.size() * 8; }
+  uint32_t hashes() const { return _hashes; }
+
+private:
+  struct Probe {
+    Probe(uint64_t key, int shift)
+        : h1(key * 0x9E3779B97F4A7C15ull),
+          h2(((key ^ (key >> 31)) * 0xBF58476D1CE4E5B9ull) | 1),
+          shift(shift), bit(h1 >> shift) {}
+    void next() {
+      h1 += h2;
+      bit = h1 >> shift;
+    }
+    uint64_t h1;
+    uint64_t h2;
+    int shift;
+    uint64_t bit;
+  };
+
+  std::vector<uint64_t> _words;
+  uint32_t _hashes;
+  int _shift;
+};
+
+} // namespace Waffle::trace_file
@@ -0,0 +1,255 @@
+#pragma once
+
+/**
+ * @file trace_file_format.hpp
+ * @brief On-disk layout of Waffle trace files (`.wtrace`).
+ *
+ * A trace file is a FileHeader followed by a sequence of chunks, each a
+ * ChunkHeader plus `payload_size` bytes of payload. All integers are
+ * little-endian; structures are written as-is and are padded explicitly so
+ * that their layout does not depend on the compiler.
+ *
+ * Chunk types:
+ * - STRINGS: repeated { uint64_t hash; uint32_t length; char bytes[length]; }.
+ *   A string always appears in a STRINGS chunk before the first RECORDS chunk
+ *   that references it.
+ * - RECORDS: `record_count` records, each a RecordHeader followed by
+ *   `num_attributes` FileAttributes. Records within a chunk are sorted by
+ *   timestamp; `min_timestamp`/`max_timestamp` bound them. Consecutive chunks
+ *   are in timestamp order up to the small skew between producer threads.
+ * - SEGMENT_INDEX: the footer of a sealed SegmentStore segment, always its
+ *   last chunk: a SegmentIndexHeader, the trace-id bloom filter
+ *   (`bloom_bytes`) and `name_count` SegmentNameCount entries sorted by
+ *   hash. Segments keep their preallocated size; a SegmentIndexTrailer in
+ *   the last 16 bytes of the file locates the chunk.
+ * - FILTERS: follows each RECORDS chunk written by TraceFileEncoder, with the
+ *   same time bounds: a ChunkFilterHeader, then bloom filters (see
+ *   BloomFilter) of the chunk's trace ids and of the names of its starts and
+ *   events.
+ * - CHUNK_INDEX: the last chunk of a file closed by TraceFileEncoder: one
+ *   ChunkIndexEntry per STRINGS and RECORDS chunk, in file order, then a
+ *   ChunkIndexTrailer, which thus ends the file and locates the chunk.
+ *
+ * Readers skip chunk types they do not know, so new chunk types can be added
+ * without a version bump. A chunk type of 0 marks the preallocated,
+ * not yet written tail of a file being written; readers stop there.
+ */
+
+#include "waffle/waffle_core.hpp"
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+namespace Waffle::trace_file {
+
+// Structures are written in host byte order.
+static_assert(std::endian::native == std::endian::little,
+              "Waffle trace files are little-endian");
+
+constexpr char kMagic[8] = {'W', 'A', 'F', 'F', 'L', 'E', 'T', 'R'};
+constexpr uint32_t kVersion = 1;
+
+// FileHeader::flags
+constexpr uint32_t kFlagMerged = 1u << 0; // Records come from several ranks
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size; // sizeof(FileHeader) of the writer
+  uint64_t process_tag; // See Tracer::process_tag(); 0 for merged files
+  uint64_t start_wall_ns;
+  uint32_t flags;
+  uint32_t rank; // Rank of the writing process, or kNoRank
+};
+static_assert(sizeof(FileHeader) == 40);
+constexpr uint32_t kNoRank = 0xFFFFFFFF;
+
+enum class ChunkType : uint32_t {
+  STRINGS = 1,
+  RECORDS = 2,
+  SEGMENT_INDEX = 3,
+  FILTERS = 4,
+  CHUNK_INDEX = 5,
+};
+
+struct ChunkHeader {
+  ChunkType type;
+  uint32_t record_count; // RECORDS: number of records; otherwise entries
+  uint64_t payload_size;
+  uint64_t min_timestamp; // RECORDS and FILTERS only
+  uint64_t max_timestamp; // RECORDS and FILTERS only
+};
+static_assert(sizeof(ChunkHeader) == 32);
+
+struct SegmentIndexHeader {
+  uint64_t record_count;
+  uint64_t min_timestamp;
+  uint64_t max_timestamp;
+  uint32_t bloom_bytes;  // Multiple of 8; see BloomFilter
+  uint32_t bloom_hashes;
+  uint32_t name_count;
+  uint32_t padding;
+};
+static_assert(sizeof(SegmentIndexHeader) == 40);
+
+// Number of SPAN_START and EVENT records with a name.
+struct SegmentNameCount {
+  uint64_t name_hash;
+  uint64_t count;
+};
+static_assert(sizeof(SegmentNameCount) == 16);
+
+constexpr char kSegmentIndexMagic[8] = {'W', 'F', 'S', 'E', 'G', 'I', 'D', 'X'};
+
+struct SegmentIndexTrailer {
+  uint64_t chunk_offset; // File offset of the SEGMENT_INDEX ChunkHeader
+  char magic[8];         // kSegmentIndexMagic
+};
+static_assert(sizeof(SegmentIndexTrailer) == 16);
+
+struct ChunkFilterHeader {
+  uint32_t trace_bloom_bytes; // Multiple of 8; see BloomFilter
+  uint32_t name_bloom_bytes;
+  uint32_t bloom_hashes;
+  uint32_t padding;
+};
+static_assert(sizeof(ChunkFilterHeader) == 16);
+
+struct ChunkIndexEntry {
+  uint64_t offset;        // File offset of the ChunkHeader
+  uint64_t filter_offset; // Of the FILTERS chunk of a RECORDS chunk, or 0
+  uint64_t min_timestamp;
+  uint64_t max_timestamp;
+  ChunkType type;
+  uint32_t record_count;
+};
+static_assert(sizeof(ChunkIndexEntry) == 40);
+
+constexpr char kChunkIndexMagic[8] = {'W', 'F', 'C', 'H', 'K', 'I', 'D', 'X'};
+
+struct ChunkIndexTrailer {
+  uint64_t chunk_offset; // File offset of the CHUNK_INDEX ChunkHeader
+  char magic[8];         // kChunkIndexMagic
+};
+static_assert(sizeof(ChunkIndexTrailer) == 16);
+
+struct RecordHeader {
+  uint64_t timestamp;
+  uint64_t hlc;
+  uint64_t trace_id;
+  uint64_t span_id;
+  uint64_t parent_span_id;
+  uint64_t cause_id;
+  uint64_t name_hash;
+  uint8_t record_type; // Tracelet::RecordType; Domain id in the high nibble
+  uint8_t num_attributes;
+  uint16_t thread_index;
+  uint16_t cpu_id;
+  uint16_t rank; // Index of the source rank in merged files, else 0
+};
+static_assert(sizeof(RecordHeader) == 64);
+static_assert(kMaxDomains <= 16, "Domain ids must fit in four bits");
+
+struct FileAttribute {
+  uint64_t key_id;
+  uint8_t type; // AttributeValue::Type
+  uint8_t padding[7];
+  uint64_t value; // Bit pattern of the active union member
+};
+static_assert(sizeof(FileAttribute) == 24);
+
+/**
+ * @brief A record as read from (or written to) a trace file: the Tracelet
+ * plus the rank it came from.
+ */
+struct TraceRecord {
+  Tracelet tracelet;
+  uint16_t rank = 0;
+};
+
+inline RecordHeader encode_header(const Tracelet &t, uint16_t rank) {
+  RecordHeader h;
+  h.timestamp = t.timestamp;
+  h.hlc = t.hlc;
+  h.trace_id = t.trace_id.value;
+  h.span_id = t.span_id.value;
+  h.parent_span_id = t.parent_span_id.value;
+  h.cause_id = t.cause_id.value;
+  h.name_hash = t.name_string_hash;
+  // Out-of-range ids count as domain 0, as in the Tracer.
+  const uint8_t domain = t.domain < kMaxDomains ? t.domain : 0;
+  h.record_type = static_cast<uint8_t>(
+      static_cast<uint8_t>(t.record_type) | domain << 4);
+  h.num_attributes = t.num_attributes;
+  h.thread_index = t.thread_index;
+  h.cpu_id = t.cpu_id;
+  h.rank = rank;
+  return h;
+}
+
+inline FileAttribute encode_attribute(const Attribute &a) {
+  FileAttribute f{};
+  f.key_id = a.key_id;
+  f.type = static_cast<uint8_t>(a.value.type);
+  std::memcpy(&f.value, &a.value.i64, sizeof(f.value));
+  if (a.value.type == AttributeValue::Type::BOOL)
+    f.value = a.value.b ? 1 : 0;
+  return f;
+}
+
+inline Attribute decode_attribute(const FileAttribute &f) {
+  AttributeValue v;
+  v.type = static_cast<AttributeValue::Type>(f.type);
+  if (v.type == AttributeValue::Type::BOOL)
+    v.b = f.value != 0;
+  else
+    std::memcpy(&v.i64, &f.value, sizeof(f.value));
+  return Attribute{f.key_id, v};
+}
+
+/**
+ * @brief Decodes the record at `data` into `out`; returns the number of bytes
+ * consumed, or 0 if `size` is too small.
+ */
+inline size_t decode_record(const char *data, size_t size, TraceRecord &out) {
+  if (size < sizeof(RecordHeader))
+    return 0;
+  RecordHeader h;
+  std::memcpy(&h, data, sizeof(h));
+  const uint8_t count = h.num_attributes < MAX_ATTRIBUTES_PER_TRACELET
+                            ? h.num_attributes
+                            : MAX_ATTRIBUTES_PER_TRACELET;
+  const size_t total =
+      sizeof(RecordHeader) + size_t{h.num_attributes} * sizeof(FileAttribute);
+  if (size < total)
+    return 0;
+  // The high nibble is the domain. An unknown type is corrupt, or from a
+  // newer writer; either way consumers must not see it.
+  const uint8_t type = h.record_type & 0x0F;
+  if (type > static_cast<uint8_t>(Tracelet::RecordType::THREAD_INFO))
+    return 0;
+
+  Tracelet &t = out.tracelet;
+  t.timestamp = h.timestamp;
+  t.hlc = h.hlc;
+  t.trace_id = Id{h.trace_id};
+  t.span_id = Id{h.span_id};
+  t.parent_span_id = Id{h.parent_span_id};
+  t.cause_id = Id{h.cause_id};
+  t.name_string_hash = h.name_hash;
+  t.record_type = static_cast<Tracelet::RecordType>(type);
+  t.domain = h.record_type >> 4;
+  t.num_attributes = count;
+  t.thread_index = h.thread_index;
+  t.cpu_id = h.cpu_id;
+  const char *attrs = data + sizeof(RecordHeader);
+  for (uint8_t i = 0; i < count; ++i) {
+    FileAttribute f;
+    std::memcpy(&f, attrs + i * sizeof(FileAttribute), sizeof(f));
+    t.attributes[i] = decode_attribute(f);
+  }
+  out.rank = h.rank;
+  return total;
+}
+
+} // namespace Waffle::trace_file
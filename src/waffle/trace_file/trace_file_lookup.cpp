@@ -0,0 +1,190 @@
+#include "waffle/trace_file/trace_file_lookup.hpp"
+#include "waffle/trace_file/bloom_filter.hpp"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace Waffle::trace_file {
+
+TraceFileLookup::TraceFileLookup(const std::string &path) : _path(path) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw std::system_error(errno, std::generic_category(),
+                            "Cannot open trace file " + path);
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    const int error = errno;
+    ::close(fd);
+    throw std::system_error(error, std::generic_category(),
+                            "Cannot open trace file " + path);
+  }
+  _size = static_cast<size_t>(st.st_size);
+  if (_size < sizeof(_header)) {
+    ::close(fd);
+    throw std::runtime_error(path + " is not a Waffle trace file");
+  }
+  void *data = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+  const int error = errno;
+  ::close(fd);
+  if (data == MAP_FAILED)
+    throw std::system_error(error, std::generic_category(),
+                            "Cannot map trace file " + path);
+  _data = static_cast<const char *>(data);
+  std::memcpy(&_header, _data, sizeof(_header));
+  if (std::memcmp(_header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      _header.version > kVersion) {
+    ::munmap(const_cast<char *>(_data), _size);
+    throw std::runtime_error(path + " is not a Waffle trace file");
+  }
+  _has_index = load_index();
+  if (!_has_index)
+    walk_chunks();
+}
+
+TraceFileLookup::~TraceFileLookup() {
+  ::munmap(const_cast<char *>(_data), _size);
+}
+
+const char *TraceFileLookup::payload(uint64_t offset,
+                                     ChunkHeader &chunk) const {
+  if (offset < _header.header_size || offset > _size ||
+      _size - offset < sizeof(chunk))
+    return nullptr;
+  std::memcpy(&chunk, _data + offset, sizeof(chunk));
+  if (chunk.payload_size > _size - offset - sizeof(chunk))
+    return nullptr;
+  return _data + offset + sizeof(chunk);
+}
+
+bool TraceFileLookup::load_index() {
+  if (_size < _header.header_size + sizeof(ChunkIndexTrailer))
+    return false;
+  ChunkIndexTrailer trailer;
+  std::memcpy(&trailer, _data + _size - sizeof(trailer), sizeof(trailer));
+  if (std::memcmp(trailer.magic, kChunkIndexMagic, sizeof(kChunkIndexMagic)))
+    return false;
+  ChunkHeader chunk;
+  const char *entries = payload(trailer.chunk_offset, chunk);
+  if (!entries || chunk.type != ChunkType::CHUNK_INDEX ||
+      chunk.payload_size !=
+          chunk.record_count * sizeof(ChunkIndexEntry) + sizeof(trailer))
+    return false;
+  for (uint32_t i = 0; i < chunk.record_count; ++i) {
+    ChunkIndexEntry entry;
+    std::memcpy(&entry, entries + i * sizeof(entry), sizeof(entry));
+    if (entry.type == ChunkType::RECORDS)
+      _records.push_back(entry);
+    else if (entry.type == ChunkType::STRINGS)
+      _string_chunks.push_back(entry.offset);
+  }
+  return true;
+}
+
+void TraceFileLookup::walk_chunks() {
+  uint64_t offset = _header.header_size;
+  ChunkHeader chunk;
+  while (payload(offset, chunk) && chunk.type != ChunkType{0}) {
+    if (chunk.type == ChunkType::RECORDS) {
+      _records.push_back({offset, 0, chunk.min_timestamp, chunk.max_timestamp,
+                          ChunkType::RECORDS, chunk.record_count});
+    } else if (chunk.type == ChunkType::FILTERS && !_records.empty() &&
+               _records.back().filter_offset == 0) {
+      _records.back().filter_offset = offset;
+    } else if (chunk.type == ChunkType::STRINGS) {
+      _string_chunks.push_back(offset);
+    }
+    offset += sizeof(chunk) + chunk.payload_size;
+  }
+}
+
+bool TraceFileLookup::may_match(const ChunkIndexEntry &entry,
+                                const Query &query) const {
+  if (entry.max_timestamp < query.from_ns ||
+      entry.min_timestamp > query.to_ns)
+    return false;
+  if (query.trace_id == kInvalidId && query.name_hash == 0)
+    return true;
+  ChunkHeader chunk;
+  const char *filters = payload(entry.filter_offset, chunk);
+  if (!filters || chunk.type != ChunkType::FILTERS ||
+      chunk.payload_size < sizeof(ChunkFilterHeader))
+    return true; // No filters: cannot exclude
+  ChunkFilterHeader header;
+  std::memcpy(&header, filters, sizeof(header));
+  if (sizeof(header) + uint64_t{header.trace_bloom_bytes} +
+          header.name_bloom_bytes >
+      chunk.payload_size)
+    return true;
+  const char *traces = filters + sizeof(header);
+  const char *names = traces + header.trace_bloom_bytes;
+  if (query.trace_id != kInvalidId &&
+      !BloomFilter::may_contain(traces, header.trace_bloom_bytes,
+                                header.bloom_hashes, query.trace_id.value))
+    return false;
+  return query.name_hash == 0 ||
+         BloomFilter::may_contain(names, header.name_bloom_bytes,
+                                  header.bloom_hashes, query.name_hash);
+}
+
+void TraceFileLookup::load_strings() {
+  _strings_loaded = true;
+  for (uint64_t offset : _string_chunks) {
+    ChunkHeader chunk;
+    const char *data = payload(offset, chunk);
+    if (!data)
+      continue;
+    size_t pos = 0;
+    for (uint32_t i = 0; i < chunk.record_count; ++i) {
+      uint64_t hash;
+      uint32_t length;
+      if (pos + sizeof(hash) + sizeof(length) > chunk.payload_size)
+        break;
+      std::memcpy(&hash, data + pos, sizeof(hash));
+      std::memcpy(&length, data + pos + sizeof(hash), sizeof(length));
+      pos += sizeof(hash) + sizeof(length);
+      if (pos + length > chunk.payload_size)
+        break;
+      _strings.emplace(hash, std::string(data + pos, length));
+      pos += length;
+    }
+  }
+}
+
+std::vector<TraceRecord> TraceFileLookup::find(const Query &query) {
+  if (!_strings_loaded)
+    load_strings();
+  std::vector<TraceRecord> out;
+  _chunks_decoded = 0;
+  TraceRecord record;
+  for (const ChunkIndexEntry &entry : _records) {
+    if (!may_match(entry, query))
+      continue;
+    ChunkHeader chunk;
+    const char *data = payload(entry.offset, chunk);
+    if (!data || chunk.type != ChunkType::RECORDS)
+      continue;
+    ++_chunks_decoded;
+    const char *end = data + chunk.payload_size;
+    for (uint32_t i = 0; i < chunk.record_count; ++i) {
+      const size_t used =
+          decode_record(data, static_cast<size_t>(end - data), record);
+      if (used == 0)
+        break; // Corrupt chunk: drop the rest of it.
+      data += used;
+      const Tracelet &t = record.tracelet;
+      if (t.timestamp < query.from_ns || t.timestamp > query.to_ns ||
+          (query.trace_id != kInvalidId && t.trace_id != query.trace_id) ||
+          (query.name_hash != 0 && t.name_string_hash != query.name_hash))
+        continue;
+      out.push_back(record);
+    }
+  }
+  return out;
+}
+
+} // namespace Waffle::trace_file
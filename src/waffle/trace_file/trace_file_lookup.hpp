@@ -0,0 +1,75 @@
+#pragma once
+
+#include "waffle/trace_file/trace_file_format.hpp"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Waffle::trace_file {
+
+/**
+ * @brief Point and range lookups in a trace file, through its chunk index
+ * and per-chunk bloom filters rather than a scan.
+ *
+ * The file is mapped, not read. For a file closed by TraceFileEncoder the
+ * CHUNK_INDEX footer lists every chunk; for one cut short (or written
+ * before the index existed) the chunk headers are walked instead, one page
+ * per chunk. `find()` then decodes only the RECORDS chunks whose time
+ * bounds overlap the query and whose FILTERS may contain its trace id and
+ * name: for one trace in a large file, the index, one filter per chunk in
+ * range and the few chunks holding the trace.
+ *
+ * @throw std::runtime_error If the file is not a trace file.
+ * @throw std::system_error If the file cannot be opened or mapped.
+ */
+class TraceFileLookup {
+public:
+  struct Query {
+    Id trace_id = kInvalidId; // kInvalidId: any trace
+    uint64_t name_hash = 0;   // 0: any; else starts and events of that name
+    uint64_t from_ns = 0;
+    uint64_t to_ns = UINT64_MAX;
+  };
+
+  explicit TraceFileLookup(const std::string &path);
+  ~TraceFileLookup();
+
+  TraceFileLookup(const TraceFileLookup &) = delete;
+  TraceFileLookup &operator=(const TraceFileLookup &) = delete;
+
+  const FileHeader &header() const { return _header; }
+  // False if the chunks were found by walking the file.
+  bool has_index() const { return _has_index; }
+  size_t chunk_count() const { return _records.size(); } // RECORDS chunks
+
+  // Records matching `query`, in file order.
+  std::vector<TraceRecord> find(const Query &query);
+  // RECORDS chunks decoded by the last find().
+  size_t chunks_decoded() const { return _chunks_decoded; }
+
+  // Every string of the file; loaded by the first find().
+  const std::unordered_map<uint64_t, std::string> &strings() const {
+    return _strings;
+  }
+
+private:
+  bool load_index();
+  void walk_chunks();
+  bool may_match(const ChunkIndexEntry &entry, const Query &query) const;
+  void load_strings();
+  // The payload of the chunk at `offset`, or nullptr if it is cut short.
+  const char *payload(uint64_t offset, ChunkHeader &chunk) const;
+
+  std::string _path;
+  const char *_data = nullptr;
+  size_t _size = 0;
+  FileHeader _header{};
+  bool _has_index = false;
+  std::vector<ChunkIndexEntry> _records;
+  std::vector<uint64_t> _string_chunks; // Offsets
+  bool _strings_loaded = false;
+  std::unordered_map<uint64_t, std::string> _strings;
+  size_t _chunks_decoded = 0;
+};
+
+} // namespace Waffle::trace_file
@@ -0,0 +1,126 @@
+#include "waffle/trace_file/trace_file_reader.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <sys/types.h> // For off_t
+#include <stdexcept>
+#include <system_error>
+
+namespace Waffle::trace_file {
+
+TraceFileReader::TraceFileReader(const std::string &path) : _path(path) {
+  _file = std::fopen(path.c_str(), "rb");
+  if (!_file)
+    throw std::system_error(errno, std::generic_category(),
+                            "Cannot open trace file " + path);
+  read_header();
+}
+
+TraceFileReader::TraceFileReader(std::FILE *file, std::string name)
+    : _path(std::move(name)), _file(file), _seekable(false) {
+  read_header();
+}
+
+void TraceFileReader::read_header() {
+  if (std::fread(&_header, sizeof(_header), 1, _file) != 1 ||
+      std::memcmp(_header.magic, kMagic, sizeof(kMagic)) != 0) {
+    std::fclose(_file);
+    throw std::runtime_error(_path + " is not a Waffle trace file");
+  }
+  if (_header.version > kVersion) {
+    std::fclose(_file);
+    throw std::runtime_error(_path + " has unsupported trace file version " +
+                             std::to_string(_header.version));
+  }
+  // Skip header fields added by newer writers.
+  if (_header.header_size > sizeof(FileHeader))
+    skip(_header.header_size - sizeof(FileHeader));
+}
+
+bool TraceFileReader::skip(uint64_t bytes) {
+  if (_seekable)
+    return fseeko(_file, static_cast<off_t>(bytes), SEEK_CUR) == 0;
+  // A pipe or socket: read and discard.
+  char discard[4096];
+  while (bytes > 0) {
+    const size_t n = bytes < sizeof(discard) ? bytes : sizeof(discard);
+    if (std::fread(discard, 1, n, _file) != n)
+      return false;
+    bytes -= n;
+  }
+  return true;
+}
+
+TraceFileReader::~TraceFileReader() {
+  if (_file)
+    std::fclose(_file);
+}
+
+bool TraceFileReader::next(TraceRecord &out) {
+  while (_remaining == 0) {
+    if (!load_chunk())
+      return false;
+  }
+  const size_t used =
+      decode_record(_payload.data() + _offset, _payload.size() - _offset, out);
+  if (used == 0) {
+    _remaining = 0; // Corrupt chunk: drop the rest of it.
+    return next(out);
+  }
+  _offset += used;
+  --_remaining;
+  return true;
+}
+
+bool TraceFileReader::load_chunk() {
+  if (std::fread(&_chunk, sizeof(_chunk), 1, _file) != 1)
+    return false; // Clean end of file (or a torn chunk header).
+  if (_chunk.type == ChunkType{0})
+    return false; // Preallocated space of a file still being written.
+  if (_chunk.type != ChunkType::RECORDS && _chunk.type != ChunkType::STRINGS) {
+    // Unknown chunk type: skip its payload.
+    if (!skip(_chunk.payload_size))
+      return false;
+    return true;
+  }
+  // Grow the buffer only as the payload actually arrives: a corrupt size
+  // must not turn into a huge allocation.
+  constexpr uint64_t kReadStep = 1 << 20;
+  _payload.clear();
+  for (uint64_t left = _chunk.payload_size; left > 0;) {
+    const size_t n = static_cast<size_t>(std::min(left, kReadStep));
+    const size_t old_size = _payload.size();
+    _payload.resize(old_size + n);
+    if (std::fread(_payload.data() + old_size, 1, n, _file) != n)
+      return false; // Truncated payload ends the file.
+    left -= n;
+  }
+  _offset = 0;
+  if (_chunk.type == ChunkType::STRINGS) {
+    parse_strings();
+    _remaining = 0;
+  } else {
+    _remaining = _chunk.record_count;
+  }
+  return true;
+}
+
+void TraceFileReader::parse_strings() {
+  size_t offset = 0;
+  for (uint32_t i = 0; i < _chunk.record_count; ++i) {
+    uint64_t hash;
+    uint32_t length;
+    if (offset + sizeof(hash) + sizeof(length) > _payload.size())
+      return;
+    std::memcpy(&hash, _payload.data() + offset, sizeof(hash));
+    std::memcpy(&length, _payload.data() + offset + sizeof(hash),
+                sizeof(length));
+    offset += sizeof(hash) + sizeof(length);
+    if (offset + length > _payload.size())
+      return;
+    _strings.emplace(hash, std::string(_payload.data() + offset, length));
+    offset += length;
+  }
+}
+
+} // namespace Waffle::trace_file
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "waffle/trace_file/trace_file_format.hpp"
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Waffle::trace_file {
+
+/**
+ * @brief Reads a trace file sequentially, one chunk in memory at a time.
+ *
+ * STRINGS chunks are folded into `strings()` as they are passed, so by the
+ * time a record is returned every string it references is resolvable.
+ *
+ * @throw std::runtime_error If the file is not a trace file or is truncated
+ * in the middle of a chunk header.
+ * @throw std::system_error If the file cannot be opened.
+ */
+class TraceFileReader {
+public:
+  explicit TraceFileReader(const std::string &path);
+  // Reads from an open stream (e.g. a socket, see LiveStreamClient) and
+  // closes it when done, also if the constructor throws. `name` is used in
+  // messages.
+  TraceFileReader(std::FILE *file, std::string name);
+  ~TraceFileReader();
+
+  TraceFileReader(const TraceFileReader &) = delete;
+  TraceFileReader &operator=(const TraceFileReader &) = delete;
+
+  const FileHeader &header() const { return _header; }
+  const std::string &path() const { return _path; }
+
+  /**
+   * @brief Reads the next record; false at the end of the file.
+   *
+   * A chunk whose payload is cut short (e.g. the writer was killed) ends the
+   * file: everything before it is still returned.
+   */
+  bool next(TraceRecord &out);
+
+  // Header of the chunk the last record was read from.
+  const ChunkHeader &current_chunk() const { return _chunk; }
+
+  const std::unordered_map<uint64_t, std::string> &strings() const {
+    return _strings;
+  }
+
+private:
+  void read_header();
+  bool skip(uint64_t bytes);
+  bool load_chunk();
+  void parse_strings();
+
+  std::string _path;
+  std::FILE *_file = nullptr;
+  bool _seekable = true;
+  FileHeader _header{};
+
+  ChunkHeader _chunk{};
+  std::vector<char> _payload;
+  size_t _offset = 0;
+  uint32_t _remaining = 0; // Records left in the current RECORDS chunk
+
+  std::unordered_map<uint64_t, std::string> _strings;
+};
+
+} // namespace Waffle::trace_file
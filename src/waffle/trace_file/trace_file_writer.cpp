@@ -0,0 +1,242 @@
+#include "waffle/trace_file/trace_file_writer.hpp"
+#include "waffle/trace_file/bloom_filter.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <system_error>
+
+namespace Waffle::trace_file {
+
+namespace {
+
+// A point lookup probes every chunk in range, so false positives add up:
+// about 0.02% per chunk (BloomFilter rounds the size up, which helps).
+constexpr size_t kFilterBitsPerKey = 20;
+constexpr uint32_t kFilterHashes = 7;
+
+} // namespace
+
+TraceFileEncoder::TraceFileEncoder(const std::string &path,
+                                   const FileHeader &header,
+                                   size_t chunk_bytes)
+    : _path(path), _chunk_bytes(chunk_bytes) {
+  _file = std::fopen(path.c_str(), "wb");
+  if (!_file)
+    throw std::system_error(errno, std::generic_category(),
+                            "Cannot create trace file " + path);
+  write(&header, sizeof(header));
+}
+
+TraceFileEncoder::TraceFileEncoder(std::FILE *file, std::string name,
+                                   const FileHeader &header,
+                                   size_t chunk_bytes)
+    : _file(file), _path(std::move(name)), _chunk_bytes(chunk_bytes) {
+  if (!_file)
+    throw std::system_error(EINVAL, std::generic_category(),
+                            "Cannot write trace to " + _path);
+  try {
+    write(&header, sizeof(header));
+  } catch (...) {
+    std::fclose(_file);
+    throw;
+  }
+}
+
+TraceFileEncoder::~TraceFileEncoder() {
+  if (_file) {
+    try {
+      close();
+    } catch (...) {
+      // Destructors must not throw; the error was already unrecoverable.
+    }
+  }
+}
+
+void TraceFileEncoder::add_string(uint64_t hash, std::string_view str) {
+  if (!_written.insert(hash).second)
+    return;
+  const uint32_t length = static_cast<uint32_t>(str.size());
+  const char *h = reinterpret_cast<const char *>(&hash);
+  const char *l = reinterpret_cast<const char *>(&length);
+  _pending_strings.insert(_pending_strings.end(), h, h + sizeof(hash));
+  _pending_strings.insert(_pending_strings.end(), l, l + sizeof(length));
+  _pending_strings.insert(_pending_strings.end(), str.begin(), str.end());
+  ++_pending_string_count;
+}
+
+void TraceFileEncoder::add_record(const Tracelet &tracelet, uint16_t rank) {
+  _pending_records.push_back(TraceRecord{tracelet, rank});
+  _pending_record_bytes += sizeof(RecordHeader) +
+                           tracelet.num_attributes * sizeof(FileAttribute);
+  if (_pending_record_bytes >= _chunk_bytes)
+    flush();
+}
+
+void TraceFileEncoder::flush() {
+  write_strings();
+  write_records();
+  if (_file && std::fflush(_file) != 0)
+    throw std::system_error(errno, std::generic_category(),
+                            "Cannot write trace file " + _path);
+}
+
+void TraceFileEncoder::close() {
+  if (!_file)
+    return;
+  flush();
+  write_index();
+  std::FILE *file = _file;
+  _file = nullptr;
+  if (std::fclose(file) != 0)
+    throw std::system_error(errno, std::generic_category(),
+                            "Cannot close trace file " + _path);
+}
+
+void TraceFileEncoder::write(const void *data, size_t size) {
+  if (std::fwrite(data, 1, size, _file) != size)
+    throw std::system_error(errno, std::generic_category(),
+                            "Cannot write trace file " + _path);
+  _offset += size;
+}
+
+void TraceFileEncoder::write_strings() {
+  if (_pending_string_count == 0)
+    return;
+  ChunkHeader chunk{ChunkType::STRINGS, _pending_string_count,
+                    _pending_strings.size(), 0, 0};
+  _index.push_back({_offset, 0, 0, 0, ChunkType::STRINGS,
+                    _pending_string_count});
+  write(&chunk, sizeof(chunk));
+  write(_pending_strings.data(), _pending_strings.size());
+  _pending_strings.clear();
+  _pending_string_count = 0;
+}
+
+void TraceFileEncoder::write_records() {
+  if (_pending_records.empty())
+    return;
+  std::stable_sort(_pending_records.begin(), _pending_records.end(),
+                   [](const TraceRecord &a, const TraceRecord &b) {
+                     return a.tracelet.timestamp < b.tracelet.timestamp;
+                   });
+  ChunkHeader chunk{ChunkType::RECORDS,
+                    static_cast<uint32_t>(_pending_records.size()),
+                    _pending_record_bytes,
+                    _pending_records.front().tracelet.timestamp,
+                    _pending_records.back().tracelet.timestamp};
+  _index.push_back({_offset, 0, chunk.min_timestamp, chunk.max_timestamp,
+                    ChunkType::RECORDS, chunk.record_count});
+  write(&chunk, sizeof(chunk));
+  for (const TraceRecord &record : _pending_records) {
+    const RecordHeader header = encode_header(record.tracelet, record.rank);
+    write(&header, sizeof(header));
+    for (auto it = record.tracelet.attributes_begin();
+         it != record.tracelet.attributes_end(); ++it) {
+      const FileAttribute attr = encode_attribute(*it);
+      write(&attr, sizeof(attr));
+    }
+  }
+  write_filters(chunk.min_timestamp, chunk.max_timestamp);
+  _pending_records.clear();
+  _pending_record_bytes = 0;
+}
+
+void TraceFileEncoder::write_filters(uint64_t min_timestamp,
+                                     uint64_t max_timestamp) {
+  std::vector<uint64_t> traces, names;
+  for (const TraceRecord &record : _pending_records) {
+    const Tracelet &t = record.tracelet;
+    if (t.trace_id != kInvalidId)
+      traces.push_back(t.trace_id.value);
+    if (t.name_string_hash != 0 &&
+        (t.record_type == Tracelet::RecordType::SPAN_START ||
+         t.record_type == Tracelet::RecordType::EVENT))
+      names.push_back(t.name_string_hash);
+  }
+  auto build = [](std::vector<uint64_t> &keys) {
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    BloomFilter filter(keys.size() * kFilterBitsPerKey, kFilterHashes);
+    for (uint64_t key : keys)
+      filter.add(key);
+    return filter;
+  };
+  const BloomFilter trace_filter = build(traces);
+  const BloomFilter name_filter = build(names);
+
+  const ChunkFilterHeader header{
+      static_cast<uint32_t>(trace_filter.byte_size()),
+      static_cast<uint32_t>(name_filter.byte_size()), kFilterHashes, 0};
+  const ChunkHeader chunk{
+      ChunkType::FILTERS, 0,
+      sizeof(header) + trace_filter.byte_size() + name_filter.byte_size(),
+      min_timestamp, max_timestamp};
+  _index.back().filter_offset = _offset;
+  write(&chunk, sizeof(chunk));
+  write(&header, sizeof(header));
+  write(trace_filter.data(), trace_filter.byte_size());
+  write(name_filter.data(), name_filter.byte_size());
+}
+
+void TraceFileEncoder::write_index() {
+  ChunkIndexTrailer trailer{_offset, {}};
+  std::memcpy(trailer.magic, kChunkIndexMagic, sizeof(trailer.magic));
+  const ChunkHeader chunk{
+      ChunkType::CHUNK_INDEX, static_cast<uint32_t>(_index.size()),
+      _index.size() * sizeof(ChunkIndexEntry) + sizeof(trailer), 0, 0};
+  write(&chunk, sizeof(chunk));
+  write(_index.data(), _index.size() * sizeof(ChunkIndexEntry));
+  write(&trailer, sizeof(trailer));
+  _index.clear();
+}
+
+// --- TraceFileWriter ---
+
+TraceFileWriter::TraceFileWriter(Options options)
+    : _options(std::move(options)) {}
+
+void TraceFileWriter::on_start(const ProcessorContext &context) {
+  FileHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.header_size = sizeof(FileHeader);
+  header.process_tag = context.process_tag;
+  header.start_wall_ns = context.start_wall_ns;
+  header.rank = _options.rank;
+  _encoder = std::make_unique<TraceFileEncoder>(_options.path, header,
+                                                _options.chunk_bytes);
+}
+
+void TraceFileWriter::add_string(
+    uint64_t hash, const std::unordered_map<uint64_t, std::string> &strings) {
+  if (_encoder->has_string(hash))
+    return;
+  auto it = strings.find(hash);
+  if (it != strings.end())
+    _encoder->add_string(hash, it->second);
+}
+
+void TraceFileWriter::on_record(
+    const Tracelet &record,
+    const std::unordered_map<uint64_t, std::string> &strings) {
+  add_string(record.name_string_hash, strings);
+  for (auto it = record.attributes_begin(); it != record.attributes_end();
+       ++it) {
+    add_string(it->key_id, strings);
+    if (it->value.type == AttributeValue::Type::STRING_ID)
+      add_string(it->value.string_id, strings);
+  }
+  _encoder->add_record(record);
+}
+
+void TraceFileWriter::flush() {
+  if (_encoder)
+    _encoder->flush();
+}
+
+void TraceFileWriter::shutdown() {
+  if (_encoder)
+    _encoder->close();
+}
+
+} // namespace Waffle::trace_file
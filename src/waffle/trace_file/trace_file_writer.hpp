@@ -0,0 +1,105 @@
+#pragma once
+
+#include "waffle/processor/iprocessor.hpp"
+#include "waffle/trace_file/trace_file_format.hpp"
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace Waffle::trace_file {
+
+/**
+ * @brief Writes the chunks of a trace file.
+ *
+ * Records are buffered and written as one RECORDS chunk (sorted by timestamp)
+ * whenever the buffer reaches `chunk_bytes`, or on `flush()`. Strings are
+ * written on first use, in a STRINGS chunk that precedes the records
+ * referencing them.
+ *
+ * Each RECORDS chunk is followed by a FILTERS chunk with bloom filters of
+ * its trace ids and names, and `close()` ends the file with a CHUNK_INDEX
+ * of every chunk, for TraceFileLookup. Only the index entries (40 bytes per
+ * chunk) are kept in memory until then.
+ *
+ * @throw std::system_error If the file cannot be opened or written.
+ */
+class TraceFileEncoder {
+public:
+  static constexpr size_t kDefaultChunkBytes = 1 << 20;
+
+  TraceFileEncoder(const std::string &path, const FileHeader &header,
+                   size_t chunk_bytes = kDefaultChunkBytes);
+  // Writes to an open stream (e.g. from open_memstream) and closes it when
+  // done, also if the constructor throws. `name` is used in messages.
+  TraceFileEncoder(std::FILE *file, std::string name,
+                   const FileHeader &header,
+                   size_t chunk_bytes = kDefaultChunkBytes);
+  ~TraceFileEncoder();
+
+  TraceFileEncoder(const TraceFileEncoder &) = delete;
+  TraceFileEncoder &operator=(const TraceFileEncoder &) = delete;
+
+  // Registers a string; written before the next RECORDS chunk if it is new.
+  void add_string(uint64_t hash, std::string_view str);
+  bool has_string(uint64_t hash) const { return _written.count(hash) > 0; }
+
+  void add_record(const Tracelet &tracelet, uint16_t rank = 0);
+
+  // Writes any buffered strings and records.
+  void flush();
+  // Flushes and closes the file. Called by the destructor if needed.
+  void close();
+
+private:
+  void write(const void *data, size_t size);
+  void write_strings();
+  void write_records();
+  void write_filters(uint64_t min_timestamp, uint64_t max_timestamp);
+  void write_index();
+
+  std::FILE *_file = nullptr;
+  std::string _path;
+  size_t _chunk_bytes;
+  uint64_t _offset = 0; // Bytes written so far
+  std::vector<ChunkIndexEntry> _index;
+
+  std::unordered_set<uint64_t> _written;
+  std::vector<char> _pending_strings;
+  uint32_t _pending_string_count = 0;
+
+  std::vector<TraceRecord> _pending_records;
+  size_t _pending_record_bytes = 0;
+};
+
+/**
+ * @brief Processor that writes every record of this process to a trace file,
+ * for later merging (`waffle-merge`) or analysis.
+ */
+class TraceFileWriter : public IProcessor {
+public:
+  struct Options {
+    std::string path;
+    uint32_t rank = kNoRank; // e.g. the MPI rank
+    size_t chunk_bytes = TraceFileEncoder::kDefaultChunkBytes;
+  };
+
+  explicit TraceFileWriter(Options options);
+
+  void on_start(const ProcessorContext &context) override;
+  void on_record(const Tracelet &record,
+                 const std::unordered_map<uint64_t, std::string> &strings)
+      override;
+  void flush() override;
+  void shutdown() override;
+
+private:
+  void add_string(uint64_t hash,
+                  const std::unordered_map<uint64_t, std::string> &strings);
+
+  Options _options;
+  std::unique_ptr<TraceFileEncoder> _encoder;
+};
+
+} // namespace Waffle::trace_file
@@ -1,19 +1,28 @@
 #include "waffle/waffle_core.hpp"
+#include "waffle/control/overhead_controller.hpp"
+#include "waffle/processor/console_processor.hpp"
+#include <algorithm>
+#include <cmath>
 #include <cstring>
+#include <ctime>
 #include <iostream>
 #include <map>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
 #include <utility>
 #include <vector>
 
+#if defined(__linux__)
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 namespace Waffle {
 
 // --- Span Implementation ---
-Span::Span(Tracer *tracer, Id trace_id, Id span_id, Id parent_span_id)
-    : _tracer(tracer), _trace_id(trace_id), _span_id(span_id),
-      _parent_span_id(parent_span_id) {
-  context::set_current_span_id(_span_id);
-}
-
 Span::Span(Span &&other) noexcept
     : _tracer(other._tracer), _trace_id(other._trace_id),
       _span_id(other._span_id), _parent_span_id(other._parent_span_id),
@@ -24,9 +33,7 @@ Span::Span(Span &&other) noexcept
 
 Span &Span::operator=(Span &&other) noexcept {
   if (this != &other) {
-    if (!_is_ended && _tracer) {
-      end();
-    }
+    finish();
     _tracer = other._tracer;
     _trace_id = other._trace_id;
     _span_id = other._span_id;
@@ -38,136 +45,307 @@ Span &Span::operator=(Span &&other) noexcept {
   return *this;
 }
 
-Span::~Span() {
-  if (!_is_ended && _tracer) {
-    end();
+// --- Tracer Implementation ---
+namespace {
+// Epoch 0 is reserved for "never registered" in StaticStringSource.
+std::atomic<uint32_t> g_next_tracer_epoch{1};
+// Thread indices are never reused; 0 is kInvalidThreadIndex.
+std::atomic<uint32_t> g_next_thread_index{1};
+
+int64_t current_os_thread_id() {
+#if defined(__linux__)
+  return static_cast<int64_t>(syscall(SYS_gettid));
+#else
+  return 0;
+#endif
+}
+
+// Ids are only unique within a process unless they start from a random base:
+// the top 24 bits identify the process (with high probability), the low 40
+// bits count. This keeps span ids carried in a RemoteContext, and CausedBy
+// links between ranks, unambiguous when traces are merged.
+uint64_t random_id_base() {
+  std::random_device rd;
+  const uint64_t tag = (static_cast<uint64_t>(rd()) << 32 | rd()) >> 40;
+  return (tag << 40) | 1; // Never kInvalidId.
+}
+
+std::string current_thread_name() {
+#if defined(__linux__)
+  char name[16] = {}; // Linux limits thread names to 15 characters.
+  if (pthread_getname_np(pthread_self(), name, sizeof(name)) == 0)
+    return name;
+#endif
+  return {};
+}
+
+uint64_t thread_cpu_ns() {
+#if defined(__linux__)
+  timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+    return static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+#endif
+  return 0; // The CPU limit is never reached
+}
+} // namespace
+
+Tracer::Tracer(TracerOptions options)
+    : _epoch(g_next_tracer_epoch.fetch_add(1, std::memory_order_relaxed)),
+      _id_base(random_id_base()), _next_id(_id_base),
+      _drain_weights(options.drain_weights), _overhead(options.overhead),
+      _processors(std::move(options.processors)) {
+  _interned.insert(0);
+  _id_to_string_map[0] = ""; // ID 0 is the empty string
+  const size_t capacities[kPriorityCount] = {options.critical_ring_capacity,
+                                             options.ring_capacity,
+                                             options.bulk_ring_capacity};
+  for (size_t lane = 0; lane < kPriorityCount; ++lane)
+    _lanes[lane] = std::make_unique<Lane>(
+        capacities[lane],
+        options.per_cpu_rings ? Lane::configured_cpus() : size_t{1});
+
+  if (options.domains.size() > kMaxDomains)
+    throw std::invalid_argument("At most " + std::to_string(kMaxDomains) +
+                                " tracing domains");
+  for (size_t i = 0; i < options.domains.size(); ++i) {
+    const DomainOptions &o = options.domains[i];
+    DomainState &domain = _domains[i];
+    domain.name = o.name;
+    domain.quota = static_cast<int64_t>(o.ring_quota);
+    if (o.max_records_per_second > 0) {
+      domain.interval_ns =
+          std::max<uint64_t>(1'000'000'000 / o.max_records_per_second, 1);
+      const uint64_t burst =
+          std::max<uint64_t>(o.max_records_per_second / 10, 1);
+      domain.burst_ns = (burst - 1) * domain.interval_ns;
+    }
+    domain.limited = domain.quota > 0 || domain.interval_ns > 0;
   }
+  if (_processors.empty())
+    _processors.push_back(std::make_shared<ConsoleProcessor>(std::cout));
+
+  _processing_thread = std::thread([this]() { process_records(); });
 }
 
-void Span::end() {
-  if (_is_ended || !_tracer)
-    return;
-  _tracer->end_span(_trace_id, _span_id);
-  _is_ended = true;
-  context::set_current_span_id(_parent_span_id);
-}
-
-// --- Processor Thread Helpers ---
-struct ReadableSpanData {
-  uint64_t name_hash;
-  Id parent_id;
-  Id cause_id;
-  std::vector<Attribute> attributes;
-};
-
-void print_attribute(const std::string &key, const AttributeValue &val,
-                     const std::unordered_map<uint64_t, std::string> &id_map) {
-  std::cout << key << ": ";
-  switch (val.type) {
-  case AttributeValue::Type::BOOL:
-    std::cout << (val.b ? "true" : "false");
-    break;
-  case AttributeValue::Type::INT64:
-    std::cout << val.i64;
-    break;
-  case AttributeValue::Type::DOUBLE:
-    std::cout << val.f64;
-    break;
-  case AttributeValue::Type::STRING_ID:
-    std::cout << "'" << id_map.at(val.string_id) << "'";
-    break;
+void Tracer::process_records() {
+  using Clock = std::chrono::steady_clock;
+  constexpr size_t kBatchSize = 256;
+  constexpr auto kIdleFlushInterval = std::chrono::milliseconds(100);
+
+  // A processor that throws is disabled for the rest of this Tracer's life;
+  // an exception escaping this thread would terminate the application.
+  std::vector<char> failed(_processors.size(), 0);
+  auto guarded = [&](size_t p, auto &&call) {
+    if (failed[p])
+      return;
+    try {
+      call(*_processors[p]);
+    } catch (...) {
+      failed[p] = 1;
+      _processor_errors.fetch_add(1, std::memory_order_relaxed);
+    }
+  };
+
+  const ProcessorContext context{process_tag(), get_timestamp()};
+  for (size_t p = 0; p < _processors.size(); ++p)
+    guarded(p, [&](IProcessor &processor) { processor.on_start(context); });
+
+  // Overhead control: every interval, measure this thread and the ring and
+  // publish the controller's sampling probability.
+  std::optional<control::OverheadController> controller;
+  if (_overhead.enabled())
+    controller.emplace(_overhead);
+  auto last_control = Clock::now();
+  uint64_t last_cpu_ns = thread_cpu_ns();
+  uint64_t last_dropped = 0;
+  uint64_t newest_ts = 0; // Of the records processed this interval
+  auto control = [&](Clock::time_point now) {
+    const uint64_t cpu_ns = thread_cpu_ns();
+    const uint64_t dropped = dropped_records();
+    const double wall_ns =
+        std::chrono::duration<double, std::nano>(now - last_control).count();
+    control::OverheadSample sample;
+    sample.cpu = (cpu_ns - last_cpu_ns) / wall_ns;
+    // Span sampling cannot relieve the BULK lane; it has its own drops.
+    for (Priority p : {Priority::CRITICAL, Priority::NORMAL}) {
+      sample.ring_occupancy = std::max(
+          sample.ring_occupancy, _lanes[static_cast<size_t>(p)]->occupancy());
+    }
+    const uint64_t wall_now = get_timestamp();
+    sample.lag_ns = newest_ts != 0 && wall_now > newest_ts
+                        ? wall_now - newest_ts
+                        : 0;
+    for (size_t p = 0; p < _processors.size(); ++p)
+      guarded(p, [&](IProcessor &processor) {
+        sample.backlog += processor.backlog();
+      });
+    sample.drops = dropped - last_dropped;
+    set_sampling_probability(controller->update(sample));
+    last_control = now;
+    last_cpu_ns = cpu_ns;
+    last_dropped = dropped;
+    newest_ts = 0;
+  };
+
+  std::vector<Tracelet> batch(kBatchSize);
+  std::vector<std::pair<uint64_t, std::string>> new_strings;
+  auto last_flush = Clock::now();
+  bool dirty = false;
+  while (true) {
+    if (controller) {
+      const auto now = Clock::now();
+      if (now - last_control >= _overhead.interval)
+        control(now);
+    }
+    // Read the flag before draining: once it is set no producer emits, so an
+    // empty ring after that point means everything has been processed.
+    const bool stopping = _shutdown_flag.load(std::memory_order_acquire);
+    const size_t count = drain(batch.data(), kBatchSize);
+
+    if (count > 0) {
+      // A record's strings are interned before it is emitted, so they were
+      // queued before it was drained.
+      {
+        std::lock_guard<std::mutex> lock(_string_mutex);
+        new_strings.swap(_new_strings);
+      }
+      for (auto &[hash, str] : new_strings)
+        _id_to_string_map.emplace(hash, std::move(str));
+      new_strings.clear();
+      for (size_t i = 0; i < count; ++i)
+        for (size_t p = 0; p < _processors.size(); ++p)
+          guarded(p, [&](IProcessor &processor) {
+            processor.on_record(batch[i], _id_to_string_map);
+          });
+      newest_ts = batch[count - 1].timestamp;
+      dirty = true;
+      continue;
+    }
+    if (stopping)
+      break;
+    if (dirty && Clock::now() - last_flush >= kIdleFlushInterval) {
+      for (size_t p = 0; p < _processors.size(); ++p)
+        guarded(p, [](IProcessor &processor) { processor.flush(); });
+      last_flush = Clock::now();
+      dirty = false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  for (size_t p = 0; p < _processors.size(); ++p) {
+    guarded(p, [](IProcessor &processor) { processor.flush(); });
+    guarded(p, [](IProcessor &processor) { processor.shutdown(); });
   }
 }
 
-// --- Tracer Implementation ---
-Tracer::Tracer() {
-  _id_to_string_map[0] = ""; // ID 0 is the empty string
-  _queue = std::make_unique<MpscRingBuffer<Tracelet>>(8192);
-
-  _processing_thread = std::thread([this]() {
-    std::map<uint64_t, ReadableSpanData> active_spans;
-    Tracelet tracelet;
-    while (!_shutdown_flag.load(std::memory_order_acquire)) {
-      if (_queue->try_pop(tracelet)) {
-        auto get_name = [&](uint64_t hash) {
-          return _id_to_string_map.count(hash) ? _id_to_string_map.at(hash)
-                                               : "???";
-        };
-
-        switch (tracelet.record_type) {
-        case Tracelet::RecordType::SPAN_START: {
-          ReadableSpanData data;
-          data.name_hash = tracelet.name_string_hash;
-          data.parent_id = tracelet.parent_span_id;
-          data.cause_id = tracelet.cause_id;
-          data.attributes.assign(tracelet.attributes,
-                                 tracelet.attributes + tracelet.num_attributes);
-          active_spans[tracelet.span_id.value] = data;
-          break;
+size_t Tracer::drain(Tracelet *out, size_t max) {
+  bool pressed = false;
+  for (const auto &lane : _lanes)
+    pressed |= lane->occupancy() > 0.5;
+
+  size_t count = 0;
+  if (!pressed) {
+    // Merge the lanes by timestamp, so that e.g. a CRITICAL span end never
+    // overtakes its NORMAL span start. Picks the oldest head and keeps the
+    // runner-up's timestamp.
+    auto oldest = [this](bool &any_empty, uint64_t &runner_up) {
+      Lane *next = nullptr;
+      uint64_t next_ts = 0;
+      runner_up = UINT64_MAX;
+      for (const auto &lane : _lanes) {
+        const Tracelet *head = lane->front();
+        any_empty |= !head;
+        if (!head)
+          continue;
+        if (!next || head->timestamp < next_ts) {
+          runner_up = next ? next_ts : runner_up;
+          next = lane.get();
+          next_ts = head->timestamp;
+        } else if (head->timestamp < runner_up) {
+          runner_up = head->timestamp;
         }
-        case Tracelet::RecordType::SPAN_END: {
-          active_spans.erase(tracelet.span_id.value);
+      }
+      return next;
+    };
+    while (count < max) {
+      bool any_empty = false;
+      uint64_t runner_up;
+      Lane *next = oldest(any_empty, runner_up);
+      if (!next)
+        break;
+      // A thread publishes its records in timestamp order, so any older
+      // record of the same thread in a lane found empty was published
+      // before `next` was seen: a second look finds it.
+      Lane *const first = next;
+      const uint64_t scans = first->scans();
+      if (any_empty)
+        next = oldest(any_empty, runner_up);
+      if (!next || !next->try_pop(out[count]))
+        break;
+      release_domain(out[count++]);
+      // Pop a run while the head stays older than the other lanes' and the
+      // lane has not read its rings since the first look (so the head was
+      // visible to it), instead of looking at every lane per record.
+      if (next != first)
+        continue;
+      while (count < max) {
+        const Tracelet *head = next->front();
+        if (!head || next->scans() != scans || head->timestamp >= runner_up ||
+            !next->try_pop(out[count]))
           break;
-        }
-        case Tracelet::RecordType::EVENT: {
-          std::cout << "\n[Processor] EVENT '"
-                    << get_name(tracelet.name_string_hash) << "'\n";
-
-          // --- Implicit Causality Tracking Logic ---
-          Id effective_cause_id = tracelet.cause_id;
-          bool is_implicit_cause = false;
-          if (effective_cause_id.value == kInvalidId.value) {
-            // No explicit cause, so search up the parent chain.
-            Id current_id = tracelet.parent_span_id;
-            while (current_id.value != kInvalidId.value &&
-                   active_spans.count(current_id.value)) {
-              const auto &parent_span_data = active_spans.at(current_id.value);
-              if (parent_span_data.cause_id.value != kInvalidId.value) {
-                effective_cause_id = parent_span_data.cause_id;
-                is_implicit_cause = true;
-                break; // Found the first ancestor with a cause
-              }
-              current_id = parent_span_data.parent_id; // Go up one level
-            }
-          }
-
-          std::cout << "  { Causal Link: " << effective_cause_id.value
-                    << (is_implicit_cause ? " (Implicit)" : " (Explicit)")
-                    << ",\n";
-
-          std::cout << "    Event Attributes: { ";
-          for (uint8_t i = 0; i < tracelet.num_attributes; ++i) {
-            print_attribute(get_name(tracelet.attributes[i].key_id),
-                            tracelet.attributes[i].value, _id_to_string_map);
-            if (i < tracelet.num_attributes - 1)
-              std::cout << ", ";
-          }
-          std::cout << " },\n";
-
-          std::cout << "    Span Context: {\n";
-          Id current_span_id = tracelet.parent_span_id;
-          while (current_span_id.value != kInvalidId.value &&
-                 active_spans.count(current_span_id.value)) {
-            const auto &span_data = active_spans.at(current_span_id.value);
-            std::cout << "      '" << get_name(span_data.name_hash) << "': { ";
-            for (size_t i = 0; i < span_data.attributes.size(); ++i) {
-              print_attribute(get_name(span_data.attributes[i].key_id),
-                              span_data.attributes[i].value, _id_to_string_map);
-              if (i < span_data.attributes.size() - 1)
-                std::cout << ", ";
-            }
-            std::cout << " },\n";
-            current_span_id = span_data.parent_id;
-          }
-          std::cout << "    }\n  }\n";
+        release_domain(out[count++]);
+      }
+    }
+    return count;
+  }
+  // Behind: weighted rounds, CRITICAL first. Order across lanes is given up
+  // so that a flooded lane cannot delay the others' records into drops, but
+  // for one: a span end waits while another lane holds an older record, as
+  // its start may be that record or queued behind it. Having seen the end,
+  // its start is visible already, so one look at the other lanes suffices.
+  auto older_elsewhere = [this](size_t lane, uint64_t timestamp) {
+    for (size_t other = 0; other < kPriorityCount; ++other) {
+      if (other == lane)
+        continue;
+      const Tracelet *head = _lanes[other]->front();
+      if (head && head->timestamp < timestamp)
+        return true;
+    }
+    return false;
+  };
+  for (bool progress = true; progress && count < max;) {
+    progress = false;
+    for (size_t lane = 0; lane < kPriorityCount; ++lane) {
+      for (uint32_t i = 0; i < _drain_weights[lane] && count < max; ++i) {
+        const Tracelet *head = _lanes[lane]->front();
+        if (!head || (head->record_type == Tracelet::RecordType::SPAN_END &&
+                      older_elsewhere(lane, head->timestamp)))
           break;
-        }
-        }
-      } else {
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (!_lanes[lane]->try_pop(out[count]))
+          break;
+        release_domain(out[count++]);
+        progress = true;
       }
     }
-  });
+  }
+  return count;
+}
+
+void Tracer::release_domain(const Tracelet &record) {
+  DomainState &domain = _domains[domain_index(record.domain)];
+  if (domain.quota > 0 && record.record_type != Tracelet::RecordType::SPAN_END)
+    domain.in_ring.fetch_sub(1, std::memory_order_relaxed);
+}
+
+Tracer::DomainStats Tracer::domain_stats(Domain id) const {
+  const DomainState &domain = _domains[domain_index(id.id)];
+  DomainStats s;
+  s.in_ring = static_cast<size_t>(
+      std::max<int64_t>(domain.in_ring.load(std::memory_order_relaxed), 0));
+  s.dropped_quota = domain.dropped_quota.load(std::memory_order_relaxed);
+  s.dropped_rate = domain.dropped_rate.load(std::memory_order_relaxed);
+  s.dropped_full = domain.dropped_full.load(std::memory_order_relaxed);
+  return s;
 }
 
 Tracer::~Tracer() {
@@ -180,54 +358,73 @@ void Tracer::shutdown() {
     _processing_thread.join();
 }
 
-uint64_t Tracer::get_timestamp() {
-  return std::chrono::duration_cast<std::chrono::nanoseconds>(
-             std::chrono::system_clock::now().time_since_epoch())
-      .count();
+void Tracer::set_sampling_probability(double probability) {
+  const uint32_t threshold =
+      probability >= 1 ? kSampleAll
+      : probability > 0
+          ? static_cast<uint32_t>(std::ldexp(probability, 32))
+          : 0;
+  _sample_threshold.store(threshold, std::memory_order_relaxed);
 }
 
-void Tracer::register_static_string(uint64_t hash, const char *str) {
-  std::lock_guard<std::mutex> lock(_string_mutex);
-  _id_to_string_map.emplace(hash, str);
+double Tracer::sampling_probability() const {
+  const uint32_t threshold = _sample_threshold.load(std::memory_order_relaxed);
+  return threshold == kSampleAll ? 1.0 : std::ldexp(threshold, -32);
 }
 
-uint64_t Tracer::get_string_id(const StaticStringSource &s) {
-  register_static_string(s.hash, s.str);
-  return s.hash;
+void Tracer::register_static_string_slow(const StaticStringSource &s) {
+  {
+    std::lock_guard<std::mutex> lock(_string_mutex);
+    if (_interned.insert(s.hash).second)
+      _new_strings.emplace_back(s.hash, s.str);
+  }
+  s.registered_epoch.store(_epoch, std::memory_order_release);
 }
 
-uint64_t Tracer::get_string_id(std::string_view s) {
-  uint64_t hash = fnv1a_hash(s.data(), s.size());
-  std::lock_guard<std::mutex> lock(_string_mutex);
-  _id_to_string_map.emplace(hash, s);
-  return hash;
+uint16_t Tracer::register_thread() {
+  detail::ThreadState &state = detail::t_thread_state;
+  if (state.index == kInvalidThreadIndex) {
+    const uint32_t index =
+        g_next_thread_index.fetch_add(1, std::memory_order_relaxed);
+    state.index = index < kOverflowThreadIndex
+                      ? static_cast<uint16_t>(index)
+                      : kOverflowThreadIndex;
+  }
+  if (_shutdown_flag.load(std::memory_order_relaxed))
+    return state.index;
+
+  AttributeValue tid;
+  tid.type = AttributeValue::Type::INT64;
+  tid.i64 = current_os_thread_id();
+  const std::string name = current_thread_name();
+  // If the ring is full the epoch is left stale, so the announcement is
+  // retried with this thread's next record.
+  if (emit_from(state.index, kInvalidId, kInvalidId, kInvalidId, kInvalidId,
+                get_string_id(name), Tracelet::RecordType::THREAD_INFO,
+                Attribute{get_string_id(kThreadIdAttribute), tid})) {
+    state.epoch = _epoch;
+  }
+  return state.index;
 }
 
-void Tracer::end_span(Id trace_id, Id span_id) {
-  // For SPAN_END, parent_span_id in Tracelet context usually refers to the span
-  // that just ended, and its "parent" for context restoration is its original
-  // parent. However, the Tracelet structure has parent_span_id. For an END
-  // record, this might be kInvalidId or the span_id itself. The current call
-  // passes kInvalidId. The name_string_hash is 0 as SPAN_END doesn't have a
-  // name in the same way.
-  _queue->try_emplace(get_timestamp(), trace_id, span_id, kInvalidId,
-                      kInvalidId, 0, Tracelet::RecordType::SPAN_END);
+void Tracer::intern_string(uint64_t hash, std::string_view s) {
+  std::lock_guard<std::mutex> lock(_string_mutex);
+  if (_interned.insert(hash).second)
+    _new_strings.emplace_back(hash, s);
 }
 
-// --- Global Setup & Context ---
-void setup() {
+// --- Global Setup ---
+void setup() { setup(TracerOptions{}); }
+void setup(TracerOptions options) {
   if (!detail::g_tracer_instance)
-    detail::g_tracer_instance = std::make_unique<Tracer>();
+    detail::g_tracer_instance = std::make_unique<Tracer>(std::move(options));
+  detail::g_tracing_key.enable();
 }
 void shutdown() {
+  detail::g_tracing_key.disable();
   if (detail::g_tracer_instance) {
     detail::g_tracer_instance->shutdown();
     detail::g_tracer_instance.reset();
   }
 }
-namespace context {
-thread_local Id g_current_span_id = {kInvalidId};
-Id get_current_span_id() { return g_current_span_id; }
-void set_current_span_id(Id id) { g_current_span_id = id; }
-} // namespace context
 } // namespace Waffle
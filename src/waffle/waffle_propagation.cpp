@@ -0,0 +1,59 @@
+#include "waffle/waffle_propagation.hpp"
+#include "waffle/waffle_core.hpp"
+
+#include <charconv>
+#include <cstdio>
+
+namespace Waffle {
+
+namespace {
+constexpr size_t kFieldDigits = 16;
+constexpr size_t kFormattedSize = 2 * kFieldDigits + 1;
+
+std::optional<uint64_t> parse_field(std::string_view field) {
+  if (field.size() != kFieldDigits)
+    return std::nullopt;
+  uint64_t value = 0;
+  auto [end, ec] =
+      std::from_chars(field.data(), field.data() + field.size(), value, 16);
+  if (ec != std::errc() || end != field.data() + field.size())
+    return std::nullopt;
+  return value;
+}
+} // namespace
+
+std::string RemoteContext::format() const {
+  char buffer[kFormattedSize + 1];
+  std::snprintf(buffer, sizeof(buffer), "%016llx-%016llx",
+                static_cast<unsigned long long>(span_id.value),
+                static_cast<unsigned long long>(hlc));
+  return std::string(buffer, kFormattedSize);
+}
+
+std::optional<RemoteContext> RemoteContext::parse(std::string_view text) {
+  if (text.size() != kFormattedSize || text[kFieldDigits] != '-')
+    return std::nullopt;
+  auto span = parse_field(text.substr(0, kFieldDigits));
+  auto hlc = parse_field(text.substr(kFieldDigits + 1, kFieldDigits));
+  if (!span || !hlc)
+    return std::nullopt;
+  return RemoteContext{Id{*span}, *hlc};
+}
+
+RemoteContext inject_context() {
+  Id current = context::get_current_span_id();
+  if (current == kUnsampledId)
+    current = kInvalidId; // Not recorded: nothing to link to
+  RemoteContext ctx{current, 0};
+  if (detail::tracing_enabled())
+    ctx.hlc = detail::g_tracer_instance->hlc_now();
+  return ctx;
+}
+
+CausedBy extract_context(const RemoteContext &remote) {
+  if (detail::tracing_enabled())
+    detail::g_tracer_instance->merge_remote_clock(remote.hlc);
+  return CausedBy{remote.span_id};
+}
+
+} // namespace Waffle
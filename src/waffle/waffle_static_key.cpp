@@ -0,0 +1,128 @@
+#include "waffle/waffle_static_key.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+
+#if WAFFLE_HAVE_JUMP_LABEL_PATCHING
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Bounds of the patch-site table, provided by the linker for every section
+// whose name is a valid C identifier. Weak so that a binary without any site
+// still links; both are then null.
+extern "C" {
+extern const Waffle::detail::JumpEntry __start___waffle_jump_table[]
+    __attribute__((weak));
+extern const Waffle::detail::JumpEntry __stop___waffle_jump_table[]
+    __attribute__((weak));
+}
+#endif
+
+namespace Waffle {
+
+namespace {
+// Serializes toggles so that two keys sharing a text page never race on its
+// protection bits.
+std::mutex g_patch_mutex;
+
+#if WAFFLE_HAVE_JUMP_LABEL_PATCHING
+uintptr_t resolve(const int64_t &field) {
+  return reinterpret_cast<uintptr_t>(&field) + static_cast<uintptr_t>(field);
+}
+
+#if defined(__x86_64__)
+constexpr size_t kSiteSize = 5;
+constexpr uint8_t kNop5[kSiteSize] = {0x0f, 0x1f, 0x44, 0x00, 0x00};
+#else
+constexpr size_t kSiteSize = 4;
+constexpr uint32_t kNop = 0xd503201f;
+#endif
+
+void write_site(uint8_t *code, uintptr_t target, bool enable) {
+#if defined(__x86_64__)
+  uint8_t insn[kSiteSize];
+  if (enable) {
+    // jmp rel32, relative to the end of the instruction.
+    const auto rel = static_cast<int32_t>(
+        static_cast<intptr_t>(target) -
+        static_cast<intptr_t>(reinterpret_cast<uintptr_t>(code) + kSiteSize));
+    insn[0] = 0xe9;
+    std::memcpy(insn + 1, &rel, sizeof(rel));
+  } else {
+    std::memcpy(insn, kNop5, kSiteSize);
+  }
+  // Sites are 8-byte aligned (see static_branch_unlikely), so a single
+  // 8-byte store replaces the instruction and a concurrently executing
+  // thread sees either encoding, never a mix.
+  const auto addr = reinterpret_cast<uintptr_t>(code);
+  const uintptr_t word_addr = addr & ~uintptr_t{7};
+  auto *word = reinterpret_cast<uint64_t *>(word_addr);
+  uint64_t value = __atomic_load_n(word, __ATOMIC_RELAXED);
+  std::memcpy(reinterpret_cast<uint8_t *>(&value) + (addr - word_addr), insn,
+              kSiteSize);
+  __atomic_store_n(word, value, __ATOMIC_RELEASE);
+#else
+  uint32_t insn = kNop;
+  if (enable) {
+    // b <target>: imm26 holds the word offset from the branch itself.
+    const intptr_t offset =
+        static_cast<intptr_t>(target) -
+        static_cast<intptr_t>(reinterpret_cast<uintptr_t>(code));
+    insn = 0x14000000u | (static_cast<uint32_t>(offset >> 2) & 0x03ffffffu);
+  }
+  __atomic_store_n(reinterpret_cast<uint32_t *>(code), insn, __ATOMIC_RELEASE);
+#endif
+  __builtin___clear_cache(reinterpret_cast<char *>(code),
+                          reinterpret_cast<char *>(code + kSiteSize));
+}
+
+void patch_site(uintptr_t code, uintptr_t target, bool enable) {
+  if ((code & 7) + kSiteSize > 8) {
+    // Could only be rewritten non-atomically under running threads.
+    throw std::runtime_error("Waffle: static key site is not aligned");
+  }
+  const auto page_size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  const uintptr_t first_page = code & ~(page_size - 1);
+  const uintptr_t last_page = (code + kSiteSize - 1) & ~(page_size - 1);
+  const size_t length = last_page - first_page + page_size;
+  void *pages = reinterpret_cast<void *>(first_page);
+
+  if (mprotect(pages, length, PROT_READ | PROT_WRITE | PROT_EXEC) != 0) {
+    throw std::system_error(errno, std::generic_category(),
+                            "Waffle: cannot make text page writable");
+  }
+  write_site(reinterpret_cast<uint8_t *>(code), target, enable);
+  if (mprotect(pages, length, PROT_READ | PROT_EXEC) != 0) {
+    throw std::system_error(errno, std::generic_category(),
+                            "Waffle: cannot restore text page protection");
+  }
+}
+#endif
+} // namespace
+
+void StaticKey::enable() { set_enabled(true); }
+
+void StaticKey::disable() { set_enabled(false); }
+
+void StaticKey::set_enabled(bool enabled) {
+  std::lock_guard<std::mutex> lock(g_patch_mutex);
+  if (_enabled.load(std::memory_order_relaxed) == enabled) {
+    return;
+  }
+#if WAFFLE_HAVE_JUMP_LABEL_PATCHING
+  const auto self = reinterpret_cast<uintptr_t>(this);
+  for (const detail::JumpEntry *entry = __start___waffle_jump_table;
+       entry != __stop___waffle_jump_table; ++entry) {
+    if (resolve(entry->key) != self) {
+      continue;
+    }
+    patch_site(resolve(entry->code), resolve(entry->target), enabled);
+  }
+#endif
+  _enabled.store(enabled, std::memory_order_release);
+}
+
+} // namespace Waffle
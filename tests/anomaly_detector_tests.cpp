@@ -0,0 +1,182 @@
+#include <catch2/catch_all.hpp> // For Catch2 v3.x
+
+#include "waffle/model/duration_sketch.hpp"
+#include "waffle/processor/anomaly_detector.hpp"
+#include "waffle/waffle.hpp"
+
+#include "test_support.hpp"
+
+#include <mutex>
+#include <random>
+#include <thread>
+
+using namespace Waffle;
+using Waffle::model::DurationSketch;
+using test_support::hash_of;
+
+namespace {
+
+struct Feeder : test_support::Feeder<AnomalyDetector> {
+  using test_support::Feeder<AnomalyDetector>::Feeder;
+  uint64_t next_span = 1;
+
+  // Feeds one span and returns its id.
+  uint64_t span(std::string_view name, uint64_t start, uint64_t duration) {
+    const uint64_t id = next_span++;
+    sink.on_record(Tracelet(start, 0, Id{7}, Id{id}, Id{1000}, kInvalidId,
+                            intern(name), Tracelet::RecordType::SPAN_START, 1,
+                            0),
+                   strings);
+    sink.on_record(Tracelet(start + duration, 0, Id{7}, Id{id}, kInvalidId,
+                            kInvalidId, 0, Tracelet::RecordType::SPAN_END, 1,
+                            0),
+                   strings);
+    return id;
+  }
+};
+
+// Keeps the anomaly events the detector records through the tracer.
+class EventCollector : public IProcessor {
+public:
+  void on_record(const Tracelet &record,
+                 const std::unordered_map<uint64_t, std::string> &) override {
+    std::lock_guard<std::mutex> lock(mutex);
+    records.push_back(record);
+  }
+  std::mutex mutex;
+  std::vector<Tracelet> records;
+};
+
+} // namespace
+
+TEST_CASE("Duration sketch quantiles are within the relative accuracy",
+          "[anomaly][sketch]") {
+  DurationSketch sketch;
+  REQUIRE(sketch.quantile(0.5) == 0);
+  for (uint64_t v = 1; v <= 100'000; ++v)
+    sketch.add(v * 1000);
+  REQUIRE(sketch.count() == 100'000);
+  for (double q : {0.01, 0.5, 0.9, 0.99, 0.999}) {
+    const double exact = q * 99'999 * 1000 + 1000;
+    REQUIRE(std::abs(sketch.quantile(q) - exact) <=
+            exact * DurationSketch::kRelativeAccuracy + 1);
+  }
+  REQUIRE(DurationSketch::bucket_of(0) == 0);
+  REQUIRE(DurationSketch::bucket_of(~uint64_t{0}) ==
+          DurationSketch::kBuckets - 1);
+
+  DurationSketch other;
+  other.add(5);
+  other.merge(sketch);
+  REQUIRE(other.count() == 100'001);
+  REQUIRE(other.quantile(0) == DurationSketch::value_of(
+                                   DurationSketch::bucket_of(5)));
+  other.decay();
+  REQUIRE(other.count() <= 50'001);
+  REQUIRE(other.count() >= 50'000 - DurationSketch::kBuckets);
+  REQUIRE(std::abs(other.quantile(0.5) - 50e6) <= 50e6 * 0.03);
+}
+
+TEST_CASE("Anomaly detector reports spans beyond the learned tail",
+          "[anomaly]") {
+  std::vector<Anomaly> seen;
+  AnomalyDetector::Options options;
+  options.on_anomaly = [&](const Anomaly &a) { seen.push_back(a); };
+  AnomalyDetector detector(options);
+  Feeder f{detector};
+  std::mt19937_64 rng(42);
+  std::uniform_int_distribution<uint64_t> normal(90'000, 110'000);
+
+  // Nothing is judged while learning, however slow.
+  uint64_t t = 1'000'000'000;
+  f.span("op", t, 50'000'000);
+  for (int i = 0; i < 5000; ++i, t += 200'000)
+    f.span("op", t, normal(rng));
+  REQUIRE(seen.empty());
+  const uint64_t threshold = detector.threshold_ns(hash_of("op"));
+  REQUIRE(threshold >= 110'000);
+  REQUIRE(threshold <= 250'000);
+
+  const uint64_t slow = f.span("op", t, 2'000'000);
+  REQUIRE(seen.size() == 1);
+  REQUIRE(seen[0].span_id == Id{slow});
+  REQUIRE(seen[0].trace_id == Id{7});
+  REQUIRE(seen[0].parent_span_id == Id{1000});
+  REQUIRE(seen[0].name == "op");
+  REQUIRE(seen[0].duration_ns == 2'000'000);
+  REQUIRE(seen[0].threshold_ns == threshold);
+  REQUIRE(seen[0].baseline_ns > 90'000);
+  REQUIRE(seen[0].baseline_ns < 150'000);
+
+  // Within the cooldown: counted, not reported.
+  f.span("op", t + 3'000'000, 2'000'000);
+  REQUIRE(seen.size() == 1);
+  REQUIRE(detector.stats().suppressed == 1);
+  f.span("op", t + 2'000'000'000, 2'000'000);
+  REQUIRE(seen.size() == 2);
+  REQUIRE(detector.stats().anomalies == 2);
+  REQUIRE(detector.stats().spans == 5004);
+}
+
+TEST_CASE("Anomaly detector bounds the names it tracks", "[anomaly]") {
+  AnomalyDetector::Options options;
+  options.max_names = 1;
+  AnomalyDetector detector(options);
+  Feeder f{detector};
+  f.span("a", 1, 10);
+  f.span("b", 1, 10);
+  f.span("a", 1, 10);
+  REQUIRE(detector.stats().spans == 3);
+  REQUIRE(detector.stats().untracked_spans == 1);
+}
+
+TEST_CASE("Anomaly detector bounds the spans waiting for their end",
+          "[anomaly]") {
+  AnomalyDetector::Options options;
+  options.max_open_spans = 4;
+  AnomalyDetector detector(options);
+  const std::unordered_map<uint64_t, std::string> strings;
+  for (uint64_t id = 1; id <= 10; ++id) // Their ends were dropped
+    detector.on_record(Tracelet(id, 0, Id{7}, Id{id}, kInvalidId, kInvalidId,
+                                hash_of("a"), Tracelet::RecordType::SPAN_START,
+                                1, 0),
+                       strings);
+  REQUIRE(detector.stats().open_spans_evicted == 6);
+  Feeder f{detector};
+  f.span("a", 20, 10);
+  REQUIRE(detector.stats().spans == 1);
+}
+
+TEST_CASE("Anomaly events are recorded caused by the slow span",
+          "[anomaly]") {
+  auto collector = std::make_shared<EventCollector>();
+  AnomalyDetector::Options options;
+  options.cooldown = std::chrono::milliseconds(0);
+  auto detector = std::make_shared<AnomalyDetector>(options);
+  Waffle::setup({{detector, collector}, 1 << 14});
+  auto &tracer = *Waffle::detail::g_tracer_instance;
+
+  for (int i = 0; i < 2000; ++i) {
+    tracer.start_span("op", kInvalidId, kInvalidId).end();
+    if (i % 256 == 0) // Keeps the ring from overflowing
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  Span slow = tracer.start_span("op", kInvalidId, kInvalidId);
+  const Id slow_id = slow.id();
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  slow.end();
+
+  // The event is recorded on the flush after the ring runs empty.
+  bool found = false;
+  for (int i = 0; i < 200 && !found; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::lock_guard<std::mutex> lock(collector->mutex);
+    for (const Tracelet &r : collector->records)
+      found |= r.record_type == Tracelet::RecordType::EVENT &&
+               r.name_string_hash == hash_of("waffle.anomaly") &&
+               r.cause_id == slow_id && r.span_id == slow_id;
+  }
+  Waffle::shutdown();
+  REQUIRE(found);
+}
@@ -0,0 +1,196 @@
+#include <catch2/catch_all.hpp> // For Catch2 v3.x
+
+#include "waffle/exporter/arrow_span_exporter.hpp"
+
+#include "test_support.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+using namespace Waffle;
+using Waffle::exporter::ArrowSpanExporter;
+
+namespace {
+
+// Just enough FlatBuffers reading to walk the Message tables.
+struct FbTable {
+  const uint8_t *buf;
+  size_t pos;
+
+  // Offset of field `id` within the table, or 0 if absent.
+  uint16_t offset_of(int id) const {
+    int32_t soffset;
+    std::memcpy(&soffset, buf + pos, 4);
+    const uint8_t *vtable = buf + pos - soffset;
+    uint16_t vsize, off = 0;
+    std::memcpy(&vsize, vtable, 2);
+    if (4 + 2 * id < vsize)
+      std::memcpy(&off, vtable + 4 + 2 * id, 2);
+    return off;
+  }
+  template <typename T> T field(int id) const {
+    T v{};
+    if (const uint16_t off = offset_of(id))
+      std::memcpy(&v, buf + pos + off, sizeof(T));
+    return v;
+  }
+  FbTable child(int id) const {
+    const uint16_t off = offset_of(id);
+    uint32_t rel;
+    std::memcpy(&rel, buf + pos + off, 4);
+    return {buf, pos + off + rel};
+  }
+};
+
+struct StreamSummary {
+  int schemas = 0;
+  int dictionaries = 0;
+  int deltas = 0;
+  int64_t rows = 0;
+  bool clean_end = false;
+};
+
+StreamSummary summarize(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  const std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)),
+                                  std::istreambuf_iterator<char>());
+  StreamSummary s;
+  size_t at = 0;
+  while (at + 8 <= data.size()) {
+    uint32_t marker, length;
+    std::memcpy(&marker, &data[at], 4);
+    std::memcpy(&length, &data[at + 4], 4);
+    REQUIRE(marker == 0xFFFFFFFF);
+    at += 8;
+    if (length == 0) {
+      s.clean_end = at == data.size();
+      break;
+    }
+    REQUIRE(length % 8 == 0);
+    const uint8_t *meta = &data[at];
+    uint32_t root;
+    std::memcpy(&root, meta, 4);
+    const FbTable message{meta, root};
+    REQUIRE(message.field<int16_t>(0) == 4); // MetadataVersion V5
+    const int64_t body = message.field<int64_t>(3);
+    switch (message.field<uint8_t>(1)) {
+    case 1:
+      ++s.schemas;
+      break;
+    case 2:
+      ++s.dictionaries;
+      s.deltas += message.child(2).field<uint8_t>(2);
+      break;
+    case 3:
+      s.rows += message.child(2).field<int64_t>(0);
+      break;
+    default:
+      FAIL("unexpected message type");
+    }
+    at += length + static_cast<size_t>(body);
+    REQUIRE(body % 8 == 0);
+  }
+  return s;
+}
+
+struct Feeder : test_support::Feeder<ArrowSpanExporter> {
+  using test_support::Feeder<ArrowSpanExporter>::Feeder;
+  uint64_t next_id = 1;
+
+  void start_only(std::string_view name) { // Its end was dropped
+    const uint64_t id = next_id++;
+    sink.on_record(Tracelet(100 * id, 0, Id{1}, Id{id}, kInvalidId,
+                            kInvalidId, intern(name),
+                            Tracelet::RecordType::SPAN_START, 1, 0),
+                   strings);
+  }
+  template <typename... Attrs> void span(std::string_view name, Attrs... attrs) {
+    const uint64_t id = next_id++;
+    sink.on_record(Tracelet(100 * id, 0, Id{1}, Id{id}, kInvalidId,
+                            kInvalidId, intern(name),
+                            Tracelet::RecordType::SPAN_START, 1, 0, attrs...),
+                   strings);
+    sink.on_record(Tracelet(100 * id + 42, 0, Id{1}, Id{id}, kInvalidId,
+                            kInvalidId, intern(name),
+                            Tracelet::RecordType::SPAN_END, 1, 0),
+                   strings);
+  }
+};
+
+} // namespace
+
+TEST_CASE("Arrow exporter writes well-formed IPC streams", "[exporter][arrow]") {
+  const std::string prefix =
+      (std::filesystem::temp_directory_path() / "waffle_arrow_test").string();
+
+  SECTION("Batches with delta dictionaries") {
+    ArrowSpanExporter exporter({prefix, 10});
+    Feeder feed{exporter};
+    for (int i = 0; i < 25; ++i)
+      feed.span(i < 10 ? "a" : "b", feed.int_attr("rows", i));
+    exporter.shutdown();
+
+    REQUIRE(exporter.files().size() == 1);
+    const StreamSummary s = summarize(exporter.files()[0]);
+    REQUIRE(s.schemas == 1);
+    REQUIRE(s.rows == 25);
+    // The initial name dictionary, then one delta when "b" shows up.
+    REQUIRE(s.dictionaries == 2);
+    REQUIRE(s.deltas == 1);
+    REQUIRE(s.clean_end);
+  }
+
+  SECTION("A new attribute key after the schema starts a new file") {
+    ArrowSpanExporter exporter({prefix, 4});
+    Feeder feed{exporter};
+    for (int i = 0; i < 6; ++i)
+      feed.span("op", feed.int_attr("rows", i));
+    feed.span("op", feed.int_attr("bytes", 1));
+    feed.span("op");
+    exporter.shutdown();
+
+    REQUIRE(exporter.files().size() == 2);
+    REQUIRE(summarize(exporter.files()[0]).rows == 6);
+    const StreamSummary second = summarize(exporter.files()[1]);
+    REQUIRE(second.rows == 2);
+    REQUIRE(second.clean_end);
+  }
+
+  SECTION("Files rotate by size") {
+    ArrowSpanExporter exporter({prefix, 8, 1});
+    Feeder feed{exporter};
+    for (int i = 0; i < 24; ++i)
+      feed.span("op");
+    exporter.shutdown();
+
+    REQUIRE(exporter.files().size() == 3);
+    for (const auto &file : exporter.files()) {
+      const StreamSummary s = summarize(file);
+      REQUIRE(s.schemas == 1);
+      REQUIRE(s.rows == 8);
+      REQUIRE(s.dictionaries == 1); // Every file carries its own dictionary
+    }
+  }
+
+  SECTION("Spans that never end are evicted") {
+    ArrowSpanExporter::Options options{prefix};
+    options.max_open_spans = 4;
+    ArrowSpanExporter exporter(options);
+    Feeder feed{exporter};
+    for (int i = 0; i < 10; ++i)
+      feed.start_only("lost");
+    REQUIRE(exporter.stats().open_spans_evicted == 6);
+    feed.span("op");
+    exporter.shutdown();
+
+    REQUIRE(exporter.files().size() == 1);
+    REQUIRE(summarize(exporter.files()[0]).rows == 1);
+  }
+
+  for (const auto &entry : std::filesystem::directory_iterator(
+           std::filesystem::temp_directory_path()))
+    if (entry.path().filename().string().starts_with("waffle_arrow_test"))
+      std::filesystem::remove(entry.path());
+}
@@ -0,0 +1,141 @@
+#include <catch2/catch_all.hpp> // For Catch2 v3.x
+
+#include <waffle/helpers/broadcast_ring_buffer.hpp>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using Ring = BroadcastRingBuffer<long>;
+
+TEST_CASE("Broadcast ring delivers every item to every lossless reader",
+          "[broadcast]") {
+  Ring rb(4);
+  long val;
+  REQUIRE(rb.try_emplace(-1)); // Before anyone subscribed: nobody sees it
+  Ring::Reader fast = rb.subscribe(Ring::ReaderMode::LOSSLESS);
+  Ring::Reader slow = rb.subscribe(Ring::ReaderMode::LOSSLESS);
+  REQUIRE_FALSE(fast.try_read(val));
+
+  for (long i = 0; i < 4; ++i)
+    REQUIRE(rb.try_emplace(i));
+  for (long i = 0; i < 4; ++i) {
+    REQUIRE(fast.try_read(val));
+    REQUIRE(val == i);
+  }
+  // The slow reader holds all four slots.
+  REQUIRE_FALSE(rb.try_emplace(4));
+  REQUIRE(slow.available() == 4);
+  REQUIRE(slow.try_read(val));
+  REQUIRE(val == 0);
+  REQUIRE(rb.try_emplace(4));
+  REQUIRE_FALSE(rb.try_emplace(5));
+
+  // Unsubscribing releases its slots.
+  slow = Ring::Reader();
+  REQUIRE_FALSE(slow);
+  REQUIRE(fast.try_read(val));
+  REQUIRE(val == 4);
+  for (long i = 5; i < 9; ++i)
+    REQUIRE(rb.try_emplace(i));
+  REQUIRE_FALSE(rb.try_emplace(9));
+  for (long i = 5; i < 9; ++i) {
+    REQUIRE(fast.try_read(val));
+    REQUIRE(val == i);
+  }
+  REQUIRE(fast.skipped() == 0);
+
+  std::vector<Ring::Reader> more;
+  for (size_t i = 1; i < Ring::kMaxReaders; ++i)
+    more.push_back(rb.subscribe(Ring::ReaderMode::LOSSY));
+  REQUIRE_THROWS_AS(rb.subscribe(Ring::ReaderMode::LOSSY),
+                    std::runtime_error);
+}
+
+TEST_CASE("Lossy readers fall behind without holding producers",
+          "[broadcast]") {
+  Ring rb(8);
+  long val;
+  Ring::Reader lossy = rb.subscribe(Ring::ReaderMode::LOSSY);
+  for (long i = 0; i < 20; ++i)
+    REQUIRE(rb.try_emplace(i)); // Overwrites: no lossless reader
+  // Tickets 0..11 are gone; the reader resumes at the oldest one left.
+  for (long i = 12; i < 20; ++i) {
+    REQUIRE(lossy.try_read(val));
+    REQUIRE(val == i);
+  }
+  REQUIRE(lossy.skipped() == 12);
+  REQUIRE_FALSE(lossy.try_read(val));
+
+  // Next to a lossless reader, the lossy one can only lose what the
+  // lossless one has read.
+  Ring::Reader lossless = rb.subscribe(Ring::ReaderMode::LOSSLESS);
+  for (long i = 20; i < 28; ++i)
+    REQUIRE(rb.try_emplace(i));
+  REQUIRE_FALSE(rb.try_emplace(28));
+  for (long i = 20; i < 28; ++i) {
+    REQUIRE(lossless.try_read(val));
+    REQUIRE(val == i);
+  }
+  REQUIRE(rb.try_emplace(28));
+  REQUIRE(lossy.try_read(val));
+  REQUIRE(val == 21);
+  REQUIRE(lossy.skipped() == 13);
+}
+
+TEST_CASE("Broadcast ring under concurrent producers and readers",
+          "[broadcast][threaded]") {
+  constexpr int kProducers = 3;
+  constexpr long kItems = 20'000; // Per producer
+  Ring rb(64);
+  std::vector<Ring::Reader> readers;
+  readers.push_back(rb.subscribe(Ring::ReaderMode::LOSSLESS));
+  readers.push_back(rb.subscribe(Ring::ReaderMode::LOSSLESS));
+  readers.push_back(rb.subscribe(Ring::ReaderMode::LOSSY));
+
+  std::atomic<int> producing{kProducers};
+  std::vector<std::thread> threads;
+  for (int p = 0; p < kProducers; ++p) {
+    threads.emplace_back([&, p] {
+      for (long i = 0; i < kItems; ++i) {
+        while (!rb.try_emplace(static_cast<long>(p) << 32 | i))
+          std::this_thread::yield();
+      }
+      producing.fetch_sub(1);
+    });
+  }
+
+  // Per reader: items seen, and whether each producer's items arrived in
+  // order.
+  std::vector<long> seen(readers.size());
+  std::vector<int> in_order(readers.size(), 1);
+  for (size_t r = 0; r < readers.size(); ++r) {
+    threads.emplace_back([&, r] {
+      std::vector<long> next(kProducers, 0);
+      Ring::Reader &reader = readers[r];
+      long val;
+      while (producing.load() > 0 || reader.available() > 0) {
+        if (!reader.try_read(val)) {
+          std::this_thread::yield();
+          continue;
+        }
+        const int p = static_cast<int>(val >> 32);
+        const long i = val & 0xFFFFFFFF;
+        if (i < next[p])
+          in_order[r] = 0;
+        next[p] = i + 1;
+        ++seen[r];
+      }
+    });
+  }
+  for (auto &t : threads)
+    t.join();
+
+  REQUIRE(in_order == std::vector<int>(readers.size(), 1));
+  REQUIRE(seen[0] == kProducers * kItems);
+  REQUIRE(seen[1] == kProducers * kItems);
+  REQUIRE(seen[2] + static_cast<long>(readers[2].skipped()) ==
+          kProducers * kItems);
+  REQUIRE(readers[0].skipped() == 0);
+  REQUIRE(rb.lapped() == 0);
+}
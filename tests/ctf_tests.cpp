@@ -0,0 +1,221 @@
+#include <catch2/catch_all.hpp> // For Catch2 v3.x
+
+#include "waffle/exporter/ctf_writer.hpp"
+
+#include "test_support.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <regex>
+#include <sstream>
+
+using namespace Waffle;
+using Waffle::exporter::CtfWriter;
+
+namespace {
+
+std::string slurp(const std::filesystem::path &path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(in)),
+                     std::istreambuf_iterator<char>());
+}
+
+struct EventClass {
+  std::string name;
+  std::vector<std::pair<std::string, std::string>> fields; // (type, name)
+};
+
+// Reads the event declarations of the TSDL metadata.
+std::map<uint32_t, EventClass> parse_metadata(const std::string &tsdl) {
+  std::map<uint32_t, EventClass> classes;
+  const std::regex event(
+      R"re(event \{\n\tname = "([^"]*)";\n\tid = (\d+);\n\tstream_id = 0;\n)re"
+      R"re(\tfields := struct \{\n((?:\t\t\w+ \w+;\n)*)\t\};\n\};)re");
+  const std::regex field(R"(\t\t(\w+) (\w+);\n)");
+  for (std::sregex_iterator it(tsdl.begin(), tsdl.end(), event), end;
+       it != end; ++it) {
+    EventClass c{(*it)[1], {}};
+    const std::string body = (*it)[3];
+    for (std::sregex_iterator f(body.begin(), body.end(), field); f != end;
+         ++f)
+      c.fields.emplace_back((*f)[1], (*f)[2]);
+    classes[std::stoul((*it)[2])] = std::move(c);
+  }
+  return classes;
+}
+
+struct Event {
+  std::string name;
+  uint64_t timestamp;
+  uint16_t cpu;
+  std::map<std::string, int64_t> numbers;
+  std::map<std::string, std::string> texts;
+};
+
+struct Packet {
+  uint64_t begin, end;
+  int64_t tid;
+  uint16_t rank, thread_index;
+  std::vector<Event> events;
+};
+
+// Decodes a stream as a CTF reader would, from the metadata's field types.
+std::vector<Packet> decode(const std::string &data,
+                           const std::map<uint32_t, EventClass> &classes) {
+  std::vector<Packet> packets;
+  size_t at = 0;
+  auto read = [&](size_t offset, auto &value) {
+    std::memcpy(&value, &data[offset], sizeof(value));
+  };
+  while (at < data.size()) {
+    uint32_t magic;
+    uint64_t content_bits, packet_bits;
+    read(at, magic);
+    REQUIRE(magic == 0xC1FC1FC1);
+    Packet p;
+    read(at + 24, p.begin);
+    read(at + 32, p.end);
+    read(at + 40, content_bits);
+    read(at + 48, packet_bits);
+    read(at + 56, p.tid);
+    read(at + 64, p.rank);
+    read(at + 66, p.thread_index);
+    const size_t end = at + content_bits / 8;
+    REQUIRE(end <= data.size());
+    size_t pos = at + 72;
+    while (pos < end) {
+      pos = (pos + 7) & ~size_t{7};
+      Event e;
+      uint32_t id;
+      read(pos, e.timestamp);
+      read(pos + 8, id);
+      read(pos + 12, e.cpu);
+      pos += 14;
+      const EventClass &c = classes.at(id);
+      e.name = c.name;
+      for (const auto &[type, name] : c.fields) {
+        if (type == "string") {
+          e.texts[name] = std::string(&data[pos]);
+          pos += e.texts[name].size() + 1;
+        } else if (type == "uint8_t") {
+          e.numbers[name] = static_cast<uint8_t>(data[pos++]);
+        } else {
+          pos = (pos + 7) & ~size_t{7};
+          int64_t v;
+          read(pos, v);
+          if (type == "double") {
+            double d;
+            read(pos, d);
+            v = static_cast<int64_t>(d * 1000);
+          }
+          e.numbers[name] = v;
+          pos += 8;
+        }
+      }
+      p.events.push_back(std::move(e));
+    }
+    REQUIRE(((pos + 7) & ~size_t{7}) == end);
+    packets.push_back(std::move(p));
+    at += packet_bits / 8;
+  }
+  return packets;
+}
+
+struct Feeder : test_support::Feeder<CtfWriter> {
+  using test_support::Feeder<CtfWriter>::Feeder;
+
+  template <typename... Attrs>
+  void record(Tracelet::RecordType type, uint64_t ts, uint64_t span,
+              std::string_view name, uint16_t thread, Attrs... attrs) {
+    sink.write({Tracelet(ts, 7, Id{1}, Id{span}, Id{span / 2}, kInvalidId,
+                         intern(name), type, thread, 3, attrs...),
+                0},
+               strings);
+  }
+};
+
+} // namespace
+
+TEST_CASE("CTF writer emits metadata matching its streams", "[exporter][ctf]") {
+  const auto dir = std::filesystem::temp_directory_path() / "waffle_ctf_test";
+  std::filesystem::remove_all(dir);
+  using RT = Tracelet::RecordType;
+
+  {
+    CtfWriter::Options options;
+    options.packet_bytes = 512; // Several packets per stream
+    CtfWriter writer(dir.string(), options);
+    Feeder f{writer};
+    f.record(RT::THREAD_INFO, 1, 0, "worker", 1,
+             f.int_attr(kThreadIdAttribute, 4242));
+    for (uint64_t i = 1; i <= 20; ++i) {
+      // Text and bool first: the layout puts 8-byte values first anyway.
+      f.record(RT::SPAN_START, 100 * i, i, "query", 1,
+               f.string_attr("table", i % 2 ? "orders" : "users"),
+               f.bool_attr("cached", i % 3 == 0), f.int_attr("rows", i),
+               f.double_attr("ratio", 0.5), f.int_attr("struct", -1));
+      f.record(RT::SPAN_END, 100 * i + 50, i, "", 1);
+    }
+    f.record(RT::EVENT, 5000, 99, "net.retry", 2);
+    REQUIRE(writer.event_class_count() == 4);
+  }
+
+  const std::string tsdl = slurp(dir / "metadata");
+  REQUIRE(tsdl.starts_with("/* CTF 1.8 */"));
+  REQUIRE(tsdl.find("map = clock.monotonic.value;") != std::string::npos);
+  const auto classes = parse_metadata(tsdl);
+  REQUIRE(classes.size() == 4);
+
+  const auto query = std::find_if(classes.begin(), classes.end(),
+                                  [](const auto &c) {
+                                    return c.second.name == "span_start:query";
+                                  });
+  REQUIRE(query != classes.end());
+  std::vector<std::string> names;
+  for (const auto &[type, name] : query->second.fields)
+    names.push_back(type + " " + name);
+  REQUIRE(names == std::vector<std::string>{
+                       "uint64_t hlc", "uint64_t trace_id", "uint64_t span_id",
+                       "uint64_t parent_span_id", "uint64_t cause_id",
+                       "int64_t rows", "double ratio", "int64_t struct_",
+                       "uint8_t cached", "string table"});
+
+  const auto packets = decode(slurp(dir / "stream_0_1"), classes);
+  REQUIRE(packets.size() > 2);
+  std::vector<Event> events;
+  for (const Packet &p : packets) {
+    REQUIRE(p.tid == 4242);
+    REQUIRE(p.thread_index == 1);
+    REQUIRE(p.begin == p.events.front().timestamp);
+    REQUIRE(p.end == p.events.back().timestamp);
+    events.insert(events.end(), p.events.begin(), p.events.end());
+  }
+  REQUIRE(events.size() == 41);
+  REQUIRE(events[0].name == "thread_info");
+  REQUIRE(events[0].texts.at("name") == "worker");
+  REQUIRE(events[0].numbers.at("thread_id") == 4242);
+
+  const Event &start = events[5]; // Span 3
+  REQUIRE(start.name == "span_start:query");
+  REQUIRE(start.timestamp == 300);
+  REQUIRE(start.cpu == 3);
+  REQUIRE(start.numbers.at("hlc") == 7);
+  REQUIRE(start.numbers.at("span_id") == 3);
+  REQUIRE(start.numbers.at("parent_span_id") == 1);
+  REQUIRE(start.numbers.at("rows") == 3);
+  REQUIRE(start.numbers.at("ratio") == 500);
+  REQUIRE(start.numbers.at("struct_") == -1);
+  REQUIRE(start.numbers.at("cached") == 1);
+  REQUIRE(start.texts.at("table") == "orders");
+  REQUIRE(events[6].name == "span_end");
+  REQUIRE(events[6].numbers.at("span_id") == 3);
+
+  const auto other = decode(slurp(dir / "stream_0_2"), classes);
+  REQUIRE(other.size() == 1);
+  REQUIRE(other[0].events.at(0).name == "event:net.retry");
+
+  std::filesystem::remove_all(dir);
+}
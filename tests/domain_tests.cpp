@@ -0,0 +1,161 @@
+#include <catch2/catch_all.hpp> // For Catch2 v3.x
+
+#include "waffle/processor/iprocessor.hpp"
+#include "waffle/waffle.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+using namespace Waffle;
+
+namespace {
+
+constexpr Domain kNoisy{1};
+constexpr Domain kQuiet{2};
+
+// Keeps every record; after hold(), blocks on the next one until released.
+class GatedCollector : public IProcessor {
+public:
+  void on_record(const Tracelet &record,
+                 const std::unordered_map<uint64_t, std::string> &) override {
+    std::unique_lock<std::mutex> lock(mutex);
+    _blocked = !_open;
+    _released.wait(lock, [this] { return _open; });
+    _blocked = false;
+    records.push_back(record);
+  }
+
+  void hold() {
+    std::lock_guard<std::mutex> lock(mutex);
+    _open = false;
+  }
+  bool blocked() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return _blocked;
+  }
+  void release() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      _open = true;
+    }
+    _released.notify_all();
+  }
+  size_t count(Domain domain, Tracelet::RecordType type) {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t n = 0;
+    for (const Tracelet &r : records)
+      n += r.domain == domain.id && r.record_type == type;
+    return n;
+  }
+
+  std::mutex mutex;
+  std::vector<Tracelet> records;
+
+private:
+  std::condition_variable _released;
+  bool _open = true;
+  bool _blocked = false;
+};
+
+} // namespace
+
+TEST_CASE("A domain over its ring quota drops only its own records",
+          "[domains]") {
+  auto collector = std::make_shared<GatedCollector>();
+  TracerOptions options{{collector}, 1024};
+  options.domains = {{"default"}, {"noisy", 100}, {"quiet", 100}};
+  Waffle::setup(options);
+  auto &tracer = *Waffle::detail::g_tracer_instance;
+  REQUIRE(tracer.domain_name(kQuiet) == "quiet");
+  static constinit StaticStringSource tick("tick", 4);
+
+  // Let this thread's first records through while the processor runs.
+  tracer.create_event(tick, kInvalidId, kInvalidId, kNoisy);
+  tracer.start_span("op", kInvalidId, kInvalidId, kQuiet).end();
+  while (collector->count(kQuiet, Tracelet::RecordType::SPAN_START) == 0)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  collector->hold();
+  tracer.create_event(tick, kInvalidId, kInvalidId);
+  while (!collector->blocked())
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  // The processing thread is stuck from here on, so nothing is returned to
+  // the quotas.
+  for (int i = 0; i < 1000; ++i)
+    tracer.create_event(tick, kInvalidId, kInvalidId, kNoisy);
+  const auto noisy = tracer.domain_stats(kNoisy);
+  REQUIRE(noisy.in_ring == 100);
+  REQUIRE(noisy.dropped_quota == 900);
+  REQUIRE(noisy.dropped_full == 0);
+  // Over quota, a span is not recorded at all.
+  Span dropped = tracer.start_span("op", kInvalidId, kInvalidId, kNoisy);
+  REQUIRE(dropped.id() == kUnsampledId);
+  dropped.end();
+  REQUIRE(tracer.domain_stats(kNoisy).dropped_quota == 901);
+
+  std::vector<Span> quiet;
+  for (int i = 0; i < 50; ++i)
+    quiet.push_back(tracer.start_span("op", kInvalidId, kInvalidId, kQuiet));
+  for (auto &span : quiet)
+    span.end();
+  const auto calm = tracer.domain_stats(kQuiet);
+  REQUIRE(calm.dropped_quota == 0);
+  REQUIRE(calm.in_ring == 50); // Span ends are not counted
+  REQUIRE(tracer.dropped_records() == 0);
+
+  collector->release();
+  for (int i = 0; i < 500 && tracer.domain_stats(kNoisy).in_ring > 0; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  REQUIRE(tracer.domain_stats(kNoisy).in_ring == 0);
+  REQUIRE(tracer.domain_stats(kQuiet).in_ring == 0);
+  Waffle::shutdown();
+
+  REQUIRE(collector->count(kNoisy, Tracelet::RecordType::EVENT) == 101);
+  REQUIRE(collector->count(kQuiet, Tracelet::RecordType::SPAN_START) == 51);
+  // Ends carry no arguments and so no domain.
+  REQUIRE(collector->count(kDefaultDomain, Tracelet::RecordType::SPAN_END) ==
+          51);
+}
+
+TEST_CASE("A domain's record rate is limited", "[domains]") {
+  auto collector = std::make_shared<GatedCollector>();
+  TracerOptions options{{collector}, 1 << 14};
+  options.domains.resize(2);
+  options.domains[1].max_records_per_second = 1000; // Bursts of 100
+  Waffle::setup(options);
+  auto &tracer = *Waffle::detail::g_tracer_instance;
+  static constinit StaticStringSource tick("tick", 4);
+
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < 10'000; ++i) {
+    tracer.create_event(tick, kInvalidId, kInvalidId, kNoisy);
+    tracer.create_event(tick, kInvalidId, kInvalidId, kQuiet); // Unlimited
+  }
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  Waffle::shutdown();
+
+  const size_t noisy = collector->count(kNoisy, Tracelet::RecordType::EVENT);
+  REQUIRE(noisy >= 100);
+  REQUIRE(noisy <= 101 + static_cast<size_t>(seconds * 1000));
+  REQUIRE(collector->count(kQuiet, Tracelet::RecordType::EVENT) == 10'000);
+  REQUIRE(tracer.domain_stats(kQuiet).dropped_rate == 0);
+}
+
+TEST_CASE("WAFFLE_DOMAIN assigns a default domain to sites", "[domains]") {
+  auto collector = std::make_shared<GatedCollector>();
+  Waffle::setup({{collector}});
+  {
+#undef WAFFLE_DOMAIN
+#define WAFFLE_DOMAIN kQuiet
+    WAFFLE_SPAN("in_quiet");
+    WAFFLE_EVENT("explicit", kNoisy);
+#undef WAFFLE_DOMAIN
+#define WAFFLE_DOMAIN Waffle::kDefaultDomain
+  }
+  Waffle::shutdown();
+  REQUIRE(collector->count(kQuiet, Tracelet::RecordType::SPAN_START) == 1);
+  REQUIRE(collector->count(kNoisy, Tracelet::RecordType::EVENT) == 1);
+}
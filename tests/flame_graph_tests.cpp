@@ -0,0 +1,113 @@
+#include <catch2/catch_all.hpp> // For Catch2 v3.x
+
+#include "waffle/profile/flame_graph.hpp"
+
+#include "test_support.hpp"
+
+#include <sstream>
+
+using namespace Waffle;
+using Waffle::profile::FlameGraph;
+
+namespace {
+
+struct Trace : test_support::Feeder<FlameGraph> {
+  using test_support::Feeder<FlameGraph>::Feeder;
+
+  void start(uint64_t id, uint64_t parent, std::string_view name,
+             uint64_t ts) {
+    sink.add(Tracelet(ts, 0, Id{1}, Id{id}, Id{parent}, kInvalidId,
+                      intern(name), Tracelet::RecordType::SPAN_START, 1, 0),
+             strings);
+  }
+  void end(uint64_t id, uint64_t ts) {
+    sink.add(Tracelet(ts, 0, Id{1}, Id{id}, kInvalidId, kInvalidId, 0,
+                      Tracelet::RecordType::SPAN_END, 1, 0),
+             strings);
+  }
+};
+
+std::string folded(const FlameGraph &graph) {
+  std::ostringstream out;
+  graph.write_folded(out);
+  return out.str();
+}
+
+} // namespace
+
+TEST_CASE("Flame graphs fold span trees by self time", "[flame]") {
+  FlameGraph graph;
+  Trace t{graph};
+
+  // step [0, 100): load [10, 30), compute [30, 90) with load [40, 50)
+  t.start(1, 0, "step", 0);
+  t.start(2, 1, "load", 10);
+  t.end(2, 30);
+  t.start(3, 1, "compute", 30);
+  t.start(4, 3, "load", 40);
+  t.end(4, 50);
+  t.end(3, 90);
+  t.end(1, 100);
+  // A second step reuses the same stacks.
+  t.start(5, 0, "step", 200);
+  t.start(6, 5, "load", 200);
+  t.end(6, 205);
+  t.end(5, 210);
+
+  REQUIRE(folded(graph) == "step 25\n"
+                           "step;load 25\n"
+                           "step;compute 50\n"
+                           "step;compute;load 10\n");
+  REQUIRE(graph.total_ns() == 110);
+  REQUIRE(graph.node_count() == 5); // Root + four stacks
+
+  std::ostringstream speedscope;
+  graph.write_speedscope(speedscope, "test");
+  const std::string json = speedscope.str();
+  REQUIRE(json.find("\"unit\":\"nanoseconds\"") != std::string::npos);
+  REQUIRE(json.find("\"weights\":[25,25,50,10]") != std::string::npos);
+}
+
+TEST_CASE("Flame graphs stay within their node budget", "[flame]") {
+  FlameGraph graph(4); // Root + three stacks
+  Trace t{graph};
+  t.start(1, 0, "root", 0);
+  for (uint64_t i = 0; i < 10; ++i) {
+    t.start(10 + i, 1, "child_" + std::to_string(i), 10 * i);
+    t.end(10 + i, 10 * i + 5);
+  }
+  t.end(1, 100);
+
+  REQUIRE(graph.node_count() <= 8);
+  const std::string out = folded(graph);
+  REQUIRE(out.find("root;child_0 5\n") != std::string::npos);
+  REQUIRE(out.find("root;[truncated] 40\n") != std::string::npos);
+  REQUIRE(graph.total_ns() == 100);
+}
+
+TEST_CASE("Flame graphs intern no names beyond their node budget",
+          "[flame]") {
+  FlameGraph graph(4);
+  Trace t{graph};
+  t.start(1, 0, "root", 0);
+  for (uint64_t i = 0; i < 100; ++i) {
+    t.start(10 + i, 1, "child_" + std::to_string(i), i);
+    t.end(10 + i, i + 1);
+  }
+  t.end(1, 200);
+
+  // "[truncated]", "root" and the first two children.
+  REQUIRE(graph.frame_count() == 4);
+  REQUIRE(folded(graph).find("root;[truncated] 98\n") != std::string::npos);
+}
+
+TEST_CASE("Flame graphs bound the spans waiting for their end", "[flame]") {
+  FlameGraph graph(FlameGraph::kDefaultMaxNodes, 4);
+  Trace t{graph};
+  for (uint64_t id = 1; id <= 10; ++id) // Their ends were dropped
+    t.start(id, 0, "a", id);
+  REQUIRE(graph.open_spans_evicted() == 6);
+  t.start(20, 0, "a", 20);
+  t.end(20, 30);
+  REQUIRE(folded(graph) == "a 10\n");
+}
@@ -0,0 +1,214 @@
+#include <catch2/catch_all.hpp> // For Catch2 v3.x
+
+#include "waffle/exporter/fxt_writer.hpp"
+
+#include "test_support.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+
+using namespace Waffle;
+using Waffle::exporter::FxtWriter;
+
+namespace {
+
+struct Event {
+  unsigned type;
+  std::string name;
+  uint64_t tid;
+  uint64_t timestamp;
+  std::map<std::string, int64_t> args; // Integer-valued arguments
+  uint64_t trailer = 0;
+};
+
+// Decodes the records this writer produces, resolving string and thread
+// refs as a reader would: against the table state at that point in the file.
+struct Decoded {
+  std::vector<Event> events;
+  std::map<uint64_t, std::string> thread_names; // koid -> name
+  uint64_t ticks_per_second = 0;
+};
+
+Decoded decode(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  const std::string bytes((std::istreambuf_iterator<char>(in)),
+                          std::istreambuf_iterator<char>());
+  REQUIRE(bytes.size() % 8 == 0);
+  std::vector<uint64_t> words(bytes.size() / 8);
+  std::memcpy(words.data(), bytes.data(), bytes.size());
+  REQUIRE(words.at(0) == 0x0016547846040010); // Magic number record
+
+  Decoded out;
+  std::map<uint16_t, std::string> strings{{0, ""}};
+  std::map<uint8_t, uint64_t> threads;
+  auto str = [&](uint64_t ref) {
+    REQUIRE(strings.count(static_cast<uint16_t>(ref)));
+    return strings[static_cast<uint16_t>(ref)];
+  };
+  size_t at = 1;
+  while (at < words.size()) {
+    const uint64_t h = words[at];
+    const size_t size = (h >> 4) & 0xFFF;
+    REQUIRE(size > 0);
+    REQUIRE(at + size <= words.size());
+    const uint64_t *body = &words[at + 1];
+    switch (h & 0xF) {
+    case 1:
+      out.ticks_per_second = body[0];
+      break;
+    case 2: {
+      const uint16_t ref = (h >> 16) & 0x7FFF;
+      const size_t length = (h >> 32) & 0x7FFF;
+      REQUIRE(size == 1 + (length + 7) / 8);
+      strings[ref] = std::string(reinterpret_cast<const char *>(body), length);
+      break;
+    }
+    case 3:
+      threads[(h >> 16) & 0xFF] = body[1];
+      break;
+    case 4: {
+      Event e;
+      e.type = (h >> 16) & 0xF;
+      const unsigned nargs = (h >> 20) & 0xF;
+      REQUIRE(threads.count((h >> 24) & 0xFF));
+      e.tid = threads[(h >> 24) & 0xFF];
+      REQUIRE(str(h >> 32 & 0xFFFF) == "waffle");
+      e.name = str(h >> 48);
+      e.timestamp = body[0];
+      size_t w = 1;
+      for (unsigned a = 0; a < nargs; ++a) {
+        const uint64_t arg = body[w];
+        const size_t arg_size = (arg >> 4) & 0xFFF;
+        const uint64_t type = arg & 0xF;
+        if (type == 3 || type == 4)
+          e.args[str(arg >> 16 & 0xFFFF)] = static_cast<int64_t>(body[w + 1]);
+        w += arg_size;
+      }
+      if (w + 1 < size)
+        e.trailer = body[w];
+      REQUIRE(w + 1 + (w + 1 < size ? 1 : 0) == size);
+      out.events.push_back(std::move(e));
+      break;
+    }
+    case 7:
+      if (((h >> 16) & 0xFF) == 2)
+        out.thread_names[body[0]] = str(h >> 24 & 0xFFFF);
+      break;
+    }
+    at += size;
+  }
+  REQUIRE(at == words.size());
+  return out;
+}
+
+struct Feeder : test_support::Feeder<FxtWriter> {
+  using test_support::Feeder<FxtWriter>::Feeder;
+
+  template <typename... Attrs>
+  void record(Tracelet::RecordType type, uint64_t ts, uint64_t span,
+              uint64_t cause, std::string_view name, uint16_t thread,
+              uint16_t cpu, Attrs... attrs) {
+    sink.write({Tracelet(ts, 0, Id{1}, Id{span}, kInvalidId, Id{cause},
+                         intern(name), type, thread, cpu, attrs...),
+                0},
+               strings);
+  }
+};
+
+} // namespace
+
+TEST_CASE("FXT writer encodes spans, flows and counters", "[exporter][fxt]") {
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "waffle_fxt_test.fxt")
+          .string();
+  using RT = Tracelet::RecordType;
+
+  SECTION("Complete events") {
+    {
+      FxtWriter writer(path);
+      Feeder f{writer};
+      f.record(RT::THREAD_INFO, 1, 0, 0, "main", 1, 0,
+               f.int_attr(kThreadIdAttribute, 4242));
+      f.record(RT::SPAN_START, 100, 10, 0, "send", 1, 0);
+      f.record(RT::SPAN_END, 150, 10, 0, "", 1, 0);
+      f.record(RT::SPAN_START, 200, 11, 10, "receive", 2, 3);
+      f.record(RT::EVENT, 210, 12, 0, "tick", 2, 5); // Migrated to CPU 5
+      f.record(RT::SPAN_END, 260, 11, 0, "", 2, 5);
+      f.record(RT::SPAN_START, 300, 13, 0, "open", 1, 0);
+    }
+    const Decoded d = decode(path);
+    REQUIRE(d.ticks_per_second == 1000000000);
+    REQUIRE(d.thread_names.at(4242) == "main");
+
+    std::map<unsigned, int> types;
+    for (const Event &e : d.events)
+      ++types[e.type];
+    REQUIRE(types[4] == 2); // send, receive
+    REQUIRE(types[0] == 1); // tick
+    REQUIRE(types[8] == 1);
+    REQUIRE(types[10] == 1);
+    REQUIRE(types[1] == 1); // cpu
+    REQUIRE(types[2] == 1); // "open" never ended
+
+    for (const Event &e : d.events) {
+      if (e.name == "send") {
+        REQUIRE(e.tid == 4242);
+        REQUIRE(e.timestamp == 100);
+        REQUIRE(e.trailer == 150);
+        REQUIRE(e.args.at("span_id") == 10);
+      } else if (e.name == "cpu") {
+        REQUIRE(e.args.at("value") == 5);
+        REQUIRE(e.timestamp == 210);
+      } else if (e.type == 8) {
+        REQUIRE(e.tid == 4242);
+        REQUIRE(e.timestamp == 100);
+      } else if (e.type == 10) {
+        REQUIRE(e.timestamp == 200);
+      }
+    }
+  }
+
+  SECTION("Begin/end events") {
+    {
+      FxtWriter::Options options;
+      options.complete_events = false;
+      options.buffer_bytes = 4096; // Force many drains
+      FxtWriter writer(path, options);
+      Feeder f{writer};
+      for (uint64_t i = 1; i <= 1000; ++i) {
+        f.record(RT::SPAN_START, 10 * i, i, 0, "op", 1, 0,
+                 f.int_attr("i", static_cast<int64_t>(i)));
+        f.record(RT::SPAN_END, 10 * i + 5, i, 0, "", 1, 0);
+      }
+    }
+    const Decoded d = decode(path);
+    REQUIRE(d.events.size() == 2000);
+    REQUIRE(d.events[0].type == 2);
+    REQUIRE(d.events[0].args.at("i") == 1);
+    REQUIRE(d.events[1].type == 3);
+    REQUIRE(d.events[1].name == "op");
+    REQUIRE(d.events[1999].timestamp == 10005);
+  }
+
+  SECTION("String and thread refs are recycled") {
+    {
+      FxtWriter writer(path);
+      Feeder f{writer};
+      for (uint64_t i = 1; i <= 40000; ++i) {
+        const std::string name = "span_" + std::to_string(i);
+        const uint16_t thread = static_cast<uint16_t>(1 + i % 300);
+        f.record(RT::SPAN_START, i, i, 0, name, thread, 0);
+        f.record(RT::SPAN_END, i + 1, i, 0, "", thread, 0);
+      }
+    }
+    const Decoded d = decode(path);
+    REQUIRE(d.events.size() == 40000);
+    for (const Event &e : d.events)
+      REQUIRE(e.name == "span_" + std::to_string(e.args.at("span_id")));
+  }
+
+  std::filesystem::remove(path);
+}
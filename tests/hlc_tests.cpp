@@ -0,0 +1,92 @@
+#include <catch2/catch_all.hpp> // For Catch2 v3.x
+
+#include "waffle/waffle.hpp"
+
+#include <thread>
+
+using Waffle::HybridLogicalClock;
+using Waffle::Id;
+using Waffle::RemoteContext;
+
+TEST_CASE("HybridLogicalClock ticks", "[waffle][hlc]") {
+  HybridLogicalClock clock;
+  // The per-thread "last value" is shared by all clocks, so start every
+  // section safely past anything this thread has stamped before.
+  const uint64_t kWall = clock.tick(0) + (uint64_t{1} << 40);
+
+  SECTION("Follows wall time at tick granularity") {
+    const uint64_t later = kWall + 10 * (HybridLogicalClock::kLogicalMask + 1);
+    const uint64_t hlc = clock.tick(later);
+    REQUIRE(HybridLogicalClock::physical_ns(hlc) ==
+            (later & ~HybridLogicalClock::kLogicalMask));
+  }
+
+  SECTION("Is strictly monotonic on a thread when wall time stalls or steps "
+          "back") {
+    const uint64_t a = clock.tick(kWall + (uint64_t{1} << 40));
+    const uint64_t b = clock.tick(kWall + (uint64_t{1} << 40));
+    const uint64_t c = clock.tick(kWall);
+    REQUIRE(b > a);
+    REQUIRE(c > b);
+    REQUIRE(HybridLogicalClock::physical_ns(c) ==
+            HybridLogicalClock::physical_ns(a));
+  }
+
+  SECTION("Orders records after a merged remote clock on every thread") {
+    // A remote node whose clock runs far ahead of ours.
+    const uint64_t remote = clock.tick(kWall) + (uint64_t{1} << 50);
+    clock.merge(remote);
+    REQUIRE(clock.tick(kWall) > remote);
+
+    uint64_t other_thread = 0;
+    std::thread([&] { other_thread = clock.tick(kWall); }).join();
+    REQUIRE(other_thread > remote);
+  }
+
+  SECTION("Ignores remote clocks that are behind or absent") {
+    const uint64_t before = clock.tick(kWall + (uint64_t{1} << 45));
+    clock.merge(0);
+    clock.merge(1);
+    const uint64_t after = clock.tick(kWall + (uint64_t{1} << 45));
+    REQUIRE(after == before + 1);
+  }
+}
+
+TEST_CASE("RemoteContext round-trips through text", "[waffle][hlc]") {
+  const RemoteContext ctx{Id{0x0123456789abcdefULL}, 0xfeedULL << 16};
+  const std::string text = ctx.format();
+  REQUIRE(text == "0123456789abcdef-00000000feed0000");
+  REQUIRE(RemoteContext::parse(text) == ctx);
+
+  REQUIRE_FALSE(RemoteContext::parse("").has_value());
+  REQUIRE_FALSE(RemoteContext::parse(text.substr(1)).has_value());
+  REQUIRE_FALSE(
+      RemoteContext::parse("0123456789abcdeg-00000000feed0000").has_value());
+  REQUIRE_FALSE(
+      RemoteContext::parse("0123456789abcdef+00000000feed0000").has_value());
+}
+
+TEST_CASE("extract_context links to the sender and merges its clock",
+          "[waffle][hlc]") {
+  Waffle::setup();
+  auto &tracer = *Waffle::detail::g_tracer_instance;
+
+  const uint64_t ahead = tracer.hlc_now() + (uint64_t{1} << 50);
+  const Waffle::CausedBy cause =
+      Waffle::extract_context(RemoteContext{Id{9}, ahead});
+  REQUIRE(cause.value == Id{9});
+  REQUIRE(tracer.hlc_now() > ahead);
+
+  {
+    WAFFLE_SPAN("sender");
+    const RemoteContext sent = Waffle::inject_context();
+    REQUIRE(sent.span_id == Waffle::context::get_current_span_id());
+    REQUIRE(sent.hlc > ahead);
+  }
+  Waffle::shutdown();
+
+  // Without a tracer the link is still returned, just without a clock.
+  REQUIRE(Waffle::extract_context(RemoteContext{Id{2}, 3}).value ==
+          Id{2});
+  REQUIRE(Waffle::inject_context().hlc == 0);
+}
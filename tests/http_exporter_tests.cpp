@@ -0,0 +1,407 @@
+#include <catch2/catch_all.hpp> // For Catch2 v3.x
+
+#include "waffle/exporter/http_span_exporter.hpp"
+
+#include "test_support.hpp"
+
+#include <arpa/inet.h>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <variant>
+
+using namespace Waffle;
+using Waffle::exporter::HttpSpanExporter;
+using test_support::hash_of;
+
+namespace {
+
+/**
+ * Loopback HTTP/1.1 collector: serves one connection at a time, records
+ * every request and answers `status` with keep-alive (or closes the
+ * connection after each response when `close_each`).
+ */
+class MockHttpServer {
+public:
+  struct Request {
+    std::string path;
+    std::string content_type;
+    std::string body;
+  };
+
+  explicit MockHttpServer(int status = 202, bool close_each = false)
+      : _status(status), _close_each(close_each) {
+    _listen = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    REQUIRE(::bind(_listen, reinterpret_cast<sockaddr *>(&address),
+                   sizeof(address)) == 0);
+    REQUIRE(::listen(_listen, 4) == 0);
+    socklen_t length = sizeof(address);
+    ::getsockname(_listen, reinterpret_cast<sockaddr *>(&address), &length);
+    _port = ntohs(address.sin_port);
+    _thread = std::thread([this] { serve(); });
+  }
+
+  ~MockHttpServer() {
+    _stop = true;
+    _thread.join();
+    ::close(_listen);
+  }
+
+  uint16_t port() const { return _port; }
+
+  std::vector<Request> wait_for(size_t requests) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _arrived.wait_for(lock, std::chrono::seconds(10),
+                      [&] { return _requests.size() >= requests; });
+    return _requests;
+  }
+
+  int connections() const { return _connections; }
+
+private:
+  // Waits until `fd` is readable; false once the server stops.
+  bool readable(int fd) {
+    pollfd p{fd, POLLIN, 0};
+    while (!_stop)
+      if (::poll(&p, 1, 20) > 0)
+        return true;
+    return false;
+  }
+
+  void serve() {
+    while (readable(_listen)) {
+      const int fd = ::accept(_listen, nullptr, nullptr);
+      ++_connections;
+      std::string buffer;
+      while (handle(fd, buffer)) {
+      }
+      ::close(fd);
+    }
+  }
+
+  // Reads and answers one request; false when the connection ends.
+  bool handle(int fd, std::string &buffer) {
+    auto more = [&] {
+      char chunk[4096];
+      if (!readable(fd))
+        return false;
+      const ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+      if (n <= 0)
+        return false;
+      buffer.append(chunk, static_cast<size_t>(n));
+      return true;
+    };
+    size_t head_end;
+    while ((head_end = buffer.find("\r\n\r\n")) == std::string::npos)
+      if (!more())
+        return false;
+    const std::string head = buffer.substr(0, head_end);
+    auto header = [&](const std::string &name) {
+      const size_t at = head.find("\r\n" + name + ": ");
+      if (at == std::string::npos)
+        return std::string();
+      const size_t start = at + name.size() + 4;
+      return head.substr(start, head.find("\r\n", start) - start);
+    };
+    Request r;
+    r.path = head.substr(5, head.find(' ', 5) - 5); // "POST <path> HTTP/1.1"
+    r.content_type = header("Content-Type");
+    const size_t length = std::stoul(header("Content-Length"));
+    while (buffer.size() < head_end + 4 + length)
+      if (!more())
+        return false;
+    r.body = buffer.substr(head_end + 4, length);
+    buffer.erase(0, head_end + 4 + length);
+
+    std::string response = "HTTP/1.1 " + std::to_string(_status) +
+                           " Status\r\nContent-Length: 2\r\n";
+    if (_close_each)
+      response += "Connection: close\r\n";
+    response += "\r\n{}";
+    ::send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _requests.push_back(std::move(r));
+    }
+    _arrived.notify_all();
+    return !_close_each;
+  }
+
+  int _status;
+  bool _close_each;
+  int _listen;
+  uint16_t _port;
+  std::atomic<bool> _stop{false};
+  std::atomic<int> _connections{0};
+  std::thread _thread;
+  std::mutex _mutex;
+  std::condition_variable _arrived;
+  std::vector<Request> _requests;
+};
+
+// Generic Thrift binary protocol reader: structs become field id -> value.
+struct ThriftValue;
+using ThriftStruct = std::map<int16_t, ThriftValue>;
+struct ThriftValue {
+  std::variant<int64_t, double, std::string, ThriftStruct,
+               std::vector<ThriftValue>>
+      v;
+  int64_t i() const { return std::get<int64_t>(v); }
+  const std::string &s() const { return std::get<std::string>(v); }
+  const ThriftStruct &st() const { return std::get<ThriftStruct>(v); }
+  const std::vector<ThriftValue> &list() const {
+    return std::get<std::vector<ThriftValue>>(v);
+  }
+};
+
+struct ThriftReader {
+  const std::string &data;
+  size_t at = 0;
+
+  uint64_t be(size_t bytes) {
+    REQUIRE(at + bytes <= data.size());
+    uint64_t v = 0;
+    for (size_t i = 0; i < bytes; ++i)
+      v = v << 8 | static_cast<uint8_t>(data[at++]);
+    return v;
+  }
+  ThriftValue value(uint8_t type) {
+    switch (type) {
+    case 2:
+      return {static_cast<int64_t>(be(1))};
+    case 4: {
+      const uint64_t bits = be(8);
+      double d;
+      std::memcpy(&d, &bits, sizeof(d));
+      return {d};
+    }
+    case 8:
+      return {static_cast<int64_t>(static_cast<int32_t>(be(4)))};
+    case 10:
+      return {static_cast<int64_t>(be(8))};
+    case 11: {
+      const size_t length = be(4);
+      REQUIRE(at + length <= data.size());
+      at += length;
+      return {data.substr(at - length, length)};
+    }
+    case 12:
+      return {structure()};
+    case 15: {
+      const uint8_t element = static_cast<uint8_t>(be(1));
+      std::vector<ThriftValue> list(be(4));
+      for (auto &e : list)
+        e = value(element);
+      return {std::move(list)};
+    }
+    }
+    FAIL("Unexpected thrift type " << int(type));
+    return {};
+  }
+  ThriftStruct structure() {
+    ThriftStruct s;
+    while (const uint8_t type = static_cast<uint8_t>(be(1))) {
+      const int16_t id = static_cast<int16_t>(be(2));
+      s[id] = value(type);
+    }
+    return s;
+  }
+};
+
+struct Feeder : test_support::Feeder<HttpSpanExporter> {
+  using test_support::Feeder<HttpSpanExporter>::Feeder;
+
+  void span(uint64_t id, uint64_t parent, uint64_t cause, uint64_t start_ns,
+            uint64_t end_ns, std::string_view name) {
+    sink.on_record(Tracelet(start_ns, 0, Id{1}, Id{id}, Id{parent}, Id{cause},
+                            intern(name), Tracelet::RecordType::SPAN_START, 2,
+                            5, int_attr("rows", static_cast<int64_t>(id)),
+                            string_attr("table", "or\"ders"),
+                            double_attr("ratio", 0.25)),
+                   strings);
+    sink.on_record(Tracelet(end_ns, 0, Id{1}, Id{id}, kInvalidId, kInvalidId,
+                            0, Tracelet::RecordType::SPAN_END, 2, 5),
+                   strings);
+  }
+};
+
+size_t count(const std::string &s, const std::string &what) {
+  size_t n = 0;
+  for (size_t at = s.find(what); at != std::string::npos;
+       at = s.find(what, at + 1))
+    ++n;
+  return n;
+}
+
+} // namespace
+
+TEST_CASE("Zipkin exporter batches spans over one connection",
+          "[exporter][http]") {
+  MockHttpServer server;
+  HttpSpanExporter::Options options;
+  options.port = server.port();
+  options.service_name = "checkout";
+  options.batch_spans = 100;
+  HttpSpanExporter exporter(options);
+  exporter.on_start({0, 0});
+  Feeder f{exporter};
+  for (uint64_t i = 1; i <= 250; ++i)
+    f.span(i, i == 1 ? 0 : 1, i == 7 ? 3 : 0, 1'000'000 * i,
+           1'000'000 * i + 1500, "query");
+  exporter.flush();
+  exporter.shutdown();
+
+  const auto requests = server.wait_for(3);
+  REQUIRE(requests.size() == 3);
+  REQUIRE(server.connections() == 1);
+  const auto stats = exporter.stats();
+  REQUIRE(stats.spans_sent == 250);
+  REQUIRE(stats.spans_dropped == 0);
+  REQUIRE(stats.connections == 1);
+
+  size_t spans = 0;
+  for (const auto &r : requests) {
+    REQUIRE(r.path == "/api/v2/spans");
+    REQUIRE(r.content_type == "application/json");
+    REQUIRE(r.body.front() == '[');
+    REQUIRE(r.body.back() == ']');
+    spans += count(r.body, "\"traceId\"");
+  }
+  REQUIRE(spans == 250);
+  const std::string &first = requests[0].body;
+  REQUIRE(first.starts_with(
+      "[{\"traceId\":\"0000000000000001\",\"id\":\"0000000000000001\","
+      "\"name\":\"query\",\"timestamp\":1000,\"duration\":2,"
+      "\"localEndpoint\":{\"serviceName\":\"checkout\"},"
+      "\"tags\":{\"thread.index\":\"2\",\"cpu\":\"5\",\"rows\":\"1\","
+      "\"table\":\"or\\\"ders\",\"ratio\":\"0.25\"}},"));
+  REQUIRE(first.find("\"id\":\"0000000000000002\","
+                     "\"parentId\":\"0000000000000001\"") !=
+          std::string::npos);
+  REQUIRE(first.find("\"waffle.cause_id\":\"0000000000000003\"") !=
+          std::string::npos);
+}
+
+TEST_CASE("Jaeger exporter sends Thrift batches", "[exporter][http]") {
+  MockHttpServer server(200, /*close_each=*/true);
+  HttpSpanExporter::Options options;
+  options.format = HttpSpanExporter::Format::JAEGER_THRIFT;
+  options.port = server.port();
+  options.service_name = "checkout";
+  options.batch_spans = 2;
+  HttpSpanExporter exporter(options);
+  exporter.on_start({0xABC, 0});
+  Feeder f{exporter};
+  f.span(10, 0, 0, 5'000'000, 5'004'000, "root");
+  f.span(11, 10, 9, 5'001'000, 5'001'200, "child");
+  f.span(12, 10, 0, 5'002'000, 5'003'000, "other");
+  exporter.shutdown();
+
+  const auto requests = server.wait_for(2);
+  REQUIRE(requests.size() == 2);
+  REQUIRE(server.connections() == 2); // The server closes each connection
+  REQUIRE(exporter.stats().spans_sent == 3);
+  REQUIRE(requests[0].path == "/api/traces");
+  REQUIRE(requests[0].content_type == "application/x-thrift");
+
+  ThriftReader reader{requests[0].body};
+  const ThriftStruct batch = reader.structure();
+  REQUIRE(reader.at == requests[0].body.size());
+  const ThriftStruct &process = batch.at(1).st();
+  REQUIRE(process.at(1).s() == "checkout");
+  REQUIRE(process.at(2).list().at(0).st().at(6).i() == 0xABC);
+
+  const auto &spans = batch.at(2).list();
+  REQUIRE(spans.size() == 2);
+  const ThriftStruct &root = spans[0].st();
+  REQUIRE(root.at(1).i() == 1); // traceIdLow
+  REQUIRE(root.at(3).i() == 10);
+  REQUIRE(root.at(4).i() == 0);
+  REQUIRE(root.at(5).s() == "root");
+  REQUIRE(root.count(6) == 0); // No references
+  REQUIRE(root.at(8).i() == 5000);
+  REQUIRE(root.at(9).i() == 4);
+
+  const ThriftStruct &child = spans[1].st();
+  REQUIRE(child.at(4).i() == 10);
+  REQUIRE(child.at(9).i() == 1); // 200 ns rounds up to 1 us
+  const auto &refs = child.at(6).list();
+  REQUIRE(refs.size() == 2);
+  REQUIRE(refs[0].st().at(1).i() == 0); // CHILD_OF
+  REQUIRE(refs[0].st().at(4).i() == 10);
+  REQUIRE(refs[1].st().at(1).i() == 1); // FOLLOWS_FROM
+  REQUIRE(refs[1].st().at(4).i() == 9);
+
+  std::map<std::string, ThriftStruct> tags;
+  for (const auto &t : child.at(10).list())
+    tags[t.st().at(1).s()] = t.st();
+  REQUIRE(tags.at("thread.index").at(6).i() == 2);
+  REQUIRE(tags.at("cpu").at(6).i() == 5);
+  REQUIRE(tags.at("rows").at(2).i() == 3); // LONG
+  REQUIRE(tags.at("rows").at(6).i() == 11);
+  REQUIRE(tags.at("table").at(3).s() == "or\"ders");
+  REQUIRE(std::get<double>(tags.at("ratio").at(4).v) == 0.25);
+}
+
+TEST_CASE("HTTP exporter drops batches it cannot deliver",
+          "[exporter][http]") {
+  uint16_t port;
+  {
+    MockHttpServer unused; // Find a free port, then close it
+    port = unused.port();
+  }
+  HttpSpanExporter::Options options;
+  options.port = port;
+  options.batch_spans = 10;
+  options.http.timeout = std::chrono::milliseconds(200);
+  HttpSpanExporter exporter(options);
+  exporter.on_start({0, 0});
+  Feeder f{exporter};
+  for (uint64_t i = 1; i <= 35; ++i)
+    f.span(i, 0, 0, i * 1000, i * 1000 + 10, "lost");
+  exporter.shutdown(); // Must not hang
+
+  const auto stats = exporter.stats();
+  REQUIRE(stats.spans_sent == 0);
+  REQUIRE(stats.spans_dropped == 35);
+  REQUIRE(stats.requests == stats.failed_requests);
+}
+
+TEST_CASE("HTTP exporter bounds the spans waiting for their end",
+          "[exporter][http]") {
+  MockHttpServer server;
+  HttpSpanExporter::Options options;
+  options.port = server.port();
+  options.max_open_spans = 4;
+  HttpSpanExporter exporter(options);
+  exporter.on_start({0, 0});
+  std::unordered_map<uint64_t, std::string> strings{{hash_of("open"), "open"}};
+  auto record = [&](uint64_t id, uint64_t ts, Tracelet::RecordType type) {
+    exporter.on_record(Tracelet(ts, 0, Id{1}, Id{id}, kInvalidId, kInvalidId,
+                                hash_of("open"), type, 0, 0),
+                       strings);
+  };
+  // Ten spans that never end (e.g. their ends were dropped).
+  for (uint64_t i = 1; i <= 10; ++i)
+    record(i, i * 1000, Tracelet::RecordType::SPAN_START);
+  record(1, 20'000, Tracelet::RecordType::SPAN_END);  // Evicted
+  record(10, 20'000, Tracelet::RecordType::SPAN_END); // Still open
+  exporter.shutdown();
+
+  const auto stats = exporter.stats();
+  REQUIRE(stats.open_spans_evicted >= 6);
+  REQUIRE(stats.spans_sent == 1);
+  const auto requests = server.wait_for(1);
+  REQUIRE(requests.size() == 1);
+  REQUIRE(requests[0].body.find("\"id\":\"000000000000000a\"") !=
+          std::string::npos);
+}
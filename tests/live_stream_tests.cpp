@@ -0,0 +1,210 @@
+#include <catch2/catch_all.hpp> // For Catch2 v3.x
+
+#include "waffle/live/live_stream.hpp"
+
+#include "test_support.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace Waffle;
+using Waffle::live::LiveFilter;
+using Waffle::live::LiveStreamClient;
+using Waffle::live::LiveStreamServer;
+using test_support::hash_of;
+
+namespace {
+
+std::string socket_path() {
+  return (std::filesystem::temp_directory_path() /
+          ("waffle_live_" + std::to_string(::getpid())))
+      .string();
+}
+
+struct Feeder : test_support::Feeder<LiveStreamServer> {
+  using test_support::Feeder<LiveStreamServer>::Feeder;
+
+  template <typename... Attrs>
+  void record(Tracelet::RecordType type, uint64_t ts, uint64_t trace,
+              uint64_t span, std::string_view name, Attrs... attrs) {
+    sink.on_record(Tracelet(ts, 0, Id{trace}, Id{span}, kInvalidId, kInvalidId,
+                            type == Tracelet::RecordType::SPAN_END
+                                ? 0
+                                : intern(name),
+                            type, 1, 0, attrs...),
+                   strings);
+  }
+};
+
+// Drives the server's accept/subscribe handling until `done` is set, as the
+// processing thread's idle flushes would.
+void serve_until(LiveStreamServer &server, const std::atomic<bool> &done) {
+  for (int i = 0; i < 5000 && !done; ++i) {
+    server.flush();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  REQUIRE(done);
+}
+
+} // namespace
+
+TEST_CASE("Live filter parsing and matching", "[live]") {
+  const LiveFilter f =
+      LiveFilter::parse("name=query name=\"send\"  trace=0x2a attr.rows=3 "
+                        "attr.table=orders");
+  REQUIRE(f.names == std::vector<uint64_t>{hash_of("query"), hash_of("send")});
+  REQUIRE(f.trace_ids == std::vector<uint64_t>{42});
+  REQUIRE(f.attributes.size() == 2);
+
+  Attribute rows;
+  rows.key_id = hash_of("rows");
+  rows.value.type = AttributeValue::Type::INT64;
+  rows.value.i64 = 3;
+  Attribute table;
+  table.key_id = hash_of("table");
+  table.value.type = AttributeValue::Type::STRING_ID;
+  table.value.string_id = hash_of("orders");
+  using RT = Tracelet::RecordType;
+  const Tracelet hit(1, 0, Id{42}, Id{1}, kInvalidId, kInvalidId,
+                     hash_of("send"), RT::SPAN_START, 1, 0, rows, table);
+  REQUIRE(f.matches(hit));
+  const Tracelet other_trace(1, 0, Id{41}, Id{1}, kInvalidId, kInvalidId,
+                             hash_of("send"), RT::SPAN_START, 1, 0, rows,
+                             table);
+  REQUIRE_FALSE(f.matches(other_trace));
+  const Tracelet missing_attr(1, 0, Id{42}, Id{1}, kInvalidId, kInvalidId,
+                              hash_of("query"), RT::SPAN_START, 1, 0, rows);
+  REQUIRE_FALSE(f.matches(missing_attr));
+
+  REQUIRE(LiveFilter::parse("").empty());
+  REQUIRE_THROWS_AS(LiveFilter::parse("bogus=1"), std::invalid_argument);
+  REQUIRE_THROWS_AS(LiveFilter::parse("name"), std::invalid_argument);
+  REQUIRE_THROWS_AS(LiveFilter::parse("trace=zz"), std::invalid_argument);
+}
+
+TEST_CASE("Live stream sends filtered records to subscribers", "[live]") {
+  const std::string path = socket_path();
+  LiveStreamServer::Options options;
+  options.socket_path = path;
+  options.chunk_bytes = 1024;
+  LiveStreamServer server(options);
+  server.on_start({0x77, 1000});
+  using RT = Tracelet::RecordType;
+
+  std::atomic<bool> subscribed{false};
+  std::vector<trace_file::TraceRecord> received;
+  std::unordered_map<uint64_t, std::string> strings;
+  uint64_t process_tag = 0;
+  std::thread reader([&] {
+    LiveStreamClient client(path, "name=query attr.table=orders");
+    process_tag = client.header().process_tag;
+    subscribed = true;
+    trace_file::TraceRecord r;
+    while (client.next(r))
+      received.push_back(r);
+    strings = client.strings();
+  });
+  serve_until(server, subscribed);
+
+  Feeder f{server};
+  f.record(RT::THREAD_INFO, 1, 0, 0, "main",
+           f.int_attr(kThreadIdAttribute, 99));
+  for (uint64_t i = 1; i <= 100; ++i) {
+    f.record(RT::SPAN_START, 10 * i, i, i, i % 2 ? "query" : "send",
+             f.string_attr("table", i % 4 == 1 ? "orders" : "users"));
+    f.record(RT::EVENT, 10 * i + 1, i, 1000 + i, "query"); // No attribute
+    f.record(RT::SPAN_END, 10 * i + 5, i, i, "");
+  }
+  server.shutdown();
+  reader.join();
+
+  REQUIRE(process_tag == 0x77);
+  REQUIRE(server.stats().clients == 0);
+  // THREAD_INFO, then start + end of the 25 spans i % 4 == 1.
+  REQUIRE(received.size() == 51);
+  REQUIRE(received[0].tracelet.record_type == RT::THREAD_INFO);
+  REQUIRE(strings.at(received[0].tracelet.name_string_hash) == "main");
+  for (size_t k = 1; k < received.size(); k += 2) {
+    const Tracelet &start = received[k].tracelet;
+    const Tracelet &end = received[k + 1].tracelet;
+    REQUIRE(start.record_type == RT::SPAN_START);
+    REQUIRE(start.span_id.value % 4 == 1);
+    REQUIRE(strings.at(start.name_string_hash) == "query");
+    REQUIRE(strings.at(start.attributes[0].value.string_id) == "orders");
+    REQUIRE(end.record_type == RT::SPAN_END);
+    REQUIRE(end.span_id == start.span_id);
+  }
+  REQUIRE_FALSE(std::filesystem::exists(path));
+}
+
+TEST_CASE("Live stream rejects bad filters", "[live]") {
+  const std::string path = socket_path();
+  LiveStreamServer server({path});
+  server.on_start({0, 0});
+  std::atomic<bool> answered{false};
+  std::string error;
+  std::thread client([&] {
+    try {
+      LiveStreamClient c(path, "colour=blue");
+    } catch (const std::invalid_argument &e) {
+      error = e.what();
+    }
+    answered = true;
+  });
+  serve_until(server, answered);
+  client.join();
+  REQUIRE(error.find("Unknown filter field: colour") != std::string::npos);
+  REQUIRE(server.stats().clients_rejected == 1);
+}
+
+TEST_CASE("A slow live client does not hold up the tracer", "[live]") {
+  const std::string path = socket_path();
+  LiveStreamServer::Options options;
+  options.socket_path = path;
+  options.chunk_bytes = 4096;
+  options.max_buffered_bytes = 16 << 10;
+  LiveStreamServer server(options);
+  server.on_start({0, 0});
+
+  // Subscribes to everything, then does not read.
+  const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  std::strcpy(address.sun_path, path.c_str());
+  REQUIRE(::connect(fd, reinterpret_cast<sockaddr *>(&address),
+                    sizeof(address)) == 0);
+  REQUIRE(::send(fd, "\n", 1, 0) == 1);
+  server.flush();
+  REQUIRE(server.stats().clients == 1);
+
+  Feeder f{server};
+  const uint64_t total = 200'000;
+  for (uint64_t i = 1; i <= total; ++i)
+    f.record(Tracelet::RecordType::EVENT, i, 1, i, "tick",
+             f.int_attr("i", static_cast<int64_t>(i)));
+  server.flush();
+  const auto stats = server.stats();
+  REQUIRE(stats.records_dropped > 0);
+  REQUIRE(stats.records_sent + stats.records_dropped == total);
+  server.shutdown();
+
+  // What did arrive is still a well-formed trace stream.
+  trace_file::TraceFileReader reader(::fdopen(fd, "rb"), path);
+  trace_file::TraceRecord r;
+  uint64_t read = 0;
+  uint64_t last = 0;
+  while (reader.next(r)) {
+    REQUIRE(r.tracelet.timestamp > last);
+    REQUIRE(r.tracelet.attributes[0].value.i64 ==
+            static_cast<int64_t>(r.tracelet.timestamp));
+    last = r.tracelet.timestamp;
+    ++read;
+  }
+  REQUIRE(read > 0);
+  REQUIRE(read <= stats.records_sent);
+}
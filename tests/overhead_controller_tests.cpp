@@ -0,0 +1,165 @@
+#include <catch2/catch_all.hpp> // For Catch2 v3.x
+
+#include "waffle/control/overhead_controller.hpp"
+#include "waffle/processor/iprocessor.hpp"
+#include "waffle/waffle.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+using namespace Waffle;
+using Waffle::control::OverheadController;
+using Waffle::control::OverheadSample;
+
+namespace {
+
+// Keeps every record; optionally takes `delay` per record to fall behind.
+class Collector : public IProcessor {
+public:
+  explicit Collector(std::chrono::microseconds delay = {}) : delay(delay) {}
+
+  void on_record(const Tracelet &record,
+                 const std::unordered_map<uint64_t, std::string> &) override {
+    if (delay.count() > 0)
+      std::this_thread::sleep_for(delay);
+    std::lock_guard<std::mutex> lock(mutex);
+    records.push_back(record);
+  }
+
+  std::chrono::microseconds delay;
+  std::mutex mutex;
+  std::vector<Tracelet> records;
+};
+
+} // namespace
+
+TEST_CASE("Overhead controller tracks the most loaded budget",
+          "[overhead]") {
+  OverheadBudget budget;
+  budget.max_cpu = 0.1;
+  budget.max_ring_occupancy = 0.5;
+  budget.max_lag = std::chrono::milliseconds(10);
+  budget.max_backlog = 8;
+  budget.min_probability = 0.01;
+  OverheadController controller(budget);
+
+  OverheadSample sample;
+  sample.cpu = 0.05;
+  sample.ring_occupancy = 0.1;
+  sample.lag_ns = 1'000'000;
+  sample.backlog = 2;
+  REQUIRE(std::abs(controller.pressure(sample) - 0.5) < 1e-9);
+  sample.backlog = 16;
+  REQUIRE(std::abs(controller.pressure(sample) - 2) < 1e-9);
+  sample.backlog = 0;
+  sample.lag_ns = 30'000'000;
+  REQUIRE(std::abs(controller.pressure(sample) - 3) < 1e-9);
+
+  // Over budget: cut in proportion, to just inside the budget.
+  sample.lag_ns = 0;
+  sample.cpu = 0.2;
+  REQUIRE(std::abs(controller.update(sample) - 0.4) < 1e-9);
+  // Drops count as a pressure of 2; cuts stop at a quarter per step.
+  sample.cpu = 0;
+  sample.drops = 1;
+  REQUIRE(std::abs(controller.update(sample) - 0.16) < 1e-9);
+  sample.drops = 0;
+  sample.cpu = 10;
+  REQUIRE(std::abs(controller.update(sample) - 0.04) < 1e-9);
+  REQUIRE(std::abs(controller.update(sample) - 0.01) < 1e-9);
+  REQUIRE(controller.update(sample) == 0.01); // min_probability
+
+  // Comfortably inside: at most 25% more per step, up to 1.
+  sample.cpu = 0;
+  REQUIRE(std::abs(controller.update(sample) - 0.0125) < 1e-9);
+  // Close to the target: held.
+  sample.cpu = 0.075;
+  REQUIRE(std::abs(controller.update(sample) - 0.0125) < 1e-9);
+  sample.cpu = 0;
+  for (int i = 0; i < 100; ++i)
+    controller.update(sample);
+  REQUIRE(controller.probability() == 1);
+}
+
+TEST_CASE("Head sampling keeps or drops whole subtrees", "[overhead]") {
+  auto collector = std::make_shared<Collector>();
+  Waffle::setup({{collector}, 1 << 16});
+  auto &tracer = *Waffle::detail::g_tracer_instance;
+  REQUIRE(tracer.sampling_probability() == 1);
+  tracer.set_sampling_probability(0.25);
+  REQUIRE(std::abs(tracer.sampling_probability() - 0.25) < 1e-9);
+
+  constexpr int kRoots = 4000;
+  for (int i = 0; i < kRoots; ++i) {
+    Span root = tracer.start_span("root", kInvalidId, kInvalidId);
+    {
+      Span child = tracer.start_span("child", root.id(), kInvalidId);
+      REQUIRE((child.id() == kUnsampledId) == (root.id() == kUnsampledId));
+      REQUIRE(context::get_current_span_id() == child.id());
+    }
+    REQUIRE(context::get_current_span_id() == root.id());
+    StaticStringSource event("tick", 4);
+    tracer.create_event(event, root.id(), kInvalidId);
+    if (i % 512 == 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  REQUIRE(context::get_current_span_id() == kInvalidId);
+  REQUIRE(tracer.dropped_records() == 0);
+  Waffle::shutdown();
+
+  std::unordered_set<uint64_t> roots, open;
+  size_t children = 0, events = 0;
+  for (const Tracelet &r : collector->records) {
+    REQUIRE(r.span_id != kUnsampledId);
+    REQUIRE(r.parent_span_id != kUnsampledId);
+    if (r.record_type == Tracelet::RecordType::SPAN_START) {
+      open.insert(r.span_id.value);
+      if (r.parent_span_id == kInvalidId) {
+        roots.insert(r.span_id.value);
+      } else {
+        REQUIRE(roots.count(r.parent_span_id.value));
+        ++children;
+      }
+    } else if (r.record_type == Tracelet::RecordType::SPAN_END) {
+      REQUIRE(open.erase(r.span_id.value) == 1);
+    } else if (r.record_type == Tracelet::RecordType::EVENT) {
+      REQUIRE(roots.count(r.parent_span_id.value));
+      ++events;
+    }
+  }
+  REQUIRE(open.empty());
+  // Binomial(4000, 0.25): 1000 +- 27 (one sigma).
+  REQUIRE(roots.size() > 850);
+  REQUIRE(roots.size() < 1150);
+  REQUIRE(children == roots.size());
+  REQUIRE(events == roots.size());
+}
+
+TEST_CASE("Overhead controller sheds load and recovers", "[overhead]") {
+  // 20us per record: the processing thread keeps up with ~50k records/s.
+  auto collector = std::make_shared<Collector>(std::chrono::microseconds(20));
+  TracerOptions options{{collector}, 1 << 12};
+  options.overhead.max_ring_occupancy = 0.25;
+  options.overhead.interval = std::chrono::milliseconds(5);
+  Waffle::setup(options);
+  auto &tracer = *Waffle::detail::g_tracer_instance;
+
+  const auto start = std::chrono::steady_clock::now();
+  double lowest = 1;
+  while (std::chrono::steady_clock::now() - start <
+         std::chrono::milliseconds(300)) {
+    tracer.start_span("busy", kInvalidId, kInvalidId).end();
+    lowest = std::min(lowest, tracer.sampling_probability());
+  }
+  REQUIRE(lowest < 0.5);
+  const uint64_t dropped = tracer.dropped_records();
+  // Once the load stops, the probability climbs back.
+  for (int i = 0; i < 300 && tracer.sampling_probability() < 1; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  REQUIRE(tracer.sampling_probability() == 1);
+  REQUIRE(tracer.dropped_records() == dropped);
+  Waffle::shutdown();
+}
@@ -0,0 +1,163 @@
+#include <catch2/catch_all.hpp> // For Catch2 v3.x
+
+#include <waffle/helpers/per_cpu_ring_buffer.hpp>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Record {
+  uint64_t ts;
+  uint64_t producer;
+  uint64_t payload[6];
+};
+
+struct ByTs {
+  bool operator()(const Record &a, const Record &b) const {
+    return a.ts < b.ts;
+  }
+};
+
+using Rings = PerCpuRingBuffer<Record, ByTs>;
+
+Rings::Mode expected_mode(bool allow_rseq) {
+#if WAFFLE_HAVE_RSEQ_RINGS
+  if (allow_rseq && __rseq_size > 0 &&
+      static_cast<int32_t>(per_cpu_detail::rseq_area()->cpu_id) >= 0)
+    return Rings::Mode::RSEQ;
+#endif
+  (void)allow_rseq;
+  return Rings::Mode::ATOMIC;
+}
+
+} // namespace
+
+TEST_CASE("Per-CPU rings hold and return records in order", "[per_cpu]") {
+  const bool allow_rseq = GENERATE(true, false);
+  Rings rings(8, 4, allow_rseq);
+  REQUIRE(rings.mode() == expected_mode(allow_rseq));
+  REQUIRE(rings.capacity() == 8);
+
+  Record out;
+  REQUIRE(rings.front() == nullptr);
+  REQUIRE_FALSE(rings.try_pop(out));
+
+  // Pinned to one CPU, so everything lands in one ring.
+  cpu_set_t one;
+  CPU_ZERO(&one);
+  CPU_SET(sched_getcpu(), &one);
+  cpu_set_t saved;
+  REQUIRE(sched_getaffinity(0, sizeof(saved), &saved) == 0);
+  REQUIRE(sched_setaffinity(0, sizeof(one), &one) == 0);
+  uint64_t ts = 0;
+  while (rings.try_emplace(Record{++ts, 0, {ts}}))
+    REQUIRE(ts <= 8);
+  REQUIRE(ts == 9);
+  REQUIRE(rings.size() == 8);
+  REQUIRE(rings.occupancy() == 1.0);
+  sched_setaffinity(0, sizeof(saved), &saved);
+
+  REQUIRE(rings.front()->ts == 1);
+  for (uint64_t i = 1; i <= 8; ++i) {
+    REQUIRE(rings.try_pop(out));
+    REQUIRE(out.ts == i);
+    REQUIRE(out.payload[0] == i);
+  }
+  REQUIRE_FALSE(rings.try_pop(out));
+  REQUIRE(rings.size() == 0);
+}
+
+TEST_CASE("Per-CPU rings merge interleaved rings in order", "[per_cpu]") {
+  // Each allowed CPU (one is enough to run, several to merge) fills its
+  // ring with every n-th timestamp; runs from one ring must stop at the
+  // next ring's head.
+  const bool allow_rseq = GENERATE(true, false);
+  cpu_set_t saved;
+  REQUIRE(sched_getaffinity(0, sizeof(saved), &saved) == 0);
+  std::vector<int> cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE && cpus.size() < 4; ++cpu)
+    if (CPU_ISSET(cpu, &saved))
+      cpus.push_back(cpu);
+  Rings rings(64, std::max(cpus.back() + 1, 2), allow_rseq);
+
+  const uint64_t n = cpus.size();
+  for (uint64_t c = 0; c < n; ++c) {
+    cpu_set_t one;
+    CPU_ZERO(&one);
+    CPU_SET(cpus[c], &one);
+    REQUIRE(sched_setaffinity(0, sizeof(one), &one) == 0);
+    // Runs of two, so that the merge alternates between rings.
+    for (uint64_t ts = 2 * c; ts < 2 * n * 16; ts += 2 * n) {
+      REQUIRE(rings.try_emplace(Record{ts, c, {}}));
+      REQUIRE(rings.try_emplace(Record{ts + 1, c, {}}));
+    }
+  }
+  sched_setaffinity(0, sizeof(saved), &saved);
+
+  Record out;
+  for (uint64_t ts = 0; ts < 2 * n * 16; ++ts) {
+    REQUIRE(rings.try_pop(out));
+    REQUIRE(out.ts == ts);
+  }
+  REQUIRE_FALSE(rings.try_pop(out));
+}
+
+TEST_CASE("A single ring is the shared MPSC ring", "[per_cpu]") {
+  Rings rings(16, 1);
+  REQUIRE(rings.mode() == Rings::Mode::SHARED);
+  REQUIRE(rings.ring_count() == 1);
+  REQUIRE(rings.try_emplace(Record{1, 0, {}}));
+  Record out;
+  REQUIRE(rings.try_pop(out));
+  REQUIRE(out.ts == 1);
+}
+
+TEST_CASE("Per-CPU rings under many preempted producers",
+          "[per_cpu][threaded]") {
+  // More threads than CPUs: producers are preempted inside the critical
+  // section and must restart rather than corrupt a slot.
+  const bool allow_rseq = GENERATE(true, false);
+  constexpr int kProducers = 32;
+  constexpr uint64_t kItems = 5'000;
+  Rings rings(64, Rings::configured_cpus() + 1, allow_rseq);
+
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.emplace_back([&, p] {
+      for (uint64_t i = 0; i < kItems; ++i) {
+        Record r{i, static_cast<uint64_t>(p), {}};
+        for (uint64_t &word : r.payload)
+          word = i * kProducers + p;
+        while (!rings.try_emplace(r))
+          std::this_thread::yield();
+      }
+    });
+  }
+
+  // A producer that migrates spreads its records over several rings, and
+  // the merge orders by `ts`, which here is only per producer: check
+  // that every record arrives once and intact, not the order.
+  std::vector<uint64_t> count(kProducers, 0), sum(kProducers, 0);
+  bool intact = true;
+  for (uint64_t consumed = 0; consumed < kProducers * kItems;) {
+    Record r;
+    if (!rings.try_pop(r)) {
+      std::this_thread::yield();
+      continue;
+    }
+    for (uint64_t word : r.payload)
+      intact &= word == r.ts * kProducers + r.producer;
+    ++count[r.producer];
+    sum[r.producer] += r.ts;
+    ++consumed;
+  }
+  for (auto &t : producers)
+    t.join();
+  REQUIRE(intact);
+  REQUIRE(count == std::vector<uint64_t>(kProducers, kItems));
+  const uint64_t expected_sum = kItems * (kItems - 1) / 2;
+  REQUIRE(sum == std::vector<uint64_t>(kProducers, expected_sum));
+  REQUIRE(rings.size() == 0);
+}
@@ -0,0 +1,177 @@
+#include <catch2/catch_all.hpp> // For Catch2 v3.x
+
+#include "waffle/processor/iprocessor.hpp"
+#include "waffle/waffle.hpp"
+
+#include "test_support.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+using namespace Waffle;
+using test_support::hash_of;
+
+namespace {
+
+// Keeps every record; after hold(), blocks on the next one until released,
+// so that the lanes fill up behind it.
+class GatedCollector : public IProcessor {
+public:
+  void on_record(const Tracelet &record,
+                 const std::unordered_map<uint64_t, std::string> &) override {
+    std::unique_lock<std::mutex> lock(mutex);
+    _released.wait(lock, [this] { return _open; });
+    records.push_back(record);
+  }
+
+  void hold() {
+    std::lock_guard<std::mutex> lock(mutex);
+    _open = false;
+  }
+  void release() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      _open = true;
+    }
+    _released.notify_all();
+  }
+  size_t size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return records.size();
+  }
+
+  std::mutex mutex;
+  std::vector<Tracelet> records;
+
+private:
+  std::condition_variable _released;
+  bool _open = true;
+};
+
+} // namespace
+
+TEST_CASE("Lanes keep cross-lane order while the consumer keeps up",
+          "[lanes]") {
+  auto collector = std::make_shared<GatedCollector>();
+  Waffle::setup({{collector}, 1 << 14});
+  auto &tracer = *Waffle::detail::g_tracer_instance;
+  static constinit StaticStringSource bulk("bulk", 4);
+  for (int i = 0; i < 3000; ++i) {
+    // NORMAL start, BULK event, CRITICAL end.
+    Span span = tracer.start_span("op", kInvalidId, kInvalidId);
+    tracer.create_event(bulk, span.id(), kInvalidId, Priority::BULK);
+    span.end();
+    if (i % 256 == 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  Waffle::shutdown();
+
+  size_t spans = 0;
+  std::unordered_set<uint64_t> open;
+  uint64_t last_ts = 0;
+  for (const Tracelet &r : collector->records) {
+    REQUIRE(r.timestamp >= last_ts);
+    last_ts = r.timestamp;
+    if (r.record_type == Tracelet::RecordType::SPAN_START) {
+      open.insert(r.span_id.value);
+    } else if (r.record_type == Tracelet::RecordType::EVENT) {
+      REQUIRE(open.count(r.span_id.value));
+    } else if (r.record_type == Tracelet::RecordType::SPAN_END) {
+      REQUIRE(open.erase(r.span_id.value) == 1);
+      ++spans;
+    }
+  }
+  REQUIRE(spans == 3000);
+}
+
+TEST_CASE("A flooded lane only drops its own records", "[lanes]") {
+  auto collector = std::make_shared<GatedCollector>();
+  TracerOptions options{{collector}, 1024};
+  options.critical_ring_capacity = 256;
+  options.bulk_ring_capacity = 256;
+  Waffle::setup(options);
+  auto &tracer = *Waffle::detail::g_tracer_instance;
+  static constinit StaticStringSource noise("noise", 5);
+  static constinit StaticStringSource error("error", 5);
+
+  // Let this thread's first records through before blocking the processing
+  // thread, so that the lanes hold only the records below.
+  std::vector<Span> spans;
+  auto request = [&] {
+    spans.push_back(tracer.start_span("request", kInvalidId, kInvalidId));
+  };
+  request();
+  tracer.create_event(noise, spans[0].id(), kInvalidId, Priority::BULK);
+  tracer.create_event(error, spans[0].id(), kInvalidId, Priority::CRITICAL);
+  spans[0].end();
+  while (collector->size() < 5) // With the THREAD_INFO record
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  collector->hold();
+
+  // The processing thread is stuck on the first record from here on.
+  for (int i = 0; i < 100; ++i) {
+    request();
+    for (int j = 0; j < 100; ++j)
+      tracer.create_event(noise, spans.back().id(), kInvalidId,
+                          Priority::BULK);
+  }
+  for (int i = 1; i <= 100; ++i)
+    tracer.create_event(error, spans[i].id(), kInvalidId, Priority::CRITICAL);
+  for (int i = 1; i <= 100; ++i)
+    spans[i].end();
+
+  REQUIRE(tracer.dropped_records(Priority::BULK) > 9000);
+  REQUIRE(tracer.dropped_records(Priority::NORMAL) == 0);
+  REQUIRE(tracer.dropped_records(Priority::CRITICAL) == 0);
+  REQUIRE(tracer.dropped_records() ==
+          tracer.dropped_records(Priority::BULK));
+  collector->release();
+  Waffle::shutdown();
+
+  size_t starts = 0, ends = 0, errors = 0;
+  for (const Tracelet &r : collector->records) {
+    starts += r.record_type == Tracelet::RecordType::SPAN_START;
+    ends += r.record_type == Tracelet::RecordType::SPAN_END;
+    errors += r.record_type == Tracelet::RecordType::EVENT &&
+              r.name_string_hash == hash_of("error");
+  }
+  REQUIRE(starts == 101);
+  REQUIRE(ends == 101);
+  REQUIRE(errors == 101);
+}
+
+TEST_CASE("Span ends stay behind their starts while the consumer is behind",
+          "[lanes]") {
+  auto collector = std::make_shared<GatedCollector>();
+  Waffle::setup({{collector}, 1024});
+  auto &tracer = *Waffle::detail::g_tracer_instance;
+  Span first = tracer.start_span("first", kInvalidId, kInvalidId);
+  first.end();
+  while (collector->size() < 3) // With the THREAD_INFO record
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  collector->hold();
+
+  // Fill the NORMAL lane past half, so that the next drains use weighted
+  // rounds, which would otherwise take the CRITICAL ends first.
+  for (int i = 0; i < 800; ++i) {
+    Span span = tracer.start_span("op", kInvalidId, kInvalidId);
+    span.end();
+  }
+  REQUIRE(tracer.dropped_records() == 0);
+  collector->release();
+  Waffle::shutdown();
+
+  size_t spans = 0;
+  std::unordered_set<uint64_t> open;
+  for (const Tracelet &r : collector->records) {
+    if (r.record_type == Tracelet::RecordType::SPAN_START) {
+      open.insert(r.span_id.value);
+    } else if (r.record_type == Tracelet::RecordType::SPAN_END) {
+      REQUIRE(open.erase(r.span_id.value) == 1);
+      ++spans;
+    }
+  }
+  REQUIRE(spans == 801);
+}
@@ -0,0 +1,156 @@
+#include <catch2/catch_all.hpp> // For Catch2 v3.x
+
+#include "waffle/query/span_query.hpp"
+
+#include "test_support.hpp"
+
+using namespace Waffle;
+using namespace Waffle::query;
+using test_support::hash_of;
+
+namespace {
+
+Attribute int_attr(std::string_view key, int64_t v) {
+  Attribute a;
+  a.key_id = hash_of(key);
+  a.value.type = AttributeValue::Type::INT64;
+  a.value.i64 = v;
+  return a;
+}
+
+Attribute string_attr(std::string_view key, std::string_view v) {
+  Attribute a;
+  a.key_id = hash_of(key);
+  a.value.type = AttributeValue::Type::STRING_ID;
+  a.value.string_id = hash_of(v);
+  return a;
+}
+
+// 1000 "allreduce" spans of 1..1000 us alternating between comm ranks 0 and
+// 1, and 999 "compute" spans (an odd count, so kernel tails are exercised)
+// of 1 us with no attributes.
+SpanTable make_table() {
+  std::unordered_map<uint64_t, std::string> strings;
+  for (const char *s : {"allreduce", "compute", "rank", "op", "sum"})
+    strings[hash_of(s)] = s;
+
+  SpanTable table;
+  for (uint64_t i = 1; i <= 1000; ++i) {
+    const Attribute attrs[] = {int_attr("rank", int64_t(i % 2)),
+                               string_attr("op", "sum")};
+    table.append({hash_of("allreduce"), i * 10'000, i * 1'000, 0, 1, 1, i},
+                 std::begin(attrs), std::end(attrs), strings);
+  }
+  for (uint64_t i = 1; i <= 999; ++i)
+    table.append({hash_of("compute"), i * 10'000, 1'000, 0, 2, 1, 5000 + i},
+                 nullptr, nullptr, strings);
+  return table;
+}
+
+} // namespace
+
+TEST_CASE("Predicates parse fields, operators and values", "[query]") {
+  Predicate p = Predicate::parse("duration>10ms");
+  REQUIRE(p.field == Predicate::Field::DURATION);
+  REQUIRE(p.op == CompareOp::GT);
+  REQUIRE(std::get<int64_t>(p.value) == 10'000'000);
+
+  p = Predicate::parse("name = 42");
+  REQUIRE(p.field == Predicate::Field::NAME);
+  REQUIRE(std::get<std::string>(p.value) == "42");
+
+  p = Predicate::parse("attr.rank!=1");
+  REQUIRE(p.field == Predicate::Field::ATTRIBUTE);
+  REQUIRE(p.attribute == "rank");
+  REQUIRE(p.op == CompareOp::NE);
+  REQUIRE(std::get<int64_t>(p.value) == 1);
+
+  p = Predicate::parse("ratio<=0.5");
+  REQUIRE(p.op == CompareOp::LE);
+  REQUIRE(std::get<double>(p.value) == 0.5);
+
+  REQUIRE(std::get<std::string>(Predicate::parse("op=\"sum\"").value) ==
+          "sum");
+  REQUIRE_THROWS_AS(Predicate::parse("duration"), std::invalid_argument);
+  REQUIRE_THROWS_AS(Predicate::parse("=5"), std::invalid_argument);
+}
+
+TEST_CASE("Queries filter and aggregate span columns", "[query]") {
+  const SpanTable table = make_table();
+  REQUIRE(table.rows() == 1999);
+
+  SECTION("Group by name with exact percentiles") {
+    const QueryResult r = run_query(table, Query{});
+    REQUIRE(r.matched == 1999);
+    REQUIRE(r.groups.size() == 2);
+    const GroupStats &g = r.groups[0]; // Largest total first
+    REQUIRE(g.name == "allreduce");
+    REQUIRE(g.count == 1000);
+    REQUIRE(g.min_ns == 1'000);
+    REQUIRE(g.max_ns == 1'000'000);
+    REQUIRE(g.percentiles_ns == std::vector<uint64_t>{500'000, 900'000,
+                                                      990'000});
+  }
+
+  SECTION("Predicates on names, durations and attributes combine") {
+    Query q;
+    q.where = {Predicate::parse("name=allreduce"),
+               Predicate::parse("rank=1"), // Built-in rank column
+               Predicate::parse("duration>100.5us")};
+    REQUIRE(run_query(table, q).matched == 0);
+
+    q.where[1] = Predicate::parse("attr.rank=1");
+    const QueryResult r = run_query(table, q);
+    // Odd i in [101, 1000]
+    REQUIRE(r.matched == 450);
+    REQUIRE(r.groups[0].min_ns == 101'000);
+  }
+
+  SECTION("Spans without the attribute never match") {
+    Query q;
+    q.where = {Predicate::parse("attr.rank!=7")};
+    REQUIRE(run_query(table, q).matched == 1000);
+    q.where = {Predicate::parse("op=sum")};
+    REQUIRE(run_query(table, q).matched == 1000);
+    q.where = {Predicate::parse("op!=max")};
+    REQUIRE(run_query(table, q).matched == 1000);
+    q.where = {Predicate::parse("missing>=0")};
+    REQUIRE(run_query(table, q).matched == 0);
+  }
+
+  SECTION("Unknown names and ordering on strings") {
+    Query q;
+    q.where = {Predicate::parse("name=nope")};
+    REQUIRE(run_query(table, q).matched == 0);
+    q.where = {Predicate::parse("name!=nope")};
+    REQUIRE(run_query(table, q).matched == 1999);
+    q.where = {Predicate::parse("name<b")};
+    REQUIRE_THROWS_AS(run_query(table, q), std::invalid_argument);
+  }
+
+  SECTION("Out-of-range literals on narrow columns") {
+    Query q;
+    q.group_by_name = false;
+    q.where = {Predicate::parse("thread<5000000000")};
+    REQUIRE(run_query(table, q).matched == 1999);
+    q.where = {Predicate::parse("duration>-1")};
+    REQUIRE(run_query(table, q).groups.at(0).count == 1999);
+  }
+}
+
+TEST_CASE("Scan kernels handle every operator and block tails", "[query]") {
+  std::vector<uint64_t> column(131);
+  for (size_t i = 0; i < column.size(); ++i)
+    column[i] = i;
+  auto matches = [&](CompareOp op, uint64_t v) {
+    std::vector<uint8_t> mask(column.size(), 1);
+    kernels::filter_u64(column.data(), column.size(), op, v, mask.data());
+    return kernels::count(mask.data(), mask.size());
+  };
+  REQUIRE(matches(CompareOp::EQ, 130) == 1);
+  REQUIRE(matches(CompareOp::NE, 130) == 130);
+  REQUIRE(matches(CompareOp::LT, 70) == 70);
+  REQUIRE(matches(CompareOp::LE, 70) == 71);
+  REQUIRE(matches(CompareOp::GT, 70) == 60);
+  REQUIRE(matches(CompareOp::GE, 70) == 61);
+}
@@ -178,6 +178,20 @@ TEST_CASE("MpscRingBuffer Basic Operations", "[ring_buffer]") {
     }
     REQUIRE_FALSE(rb.try_pop(val)); // Buffer should be empty
   }
+
+  SECTION("Front peeks at the next element") {
+    REQUIRE(rb.front() == nullptr);
+    REQUIRE(rb.try_emplace(7));
+    REQUIRE(rb.try_emplace(8));
+    REQUIRE(rb.size() == 2);
+    REQUIRE(rb.capacity() == 4);
+    REQUIRE(*rb.front() == 7);
+    int val;
+    REQUIRE(rb.try_pop(val));
+    REQUIRE(val == 7);
+    REQUIRE(*rb.front() == 8);
+    REQUIRE(rb.size() == 1);
+  }
 }
 
 TEST_CASE("MpscRingBuffer Wrap Around Behavior", "[ring_buffer]") {
@@ -232,6 +246,76 @@ TEST_CASE("MpscRingBuffer Wrap Around Behavior", "[ring_buffer]") {
   }
 }
 
+TEST_CASE("MpscRingBuffer Multi-Slot Claims", "[ring_buffer]") {
+  /**
+   * @brief Verifies try_claim(): n slots reserved with one CAS, filled in
+   * order and published individually or as a group.
+   * Setup: A ring buffer of capacity 4.
+   * Verifies: Group visibility, wrap-around, full/invalid claims, and that
+   * slots a Claim leaves unfilled are skipped by the consumer.
+   */
+  MpscRingBuffer<int> rb(4);
+  int val;
+
+  SECTION("A group becomes visible at once") {
+    auto claim = rb.try_claim(3);
+    REQUIRE(claim);
+    REQUIRE(claim.size() == 3);
+    claim.emplace(1);
+    claim.emplace(2);
+    REQUIRE(rb.front() == nullptr); // Claimed, not published
+    claim.publish();
+    REQUIRE(rb.try_pop(val));
+    REQUIRE(val == 1);
+    REQUIRE(rb.try_pop(val));
+    REQUIRE(val == 2);
+    REQUIRE_FALSE(rb.try_pop(val));
+    claim.emplace(3);
+    claim.publish(); // Individually
+    REQUIRE(rb.try_pop(val));
+    REQUIRE(val == 3);
+  }
+
+  SECTION("Claims wrap around and respect free space") {
+    for (int i = 0; i < 3; ++i) {
+      REQUIRE(rb.try_emplace(i));
+      REQUIRE(rb.try_pop(val));
+    }
+    REQUIRE_FALSE(rb.try_claim(0));
+    REQUIRE_FALSE(rb.try_claim(5));
+    {
+      auto claim = rb.try_claim(4); // Tickets 3..6: slots 3, 0, 1, 2
+      REQUIRE(claim);
+      REQUIRE_FALSE(rb.try_claim(1)); // Full
+      for (int i = 10; i < 14; ++i)
+        claim.emplace(i);
+    } // The destructor publishes
+    for (int i = 10; i < 14; ++i) {
+      REQUIRE(rb.try_pop(val));
+      REQUIRE(val == i);
+    }
+    REQUIRE(rb.size() == 0);
+  }
+
+  SECTION("Unfilled slots are skipped") {
+    {
+      auto claim = rb.try_claim(3);
+      claim.emplace(7);
+      auto moved = std::move(claim);
+      REQUIRE_FALSE(claim);
+      REQUIRE(moved.filled() == 1);
+    }
+    REQUIRE(rb.try_emplace(8));
+    REQUIRE(rb.try_pop(val));
+    REQUIRE(val == 7);
+    REQUIRE(*rb.front() == 8);
+    REQUIRE(rb.try_pop(val));
+    REQUIRE(val == 8);
+    REQUIRE(rb.size() == 0);
+    REQUIRE(rb.try_claim(4)); // All slots were returned
+  }
+}
+
 TEST_CASE("MpscRingBuffer Object Lifecycle and Move Semantics",
           "[ring_buffer]") {
   /**
@@ -576,6 +660,66 @@ TEST_CASE("MpscRingBuffer High Contention MPSC Test",
   REQUIRE(unique_consumed_items.size() == static_cast<size_t>(total_items));
 }
 
+TEST_CASE("MpscRingBuffer Concurrent Burst Claims",
+          "[ring_buffer][threaded][contention]") {
+  /**
+   * @brief Objective: Producers claim bursts of 1..8 slots on a small buffer.
+   * Verifies: Every item arrives once, each burst is contiguous in consumer
+   * order, and each producer's bursts arrive in order.
+   */
+  const size_t capacity = 16;
+  const int num_producers = 4;
+  const int bursts_per_producer = 2000;
+  MpscRingBuffer<long> rb(capacity);
+
+  // Value: producer << 32 | burst << 8 | size << 4 | index in burst.
+  auto producer_task = [&](int producer) {
+    for (long burst = 0; burst < bursts_per_producer; ++burst) {
+      const long size = 1 + (burst + producer) % 8;
+      auto claim = rb.try_claim(size);
+      while (!claim) {
+        std::this_thread::yield();
+        claim = rb.try_claim(size);
+      }
+      for (long i = 0; i < size; ++i)
+        claim.emplace((static_cast<long>(producer) << 32) | burst << 8 |
+                      size << 4 | i);
+      claim.publish();
+    }
+  };
+  std::vector<std::thread> producers;
+  for (int i = 0; i < num_producers; ++i)
+    producers.emplace_back(producer_task, i);
+
+  std::vector<long> next_burst(num_producers, 0);
+  long expected_total = 0;
+  for (int p = 0; p < num_producers; ++p)
+    for (long b = 0; b < bursts_per_producer; ++b)
+      expected_total += 1 + (b + p) % 8;
+  for (long consumed = 0; consumed < expected_total;) {
+    long first;
+    if (!rb.try_pop(first)) {
+      std::this_thread::yield();
+      continue;
+    }
+    const int producer = static_cast<int>(first >> 32);
+    const long burst = (first >> 8) & 0xFFFFFF;
+    const long size = (first >> 4) & 0xF;
+    REQUIRE((first & 0xF) == 0);
+    REQUIRE(burst == next_burst[producer]++);
+    for (long i = 1; i < size; ++i) {
+      long v;
+      REQUIRE(rb.try_pop(v)); // Published as a group
+      REQUIRE(v == (first | i));
+    }
+    consumed += size;
+  }
+  for (auto &t : producers)
+    t.join();
+  long v;
+  REQUIRE_FALSE(rb.try_pop(v));
+}
+
 TEST_CASE(
     "MpscRingBuffer Simplified Multi-Producer, Single-Consumer Sanity Test",
     "[ring_buffer][threaded][simple_sanity]") {
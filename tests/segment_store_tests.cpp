@@ -0,0 +1,266 @@
+#include <catch2/catch_all.hpp> // For Catch2 v3.x
+
+#include "waffle/store/segment_store.hpp"
+#include "waffle/trace_file/trace_file_reader.hpp"
+
+#include "test_support.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <unistd.h>
+
+using namespace Waffle;
+using Waffle::store::MappedSegment;
+using Waffle::store::SegmentReader;
+using Waffle::store::SegmentStore;
+using test_support::hash_of;
+
+namespace {
+
+uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+std::string store_directory(std::string_view name) {
+  const auto path = std::filesystem::temp_directory_path() /
+                    ("waffle_store_" + std::string(name) + "_" +
+                     std::to_string(::getpid()));
+  std::filesystem::remove_all(path);
+  return path.string();
+}
+
+struct Feeder : test_support::Feeder<SegmentStore> {
+  using test_support::Feeder<SegmentStore>::Feeder;
+
+  // A span of its own trace: start and end, `ts` apart by 10ns.
+  void span(uint64_t trace, uint64_t ts, std::string_view name = "request") {
+    using RT = Tracelet::RecordType;
+    sink.on_record(Tracelet(ts, 0, Id{trace}, Id{trace}, kInvalidId,
+                            kInvalidId, intern(name), RT::SPAN_START, 1, 0),
+                   strings);
+    sink.on_record(Tracelet(ts + 10, 0, Id{trace}, Id{trace}, kInvalidId,
+                            kInvalidId, 0, RT::SPAN_END, 1, 0),
+                   strings);
+  }
+};
+
+SegmentStore::Options small_segments(std::string directory) {
+  SegmentStore::Options options;
+  options.directory = std::move(directory);
+  options.segment_bytes = 64 << 10;
+  options.chunk_bytes = 4 << 10;
+  options.bloom_bits = 1 << 12;
+  // The tests feed records far faster than a loaded machine writes them;
+  // nothing may be dropped.
+  options.max_queued_chunks = 1 << 20;
+  return options;
+}
+
+} // namespace
+
+TEST_CASE("Segment store rolls over into sealed segments", "[store]") {
+  const std::string dir = store_directory("roll");
+  SegmentStore store(small_segments(dir));
+  store.on_start({0x42, 1});
+  Feeder f{store};
+  const uint64_t t0 = now_ns();
+  for (uint64_t i = 1; i <= 2000; ++i)
+    f.span(i, t0 + i * 100, i % 2 ? "request" : "query");
+  store.shutdown();
+
+  const auto segments = store::list_segments(dir);
+  REQUIRE(segments.size() > 3);
+  REQUIRE(store.stats().records_written == 4000);
+  REQUIRE(store.stats().segments_sealed == segments.size());
+  REQUIRE(store.stats().write_errors == 0);
+  uint64_t previous_max = 0, requests = 0;
+  for (const auto &info : segments) {
+    REQUIRE(info.sealed);
+    REQUIRE(info.bytes == 64 << 10); // Preallocated size kept
+    REQUIRE(info.min_timestamp > previous_max);
+    previous_max = info.max_timestamp;
+
+    MappedSegment segment(info.path);
+    REQUIRE(segment.has_index());
+    REQUIRE(segment.header().process_tag == 0x42);
+    REQUIRE(segment.min_timestamp() == info.min_timestamp);
+    REQUIRE(segment.max_timestamp() == info.max_timestamp);
+    REQUIRE(segment.name_count(hash_of("span_end")) == 0);
+    requests += segment.name_count(hash_of("request"));
+  }
+  REQUIRE(requests == 1000);
+
+  // Each segment is an ordinary trace file with its own strings.
+  trace_file::TraceFileReader reader(segments.back().path);
+  trace_file::TraceRecord r;
+  size_t records = 0;
+  while (reader.next(r))
+    ++records;
+  REQUIRE(records > 0);
+  REQUIRE(reader.strings().at(hash_of("query")) == "query");
+  std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("Segment reader opens only the segments it needs", "[store]") {
+  const std::string dir = store_directory("read");
+  SegmentStore store(small_segments(dir));
+  store.on_start({0, 0});
+  Feeder f{store};
+  const uint64_t t0 = now_ns();
+  for (uint64_t i = 1; i <= 2000; ++i)
+    f.span(i, t0 + i * 100);
+  store.shutdown();
+  const size_t segment_count = store::list_segments(dir).size();
+
+  // A time range: records in it, in order, from one or two segments.
+  SegmentReader range(dir, t0 + 100'000, t0 + 110'000);
+  trace_file::TraceRecord r;
+  std::vector<uint64_t> traces;
+  while (range.next(r)) {
+    REQUIRE(r.tracelet.timestamp >= t0 + 100'000);
+    REQUIRE(r.tracelet.timestamp <= t0 + 110'000);
+    if (r.tracelet.record_type == Tracelet::RecordType::SPAN_START)
+      traces.push_back(r.tracelet.trace_id.value);
+  }
+  REQUIRE(traces.size() == 101);
+  REQUIRE(std::is_sorted(traces.begin(), traces.end()));
+  REQUIRE(range.segments_opened() <= 2);
+  REQUIRE(range.strings().at(hash_of("request")) == "request");
+
+  // A trace over all time: the bloom filters skip most segments.
+  SegmentReader trace(dir, 0, UINT64_MAX, Id{1234});
+  size_t records = 0;
+  while (trace.next(r)) {
+    REQUIRE(r.tracelet.trace_id == Id{1234});
+    ++records;
+  }
+  REQUIRE(records == 2);
+  REQUIRE(trace.segments_opened() == segment_count);
+  std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("Segment store deletes the oldest segments", "[store]") {
+  const std::string dir = store_directory("retain");
+  SegmentStore::Options options = small_segments(dir);
+  options.max_total_bytes = 256 << 10;
+  SegmentStore store(options);
+  store.on_start({0, 0});
+  Feeder f{store};
+  const uint64_t t0 = now_ns();
+  for (uint64_t i = 1; i <= 5000; ++i)
+    f.span(i, t0 + i * 100);
+  store.shutdown();
+
+  const auto segments = store::list_segments(dir);
+  REQUIRE(segments.size() == 4);
+  REQUIRE(store.stats().segments_deleted ==
+          store.stats().segments_sealed - 4);
+  // The newest records are the ones kept.
+  REQUIRE(segments.back().max_timestamp == t0 + 5000 * 100 + 10);
+  REQUIRE(segments.front().sequence == store.stats().segments_sealed - 3);
+
+  // Segments whose newest record is older than max_age go too.
+  SegmentStore::Options aged = options;
+  aged.max_age = std::chrono::hours(1);
+  SegmentStore old_store(aged);
+  Feeder old{old_store};
+  std::ofstream(dir + "/unrelated.txt") << "kept";
+  old_store.on_start({0, 0});
+  old.span(1, now_ns() - 7200'000'000'000); // Alone in its own segment
+  old_store.shutdown();
+  REQUIRE(old_store.stats().segments_sealed == 1);
+  REQUIRE(old_store.stats().segments_deleted == 1);
+  REQUIRE(store::list_segments(dir).size() == 4);
+  REQUIRE(std::filesystem::exists(dir + "/unrelated.txt"));
+  std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("Segment store recovers an unsealed segment", "[store]") {
+  const std::string dir = store_directory("recover");
+  {
+    SegmentStore store(small_segments(dir));
+    store.on_start({0, 0});
+    Feeder f{store};
+    const uint64_t t0 = now_ns();
+    for (uint64_t i = 1; i <= 100; ++i)
+      f.span(i, t0 + i * 100);
+    store.flush();
+
+    // The writer has the .part segment; readers see what it wrote so far.
+    trace_file::TraceRecord r;
+    size_t records = 0;
+    for (int attempt = 0; attempt < 100 && records < 200; ++attempt) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      SegmentReader reader(dir, 0, UINT64_MAX);
+      records = 0;
+      while (reader.next(r))
+        ++records;
+    }
+    REQUIRE(records == 200);
+
+    // Simulates a crash: the segment stays a .part file.
+    std::filesystem::copy_file(store::list_segments(dir).front().path,
+                               dir + "/saved");
+    store.shutdown();
+    for (const auto &info : store::list_segments(dir))
+      std::filesystem::remove(info.path);
+    std::filesystem::rename(dir + "/saved", dir + "/0000000007.wseg.part");
+  }
+
+  SegmentStore store(small_segments(dir));
+  store.on_start({0, 0});
+  store.shutdown();
+  const auto segments = store::list_segments(dir);
+  REQUIRE(segments.size() == 1);
+  REQUIRE(segments[0].sealed);
+  REQUIRE(segments[0].sequence == 7);
+  MappedSegment segment(segments[0].path);
+  REQUIRE_FALSE(segment.has_index());
+  REQUIRE(segment.min_timestamp() == segments[0].min_timestamp);
+  REQUIRE(segment.may_contain_trace(Id{12345}));
+
+  SegmentReader reader(dir, 0, UINT64_MAX, Id{50});
+  trace_file::TraceRecord r;
+  size_t records = 0;
+  while (reader.next(r))
+    ++records;
+  REQUIRE(records == 2);
+  std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("Corrupt segment offsets stay inside the mapping", "[store]") {
+  const std::string dir = store_directory("corrupt");
+  {
+    SegmentStore store(small_segments(dir));
+    store.on_start({0, 0});
+    Feeder f{store};
+    const uint64_t t0 = now_ns();
+    for (uint64_t i = 1; i <= 100; ++i)
+      f.span(i, t0 + i * 100);
+    store.shutdown();
+  }
+  const auto segments = store::list_segments(dir);
+  REQUIRE(segments.size() == 1);
+  const std::string path = segments[0].path;
+  const auto size = std::filesystem::file_size(path);
+  auto patch = [&](size_t offset, auto value) {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(static_cast<std::streamoff>(offset));
+    file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+  };
+
+  // A footer offset that wraps when the index size is added to it.
+  patch(size - sizeof(trace_file::SegmentIndexTrailer), ~uint64_t{0} - 8);
+  {
+    MappedSegment segment(path);
+    REQUIRE_FALSE(segment.has_index());
+    REQUIRE(segment.min_timestamp() == segments[0].min_timestamp);
+  }
+
+  patch(offsetof(trace_file::FileHeader, header_size), uint32_t{1} << 30);
+  REQUIRE_THROWS_AS(MappedSegment(path), std::system_error);
+  std::filesystem::remove_all(dir);
+}
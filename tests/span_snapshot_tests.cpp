@@ -0,0 +1,148 @@
+#include <catch2/catch_all.hpp> // For Catch2 v3.x
+
+#include "waffle/processor/span_snapshot.hpp"
+
+#include "test_support.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+
+using namespace Waffle;
+
+namespace {
+
+uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+struct Feeder : test_support::Feeder<SpanSnapshotProcessor> {
+  using test_support::Feeder<SpanSnapshotProcessor>::Feeder;
+
+  template <typename... Attrs>
+  void start(uint64_t ts, uint64_t span, uint64_t parent, uint64_t cause,
+             std::string_view name, uint16_t thread, Attrs... attrs) {
+    sink.on_record(Tracelet(ts, 0, Id{1}, Id{span}, Id{parent}, Id{cause},
+                            intern(name), Tracelet::RecordType::SPAN_START,
+                            thread, 0, attrs...),
+                   strings);
+  }
+  void end(uint64_t ts, uint64_t span, uint16_t thread) {
+    sink.on_record(Tracelet(ts, 0, Id{1}, Id{span}, kInvalidId, kInvalidId, 0,
+                            Tracelet::RecordType::SPAN_END, thread, 0),
+                   strings);
+  }
+  void thread_info(uint16_t thread, std::string_view name, int64_t tid) {
+    sink.on_record(Tracelet(1, 0, kInvalidId, kInvalidId, kInvalidId,
+                            kInvalidId, intern(name),
+                            Tracelet::RecordType::THREAD_INFO, thread, 0,
+                            int_attr(kThreadIdAttribute, tid)),
+                   strings);
+  }
+};
+
+std::string slurp(const std::string &path) {
+  std::ifstream in(path);
+  return std::string((std::istreambuf_iterator<char>(in)),
+                     std::istreambuf_iterator<char>());
+}
+
+// Polls `condition` for up to five seconds.
+template <typename F> bool eventually(F condition) {
+  for (int i = 0; i < 500; ++i) {
+    if (condition())
+      return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return false;
+}
+
+} // namespace
+
+TEST_CASE("Span snapshot lists open spans per thread", "[snapshot]") {
+  SpanSnapshotProcessor processor;
+  processor.on_start({0, 0});
+  Feeder f{processor};
+  const uint64_t t0 = now_ns() - 2'000'000'000; // Two seconds ago
+
+  f.thread_info(1, "worker", 4242);
+  f.start(t0, 10, 0, 0, "train_step", 1);
+  f.start(t0 + 1000, 11, 10, 0, "allreduce", 1);
+  f.start(t0 + 2000, 12, 11, 0, "finished", 1);
+  f.end(t0 + 3000, 12, 1);
+  f.start(t0 + 4000, 20, 0, 0, "send", 2);
+  f.start(t0 + 5000, 21, 0, 20, "recv", 3); // Caused by the open send
+  f.start(t0 + 6000, 22, 10, 99, "late", 3); // Parent on another thread
+  REQUIRE(processor.open_spans() == 5);
+
+  const SpanSnapshot s = processor.snapshot("test");
+  REQUIRE(s.threads.size() == 3);
+  const auto &worker = s.threads[0];
+  REQUIRE(worker.index == 1);
+  REQUIRE(worker.name == "worker");
+  REQUIRE(worker.tid == 4242);
+  REQUIRE(worker.stack.size() == 2);
+  REQUIRE(s.strings.at(worker.stack[0].start.name_string_hash) ==
+          "train_step");
+  REQUIRE(worker.stack[0].depth == 0);
+  REQUIRE(worker.stack[1].depth == 1);
+  REQUIRE(worker.stack[0].age_ns >= 2'000'000'000);
+  REQUIRE(worker.stack[0].age_ns > worker.stack[1].age_ns);
+
+  REQUIRE(s.threads[2].stack.size() == 2);
+  REQUIRE(s.threads[2].stack[1].depth == 0); // Stacks are per thread
+
+  REQUIRE(s.pending_links.size() == 2);
+  REQUIRE(s.pending_links[0].span_id == Id{21});
+  REQUIRE(s.pending_links[0].cause_open);
+  REQUIRE(s.pending_links[0].cause_thread == 2);
+  REQUIRE_FALSE(s.pending_links[1].cause_open);
+
+  std::ostringstream text;
+  s.format(text);
+  REQUIRE(text.str().find("5 open spans on 3 threads") != std::string::npos);
+  REQUIRE(text.str().find("thread 1 \"worker\" (tid 4242)\n  train_step  open "
+                          "2.") != std::string::npos);
+  REQUIRE(text.str().find("\n    allreduce  open ") != std::string::npos);
+  REQUIRE(text.str().find("cause still open on thread 2") !=
+          std::string::npos);
+  processor.shutdown();
+}
+
+TEST_CASE("Span snapshot watchdog and signal dumps", "[snapshot]") {
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "waffle_snapshot_test.txt")
+          .string();
+  std::filesystem::remove(path);
+  SpanSnapshotProcessor::Options options;
+  options.deadline = std::chrono::milliseconds(200);
+  options.poll_interval = std::chrono::milliseconds(10);
+  options.dump_signal = SIGUSR2;
+  options.dump_path = path;
+  SpanSnapshotProcessor processor(options);
+  processor.on_start({0, 0});
+  Feeder f{processor};
+
+  f.start(now_ns(), 1, 0, 0, "quick", 1);
+  f.end(now_ns(), 1, 1);
+  f.start(now_ns(), 2, 0, 0, "stuck", 1);
+  REQUIRE(eventually([&] { return processor.dumps() == 1; }));
+  REQUIRE(slurp(path).find("(span 'stuck' open for ") != std::string::npos);
+
+  // Still open, but already reported: no second dump.
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  REQUIRE(processor.dumps() == 1);
+
+  std::raise(SIGUSR2);
+  REQUIRE(eventually([&] { return processor.dumps() == 2; }));
+  REQUIRE(slurp(path).find("=== Waffle span snapshot (signal " +
+                           std::to_string(SIGUSR2) + "): 1 open spans") !=
+          std::string::npos);
+
+  processor.shutdown();
+  std::filesystem::remove(path);
+}
@@ -0,0 +1,86 @@
+#include <catch2/catch_all.hpp>
+
+#include "waffle/waffle.hpp"
+#include "waffle/waffle_static_key.hpp"
+
+namespace {
+Waffle::StaticKey g_test_key;
+
+// Kept out of line so each call exercises the same patched site.
+[[gnu::noinline]] int guarded_work(int x) {
+  if (Waffle::static_branch_unlikely(g_test_key)) {
+    return x * 3;
+  }
+  return x + 1;
+}
+
+int g_attr_evaluations = 0;
+Waffle::Attribute counted_attribute() {
+  ++g_attr_evaluations;
+  return Waffle::Attribute{};
+}
+} // namespace
+
+TEST_CASE("StaticKey patches its call sites", "[waffle][static_key]") {
+  /**
+   * @brief Verifies that toggling a StaticKey flips every site guarded by it.
+   * Objective: A disabled site falls through, an enabled site takes the jump,
+   * and repeated toggles to the same state are no-ops.
+   */
+  REQUIRE_FALSE(g_test_key.is_enabled());
+  REQUIRE(guarded_work(1) == 2);
+
+  g_test_key.enable();
+  REQUIRE(g_test_key.is_enabled());
+  REQUIRE(guarded_work(1) == 3);
+
+  g_test_key.enable(); // Already enabled: must not re-patch into garbage.
+  REQUIRE(guarded_work(2) == 6);
+
+  g_test_key.disable();
+  REQUIRE_FALSE(g_test_key.is_enabled());
+  REQUIRE(guarded_work(1) == 2);
+}
+
+TEST_CASE("Tracing sites are inert until setup", "[waffle][static_key]") {
+  /**
+   * @brief Verifies that WAFFLE_SPAN / WAFFLE_EVENT sites do nothing while
+   * tracing is disabled, including not evaluating their arguments.
+   */
+  g_attr_evaluations = 0;
+  {
+    WAFFLE_SPAN("disabled_span", counted_attribute());
+    REQUIRE(Waffle::context::get_current_span_id() == Waffle::kInvalidId);
+    WAFFLE_EVENT("disabled_event", counted_attribute());
+  }
+  REQUIRE(g_attr_evaluations == 0);
+
+  Waffle::setup();
+  {
+    WAFFLE_SPAN("enabled_span", counted_attribute());
+    REQUIRE(Waffle::context::get_current_span_id() != Waffle::kInvalidId);
+  }
+  REQUIRE(g_attr_evaluations == 1); // Arguments are evaluated exactly once.
+  Waffle::shutdown();
+
+  {
+    WAFFLE_SPAN("disabled_again");
+    REQUIRE(Waffle::context::get_current_span_id() == Waffle::kInvalidId);
+  }
+}
+
+TEST_CASE("A span ended by shutdown restores its parent",
+          "[waffle][static_key]") {
+  /**
+   * @brief Verifies that a Span destroyed after shutdown() no longer leaves
+   * itself as the current span: spans after the next setup() must not get
+   * it as their parent.
+   */
+  Waffle::setup();
+  {
+    WAFFLE_SPAN("outlives_tracing");
+    REQUIRE(Waffle::context::get_current_span_id() != Waffle::kInvalidId);
+    Waffle::shutdown();
+  }
+  REQUIRE(Waffle::context::get_current_span_id() == Waffle::kInvalidId);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+// Helpers shared by the tests that feed records straight to a processor or
+// writer, without a tracer in between.
+
+#include "waffle/waffle_common_types.hpp"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace test_support {
+
+// The id the tracer interns `s` under.
+inline uint64_t hash_of(std::string_view s) {
+  return Waffle::fnv1a_hash(s.data(), s.size());
+}
+
+// Holds the strings the fed records refer to, as the tracer's string table
+// would, and builds their attributes. Each test derives the record shapes
+// it needs and hands `strings` to `sink` with them.
+template <typename Sink> struct Feeder {
+  explicit Feeder(Sink &sink) : sink(sink) {}
+
+  Sink &sink;
+  std::unordered_map<uint64_t, std::string> strings;
+
+  // Adds `s` to the strings and returns its id.
+  uint64_t intern(std::string_view s) {
+    const uint64_t id = hash_of(s);
+    strings[id] = std::string(s);
+    return id;
+  }
+
+  Waffle::Attribute attr(std::string_view key,
+                         Waffle::AttributeValue::Type type) {
+    Waffle::Attribute a;
+    a.key_id = intern(key);
+    a.value.type = type;
+    return a;
+  }
+  Waffle::Attribute int_attr(std::string_view key, int64_t v) {
+    Waffle::Attribute a = attr(key, Waffle::AttributeValue::Type::INT64);
+    a.value.i64 = v;
+    return a;
+  }
+  Waffle::Attribute double_attr(std::string_view key, double v) {
+    Waffle::Attribute a = attr(key, Waffle::AttributeValue::Type::DOUBLE);
+    a.value.f64 = v;
+    return a;
+  }
+  Waffle::Attribute bool_attr(std::string_view key, bool v) {
+    Waffle::Attribute a = attr(key, Waffle::AttributeValue::Type::BOOL);
+    a.value.b = v;
+    return a;
+  }
+  Waffle::Attribute string_attr(std::string_view key, std::string_view v) {
+    Waffle::Attribute a = attr(key, Waffle::AttributeValue::Type::STRING_ID);
+    a.value.string_id = intern(v);
+    return a;
+  }
+};
+
+} // namespace test_support
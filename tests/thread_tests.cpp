@@ -0,0 +1,128 @@
+#include <catch2/catch_all.hpp> // For Catch2 v3.x
+
+#include "waffle/model/thread_tracks.hpp"
+#include "waffle/waffle.hpp"
+
+#include <thread>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+using Waffle::Attribute;
+using Waffle::AttributeValue;
+using Waffle::Id;
+using Waffle::kInvalidId;
+using Waffle::Tracelet;
+
+namespace {
+Tracelet make_tracelet(Tracelet::RecordType type, uint16_t thread_index,
+                       uint16_t cpu, uint64_t ts = 0) {
+  return Tracelet(ts, 0, kInvalidId, Id{1}, kInvalidId, kInvalidId, 0, type,
+                  thread_index, cpu);
+}
+} // namespace
+
+TEST_CASE("current_cpu reports the CPU the thread runs on",
+          "[waffle][thread]") {
+#if defined(__linux__)
+  // Pin to one CPU so that the two reads cannot straddle a migration.
+  cpu_set_t original;
+  REQUIRE(sched_getaffinity(0, sizeof(original), &original) == 0);
+  const int cpu = sched_getcpu();
+  cpu_set_t pinned;
+  CPU_ZERO(&pinned);
+  CPU_SET(cpu, &pinned);
+  REQUIRE(sched_setaffinity(0, sizeof(pinned), &pinned) == 0);
+
+  REQUIRE(Waffle::detail::current_cpu() == sched_getcpu());
+
+  sched_setaffinity(0, sizeof(original), &original);
+#else
+  SUCCEED("No CPU id source on this platform");
+#endif
+}
+
+TEST_CASE("Threads get distinct, stable indices", "[waffle][thread]") {
+  Waffle::setup();
+  auto &tracer = *Waffle::detail::g_tracer_instance;
+
+  const uint16_t main_index = tracer.current_thread_index();
+  REQUIRE(main_index != Waffle::kInvalidThreadIndex);
+  REQUIRE(tracer.current_thread_index() == main_index);
+
+  uint16_t other_index = Waffle::kInvalidThreadIndex;
+  std::thread([&] { other_index = tracer.current_thread_index(); }).join();
+  REQUIRE(other_index != Waffle::kInvalidThreadIndex);
+  REQUIRE(other_index != main_index);
+
+  Waffle::shutdown();
+
+  // The index survives the Tracer; a new Tracer re-announces the thread.
+  Waffle::setup();
+  REQUIRE(Waffle::detail::g_tracer_instance->current_thread_index() ==
+          main_index);
+  REQUIRE(Waffle::detail::t_thread_state.epoch != 0);
+  Waffle::shutdown();
+}
+
+TEST_CASE("ThreadTracks maps records to threads and migrations",
+          "[waffle][thread][model]") {
+  Waffle::model::ThreadTracks tracks;
+  const std::string thread_name = "worker";
+  const uint64_t name_hash =
+      Waffle::fnv1a_hash(thread_name.data(), thread_name.size());
+  const uint64_t tid_key = Waffle::fnv1a_hash(
+      Waffle::kThreadIdAttribute.data(), Waffle::kThreadIdAttribute.size());
+  const std::unordered_map<uint64_t, std::string> strings = {
+      {name_hash, thread_name}, {tid_key, "thread.id"}};
+
+  AttributeValue tid;
+  tid.type = AttributeValue::Type::INT64;
+  tid.i64 = 4242;
+  const Tracelet info(0, 0, kInvalidId, kInvalidId, kInvalidId, kInvalidId,
+                      name_hash, Tracelet::RecordType::THREAD_INFO, 3, 0,
+                      Attribute{tid_key, tid});
+
+  SECTION("THREAD_INFO populates the thread table") {
+    REQUIRE(tracks.find(3) == nullptr);
+    REQUIRE_FALSE(tracks.observe(info, strings).has_value());
+    const auto *thread = tracks.find(3);
+    REQUIRE(thread != nullptr);
+    REQUIRE(thread->tid == 4242);
+    REQUIRE(thread->name == "worker");
+  }
+
+  SECTION("A change of CPU is reported once") {
+    tracks.observe(info, strings);
+    REQUIRE_FALSE(tracks
+                      .observe(make_tracelet(Tracelet::RecordType::SPAN_START,
+                                             3, 0, 10),
+                               strings)
+                      .has_value());
+    auto migration = tracks.observe(
+        make_tracelet(Tracelet::RecordType::SPAN_END, 3, 2, 20), strings);
+    REQUIRE(migration.has_value());
+    REQUIRE(migration->thread_index == 3);
+    REQUIRE(migration->from_cpu == 0);
+    REQUIRE(migration->to_cpu == 2);
+    REQUIRE(migration->timestamp == 20);
+    REQUIRE_FALSE(
+        tracks
+            .observe(make_tracelet(Tracelet::RecordType::EVENT, 3, 2), strings)
+            .has_value());
+  }
+
+  SECTION("Threads are tracked independently and unknown CPUs are ignored") {
+    tracks.observe(make_tracelet(Tracelet::RecordType::EVENT, 3, 0), strings);
+    REQUIRE_FALSE(
+        tracks
+            .observe(make_tracelet(Tracelet::RecordType::EVENT, 4, 1), strings)
+            .has_value());
+    REQUIRE_FALSE(tracks
+                      .observe(make_tracelet(Tracelet::RecordType::EVENT, 3,
+                                             Waffle::kUnknownCpu),
+                               strings)
+                      .has_value());
+  }
+}
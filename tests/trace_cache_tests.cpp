@@ -0,0 +1,235 @@
+#include <catch2/catch_all.hpp> // For Catch2 v3.x
+
+#include "waffle/live/live_stream.hpp"
+#include "waffle/live/trace_cache.hpp"
+
+#include "test_support.hpp"
+
+#include <atomic>
+#include <filesystem>
+#include <thread>
+#include <unistd.h>
+
+using namespace Waffle;
+using Waffle::live::CachedTrace;
+using Waffle::live::TraceCache;
+using test_support::hash_of;
+
+namespace {
+
+uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+struct Feeder : test_support::Feeder<TraceCache> {
+  using test_support::Feeder<TraceCache>::Feeder;
+
+  template <typename... Attrs>
+  void record(Tracelet::RecordType type, uint64_t ts, uint64_t trace,
+              uint64_t span, uint64_t parent, std::string_view name,
+              Attrs... attrs) {
+    sink.on_record(Tracelet(ts, 0, Id{trace}, Id{span}, Id{parent}, kInvalidId,
+                            type == Tracelet::RecordType::SPAN_END
+                                ? 0
+                                : intern(name),
+                            type, 1, 0, attrs...),
+                   strings);
+  }
+  // A root span with one child, all of `trace`.
+  void trace(uint64_t trace, uint64_t ts) {
+    using RT = Tracelet::RecordType;
+    record(RT::SPAN_START, ts, trace, trace, 0, "request",
+           string_attr("route", "/checkout"));
+    record(RT::SPAN_START, ts + 10, trace, trace + 1, trace, "query");
+    record(RT::SPAN_END, ts + 20, trace, trace + 1, 0, "");
+    record(RT::SPAN_END, ts + 30, trace, trace, 0, "");
+  }
+};
+
+std::string socket_path() {
+  return (std::filesystem::temp_directory_path() /
+          ("waffle_cache_" + std::to_string(::getpid())))
+      .string();
+}
+
+} // namespace
+
+TEST_CASE("Trace cache returns every span of a trace", "[cache]") {
+  TraceCache cache;
+  cache.on_start({0x42, 1});
+  Feeder f{cache};
+  using RT = Tracelet::RecordType;
+  const uint64_t t0 = now_ns();
+
+  // Two traces interleaved, plus an event and a span that never ends.
+  f.record(RT::SPAN_START, t0, 100, 100, 0, "request",
+           f.string_attr("route", "/checkout"));
+  f.record(RT::SPAN_START, t0 + 1, 200, 200, 0, "request");
+  f.record(RT::SPAN_START, t0 + 2, 100, 101, 100, "query");
+  f.record(RT::EVENT, t0 + 3, 100, 101, 101, "retry");
+  f.record(RT::SPAN_END, t0 + 4, 100, 101, 0, "");
+  f.record(RT::SPAN_START, t0 + 5, 100, 102, 100, "hung");
+  f.record(RT::SPAN_END, t0 + 6, 200, 200, 0, "");
+  f.record(RT::SPAN_END, t0 + 7, 100, 100, 0, "");
+
+  const CachedTrace trace = cache.get_trace(Id{100});
+  REQUIRE(trace.spans.size() == 3);
+  REQUIRE(trace.spans[0].start.span_id == Id{100});
+  REQUIRE(trace.spans[0].end_ns == t0 + 7);
+  REQUIRE(trace.spans[0].start.num_attributes == 1);
+  REQUIRE(trace.strings.at(trace.spans[0].start.attributes[0].value
+                               .string_id) == "/checkout");
+  REQUIRE(trace.spans[1].start.span_id == Id{101});
+  REQUIRE(trace.spans[1].start.parent_span_id == Id{100});
+  REQUIRE(trace.spans[1].end_ns == t0 + 4);
+  REQUIRE(trace.spans[2].start.record_type == RT::EVENT);
+  REQUIRE(trace.strings.at(trace.spans[2].start.name_string_hash) ==
+          "retry");
+
+  REQUIRE(cache.get_trace(Id{200}).spans.size() == 1);
+  REQUIRE(cache.get_trace(Id{300}).spans.empty());
+  REQUIRE(cache.stats().spans_cached == 4);
+
+  // Exported traces read back as ordinary trace files.
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "waffle_cache_export.wft")
+          .string();
+  REQUIRE(cache.export_trace(Id{100}, path) == 3);
+  trace_file::TraceFileReader reader(path);
+  REQUIRE(reader.header().process_tag == 0x42);
+  trace_file::TraceRecord r;
+  std::vector<RT> types;
+  while (reader.next(r))
+    types.push_back(r.tracelet.record_type);
+  REQUIRE(types == std::vector<RT>{RT::SPAN_START, RT::SPAN_START, RT::EVENT,
+                                   RT::SPAN_END, RT::SPAN_END});
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("Trace cache reuses its oldest segment", "[cache]") {
+  TraceCache::Options options;
+  options.segment_bytes = 16 << 10;
+  options.max_bytes = 64 << 10;
+  TraceCache cache(options);
+  cache.on_start({0, 0});
+  Feeder f{cache};
+  const uint64_t t0 = now_ns();
+  for (uint64_t i = 1; i <= 2000; ++i)
+    f.trace(i * 16, t0 + i * 100);
+
+  REQUIRE(cache.stats().segments_recycled > 0);
+  REQUIRE(cache.get_trace(Id{16}).spans.empty());
+  REQUIRE(cache.get_trace(Id{2000 * 16}).spans.size() == 2);
+  // About 64 KiB of 104 / 80 byte spans are retained.
+  size_t retained = 0;
+  for (uint64_t i = 1; i <= 2000; ++i)
+    retained += cache.get_trace(Id{i * 16}).spans.size();
+  REQUIRE(retained > 400);
+  REQUIRE(retained < 800);
+}
+
+TEST_CASE("Trace cache expires spans by age", "[cache]") {
+  TraceCache::Options options;
+  options.max_age = std::chrono::seconds(5);
+  TraceCache cache(options);
+  cache.on_start({0, 0});
+  Feeder f{cache};
+  f.trace(16, now_ns() - 60'000'000'000);
+  REQUIRE(cache.get_trace(Id{16}).spans.empty());
+  f.trace(32, now_ns());
+  REQUIRE(cache.get_trace(Id{32}).spans.size() == 2);
+  cache.flush();
+  REQUIRE(cache.stats().segments_recycled == 0); // Newest span is recent
+}
+
+TEST_CASE("Trace cache bounds the spans waiting for their end", "[cache]") {
+  TraceCache::Options options;
+  options.max_open_spans = 4;
+  TraceCache cache(options);
+  cache.on_start({0, 0});
+  Feeder f{cache};
+  using RT = Tracelet::RecordType;
+  const uint64_t t0 = now_ns();
+  for (uint64_t i = 1; i <= 10; ++i) // Their ends were dropped
+    f.record(RT::SPAN_START, t0 + i, 16, 16 + i, 0, "lost");
+  REQUIRE(cache.stats().open_spans_evicted == 6);
+  f.record(RT::SPAN_END, t0 + 20, 16, 17, 0, ""); // Evicted
+  f.record(RT::SPAN_END, t0 + 20, 16, 26, 0, "");
+  REQUIRE(cache.get_trace(Id{16}).spans.size() == 1);
+}
+
+TEST_CASE("Trace cache lookups run concurrently with appends", "[cache]") {
+  TraceCache::Options options;
+  options.segment_bytes = 16 << 10;
+  options.max_bytes = 64 << 10;
+  TraceCache cache(options);
+  cache.on_start({0, 0});
+  std::atomic<uint64_t> last_complete{0};
+  std::atomic<bool> done{false};
+  uint64_t found = 0;
+  uint64_t inconsistent = 0; // Catch2 assertions are main-thread only
+  std::thread reader([&] {
+    while (!done) {
+      const uint64_t id = last_complete.load();
+      if (id == 0)
+        continue;
+      const CachedTrace trace = cache.get_trace(Id{id});
+      for (const auto &span : trace.spans)
+        inconsistent += span.start.trace_id != Id{id} ||
+                        span.end_ns < span.start.timestamp;
+      inconsistent += trace.spans.size() > 2;
+      found += !trace.spans.empty();
+    }
+  });
+  Feeder f{cache};
+  const uint64_t t0 = now_ns();
+  for (uint64_t i = 1; i <= 50'000; ++i) {
+    f.trace(i * 16, t0 + i * 100);
+    last_complete = i * 16;
+  }
+  done = true;
+  reader.join();
+  REQUIRE(inconsistent == 0);
+  REQUIRE(found > 0);
+}
+
+TEST_CASE("Trace cache serves traces on its control socket", "[cache]") {
+  TraceCache::Options options;
+  options.control_socket = socket_path();
+  TraceCache cache(options);
+  cache.on_start({0x42, 1});
+  Feeder f{cache};
+  const uint64_t t0 = now_ns();
+  f.trace(16, t0);
+  f.trace(32, t0 + 100);
+
+  live::LiveStreamClient client(options.control_socket, "trace=0x20");
+  REQUIRE(client.header().process_tag == 0x42);
+  trace_file::TraceRecord r;
+  std::vector<uint64_t> spans;
+  while (client.next(r)) {
+    REQUIRE(r.tracelet.trace_id == Id{32});
+    spans.push_back(r.tracelet.span_id.value);
+  }
+  REQUIRE(spans == std::vector<uint64_t>{32, 33, 33, 32});
+  REQUIRE(client.strings().at(hash_of("route")) == "route");
+
+  // Further terms narrow the spans returned.
+  live::LiveStreamClient queries(options.control_socket,
+                                 "trace=16 trace=32 name=query");
+  size_t records = 0;
+  while (queries.next(r)) {
+    REQUIRE(r.tracelet.span_id.value % 16 == 1);
+    ++records;
+  }
+  REQUIRE(records == 4);
+
+  REQUIRE_THROWS_AS(live::LiveStreamClient(options.control_socket,
+                                           "name=query"),
+                    std::invalid_argument);
+  REQUIRE(cache.stats().requests_served == 2);
+  cache.shutdown();
+  REQUIRE_FALSE(std::filesystem::exists(options.control_socket));
+}
@@ -0,0 +1,162 @@
+#include <catch2/catch_all.hpp> // For Catch2 v3.x
+
+#include "waffle/profile/trace_diff.hpp"
+
+#include "test_support.hpp"
+
+#include <cmath>
+#include <random>
+#include <sstream>
+
+using namespace Waffle;
+using Waffle::profile::SpanPathProfile;
+using test_support::hash_of;
+
+namespace {
+
+struct Recording {
+  SpanPathProfile profile;
+  std::unordered_map<uint64_t, std::string> strings;
+  uint64_t next_id = 1;
+
+  void start(uint64_t id, uint64_t parent, std::string_view name,
+             uint64_t ts) {
+    strings[hash_of(name)] = std::string(name);
+    profile.add(Tracelet(ts, 0, Id{1}, Id{id}, Id{parent}, kInvalidId,
+                         hash_of(name), Tracelet::RecordType::SPAN_START, 1,
+                         0),
+                strings);
+  }
+  void end(uint64_t id, uint64_t ts) {
+    profile.add(Tracelet(ts, 0, Id{1}, Id{id}, kInvalidId, kInvalidId, 0,
+                         Tracelet::RecordType::SPAN_END, 1, 0),
+                strings);
+  }
+  // request -> {checkout -> query, render}, with the given durations.
+  void request(uint64_t query_ns, uint64_t render_ns, uint64_t ts) {
+    const uint64_t root = next_id, checkout = root + 1, query = root + 2,
+                   render = root + 3;
+    next_id += 4;
+    start(root, 0, "request", ts);
+    start(checkout, root, "checkout", ts + 10);
+    start(query, checkout, "query", ts + 20);
+    end(query, ts + 20 + query_ns);
+    end(checkout, ts + 30 + query_ns);
+    start(render, root, "render", ts + 40 + query_ns);
+    end(render, ts + 40 + query_ns + render_ns);
+    end(root, ts + 50 + query_ns + render_ns);
+  }
+};
+
+} // namespace
+
+TEST_CASE("Span paths align across recordings", "[diff]") {
+  Recording a, b;
+  a.request(1000, 500, 0);
+  b.request(3000, 500, 100);
+  // "query" elsewhere in the tree is a different path.
+  b.start(100, 0, "query", 0);
+  b.end(100, 50);
+
+  REQUIRE(a.profile.span_count() == 4);
+  REQUIRE(b.profile.span_count() == 5);
+  REQUIRE(b.profile.paths().size() == 5);
+  uint64_t query = 0;
+  for (const auto &[id, path] : a.profile.paths())
+    if (a.profile.frames(id) == "request;checkout;query")
+      query = id;
+  REQUIRE(query != 0);
+  const auto &bq = b.profile.paths().at(query);
+  REQUIRE(bq.count == 1);
+  REQUIRE(bq.total_ns == 3000);
+  REQUIRE(bq.self_ns == 3000);
+  // checkout's self time excludes the query.
+  const auto &checkout = b.profile.paths().at(bq.parent);
+  REQUIRE(checkout.total_ns == 3020);
+  REQUIRE(checkout.self_ns == 20);
+
+  // Merging another rank adds its spans to the same paths.
+  a.profile.merge(b.profile);
+  REQUIRE(a.profile.paths().at(query).count == 2);
+  REQUIRE(a.profile.span_count() == 9);
+  REQUIRE(a.profile.frames(query) == "request;checkout;query");
+}
+
+TEST_CASE("Rank test on sketches", "[diff]") {
+  std::mt19937_64 rng(7);
+  std::lognormal_distribution<double> base(std::log(1e6), 0.3);
+  std::lognormal_distribution<double> slower(std::log(1.1e6), 0.3);
+  model::DurationSketch a, a2, b;
+  for (int i = 0; i < 5000; ++i) {
+    a.add(static_cast<uint64_t>(base(rng)));
+    a2.add(static_cast<uint64_t>(base(rng)));
+    b.add(static_cast<uint64_t>(slower(rng)));
+  }
+  const auto same = profile::mann_whitney(a, a2);
+  REQUIRE(same.p_value > 0.001);
+  REQUIRE(std::abs(same.prob_greater - 0.5) < 0.02);
+  REQUIRE(profile::ks_distance(a, a2) < 0.05);
+
+  const auto shifted = profile::mann_whitney(a, b);
+  REQUIRE(shifted.p_value < 1e-20);
+  REQUIRE(shifted.z > 0);
+  // 10% slower with sigma 0.3: P(slower) = Phi(ln 1.1 / (0.3 sqrt 2)).
+  REQUIRE(std::abs(shifted.prob_greater - 0.587) < 0.02);
+  REQUIRE(profile::mann_whitney(b, a).z < 0);
+  REQUIRE(profile::ks_distance(a, b) > 0.1);
+}
+
+TEST_CASE("Trace diff ranks regressions by added time", "[diff]") {
+  std::mt19937_64 rng(11);
+  std::normal_distribution<double> noise(1.0, 0.05);
+  auto jitter = [&](double ns) {
+    return static_cast<uint64_t>(ns * noise(rng));
+  };
+  Recording base, target;
+  for (uint64_t i = 0; i < 2000; ++i) {
+    base.request(jitter(100'000), jitter(20'000), i * 1'000'000);
+    // The query is 20% slower (20us per request); render 50% (10us).
+    target.request(jitter(120'000), jitter(30'000), i * 1'000'000);
+  }
+  // A path only the target has.
+  target.start(1'000'000, 0, "migrate", 0);
+  target.end(1'000'000, 5'000'000);
+
+  const auto diffs = profile::diff_profiles(base.profile, target.profile);
+  REQUIRE(diffs.size() == 4);
+  REQUIRE(diffs[0].frames == "request"); // +30us
+  // Checkout and its query both add about 20us.
+  const auto &query =
+      diffs[1].frames == "request;checkout;query" ? diffs[1] : diffs[2];
+  REQUIRE(query.frames == "request;checkout;query");
+  REQUIRE(query.significant);
+  REQUIRE(std::abs(query.change - 0.2) < 0.01);
+  REQUIRE(std::abs(query.impact_ns / (2000 * 20'000.0) - 1) < 0.05);
+  // Within the sketch's accuracy, plus the noise of the sample median.
+  REQUIRE(std::abs(query.target_p50_ns / 120'000.0 - 1) < 0.04);
+  REQUIRE(diffs[3].frames == "request;render");
+  REQUIRE(std::abs(diffs[3].change - 0.5) < 0.02);
+
+  std::ostringstream report;
+  profile::write_diff_report(report, diffs, base.profile, target.profile);
+  const std::string text = report.str();
+  REQUIRE(text.find("request;checkout;query") < text.find("request;render"));
+  REQUIRE(text.find("Improvements") < text.find("none"));
+  REQUIRE(text.find("Only in target:") < text.find("migrate"));
+
+  // Differential flame graph: base and target self time per stack.
+  std::ostringstream folded;
+  profile::write_diff_folded(folded, base.profile, target.profile, false);
+  std::istringstream lines(folded.str());
+  std::string stack;
+  uint64_t before, after;
+  size_t count = 0;
+  while (lines >> stack >> before >> after) {
+    ++count;
+    if (stack == "migrate")
+      REQUIRE((before == 0 && after == 5'000'000));
+    if (stack == "request;checkout;query")
+      REQUIRE(std::abs(after / (before * 1.2) - 1) < 0.01);
+  }
+  REQUIRE(count == 5);
+}
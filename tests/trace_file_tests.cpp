@@ -0,0 +1,339 @@
+#include <catch2/catch_all.hpp> // For Catch2 v3.x
+
+#include "waffle/merge/trace_merge.hpp"
+#include "waffle/trace_file/trace_file_lookup.hpp"
+#include "waffle/trace_file/trace_file_reader.hpp"
+#include "waffle/trace_file/trace_file_writer.hpp"
+
+#include "test_support.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+using namespace Waffle;
+using namespace Waffle::trace_file;
+using test_support::hash_of;
+
+namespace {
+
+std::string temp_path(const std::string &name) {
+  return (std::filesystem::temp_directory_path() / ("waffle_" + name))
+      .string();
+}
+
+FileHeader rank_header(uint64_t process_tag, uint32_t rank = kNoRank) {
+  FileHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof(header.magic));
+  header.version = kVersion;
+  header.header_size = sizeof(header);
+  header.process_tag = process_tag;
+  header.rank = rank;
+  return header;
+}
+
+Tracelet record(uint64_t ts, uint64_t span, uint64_t cause, uint64_t name,
+                Tracelet::RecordType type) {
+  return Tracelet(ts, 0, Id{span}, Id{span}, kInvalidId, Id{cause}, name,
+                  type, 1, 0);
+}
+
+std::vector<TraceRecord> read_all(const std::string &path) {
+  TraceFileReader reader(path);
+  std::vector<TraceRecord> out;
+  TraceRecord r;
+  while (reader.next(r))
+    out.push_back(r);
+  return out;
+}
+
+} // namespace
+
+TEST_CASE("Trace files round-trip records and strings", "[trace_file]") {
+  const std::string path = temp_path("roundtrip.wtrace");
+  const uint64_t kName = hash_of("work");
+  const uint64_t kKey = hash_of("rows");
+
+  {
+    // Tiny chunks so that the records span several chunks.
+    TraceFileEncoder encoder(path, rank_header(7, 3), 256);
+    encoder.add_string(kName, "work");
+    encoder.add_string(kKey, "rows");
+    Attribute rows;
+    rows.key_id = kKey;
+    rows.value.type = AttributeValue::Type::INT64;
+    rows.value.i64 = -5;
+    for (uint64_t i = 0; i < 20; ++i)
+      encoder.add_record(Tracelet((20 - i) * 10, i, Id{1}, Id{i + 1},
+                                  kInvalidId, kInvalidId, kName,
+                                  Tracelet::RecordType::EVENT, 2, 3, rows));
+  }
+
+  TraceFileReader reader(path);
+  REQUIRE(reader.header().process_tag == 7);
+  REQUIRE(reader.header().rank == 3);
+
+  TraceRecord r;
+  uint64_t last_chunk_max = 0;
+  size_t count = 0;
+  while (reader.next(r)) {
+    ++count;
+    const Tracelet &t = r.tracelet;
+    REQUIRE(reader.strings().at(t.name_string_hash) == "work");
+    REQUIRE(t.num_attributes == 1);
+    REQUIRE(reader.strings().at(t.attributes[0].key_id) == "rows");
+    REQUIRE(t.attributes[0].value.i64 == -5);
+    REQUIRE(t.thread_index == 2);
+    REQUIRE(t.cpu_id == 3);
+    REQUIRE(t.timestamp >= reader.current_chunk().min_timestamp);
+    REQUIRE(t.timestamp <= reader.current_chunk().max_timestamp);
+    last_chunk_max = reader.current_chunk().max_timestamp;
+  }
+  REQUIRE(count == 20);
+  REQUIRE(last_chunk_max > 0);
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("Trace files keep each record's domain", "[trace_file]") {
+  const std::string path = temp_path("domains.wtrace");
+  {
+    TraceFileEncoder encoder(path, rank_header(1));
+    for (uint8_t d = 0; d < kMaxDomains; ++d)
+      encoder.add_record(Tracelet(d + 1, 0, Id{1}, Id{1}, kInvalidId,
+                                  kInvalidId, 0, Tracelet::RecordType::EVENT,
+                                  1, 0, Domain{d}));
+  }
+  const auto records = read_all(path);
+  REQUIRE(records.size() == kMaxDomains);
+  for (uint8_t d = 0; d < kMaxDomains; ++d) {
+    REQUIRE(records[d].tracelet.domain == d);
+    REQUIRE(records[d].tracelet.record_type == Tracelet::RecordType::EVENT);
+  }
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("A truncated trace file ends at the last complete chunk",
+          "[trace_file]") {
+  const std::string path = temp_path("truncated.wtrace");
+  {
+    TraceFileEncoder encoder(path, rank_header(1), 64 * 4);
+    for (uint64_t i = 1; i <= 8; ++i)
+      encoder.add_record(record(i, i, 0, 0, Tracelet::RecordType::EVENT));
+  }
+  // Halfway is in the second RECORDS chunk; the end is the chunk index.
+  const auto full = std::filesystem::file_size(path);
+  std::filesystem::resize_file(path, full / 2);
+
+  const auto records = read_all(path);
+  REQUIRE(!records.empty());
+  REQUIRE(records.size() < 8);
+  REQUIRE(records.front().tracelet.timestamp == 1);
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("A corrupt chunk size ends the file without a huge allocation",
+          "[trace_file]") {
+  const std::string path = temp_path("corrupt_size.wtrace");
+  {
+    std::ofstream out(path, std::ios::binary);
+    const FileHeader header = rank_header(1);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    ChunkHeader chunk{};
+    chunk.type = ChunkType::RECORDS;
+    chunk.record_count = 1;
+    chunk.payload_size = uint64_t{1} << 50;
+    out.write(reinterpret_cast<const char *>(&chunk), sizeof(chunk));
+    out.write("garbage", 7);
+  }
+  REQUIRE(read_all(path).empty());
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("A record of unknown type is dropped as corrupt", "[trace_file]") {
+  const std::string path = temp_path("bad_type.wtrace");
+  {
+    std::ofstream out(path, std::ios::binary);
+    const FileHeader header = rank_header(1);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    RecordHeader records[2] = {
+        encode_header(record(1, 1, 0, 0, Tracelet::RecordType::EVENT), 0),
+        encode_header(record(2, 1, 0, 0, Tracelet::RecordType::EVENT), 0)};
+    records[1].record_type = 0x0E;
+    ChunkHeader chunk{};
+    chunk.type = ChunkType::RECORDS;
+    chunk.record_count = 2;
+    chunk.payload_size = sizeof(records);
+    out.write(reinterpret_cast<const char *>(&chunk), sizeof(chunk));
+    out.write(reinterpret_cast<const char *>(records), sizeof(records));
+  }
+  const auto records = read_all(path);
+  REQUIRE(records.size() == 1);
+  REQUIRE(records[0].tracelet.timestamp == 1);
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("waffle-merge aligns skewed rank clocks and interleaves records",
+          "[trace_file][merge]") {
+  // Rank 1's clock runs 5us ahead of rank 0's; messages take 1us each way.
+  const int64_t kSkew = 5000, kDelay = 1000;
+  const uint64_t kTag0 = 1, kTag1 = 2;
+  const uint64_t kSend = hash_of("send"), kRecv = hash_of("recv");
+  const std::string in0 = temp_path("rank0.wtrace");
+  const std::string in1 = temp_path("rank1.wtrace");
+  {
+    TraceFileEncoder rank0(in0, rank_header(kTag0));
+    TraceFileEncoder rank1(in1, rank_header(kTag1));
+    for (auto *e : {&rank0, &rank1}) {
+      e->add_string(kSend, "send");
+      e->add_string(kRecv, "recv");
+    }
+    for (uint64_t k = 1; k <= 10; ++k) {
+      const uint64_t t = 100000 * k;
+      // 0 -> 1
+      const uint64_t s0 = (kTag0 << 40) | k;
+      rank0.add_record(record(t, s0, 0, kSend, Tracelet::RecordType::SPAN_START));
+      rank1.add_record(record(t + kDelay + kSkew + k, 0, s0, kRecv,
+                              Tracelet::RecordType::EVENT));
+      // 1 -> 0
+      const uint64_t s1 = (kTag1 << 40) | k;
+      rank1.add_record(record(t + 50000 + kSkew, s1, 0, kSend,
+                              Tracelet::RecordType::SPAN_START));
+      rank0.add_record(record(t + 50000 + kDelay + k, 0, s1, kRecv,
+                              Tracelet::RecordType::EVENT));
+    }
+  }
+
+  const auto clocks = merge::estimate_clock_offsets({in0, in1}, 2);
+  REQUIRE(clocks.matched_pairs == 20);
+  REQUIRE(clocks.offsets_ns[0] == 0);
+  REQUIRE(clocks.offsets_ns[1] == kSkew);
+
+  SECTION("Waffle output") {
+    const std::string out = temp_path("merged.wtrace");
+    merge::MergeOptions options;
+    options.inputs = {in0, in1};
+    options.output = out;
+    options.threads = 2;
+    const auto stats = merge::merge_traces(options);
+    REQUIRE(stats.records == 40);
+
+    TraceFileReader reader(out);
+    REQUIRE((reader.header().flags & kFlagMerged) != 0);
+    TraceRecord r;
+    uint64_t last = 0;
+    std::unordered_map<uint64_t, std::pair<uint16_t, uint64_t>> sends;
+    while (reader.next(r)) {
+      const Tracelet &t = r.tracelet;
+      REQUIRE(t.timestamp >= last);
+      last = t.timestamp;
+      REQUIRE(reader.strings().count(t.name_string_hash) == 1);
+      if (t.record_type == Tracelet::RecordType::SPAN_START) {
+        sends[t.span_id.value] = {r.rank, t.timestamp};
+      } else {
+        // Every receive comes after its send, on the other rank.
+        const auto &send = sends.at(t.cause_id.value);
+        REQUIRE(send.first != r.rank);
+        REQUIRE(t.timestamp > send.second);
+      }
+    }
+    std::filesystem::remove(out);
+  }
+
+  SECTION("Perfetto output") {
+    const std::string out = temp_path("merged.json");
+    merge::MergeOptions options;
+    options.inputs = {in0, in1};
+    options.output = out;
+    options.format = merge::MergeOptions::Format::PERFETTO;
+    REQUIRE(merge::merge_traces(options).records == 40);
+
+    std::ifstream in(out);
+    std::stringstream json;
+    json << in.rdbuf();
+    const std::string text = json.str();
+    REQUIRE(text.rfind("{\"displayTimeUnit\"", 0) == 0);
+    REQUIRE(text.find("\"name\":\"recv\"") != std::string::npos);
+    REQUIRE(text.find("\"ph\":\"f\"") != std::string::npos);
+    REQUIRE(text.find("\"pid\":1") != std::string::npos);
+    std::filesystem::remove(out);
+  }
+
+  SECTION("Merged files are rejected as inputs") {
+    const std::string out = temp_path("merged_again.wtrace");
+    merge::MergeOptions options;
+    options.inputs = {in0};
+    options.output = out;
+    merge::merge_traces(options);
+    options.inputs = {out};
+    options.output = temp_path("unused.wtrace");
+    REQUIRE_THROWS_AS(merge::merge_traces(options), std::invalid_argument);
+    std::filesystem::remove(out);
+  }
+
+  std::filesystem::remove(in0);
+  std::filesystem::remove(in1);
+}
+
+TEST_CASE("Trace file lookups read only the chunks that may match",
+          "[trace_file][lookup]") {
+  const std::string path = temp_path("lookup.wtrace");
+  const uint64_t kRequest = hash_of("request"), kQuery = hash_of("query");
+  using RT = Tracelet::RecordType;
+  {
+    // 64 records of 64 bytes per chunk: 4 traces of 8 spans each.
+    TraceFileEncoder encoder(path, rank_header(7), 64 * 64);
+    encoder.add_string(kRequest, "request");
+    encoder.add_string(kQuery, "query");
+    for (uint64_t trace = 1; trace <= 1000; ++trace) {
+      const uint64_t ts = trace * 1000;
+      for (uint64_t s = 0; s < 8; ++s) {
+        const uint64_t name = s == 0 ? kRequest : kQuery;
+        encoder.add_record(Tracelet(ts + s, 0, Id{trace}, Id{trace * 8 + s},
+                                    kInvalidId, kInvalidId, name,
+                                    RT::SPAN_START, 1, 0));
+        encoder.add_record(Tracelet(ts + 100 + s, 0, Id{trace},
+                                    Id{trace * 8 + s}, kInvalidId, kInvalidId,
+                                    0, RT::SPAN_END, 1, 0));
+      }
+    }
+  }
+
+  TraceFileLookup file(path);
+  REQUIRE(file.has_index());
+  REQUIRE(file.header().process_tag == 7);
+  REQUIRE(file.chunk_count() == 250);
+
+  // One trace: its chunk plus the rare bloom false positive.
+  const auto trace = file.find({Id{777}});
+  REQUIRE(trace.size() == 16);
+  for (const auto &r : trace)
+    REQUIRE(r.tracelet.trace_id == Id{777});
+  REQUIRE(file.chunks_decoded() >= 1);
+  REQUIRE(file.chunks_decoded() <= 5);
+  REQUIRE(file.strings().at(kRequest) == "request");
+  REQUIRE(file.find({Id{5000}}).empty());
+
+  // A name within a time range: chunks outside it are never read.
+  TraceFileLookup::Query by_name;
+  by_name.name_hash = kRequest;
+  by_name.from_ns = 100'000;
+  by_name.to_ns = 199'999;
+  const auto requests = file.find(by_name);
+  REQUIRE(requests.size() == 100);
+  REQUIRE(file.chunks_decoded() <= 27);
+
+  // Without the index (a file cut short) the chunks are walked instead and
+  // the filters still apply.
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 100);
+  TraceFileLookup cut(path);
+  REQUIRE_FALSE(cut.has_index());
+  REQUIRE(cut.chunk_count() == 250);
+  REQUIRE(cut.find({Id{777}}).size() == 16);
+  REQUIRE(cut.chunks_decoded() <= 5);
+
+  // Sequential readers skip the FILTERS and CHUNK_INDEX chunks.
+  REQUIRE(read_all(path).size() == 16000);
+  std::filesystem::remove(path);
+}
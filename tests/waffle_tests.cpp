@@ -1,6 +1,13 @@
 #include <catch2/catch_all.hpp> // For Catch2 v3.x
 
+#include "waffle/processor/iprocessor.hpp"
+#include "waffle/waffle.hpp"
 #include "waffle/waffle_core_detail.hpp"
+#include "waffle/waffle_tracelet.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
 
 TEST_CASE("Waffle::detail::parse_args_impl", "[waffle][detail][parser]") {
   using Waffle::Attribute; // For dummy arguments
@@ -80,3 +87,83 @@ TEST_CASE("Waffle::detail::parse_args_impl", "[waffle][detail][parser]") {
     REQUIRE(result_with_other_not_found.cause == kInvalidId);
   }
 }
+
+TEST_CASE("Waffle::Tracelet writes only the attributes it is given",
+          "[waffle][tracelet]") {
+  /**
+   * @brief Verifies that constructing a Tracelet writes each attribute exactly
+   * once and leaves the unused slots untouched, i.e. no zero-fill pass.
+   */
+  using Waffle::Attribute;
+  using Waffle::AttributeValue;
+  using Waffle::CausedBy;
+  using Waffle::Id;
+  using Waffle::Tracelet;
+
+  constexpr unsigned char kSentinel = 0xAB;
+  alignas(Tracelet) unsigned char storage[sizeof(Tracelet)];
+  std::memset(storage, kSentinel, sizeof(storage));
+  // GCC treats stores before a placement new as dead (-flifetime-dse); the
+  // empty asm keeps the sentinel fill observable.
+  asm volatile("" : : "r"(storage) : "memory");
+
+  Attribute first;
+  first.key_id = 11;
+  first.value.type = AttributeValue::Type::INT64;
+  first.value.i64 = 42;
+  Attribute second;
+  second.key_id = 22;
+  second.value.type = AttributeValue::Type::BOOL;
+  second.value.b = true;
+
+  // The CausedBy argument is not an attribute and must not take a slot.
+  const Tracelet *t = new (storage)
+      Tracelet(1, 0, Id{2}, Id{3}, Id{4}, Id{5}, 6, Tracelet::RecordType::EVENT,
+               8, 9, first, CausedBy{Id{7}}, second);
+
+  asm volatile("" : : "r"(storage) : "memory");
+
+  REQUIRE(t->num_attributes == 2);
+  REQUIRE(t->thread_index == 8);
+  REQUIRE(t->cpu_id == 9);
+  REQUIRE(t->attributes[0].key_id == 11);
+  REQUIRE(t->attributes[0].value.i64 == 42);
+  REQUIRE(t->attributes[1].key_id == 22);
+  REQUIRE(t->attributes[1].value.b);
+
+  const auto *unused =
+      reinterpret_cast<const unsigned char *>(&t->attributes[2]);
+  const auto *end = storage + sizeof(storage);
+  REQUIRE(std::all_of(unused, end,
+                      [](unsigned char c) { return c == kSentinel; }));
+}
+
+TEST_CASE("A throwing processor is disabled, not fatal", "[waffle]") {
+  struct Counter : Waffle::IProcessor {
+    explicit Counter(int throw_at) : throw_at(throw_at) {}
+    void on_record(const Waffle::Tracelet &,
+                   const std::unordered_map<uint64_t, std::string> &) override {
+      if (++records == throw_at)
+        throw std::runtime_error("disk full");
+    }
+    void shutdown() override { shut_down = true; }
+    int throw_at;
+    int records = 0;
+    bool shut_down = false;
+  };
+  auto failing = std::make_shared<Counter>(2);
+  auto healthy = std::make_shared<Counter>(0);
+  Waffle::setup({{failing, healthy}});
+  for (int i = 0; i < 10; ++i) {
+    WAFFLE_EVENT("tick");
+  }
+  auto &tracer = *Waffle::detail::g_tracer_instance;
+  tracer.shutdown();
+  REQUIRE(tracer.processor_errors() == 1);
+  Waffle::shutdown();
+
+  REQUIRE(failing->records == 2);
+  REQUIRE_FALSE(failing->shut_down);
+  REQUIRE(healthy->records >= 10); // Plus the thread's THREAD_INFO
+  REQUIRE(healthy->shut_down);
+}
@@ -0,0 +1,175 @@
+// waffle-diff: compares the span durations of two recordings, path by path
+// (a span's name and its ancestors' names), and reports which operations got
+// slower, ranked by the time the change adds.
+//
+//   waffle-diff [--alpha=P] [--min-change=PCT] [--min-count=N] [--top=N]
+//               [--flame=OUTPUT] [--normalize] [--threads=N]
+//               BASE[,BASE...] TARGET[,TARGET...]
+//
+// e.g. waffle-diff --flame=diff.folded v1/rank0.wtrace,v1/rank1.wtrace
+//                  v2/rank0.wtrace,v2/rank1.wtrace
+//      flamegraph.pl diff.folded > diff.svg
+
+#include "waffle/profile/trace_diff.hpp"
+#include "waffle/trace_file/trace_file_reader.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Waffle::profile::SpanPathProfile;
+
+void usage(std::ostream &out) {
+  out << "usage: waffle-diff [--alpha=P] [--min-change=PCT] [--min-count=N]\n"
+         "                   [--top=N] [--flame=OUTPUT] [--normalize]\n"
+         "                   [--threads=N] BASE[,BASE...] "
+         "TARGET[,TARGET...]\n"
+         "\n"
+         "  BASE, TARGET      trace files of each recording, comma-separated\n"
+         "  --alpha=P         significance level (default 0.001)\n"
+         "  --min-change=PCT  smallest mean change reported (default 5)\n"
+         "  --min-count=N     spans needed per side to compare (default 30)\n"
+         "  --top=N           rows per section of the report (default 20)\n"
+         "  --flame=OUTPUT    write a differential flame graph (folded,\n"
+         "                    two columns) for flamegraph.pl\n"
+         "  --normalize       scale the base flame graph to the target's\n"
+         "                    total time\n"
+         "  --threads=N       files read at once (default: all cores)\n";
+}
+
+std::vector<std::string> split(std::string_view list) {
+  std::vector<std::string> out;
+  while (!list.empty()) {
+    const size_t comma = list.find(',');
+    if (comma != 0)
+      out.emplace_back(list.substr(0, comma));
+    if (comma == std::string_view::npos)
+      break;
+    list.remove_prefix(comma + 1);
+  }
+  return out;
+}
+
+// Reads every file into its own profile, `threads` files at a time (both
+// recordings share the pool), and merges them per recording.
+void load(const std::vector<std::string> &base,
+          const std::vector<std::string> &target, size_t threads,
+          SpanPathProfile &base_profile, SpanPathProfile &target_profile) {
+  struct Job {
+    const std::string *path;
+    SpanPathProfile *into;
+  };
+  std::vector<Job> jobs;
+  for (const auto &path : base)
+    jobs.push_back({&path, &base_profile});
+  for (const auto &path : target)
+    jobs.push_back({&path, &target_profile});
+
+  std::atomic<size_t> next{0};
+  std::mutex mutex;
+  std::exception_ptr error;
+  auto worker = [&] {
+    for (size_t i; (i = next++) < jobs.size();) {
+      try {
+        SpanPathProfile profile;
+        Waffle::trace_file::TraceFileReader reader(*jobs[i].path);
+        Waffle::trace_file::TraceRecord record;
+        while (reader.next(record))
+          profile.add(record.tracelet, reader.strings());
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs[i].into->merge(profile);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error)
+          error = std::current_exception();
+      }
+    }
+  };
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < std::min(threads, jobs.size()); ++t)
+    pool.emplace_back(worker);
+  worker();
+  for (auto &thread : pool)
+    thread.join();
+  if (error)
+    std::rethrow_exception(error);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Waffle::profile::DiffOptions options;
+  size_t top = 20;
+  std::string flame;
+  bool normalize = false;
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::string> inputs;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    auto value = [&](std::string_view option) {
+      return argv[i] + option.size();
+    };
+    if (arg == "-h" || arg == "--help") {
+      usage(std::cout);
+      return EXIT_SUCCESS;
+    } else if (arg.starts_with("--alpha=")) {
+      options.alpha = std::strtod(value("--alpha="), nullptr);
+    } else if (arg.starts_with("--min-change=")) {
+      options.min_change = std::strtod(value("--min-change="), nullptr) / 100;
+    } else if (arg.starts_with("--min-count=")) {
+      options.min_count = std::strtoull(value("--min-count="), nullptr, 10);
+    } else if (arg.starts_with("--top=")) {
+      top = std::strtoull(value("--top="), nullptr, 10);
+    } else if (arg.starts_with("--flame=")) {
+      flame = value("--flame=");
+    } else if (arg == "--normalize") {
+      normalize = true;
+    } else if (arg.starts_with("--threads=")) {
+      threads = std::max<size_t>(
+          1, std::strtoull(value("--threads="), nullptr, 10));
+    } else if (arg.starts_with("-")) {
+      std::cerr << "waffle-diff: unknown option '" << arg << "'\n";
+      usage(std::cerr);
+      return EXIT_FAILURE;
+    } else {
+      inputs.emplace_back(arg);
+    }
+  }
+  if (inputs.size() != 2) {
+    usage(std::cerr);
+    return EXIT_FAILURE;
+  }
+
+  try {
+    SpanPathProfile base, target;
+    load(split(inputs[0]), split(inputs[1]), threads, base, target);
+    std::cout << "Base: " << base.span_count() << " spans, "
+              << base.paths().size() << " paths; target: "
+              << target.span_count() << " spans, " << target.paths().size()
+              << " paths\n\n";
+    const auto diffs = Waffle::profile::diff_profiles(base, target, options);
+    Waffle::profile::write_diff_report(std::cout, diffs, base, target, top);
+    if (!flame.empty()) {
+      std::ofstream out(flame);
+      if (!out)
+        throw std::runtime_error("Cannot create " + flame);
+      Waffle::profile::write_diff_folded(out, base, target, normalize);
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "waffle-diff: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,89 @@
+// waffle-flame: folds the span trees of recorded trace files into a flame
+// graph weighted by self time.
+//
+//   waffle-flame [--format=folded|speedscope] [--max-nodes=N] -o OUTPUT
+//                INPUT...
+//
+// Folded output feeds flamegraph.pl; speedscope output opens in
+// https://www.speedscope.app.
+
+#include "waffle/profile/flame_graph.hpp"
+#include "waffle/trace_file/trace_file_reader.hpp"
+
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+void usage(std::ostream &out) {
+  out << "usage: waffle-flame [--format=folded|speedscope] [--max-nodes=N]\n"
+         "                    -o OUTPUT INPUT...\n"
+         "\n"
+         "  --format=folded      'a;b;c <self ns>' lines (default)\n"
+         "  --format=speedscope  speedscope JSON\n"
+         "  --max-nodes=N        bound on distinct stacks (default 1M)\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  bool speedscope = false;
+  size_t max_nodes = Waffle::profile::FlameGraph::kDefaultMaxNodes;
+  std::string output;
+  std::vector<std::string> inputs;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (arg == "-h" || arg == "--help") {
+      usage(std::cout);
+      return EXIT_SUCCESS;
+    } else if (arg == "-o" && i + 1 < argc) {
+      output = argv[++i];
+    } else if (arg == "--format=folded") {
+      speedscope = false;
+    } else if (arg == "--format=speedscope") {
+      speedscope = true;
+    } else if (arg.starts_with("--max-nodes=")) {
+      max_nodes = std::strtoull(argv[i] + sizeof("--max-nodes=") - 1, nullptr,
+                                10);
+    } else if (arg.starts_with("-")) {
+      std::cerr << "waffle-flame: unknown option '" << arg << "'\n";
+      usage(std::cerr);
+      return EXIT_FAILURE;
+    } else {
+      inputs.emplace_back(arg);
+    }
+  }
+  if (output.empty() || inputs.empty()) {
+    usage(std::cerr);
+    return EXIT_FAILURE;
+  }
+
+  try {
+    Waffle::profile::FlameGraph graph(max_nodes);
+    for (const auto &input : inputs) {
+      Waffle::trace_file::TraceFileReader reader(input);
+      Waffle::trace_file::TraceRecord record;
+      while (reader.next(record))
+        graph.add(record.tracelet, reader.strings());
+    }
+    std::ofstream out(output);
+    if (!out)
+      throw std::runtime_error("Cannot create " + output);
+    if (speedscope)
+      graph.write_speedscope(out, inputs.front());
+    else
+      graph.write_folded(out);
+    std::cout << "Wrote " << graph.node_count() - 1 << " stacks to " << output
+              << "\n";
+  } catch (const std::exception &e) {
+    std::cerr << "waffle-flame: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,159 @@
+// waffle-lookup: finds the records of one trace (or of a span name, or a time
+// range) in a trace file through its chunk index and bloom filters, reading
+// only the chunks that may hold them.
+//
+//   waffle-lookup [--name NAME] [--from NS] [--to NS] [-o OUTPUT]
+//                 INPUT [TRACE_ID]
+//
+// e.g. waffle-lookup rank0.wtrace 0x5c1e000000002a
+//      waffle-lookup --name NcclAllReduce -o allreduce.wtrace merged.wtrace
+
+#include "waffle/trace_file/trace_file_lookup.hpp"
+#include "waffle/trace_file/trace_file_writer.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+namespace {
+
+void usage(std::ostream &out) {
+  out << "usage: waffle-lookup [--name NAME] [--from NS] [--to NS]\n"
+         "                     [-o OUTPUT] INPUT [TRACE_ID]\n"
+         "\n"
+         "  TRACE_ID         decimal or 0x-prefixed hex; default: any trace\n"
+         "  --name NAME      only span starts and events named NAME\n"
+         "  --from/--to NS   only records in this timestamp range\n"
+         "  -o OUTPUT        write a Waffle trace file instead of printing\n";
+}
+
+std::string_view lookup(const std::unordered_map<uint64_t, std::string> &s,
+                        uint64_t hash) {
+  auto it = s.find(hash);
+  return it != s.end() ? std::string_view(it->second) : "???";
+}
+
+void print(const Waffle::Tracelet &t,
+           const std::unordered_map<uint64_t, std::string> &strings) {
+  using RT = Waffle::Tracelet::RecordType;
+  static constexpr const char *kTypes[] = {"start", "end", "event", "thread"};
+  const auto type = static_cast<size_t>(t.record_type);
+  const std::string_view name = t.record_type == RT::SPAN_END
+                                    ? std::string_view()
+                                    : lookup(strings, t.name_string_hash);
+  std::printf("%llu t%u %-6s %.*s trace=%llx span=%llx parent=%llx",
+              static_cast<unsigned long long>(t.timestamp),
+              unsigned{t.thread_index}, type < 4 ? kTypes[type] : "?",
+              static_cast<int>(name.size()), name.data(),
+              static_cast<unsigned long long>(t.trace_id.value),
+              static_cast<unsigned long long>(t.span_id.value),
+              static_cast<unsigned long long>(t.parent_span_id.value));
+  for (auto it = t.attributes_begin(); it != t.attributes_end(); ++it) {
+    const std::string_view key = lookup(strings, it->key_id);
+    std::printf(" %.*s=", static_cast<int>(key.size()), key.data());
+    switch (it->value.type) {
+    case Waffle::AttributeValue::Type::BOOL:
+      std::printf("%s", it->value.b ? "true" : "false");
+      break;
+    case Waffle::AttributeValue::Type::INT64:
+      std::printf("%lld", static_cast<long long>(it->value.i64));
+      break;
+    case Waffle::AttributeValue::Type::DOUBLE:
+      std::printf("%g", it->value.f64);
+      break;
+    case Waffle::AttributeValue::Type::STRING_ID: {
+      const std::string_view v = lookup(strings, it->value.string_id);
+      std::printf("%.*s", static_cast<int>(v.size()), v.data());
+      break;
+    }
+    }
+  }
+  std::printf("\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Waffle::trace_file::TraceFileLookup::Query query;
+  std::string output;
+  std::string input;
+
+  try {
+    for (int i = 1; i < argc; ++i) {
+      const std::string_view arg = argv[i];
+      if (arg == "-h" || arg == "--help") {
+        usage(std::cout);
+        return EXIT_SUCCESS;
+      } else if (arg == "--name" && i + 1 < argc) {
+        const std::string_view name = argv[++i];
+        query.name_hash = Waffle::fnv1a_hash(name.data(), name.size());
+      } else if (arg == "--from" && i + 1 < argc) {
+        query.from_ns = std::stoull(argv[++i]);
+      } else if (arg == "--to" && i + 1 < argc) {
+        query.to_ns = std::stoull(argv[++i]);
+      } else if (arg == "-o" && i + 1 < argc) {
+        output = argv[++i];
+      } else if (arg.starts_with("-")) {
+        std::cerr << "waffle-lookup: unknown option '" << arg << "'\n";
+        usage(std::cerr);
+        return EXIT_FAILURE;
+      } else if (input.empty()) {
+        input = arg;
+      } else if (query.trace_id == Waffle::kInvalidId) {
+        query.trace_id = Waffle::Id{std::stoull(argv[i], nullptr, 0)};
+      } else {
+        usage(std::cerr);
+        return EXIT_FAILURE;
+      }
+    }
+  } catch (const std::exception &) {
+    std::cerr << "waffle-lookup: invalid number\n";
+    return EXIT_FAILURE;
+  }
+  if (input.empty()) {
+    usage(std::cerr);
+    return EXIT_FAILURE;
+  }
+
+  try {
+    const auto start = std::chrono::steady_clock::now();
+    Waffle::trace_file::TraceFileLookup file(input);
+    const auto records = file.find(query);
+    const auto elapsed = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start);
+
+    if (output.empty()) {
+      for (const auto &record : records)
+        print(record.tracelet, file.strings());
+    } else {
+      Waffle::trace_file::TraceFileEncoder encoder(output, file.header());
+      for (const auto &record : records) {
+        const Waffle::Tracelet &t = record.tracelet;
+        auto add = [&](uint64_t hash) {
+          auto it = file.strings().find(hash);
+          if (it != file.strings().end())
+            encoder.add_string(hash, it->second);
+        };
+        add(t.name_string_hash);
+        for (auto it = t.attributes_begin(); it != t.attributes_end(); ++it) {
+          add(it->key_id);
+          if (it->value.type == Waffle::AttributeValue::Type::STRING_ID)
+            add(it->value.string_id);
+        }
+        encoder.add_record(t, record.rank);
+      }
+      encoder.close();
+    }
+    std::fprintf(stderr, "%zu records from %zu of %zu chunks in %.1f ms%s\n",
+                 records.size(), file.chunks_decoded(), file.chunk_count(),
+                 elapsed.count(), file.has_index() ? "" : " (no index)");
+  } catch (const std::exception &e) {
+    std::cerr << "waffle-lookup: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
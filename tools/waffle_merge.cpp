@@ -0,0 +1,85 @@
+// waffle-merge: merges the trace files written by several processes (ranks)
+// into a single timeline, aligning their clocks from cross-rank CausedBy links.
+//
+//   waffle-merge [--format=waffle|perfetto|fxt|ctf] [--threads=N]
+//                [--no-clock-align] -o OUTPUT INPUT...
+
+#include "waffle/merge/trace_merge.hpp"
+
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+namespace {
+
+void usage(std::ostream &out) {
+  out << "usage: waffle-merge [--format=waffle|perfetto|fxt|ctf]\n"
+         "                    [--threads=N] [--no-clock-align]\n"
+         "                    -o OUTPUT INPUT...\n"
+         "\n"
+         "  --format=waffle     write one merged Waffle trace file (default)\n"
+         "  --format=perfetto   write trace-event JSON for ui.perfetto.dev\n"
+         "  --format=fxt        write Fuchsia trace format (binary, Perfetto)\n"
+         "  --format=ctf        write a CTF 1.8 trace directory (Babeltrace)\n"
+         "  --threads=N         worker threads (default: all cores)\n"
+         "  --no-clock-align    keep each rank's timestamps as recorded\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Waffle::merge::MergeOptions options;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (arg == "-h" || arg == "--help") {
+      usage(std::cout);
+      return EXIT_SUCCESS;
+    } else if (arg == "-o" && i + 1 < argc) {
+      options.output = argv[++i];
+    } else if (arg == "--format=waffle") {
+      options.format = Waffle::merge::MergeOptions::Format::WAFFLE;
+    } else if (arg == "--format=perfetto") {
+      options.format = Waffle::merge::MergeOptions::Format::PERFETTO;
+    } else if (arg == "--format=fxt") {
+      options.format = Waffle::merge::MergeOptions::Format::FXT;
+    } else if (arg == "--format=ctf") {
+      options.format = Waffle::merge::MergeOptions::Format::CTF;
+    } else if (arg.starts_with("--threads=")) {
+      options.threads = static_cast<unsigned>(
+          std::strtoul(argv[i] + sizeof("--threads=") - 1, nullptr, 10));
+    } else if (arg == "--no-clock-align") {
+      options.align_clocks = false;
+    } else if (arg.starts_with("-")) {
+      std::cerr << "waffle-merge: unknown option '" << arg << "'\n";
+      usage(std::cerr);
+      return EXIT_FAILURE;
+    } else {
+      options.inputs.emplace_back(arg);
+    }
+  }
+  if (options.output.empty() || options.inputs.empty()) {
+    usage(std::cerr);
+    return EXIT_FAILURE;
+  }
+
+  try {
+    const auto stats = Waffle::merge::merge_traces(options);
+    std::cout << "Merged " << stats.records << " records from "
+              << options.inputs.size() << " inputs into " << options.output
+              << "\n";
+    if (options.align_clocks) {
+      std::cout << "Clock alignment from " << stats.clocks.matched_pairs
+                << " send/receive pairs:\n";
+      for (size_t i = 0; i < stats.clocks.offsets_ns.size(); ++i)
+        std::cout << "  " << options.inputs[i] << ": "
+                  << stats.clocks.offsets_ns[i] << " ns\n";
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "waffle-merge: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,120 @@
+// waffle-query: filters and aggregates the spans of recorded trace files.
+//
+//   waffle-query [--where EXPR]... [--no-group] [--percentiles=P,P,...]
+//                [--threads=N] INPUT...
+//
+// e.g. waffle-query --where name=NcclAllReduce --where attr.rank=1
+//                   --where 'duration>10ms' rank*.wtrace
+
+#include "waffle/query/span_query.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+namespace {
+
+void usage(std::ostream &out) {
+  out << "usage: waffle-query [--where EXPR]... [--no-group]\n"
+         "                    [--percentiles=P,P,...] [--threads=N] INPUT...\n"
+         "\n"
+         "  --where EXPR        keep spans matching FIELD OP VALUE; repeatable\n"
+         "                      FIELD: name, start, duration, rank, thread or\n"
+         "                      an attribute key (attr.KEY); OP: = != < <= > >=\n"
+         "                      VALUE: number (with ns/us/ms/s), true/false,\n"
+         "                      or string\n"
+         "  --no-group          aggregate all matching spans together\n"
+         "  --percentiles=...   duration percentiles (default 50,90,99)\n"
+         "  --threads=N         worker threads (default: all cores)\n";
+}
+
+std::string format_ns(uint64_t ns) {
+  char buf[32];
+  if (ns < 1'000)
+    std::snprintf(buf, sizeof(buf), "%lluns", static_cast<unsigned long long>(ns));
+  else if (ns < 1'000'000)
+    std::snprintf(buf, sizeof(buf), "%.2fus", ns / 1e3);
+  else if (ns < 1'000'000'000)
+    std::snprintf(buf, sizeof(buf), "%.2fms", ns / 1e6);
+  else
+    std::snprintf(buf, sizeof(buf), "%.2fs", ns / 1e9);
+  return buf;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Waffle::query::Query query;
+  std::vector<std::string> inputs;
+
+  try {
+    for (int i = 1; i < argc; ++i) {
+      const std::string_view arg = argv[i];
+      if (arg == "-h" || arg == "--help") {
+        usage(std::cout);
+        return EXIT_SUCCESS;
+      } else if (arg == "--where" && i + 1 < argc) {
+        query.where.push_back(Waffle::query::Predicate::parse(argv[++i]));
+      } else if (arg == "--no-group") {
+        query.group_by_name = false;
+      } else if (arg.starts_with("--percentiles=")) {
+        query.percentiles.clear();
+        std::string list(arg.substr(sizeof("--percentiles=") - 1));
+        for (size_t pos = 0; pos < list.size();) {
+          size_t comma = list.find(',', pos);
+          if (comma == std::string::npos)
+            comma = list.size();
+          query.percentiles.push_back(std::stod(list.substr(pos, comma - pos)));
+          pos = comma + 1;
+        }
+      } else if (arg.starts_with("--threads=")) {
+        query.threads = static_cast<unsigned>(
+            std::strtoul(argv[i] + sizeof("--threads=") - 1, nullptr, 10));
+      } else if (arg.starts_with("-")) {
+        std::cerr << "waffle-query: unknown option '" << arg << "'\n";
+        usage(std::cerr);
+        return EXIT_FAILURE;
+      } else {
+        inputs.emplace_back(arg);
+      }
+    }
+    if (inputs.empty()) {
+      usage(std::cerr);
+      return EXIT_FAILURE;
+    }
+
+    const auto load_start = std::chrono::steady_clock::now();
+    const auto table = Waffle::query::SpanTable::load(inputs, query.threads);
+    const auto scan_start = std::chrono::steady_clock::now();
+    const auto result = Waffle::query::run_query(table, query);
+    const auto scan_end = std::chrono::steady_clock::now();
+
+    std::printf("%-40s %10s %12s %12s", "name", "count", "total", "min");
+    for (double p : query.percentiles) {
+      char label[16];
+      std::snprintf(label, sizeof(label), "p%g", p);
+      std::printf(" %12s", label);
+    }
+    std::printf(" %12s\n", "max");
+    for (const auto &g : result.groups) {
+      std::printf("%-40s %10zu %12s %12s", g.name.c_str(), g.count,
+                  format_ns(g.total_ns).c_str(), format_ns(g.min_ns).c_str());
+      for (uint64_t p : g.percentiles_ns)
+        std::printf(" %12s", format_ns(p).c_str());
+      std::printf(" %12s\n", format_ns(g.max_ns).c_str());
+    }
+    using ms = std::chrono::duration<double, std::milli>;
+    std::fprintf(stderr, "%zu of %zu spans matched (load %.1f ms, query %.1f ms)\n",
+                 result.matched, result.scanned,
+                 ms(scan_start - load_start).count(),
+                 ms(scan_end - scan_start).count());
+  } catch (const std::exception &e) {
+    std::cerr << "waffle-query: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
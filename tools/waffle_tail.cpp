@@ -0,0 +1,149 @@
+// waffle-tail: subscribes to a running process's live stream socket (see
+// LiveStreamServer) and prints the matching records as they happen, or
+// records them to a trace file. Pointed at a TraceCache control socket with
+// a trace=ID term, it fetches that cached trace instead.
+//
+//   waffle-tail [-o OUTPUT] SOCKET [FILTER TERM...]
+//
+// e.g. waffle-tail /tmp/app.waffle name=NcclAllReduce attr.rank=1
+//      waffle-tail -o failed.wft /tmp/app.cache trace=0x5c1e000000002a
+
+#include "waffle/live/live_stream.hpp"
+#include "waffle/trace_file/trace_file_writer.hpp"
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace {
+
+void usage(std::ostream &out) {
+  out << "usage: waffle-tail [-o OUTPUT] SOCKET [FILTER TERM...]\n"
+         "\n"
+         "  -o OUTPUT        write a Waffle trace file instead of printing\n"
+         "  FILTER TERMs     name=NAME, trace=ID, attr.KEY=VALUE; names and\n"
+         "                   trace ids match any given, attributes all\n";
+}
+
+std::string_view lookup(const std::unordered_map<uint64_t, std::string> &s,
+                        uint64_t hash) {
+  auto it = s.find(hash);
+  return it != s.end() ? std::string_view(it->second) : "???";
+}
+
+void print(const Waffle::Tracelet &t,
+           const std::unordered_map<uint64_t, std::string> &strings) {
+  using RT = Waffle::Tracelet::RecordType;
+  static constexpr const char *kTypes[] = {"start", "end", "event", "thread"};
+  const auto type = static_cast<size_t>(t.record_type);
+  const std::string_view name = t.record_type == RT::SPAN_END
+                                    ? std::string_view()
+                                    : lookup(strings, t.name_string_hash);
+  std::printf("%llu t%u %-6s %.*s trace=%llx span=%llx",
+              static_cast<unsigned long long>(t.timestamp),
+              unsigned{t.thread_index}, type < 4 ? kTypes[type] : "?",
+              static_cast<int>(name.size()), name.data(),
+              static_cast<unsigned long long>(t.trace_id.value),
+              static_cast<unsigned long long>(t.span_id.value));
+  for (auto it = t.attributes_begin(); it != t.attributes_end(); ++it) {
+    const std::string_view key = lookup(strings, it->key_id);
+    std::printf(" %.*s=", static_cast<int>(key.size()), key.data());
+    switch (it->value.type) {
+    case Waffle::AttributeValue::Type::BOOL:
+      std::printf("%s", it->value.b ? "true" : "false");
+      break;
+    case Waffle::AttributeValue::Type::INT64:
+      std::printf("%lld", static_cast<long long>(it->value.i64));
+      break;
+    case Waffle::AttributeValue::Type::DOUBLE:
+      std::printf("%g", it->value.f64);
+      break;
+    case Waffle::AttributeValue::Type::STRING_ID: {
+      const std::string_view v = lookup(strings, it->value.string_id);
+      std::printf("%.*s", static_cast<int>(v.size()), v.data());
+      break;
+    }
+    }
+  }
+  std::printf("\n");
+  std::fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  std::string output;
+  std::string socket_path;
+  std::string filter;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (arg == "-h" || arg == "--help") {
+      usage(std::cout);
+      return EXIT_SUCCESS;
+    } else if (arg == "-o" && i + 1 < argc) {
+      output = argv[++i];
+    } else if (arg.starts_with("-")) {
+      std::cerr << "waffle-tail: unknown option '" << arg << "'\n";
+      usage(std::cerr);
+      return EXIT_FAILURE;
+    } else if (socket_path.empty()) {
+      socket_path = arg;
+    } else {
+      filter.append(filter.empty() ? "" : " ").append(arg);
+    }
+  }
+  if (socket_path.empty()) {
+    usage(std::cerr);
+    return EXIT_FAILURE;
+  }
+
+  try {
+    Waffle::live::LiveStreamClient client(socket_path, filter);
+    std::unique_ptr<Waffle::trace_file::TraceFileEncoder> encoder;
+    if (!output.empty()) {
+      encoder = std::make_unique<Waffle::trace_file::TraceFileEncoder>(
+          output, client.header());
+      // Ctrl-C ends the loop below through an interrupted read (no
+      // SA_RESTART), so the file is closed properly.
+      struct sigaction action {};
+      action.sa_handler = [](int) {};
+      sigaction(SIGINT, &action, nullptr);
+    }
+    Waffle::trace_file::TraceRecord record;
+    size_t count = 0;
+    while (client.next(record)) {
+      ++count;
+      if (!encoder) {
+        print(record.tracelet, client.strings());
+        continue;
+      }
+      const Waffle::Tracelet &t = record.tracelet;
+      auto add = [&](uint64_t hash) {
+        auto it = client.strings().find(hash);
+        if (it != client.strings().end())
+          encoder->add_string(hash, it->second);
+      };
+      add(t.name_string_hash);
+      for (auto it = t.attributes_begin(); it != t.attributes_end(); ++it) {
+        add(it->key_id);
+        if (it->value.type == Waffle::AttributeValue::Type::STRING_ID)
+          add(it->value.string_id);
+      }
+      encoder->add_record(t);
+    }
+    if (encoder) {
+      encoder->close();
+      std::cout << "Wrote " << count << " records to " << output << "\n";
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "waffle-tail: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}